@@ -6,479 +6,303 @@
 #include <stdint.h>
 #include <time.h>
 #include <getopt.h>
-#include <sys/stat.h>
 #include <errno.h>
+#include "libinodex.h"
+#include "bench.h"
+#include "import.h"
+#include "tar.h"
+#include "workload.h"
 
-#define MAGIC_NUMBER 0x5844494E
-#define DEFAULT_BLOCK_SIZE 4096
-#define MICRODATA_SIZE 256
-#define INODE_SIZE 512
-#define FILENAME_MAX 224
 #define MAX_COMMAND 256
+#define CACHE_TRIM_STEP 256                 // узлов за шаг при уменьшении кэша
+#define BENCH_PATH "bench.img"
 
-typedef struct {
-    uint32_t magic;
-    uint32_t block_size;
-    uint32_t inode_count;
-    uint32_t free_inodes;
-    uint32_t free_blocks;
-    uint32_t inode_table;
-    uint32_t bitmap_blocks;
-    uint32_t root_inode;
-    uint32_t l1_cache_size;
-    uint32_t free_inode_hint;
-    uint8_t padding[4036];
-} SuperBlock;
-
-typedef struct {
-    char name[FILENAME_MAX];
-    uint32_t size;
-    uint32_t flags;
-    time_t created;
-    time_t modified;
-    union {
-        uint8_t micro_data[MICRODATA_SIZE];
-        struct {
-            uint32_t blocks[12];
-            uint32_t indirect_block;
-        };
-    };
-    uint32_t last_block;
-    uint32_t access_pattern;
-} Inode;
-
-typedef struct LRUNode {
-    uint32_t inode_num;
-    Inode inode;
-    uint8_t pinned;
-    struct LRUNode* prev;
-    struct LRUNode* next;
-    struct LRUNode* next_hash;
-} LRUNode;
-
-typedef struct {
-    LRUNode** hashmap;
-    LRUNode* head;
-    LRUNode* tail;
-    uint32_t capacity;
-    uint32_t size;
-} LRUCache;
-
-int disk_fd;
-SuperBlock sb;
-uint8_t* block_bitmap;
-LRUCache* l1_cache;
-
+ix_fs* fs;
+static int direct; // O_DIRECT: -R или "direct on", действует и на бенчмарк
+#define MAX_MEMBERS 7
 
 void panic(const char* msg) {
     fprintf(stderr, "Fatal error: %s (%d)\n", msg, errno);
     exit(EXIT_FAILURE);
 }
 
-LRUCache* lru_cache_create(uint32_t capacity) {
-    LRUCache* cache = malloc(sizeof(LRUCache));
-    if (!cache) panic("Cache alloc failed");
-    
-    cache->capacity = capacity;
-    cache->size = 0;
-    cache->head = cache->tail = NULL;
-    cache->hashmap = calloc(capacity, sizeof(LRUNode*));
-    if (!cache->hashmap) panic("Hashmap alloc failed");
-    
-    return cache;
+static int report(int rc) {
+    if (rc == -EEXIST) printf("File already exists!\n");
+    else if (rc == -ENOENT) printf("File not found!\n");
+    else if (rc < 0) printf("Error: %s\n", ix_strerror(rc));
+    return rc;
 }
 
-void lru_cache_free(LRUCache* cache) {
-    LRUNode* current = cache->head;
-    while (current) {
-        LRUNode* next = current->next;
-        free(current);
-        current = next;
+int write_file(const char* dst, const char* src) {
+    FILE* fp = fopen(src, "rb");
+    if (!fp) {
+        fprintf(stderr, "Can't open source file: %s\n", src);
+        return -ENOENT;
     }
-    free(cache->hashmap);
-    free(cache);
-}
 
-Inode* lru_cache_get(LRUCache* cache, uint32_t inode_num) {
-    if (!cache || cache->capacity == 0) return NULL;
-
-    uint32_t hash = inode_num % cache->capacity;
-    LRUNode* node = cache->hashmap[hash];
-    
-    while (node) {
-        if (node->inode_num == inode_num) {
-            if (node != cache->head) {
-                if (node->prev) node->prev->next = node->next;
-                if (node->next) node->next->prev = node->prev;
-                if (node == cache->tail) cache->tail = node->prev;
-                
-                node->prev = NULL;
-                node->next = cache->head;
-                if (cache->head) cache->head->prev = node;
-                cache->head = node;
-            }
-            return &node->inode;
-        }
-        node = node->next_hash;
-    }
-    return NULL;
-}
+    fseek(fp, 0, SEEK_END);
+    size_t size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
 
-void lru_cache_put(LRUCache* cache, uint32_t inode_num, Inode* inode, uint8_t pinned) {
-    if (!cache || cache->capacity == 0) return;
-
-    uint32_t hash = inode_num % cache->capacity;
-    LRUNode* node = cache->hashmap[hash];
-    
-    while (node) {
-        if (node->inode_num == inode_num) {
-            node->inode = *inode;
-            node->pinned = pinned;
-            lru_cache_get(cache, inode_num);
-            return;
-        }
-        node = node->next_hash;
+    char* buffer = malloc(size ? size : 1);
+    if (!buffer) {
+        fclose(fp);
+        panic("Buffer allocation failed");
     }
 
-    LRUNode* new_node = malloc(sizeof(LRUNode));
-    if (!new_node) panic("Node alloc failed");
-    
-    new_node->inode_num = inode_num;
-    new_node->inode = *inode;
-    new_node->pinned = pinned;
-    new_node->prev = NULL;
-    new_node->next = cache->head;
-    new_node->next_hash = cache->hashmap[hash];
-    
-    cache->hashmap[hash] = new_node;
-    
-    if (cache->head) cache->head->prev = new_node;
-    cache->head = new_node;
-    if (!cache->tail) cache->tail = new_node;
-    
-    cache->size++;
-
-    while (cache->size > cache->capacity) {
-        LRUNode* tail = cache->tail;
-        while (tail && tail->pinned) {
-            tail = tail->prev;
-        }
-        
-        if (!tail) {
-            fprintf(stderr, "Cache overflow with pinned nodes!\n");
-            free(new_node);
-            cache->size--;
-            return;
-        }
+    size_t got = fread(buffer, 1, size, fp);
+    fclose(fp);
 
-        if (tail->prev) tail->prev->next = NULL;
-        else cache->head = NULL;
-        
-        cache->tail = tail->prev;
-        uint32_t tail_hash = tail->inode_num % cache->capacity;
-        LRUNode** ptr = &cache->hashmap[tail_hash];
-        while (*ptr != tail) ptr = &(*ptr)->next_hash;
-        *ptr = tail->next_hash;
-        
-        free(tail);
-        cache->size--;
-    }
+    int rc = got == size ? ix_write(fs, dst, buffer, size) : -EIO;
+    free(buffer);
+    return report(rc);
 }
 
-Inode* get_inode(uint32_t inode_num) {
-    Inode* cached = lru_cache_get(l1_cache, inode_num);
-    if (cached) return cached;
-
-    Inode inode;
-    off_t offset = sb.inode_table * sb.block_size + inode_num * INODE_SIZE;
-    if (pread(disk_fd, &inode, INODE_SIZE, offset) != INODE_SIZE)
-        panic("Inode read failed");
-    
-    lru_cache_put(l1_cache, inode_num, &inode, 0);
-    return lru_cache_get(l1_cache, inode_num);
+static int print_entry(const ix_stat* st, void* arg) {
+    printf("%-20s %8u B %s", st->name, st->size, ctime(&st->created));
+    return 0;
 }
 
-void format_disk(const char* path, uint64_t size, uint32_t l1_cache_size) {
-    disk_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
-    if (disk_fd < 0) panic("Disk open failed");
-    
-    if (ftruncate(disk_fd, size) < 0)
-        panic("Disk truncate failed");
-
-    uint32_t block_size = DEFAULT_BLOCK_SIZE;
-    uint32_t total_blocks = size / block_size;
-    uint32_t inode_count = total_blocks / 4;  // Исправлено
-    uint32_t bitmap_size = (total_blocks + 7) / 8;
-    
-    sb = (SuperBlock){
-        .magic = MAGIC_NUMBER,
-        .block_size = block_size,
-        .inode_count = inode_count,
-        .free_inodes = inode_count - 1,
-        .free_blocks = total_blocks - 3,
-        .inode_table = 2,
-        .bitmap_blocks = (bitmap_size + block_size - 1) / block_size,
-        .root_inode = 0,
-        .l1_cache_size = l1_cache_size,
-        .free_inode_hint = 1
-    };
+void list_files() {
+    report(ix_list(fs, print_entry, NULL));
+}
 
-    if (pwrite(disk_fd, &sb, sizeof(SuperBlock), 0) != sizeof(SuperBlock))
-        panic("Superblock write failed");
-
-    block_bitmap = calloc(sb.bitmap_blocks, block_size);
-    if (!block_bitmap) panic("Bitmap alloc failed");
-    
-    for (int i = 0; i < 3; i++)
-        block_bitmap[i/8] |= 1 << (i%8);
-    
-    if (pwrite(disk_fd, block_bitmap, sb.bitmap_blocks * block_size, block_size) != sb.bitmap_blocks * block_size)
-        panic("Bitmap write failed");
-
-    Inode* inode_table = calloc(inode_count, INODE_SIZE);
-    if (!inode_table) panic("Inode table alloc failed");
-    
-    inode_table[0] = (Inode){
-        .name = "/",
-        .flags = 1,
-        .created = time(NULL),
-        .modified = time(NULL)
-    };
-    
-    if (pwrite(disk_fd, inode_table, inode_count * INODE_SIZE, 2 * block_size) != inode_count * INODE_SIZE)
-        panic("Inode table write failed");
-    
-    free(inode_table);
-    close(disk_fd);
+void read_file(const char* filename) {
+    ix_stat st;
+    if (report(ix_lookup(fs, filename, &st)) < 0) return;
+
+    char* data = malloc(st.size + 1);
+    if (!data) panic("Buffer allocation failed");
+    ssize_t n = ix_read(fs, filename, data, st.size, 0);
+    if (report(n) >= 0)
+        printf("%.*s\n", (int)n, data);
+    free(data);
 }
 
-uint32_t allocate_block() {
-    for (uint32_t i = sb.inode_table + 1; i < sb.free_blocks; i++) {
-        if (!(block_bitmap[i/8] & (1 << (i%8)))) {
-            block_bitmap[i/8] |= 1 << (i%8);
-            sb.free_blocks--;
-            
-            off_t offset = sb.block_size + (i/8);
-            uint8_t byte = block_bitmap[i/8];
-            if (pwrite(disk_fd, &byte, 1, offset) != 1)
-                panic("Bitmap update failed");
-            
-            return i;
-        }
-    }
-    panic("No free blocks");
+// Адаптер Inode-X для набора бенчмарков; гоняем на отдельном образе,
+// чтобы не засорять рабочий диск
+typedef struct {
+    ix_fs* fs;
+    uint32_t cache_size;
+} bench_ctx;
+
+static int bench_reset(void* ctx, uint32_t files, uint64_t file_size) {
+    bench_ctx* b = ctx;
+    if (b->fs) ix_unmount(b->fs);
+    b->fs = NULL;
+
+    // inode на каждые 4 блока, таблица inode занимает 1/32 образа
+    uint64_t per_file = file_size > 256 ? (file_size + 4095) / 4096 : 0;
+    uint64_t blocks = 4ull * (files + 16);
+    uint64_t need = (files * per_file + 64) * 32 / 31 + 64;
+    if (need > blocks) blocks = need;
+
+    int rc = ix_format(BENCH_PATH, blocks * 4096, b->cache_size);
+    if (rc == 0) rc = ix_mount(BENCH_PATH, &b->fs);
+    if (rc == 0 && direct) rc = ix_set_direct(b->fs, 1);
+    return rc;
 }
 
-int find_inode(const char* filename) {
-    for (uint32_t i = sb.free_inode_hint; i < sb.inode_count; i++) {
-        Inode* inode = get_inode(i);
-        if (strcmp(inode->name, filename) == 0) return i;
-        if (inode->name[0] == '\0') {
-            sb.free_inode_hint = i;
-            break;
-        }
-    }
-    
-    for (uint32_t i = 1; i < sb.free_inode_hint; i++) {
-        Inode* inode = get_inode(i);
-        if (strcmp(inode->name, filename) == 0) return i;
-    }
-    return -1;
+static int bench_create(void* ctx, const char* name, const void* data, size_t size) {
+    return ix_write(((bench_ctx*)ctx)->fs, name, data, size);
 }
 
-void write_from_buffer(const char* dst, const char* data, size_t size) {
-    disk_fd = open("disk.img", O_RDWR);
-    if (disk_fd < 0) panic("Disk open failed");
+static int bench_lookup(void* ctx, const char* name) {
+    return ix_lookup(((bench_ctx*)ctx)->fs, name, NULL);
+}
 
-    if (find_inode(dst) != -1) {
-        printf("File %s already exists!\n", dst);
-        close(disk_fd);
-        return;
-    }
+static ssize_t bench_read(void* ctx, const char* name, void* buf, size_t count, uint64_t off) {
+    return ix_read(((bench_ctx*)ctx)->fs, name, buf, count, off);
+}
 
-    int inode_num = -1;
-    for (uint32_t i = sb.free_inode_hint; i < sb.inode_count; i++) {
-        Inode* inode = get_inode(i);
-        if (inode->name[0] == '\0') {
-            inode_num = i;
-            sb.free_inode_hint = i + 1;
-            sb.free_inodes--;
-            break;
-        }
-    }
-    
-    if (inode_num == -1) {
-        for (uint32_t i = 1; i < sb.free_inode_hint; i++) {
-            Inode* inode = get_inode(i);
-            if (inode->name[0] == '\0') {
-                inode_num = i;
-                sb.free_inode_hint = i + 1;
-                sb.free_inodes--;
-                break;
-            }
-        }
-    }
-    
-    if (inode_num == -1) panic("No free inodes");
-
-    Inode inode;
-    memset(&inode, 0, sizeof(Inode));
-    strncpy(inode.name, dst, FILENAME_MAX);
-    inode.size = size;
-    inode.created = time(NULL);
-    inode.modified = time(NULL);
-
-    if (size <= MICRODATA_SIZE) {
-        memcpy(inode.micro_data, data, size);
-    } else {
-        uint32_t blocks_needed = (size + sb.block_size - 1) / sb.block_size;
-        for (int i = 0; i < blocks_needed; i++) {
-            inode.blocks[i] = allocate_block();
-            size_t write_size = (i == blocks_needed-1) ? 
-                size % sb.block_size : sb.block_size;
-            if (write_size == 0) write_size = sb.block_size;
-            
-            if (pwrite(disk_fd, data + i*sb.block_size, write_size,
-                      inode.blocks[i] * sb.block_size) != write_size)
-                panic("Data write failed");
-        }
-    }
+static int bench_remove(void* ctx, const char* name) {
+    return ix_delete(((bench_ctx*)ctx)->fs, name);
+}
 
-    off_t inode_offset = sb.inode_table * sb.block_size + inode_num * INODE_SIZE;
-    if (pwrite(disk_fd, &inode, INODE_SIZE, inode_offset) != INODE_SIZE)
-        panic("Inode write failed");
-    
-    lru_cache_put(l1_cache, inode_num, &inode, 1);
-    close(disk_fd);
+static int count_entry(const ix_stat* st, void* arg) {
+    (*(uint64_t*)arg)++;
+    return 0;
 }
 
-void write_file(const char* dst, const char* src) {
-    FILE* fp = fopen(src, "rb");
-    if (!fp) {
-        fprintf(stderr, "Can't open source file: %s\n", src);
-        return;
-    }
+static int bench_list(void* ctx, uint64_t* entries) {
+    return ix_list(((bench_ctx*)ctx)->fs, count_entry, entries);
+}
 
-    fseek(fp, 0, SEEK_END);
-    size_t size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+static bench_ops bench_table(bench_ctx* ctx) {
+    return (bench_ops){
+        .engine = "inodex",
+        .ctx = ctx,
+        .reset = bench_reset,
+        .create = bench_create,
+        .lookup = bench_lookup,
+        .read = bench_read,
+        .remove = bench_remove,
+        .list = bench_list,
+    };
+}
 
-    char* buffer = malloc(size);
-    if (!buffer) {
-        fclose(fp);
-        panic("Buffer allocation failed");
+// benchmark [files,..] [sizes,..] [text|csv|json] [outfile]
+void benchmark(const char* args) {
+    char files[MAX_COMMAND] = "1000", sizes[MAX_COMMAND] = "256";
+    char format[MAX_COMMAND] = "text", out_path[MAX_COMMAND] = "";
+    bench_config cfg;
+    ix_fsinfo info;
+
+    sscanf(args, "%255s %255s %255s %255s", files, sizes, format, out_path);
+    bench_default_config(&cfg);
+    cfg.nfiles = bench_parse_list(files, cfg.files, BENCH_MAX_PARAMS);
+    cfg.nsizes = bench_parse_list(sizes, cfg.sizes, BENCH_MAX_PARAMS);
+    cfg.format = bench_parse_format(format);
+    if (cfg.nfiles < 0 || cfg.nsizes < 0 || cfg.format < 0) {
+        printf("Usage: benchmark [files,..] [sizes,..] [text|csv|json] [outfile]\n");
+        return;
+    }
+    if (out_path[0] && !(cfg.out = fopen(out_path, "w"))) {
+        printf("Can't open %s\n", out_path);
+        return;
     }
 
-    fread(buffer, 1, size, fp);
-    fclose(fp);
-
-    write_from_buffer(dst, buffer, size);
-    free(buffer);
+    ix_statfs(fs, &info);
+    bench_ctx ctx = { .fs = NULL, .cache_size = info.l1_cache_size };
+    bench_ops ops = bench_table(&ctx);
+    report(bench_run(&ops, &cfg));
+    if (ctx.fs) ix_unmount(ctx.fs);
+    unlink(BENCH_PATH);
+    if (cfg.out != stdout) fclose(cfg.out);
 }
 
-void list_files() {
-    disk_fd = open("disk.img", O_RDWR);
-    if (disk_fd < 0) panic("Disk open failed");
-
-    for (uint32_t i = 0; i < sb.inode_count; i++) {
-        Inode* inode = get_inode(i);
-        if (inode->name[0] != '\0') {
-            printf("%-20s %8u B %s", inode->name, inode->size, ctime(&inode->created));
-        }
+// replay <file> [threads] [speed] [text|csv|json] - на свежем BENCH_PATH
+// с ёмкостью кэша рабочего образа. Inode-X не потокобезопасен: потоки задают
+// конкурентность открытого цикла, а операции идут по одной
+void replay(const char* args) {
+    char path[MAX_COMMAND] = "", format[MAX_COMMAND] = "text";
+    unsigned threads = 1;
+    double speed = 0;
+    workload_config cfg = { .serialize = 1, .out = stdout };
+    ix_fsinfo info;
+
+    sscanf(args, "%255s %u %lf %255s", path, &threads, &speed, format);
+    cfg.threads = threads;
+    cfg.speed = speed;
+    cfg.format = bench_parse_format(format);
+    if (!path[0] || speed < 0 || cfg.format < 0) {
+        printf("Usage: replay <file> [threads] [speed] [text|csv|json]\n");
+        return;
     }
-    close(disk_fd);
+    ix_statfs(fs, &info);
+    bench_ctx ctx = { .fs = NULL, .cache_size = info.l1_cache_size };
+    bench_ops ops = bench_table(&ctx);
+    report(workload_replay(&ops, path, &cfg));
+    if (ctx.fs) ix_unmount(ctx.fs);
+    unlink(BENCH_PATH);
 }
 
-void read_file(const char* filename) {
-    disk_fd = open("disk.img", O_RDWR);
-    if (disk_fd < 0) panic("Disk open failed");
-
-    int inode_num = find_inode(filename);
-    if (inode_num == -1) {
-        printf("File not found!\n");
-        return;
-    }
+// capture <file> | capture off | capture show <file>
+void capture(const char* args) {
+    char cmd[MAX_COMMAND] = "", arg[MAX_COMMAND] = "";
+    sscanf(args, "%255s %255s", cmd, arg);
+    if (strcmp(cmd, "off") == 0) report(ix_capture_enable(fs, NULL));
+    else if (strcmp(cmd, "show") == 0 && arg[0]) report(workload_print(arg, stdout));
+    else if (cmd[0] && !arg[0]) report(ix_capture_enable(fs, cmd));
+    else printf("Usage: capture <file> | off | show <file>\n");
+}
 
-    Inode* inode = get_inode(inode_num);
-    if (inode->size <= MICRODATA_SIZE) {
-        printf("%.*s\n", inode->size, inode->micro_data);
-    } else {
-        uint8_t* data = malloc(inode->size);
-        for (uint32_t i = 0; i < (inode->size + sb.block_size - 1)/sb.block_size; i++) {
-            if (i < 12) {
-                off_t offset = inode->blocks[i] * sb.block_size;
-                pread(disk_fd, data + i*sb.block_size, sb.block_size, offset);
-            }
+// trace on [records] | trace off | trace dump <file> | trace show <file>
+void trace(const char* args) {
+    char cmd[MAX_COMMAND] = "", arg[MAX_COMMAND] = "";
+    asfs_latency* lat = ix_get_latency(fs);
+    sscanf(args, "%255s %255s", cmd, arg);
+
+    if (strcmp(cmd, "on") == 0) {
+        uint32_t records = arg[0] ? strtoul(arg, NULL, 10) : 65536;
+        if (report(asfs_trace_enable(lat, records ? records : 65536)) == 0)
+            printf("Tracing %u records\n", lat->trace_capacity);
+    } else if (strcmp(cmd, "off") == 0) {
+        asfs_trace_enable(lat, 0);
+    } else if (strcmp(cmd, "dump") == 0 && arg[0]) {
+        FILE* f = fopen(arg, "wb");
+        if (!f) {
+            report(-errno);
+            return;
         }
-        printf("%.*s\n", inode->size, data);
-        free(data);
+        int rc = asfs_trace_write(lat, f);
+        fclose(f);
+        report(rc);
+    } else if (strcmp(cmd, "show") == 0 && arg[0]) {
+        FILE* f = fopen(arg, "rb");
+        if (!f) {
+            report(-errno);
+            return;
+        }
+        report(asfs_trace_print(f, stdout));
+        fclose(f);
+    } else {
+        printf("Usage: trace on [records] | off | dump <file> | show <file>\n");
     }
-    close(disk_fd);
 }
 
-void mount_disk() {
-    disk_fd = open("disk.img", O_RDWR);
-    if (disk_fd < 0) panic("Disk open failed");
-    
-    if (pread(disk_fd, &sb, sizeof(SuperBlock), 0) != sizeof(SuperBlock))
-        panic("Superblock read failed");
-    
-    block_bitmap = malloc(sb.bitmap_blocks * sb.block_size);
-    if (!block_bitmap) panic("Bitmap alloc failed");
-    
-    if (pread(disk_fd, block_bitmap, sb.bitmap_blocks * sb.block_size, sb.block_size) != sb.bitmap_blocks * sb.block_size)
-        panic("Bitmap read failed");
-    
-    l1_cache = lru_cache_create(sb.l1_cache_size);
-    get_inode(sb.root_inode);
+// У Inode-X нет пакетной записи - пишем по одному, чтение хоста всё равно параллельное
+static int import_batch(void* ctx, import_file* files, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        files[i].result = ix_write(ctx, files[i].name, files[i].data, files[i].size);
+    return 0;
 }
 
+void import_dir(const char* dir) {
+    ix_fsinfo info;
+    ix_statfs(fs, &info);
+    import_ops ops = {
+        .ctx = fs,
+        .max_size = 12 * (size_t)info.block_size,
+        .max_name = IX_NAME_MAX,
+        .create_batch = import_batch,
+    };
+    import_config cfg = { .log = stdout };
+    import_report r;
+    if (report(import_tree(&ops, &cfg, dir, &r)) < 0) return;
+    printf("Imported %lu files (%.2f MB), %lu failed\n",
+           (unsigned long)r.files, r.bytes / 1048576.0, (unsigned long)r.failed);
+}
 
-void benchmark() {
-    const int num_files = 1000;
-    const size_t file_size = 256; // 1KB
-    char filename[FILENAME_MAX];
-    char data[file_size];
-    struct timespec start, end;
-    double total_time;
-    
-    // Генерируем тестовые данные
-    int urandom = open("/dev/urandom", O_RDONLY);
-    if (urandom < 0 || read(urandom, data, file_size) != file_size) {
-        panic("Failed to generate test data");
-    }
-    close(urandom);
-
-    printf("Starting benchmark: %d files of 1KB each\n", num_files);
-    
-    // Замер времени начала
-    if (clock_gettime(CLOCK_MONOTONIC, &start) != 0) {
-        panic("Clock error");
-    }
+static int tar_entry(const ix_stat* st, const void* data, size_t len, uint64_t offset,
+                     void* arg) {
+    tar_writer* w = arg;
+    int rc = 0;
+    if (offset == 0) rc = tar_begin_file(w, st->name, st->size, st->modified);
+    if (rc == 0) rc = tar_write(w, data, len);
+    if (rc == 0 && offset + len == st->size) rc = tar_end_file(w);
+    return rc;
+}
 
-    // Создаем файлы
-    for (int i = 0; i < num_files; i++) {
-        snprintf(filename, FILENAME_MAX, "bench_%08d.dat", i);
-        write_from_buffer(filename, (char*)data, file_size);
+// export <file.tar> [prefix]
+void export_tar(const char* path, const char* prefix) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        report(-errno);
+        return;
     }
+    tar_writer w;
+    tar_init(&w, out);
+    int rc = ix_export(fs, prefix, tar_entry, &w);
+    if (rc == 0) rc = tar_finish(&w);
+    if (fclose(out) != 0 && rc == 0) rc = -errno;
+    if (report(rc) == 0)
+        printf("Exported %lu files to %s\n", (unsigned long)w.files, path);
+}
 
-    // Замер времени окончания
-    if (clock_gettime(CLOCK_MONOTONIC, &end) != 0) {
-        panic("Clock error");
-    }
+void resize(const char* mb) {
+    ix_fsinfo before, after;
+    ix_statfs(fs, &before);
+    if (report(ix_resize(fs, strtoull(mb, NULL, 10) * 1024 * 1024)) < 0) return;
+    ix_statfs(fs, &after);
+    printf("Resized: %u -> %u blocks, %u -> %u inodes\n", before.total_blocks,
+           after.total_blocks, before.inode_count, after.inode_count);
+}
 
-    // Вычисляем результаты
-    total_time = (end.tv_sec - start.tv_sec) + 
-                (end.tv_nsec - start.tv_nsec) / 1e9;
-    
-    double files_per_sec = num_files / total_time;
-    double mb_per_sec = (num_files * file_size) / (1024.0 * 1024.0) / total_time;
-
-    printf("\nBenchmark results:\n");
-    printf("Total files:     %d\n", num_files);
-    printf("Total time:      %.3f seconds\n", total_time);
-    printf("Files per second: %.2f\n", files_per_sec);
-    printf("Throughput:      %.2f MB/s\n", mb_per_sec);
+void trim() {
+    uint64_t bytes;
+    if (report(ix_trim(fs, &bytes)) == 0)
+        printf("Trimmed %.1f MB of free space\n", bytes / (1024.0 * 1024.0));
 }
 
 void start_shell() {
@@ -492,35 +316,93 @@ void start_shell() {
         if (!fgets(command, MAX_COMMAND, stdin)) break;
 
         if (sscanf(command, "create %s %s", arg1, arg2) == 2) {
-            write_file(arg1, arg2);
-            int inode_num = find_inode(arg1);
-            if (inode_num != -1) {
-                Inode* inode = get_inode(inode_num);
-                lru_cache_put(l1_cache, inode_num, inode, 1);
-            }
+            if (write_file(arg1, arg2) == 0)
+                ix_pin(fs, arg1, NULL);
+        }
+        else if (strncmp(command, "export ", 7) == 0) {
+            arg2[0] = '\0';
+            if (sscanf(command, "export %s %s", arg1, arg2) >= 1)
+                export_tar(arg1, arg2[0] ? arg2 : NULL);
+        }
+        else if (sscanf(command, "import %s", arg1) == 1) {
+            import_dir(arg1);
         }
         else if (strncmp(command, "benchmark", 9) == 0) {
-            //mount_disk();
-            benchmark();
+            benchmark(command + 9);
+        }
+        else if (strncmp(command, "replay", 6) == 0) {
+            replay(command + 6);
+        }
+        else if (strncmp(command, "capture", 7) == 0) {
+            capture(command + 7);
         }
         //else if (sscanf(command, "echo %s \"%[^\"]", arg1, arg2) == 2) {
         else if (sscanf(command, "echo %s %s", arg1, arg2) == 2) {
-            write_from_buffer(arg1, arg2, strlen(arg2));
+            report(ix_write(fs, arg1, arg2, strlen(arg2)));
         }
         else if (sscanf(command, "read %s", arg1) == 1) {
             read_file(arg1);
         }
-        else if (sscanf(command, "pin %s", arg1) == 1) {
-            int inode_num = find_inode(arg1);
-            if (inode_num != -1) {
-                Inode* inode = get_inode(inode_num);
-                lru_cache_put(l1_cache, inode_num, inode, 1);
-                printf("Inode %d pinned\n", inode_num);
+        else if (sscanf(command, "rm %s", arg1) == 1) {
+            report(ix_delete(fs, arg1));
+        }
+        else if (sscanf(command, "discard %s", arg1) == 1) {
+            ix_set_discard(fs, strcmp(arg1, "on") == 0);
+        }
+        else if (sscanf(command, "direct %s", arg1) == 1) {
+            int on = strcmp(arg1, "on") == 0;
+            if (report(ix_set_direct(fs, on)) == 0) direct = on;
+        }
+        else if (sscanf(command, "cache resize %s", arg1) == 1) {
+            ix_fsinfo info;
+            if (report(ix_cache_resize(fs, strtoul(arg1, NULL, 10))) == 0) {
+                // Уменьшенный кэш сразу ужимается до ёмкости, по шагу за раз
+                while (ix_cache_trim(fs, CACHE_TRIM_STEP) > 0) {}
+                if (ix_statfs(fs, &info) == 0)
+                    printf("L1 cache: %u entries, %u cached\n", info.l1_cache_size,
+                           info.cached_inodes);
             }
         }
+        else if (sscanf(command, "resize %s", arg1) == 1) {
+            resize(arg1);
+        }
+        else if (strncmp(command, "sync", 4) == 0) {
+            report(ix_sync(fs));
+        }
+        else if (strncmp(command, "trim", 4) == 0) {
+            trim();
+        }
+        else if (sscanf(command, "pin %s", arg1) == 1) {
+            uint32_t inode_num;
+            if (report(ix_pin(fs, arg1, &inode_num)) == 0)
+                printf("Inode %u pinned\n", inode_num);
+        }
         else if (strncmp(command, "list", 4) == 0) {
             list_files();
         }
+        else if (strncmp(command, "lazyinit", 8) == 0) {
+            ix_fsinfo info;
+            uint32_t groups = strtoul(command + 8, NULL, 10);
+            int rc = report(ix_itable_init(fs, groups ? groups : UINT32_MAX));
+            ix_statfs(fs, &info);
+            if (rc >= 0)
+                printf("Zeroed %d inode table groups, %u of %u left\n",
+                       rc, info.itable_uninit, info.itable_groups);
+        }
+        else if (strncmp(command, "hist", 4) == 0) {
+            asfs_latency_json(ix_get_latency(fs), stdout);
+        }
+        else if (strncmp(command, "trace", 5) == 0) {
+            trace(command + 5);
+        }
+        else if (strncmp(command, "stats reset", 11) == 0) {
+            ix_reset_stats(fs);
+        }
+        else if (strncmp(command, "stats", 5) == 0) {
+            asfs_stats st;
+            ix_get_stats(fs, &st);
+            asfs_stats_json(&st, stdout);
+        }
         else if (strncmp(command, "exit", 4) == 0) {
             break;
         }
@@ -529,23 +411,46 @@ void start_shell() {
                    "create <dst> <src> - Write file\n"
                    "echo <file> \"text\" - Write text\n"
                    "read <file>        - Read file\n"
+                   "rm <file>          - Delete file\n"
+                   "discard on|off     - Punch holes for blocks of deleted files\n"
+                   "trim               - Punch holes for all free blocks\n"
+                   "sync               - Flush superblock and L1 cache hot set\n"
+                   "direct on|off      - O_DIRECT I/O bypassing the page cache\n"
+                   "resize <MB>        - Grow the image online\n"
+                   "cache resize <N>   - Change L1 cache capacity\n"
                    "pin <file>         - Pin inode\n"
+                   "import <dir>       - Import a host directory tree\n"
+                   "export <tar> [pfx] - Export files (or a name prefix) as ustar\n"
+                   "benchmark [files,..] [sizes,..] [text|csv|json] [outfile]\n"
+                   "                   - Run benchmark suite on " BENCH_PATH "\n"
+                   "capture <file>|off - Append every operation to a workload capture\n"
+                   "capture show <file> - Decode a workload capture\n"
+                   "replay <file> [threads] [speed] [text|csv|json]\n"
+                   "                   - Replay a capture on " BENCH_PATH " (speed 0 - max)\n"
                    "list               - List files\n"
+                   "stats [reset]      - Engine counters (JSON)\n"
+                   "lazyinit [N]       - Zero N (or all) pending inode table groups\n"
+                   "hist               - Latency histograms (JSON)\n"
+                   "trace on [N]|off   - Record last N operations in a ring\n"
+                   "trace dump <file>  - Save trace; trace show <file> - decode\n"
                    "exit               - Exit\n");
         }
     }
-    
-    lru_cache_free(l1_cache);
-    free(block_bitmap);
-    close(disk_fd);
+
+    report(ix_unmount(fs));
 }
 
 int main(int argc, char* argv[]) {
     uint64_t format_size = 0;
     uint32_t l1_cache_size = 128;
+    int discard = 0, offline_trim = 0;
+    const char* members[MAX_MEMBERS];
+    int member_count = 0;
+    uint64_t stripe_unit = 64 << 10;
+    const char* convert_from = NULL;
     int opt;
 
-    while ((opt = getopt(argc, argv, "f:k:")) != -1) {
+    while ((opt = getopt(argc, argv, "f:k:utRM:U:C:")) != -1) {
         switch (opt) {
             case 'f':
                 format_size = atoll(optarg) * 1024 * 1024;
@@ -553,20 +458,93 @@ int main(int argc, char* argv[]) {
             case 'k':
                 l1_cache_size = atoi(optarg);
                 break;
+            case 'u':
+                discard = 1;
+                break;
+            case 't':
+                offline_trim = 1;
+                break;
+            case 'R':
+                direct = 1;
+                break;
+            case 'M':
+                // Ещё образы набора с чередованием, через запятую
+                for (char* p = strtok(optarg, ","); p; p = strtok(NULL, ",")) {
+                    if (member_count == MAX_MEMBERS) goto usage;
+                    members[member_count++] = p;
+                }
+                break;
+            case 'C':
+                convert_from = optarg;
+                break;
+            case 'U':
+                if (bench_parse_list(optarg, &stripe_unit, 1) != 1 || stripe_unit > UINT32_MAX)
+                    goto usage;
+                break;
             default:
-                fprintf(stderr, "Usage: %s -f <sizeMB> -k <cache_size>\n", argv[0]);
+            usage:
+                fprintf(stderr, "Usage: %s -f <sizeMB> -k <cache_size> -u (discard) -t (trim) -R (O_DIRECT)\n"
+                        "          -M <img,..> (stripe -f over these too) -U <unit> (stripe unit, 64K)\n"
+                        "          -C <img> (convert a v1 image into " IX_DEFAULT_PATH ")\n",
+                        argv[0]);
                 return EXIT_FAILURE;
         }
     }
 
     if (format_size > 0) {
-        format_disk("disk.img", format_size, l1_cache_size);
-        printf("Formatted disk with %luMB, cache size: %u\n", 
+        int rc = ix_format_striped(IX_DEFAULT_PATH, members, member_count, stripe_unit,
+                                   format_size, l1_cache_size);
+        if (rc < 0) {
+            fprintf(stderr, "Format failed: %s\n", ix_strerror(rc));
+            return EXIT_FAILURE;
+        }
+        printf("Formatted disk with %luMB, cache size: %u\n",
                format_size/(1024*1024), l1_cache_size);
+        if (member_count)
+            printf("Striped over %d images, %u byte stripe unit\n",
+                   member_count + 1, (uint32_t)stripe_unit);
+    }
+
+    if (convert_from) {
+        // Свой образ переводится рядом и подменяется только после успеха
+        int in_place = strcmp(convert_from, IX_DEFAULT_PATH) == 0;
+        const char* dst = in_place ? IX_DEFAULT_PATH ".v2" : IX_DEFAULT_PATH;
+        uint32_t uninlined;
+        int rc = ix_convert(convert_from, dst, &uninlined);
+        if (rc >= 0 && in_place && rename(dst, IX_DEFAULT_PATH) < 0) rc = -errno;
+        if (rc < 0) {
+            fprintf(stderr, "Convert failed: %s\n", ix_strerror(rc));
+            return EXIT_FAILURE;
+        }
+        printf("Converted %s: %d files\n", convert_from, rc);
+        // v2 держит в inode до 48 байт данных, v1 держал до 256
+        if (uninlined)
+            printf("%u of them (49-256 bytes) no longer fit in the inode and take a data "
+                   "block each\n", uninlined);
     }
 
     if (argc == 1 || optind == argc) {
-        mount_disk();
+        int rc = ix_mount(IX_DEFAULT_PATH, &fs);
+        if (rc < 0) {
+            fprintf(stderr, "Mount failed: %s\n", ix_strerror(rc));
+            if (rc == -EPROTO) fprintf(stderr, "Old inode format, convert it with -C %s\n",
+                                       IX_DEFAULT_PATH);
+            return EXIT_FAILURE;
+        }
+        ix_set_discard(fs, discard);
+        ix_fsinfo info;
+        ix_statfs(fs, &info);
+        if (info.cached_inodes > 1)
+            printf("L1 cache warmed: %u inodes\n", info.cached_inodes);
+        if (direct && (rc = ix_set_direct(fs, 1)) < 0) {
+            fprintf(stderr, "O_DIRECT on %s: %s\n", IX_DEFAULT_PATH, ix_strerror(rc));
+            ix_unmount(fs);
+            return EXIT_FAILURE;
+        }
+        if (offline_trim) {
+            trim();
+            return report(ix_unmount(fs)) < 0 ? EXIT_FAILURE : 0;
+        }
         start_shell();
     }
 
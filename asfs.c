@@ -1,918 +1,1031 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
-#include <unistd.h>
 #include <stdint.h>
 #include <time.h>
 #include <getopt.h>
-#include <sys/stat.h>
-//#include <errno.h> // Добавляем для обработки ошибок
-#define MAX_NAME_LEN 224
-#define MAX_SNAPSHOTS 32
-#define BLOCK_SIZE 4096
-#define MAGIC_NUMBER 0x46534653
-#define DEBUG 1
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include "libasfs.h"
+#include "asfs_remote.h"
+#include "bench.h"
+#include "import.h"
+#include "tar.h"
+#include "workload.h"
+
 #define DEVICE_PATH "image.img"
+#define BENCH_PATH "bench.img"
+
+static int show_stats; // -S: счётчики движка в JSON на stderr после команды
+static int show_hist;  // -H: гистограммы задержек в JSON на stderr
+static const char* trace_path; // -T: куда сбросить трейс операций
+static const char* capture_path; // -Q: дописывать сюда нагрузку (workload.h)
+static int discard;    // -u: дырявить образ на месте освобождённых блоков
+static int direct;     // -R: O_DIRECT мимо page cache
+static int background; // -g: удаления освобождает фоновый поток
+#define MAX_MEMBERS 7
+static const char* members[MAX_MEMBERS]; // -M: ещё образы набора для -f
+static int member_count;
+static uint64_t stripe_unit = 64 << 10;  // -U: размер полосы
+static const char* view;  // -V: -l, -q и -X показывают этот снапшот ФС
+static const char* remote_path;  // -k: команды идут демону на этом сокете
+#define PIPELINE_DEPTH 256       // -i: запросов в конвейере до чтения ответов
+
+static void dump_latency(asfs_latency* lat) {
+    if (show_hist) asfs_latency_json(lat, stderr);
+    if (!trace_path || !lat->trace) return;
+    FILE* f = fopen(trace_path, "wb");
+    int rc = f ? asfs_trace_write(lat, f) : -errno;
+    if (f && fclose(f) != 0 && rc == 0) rc = -errno;
+    if (rc < 0) fprintf(stderr, "Trace %s: %s\n", trace_path, asfs_strerror(rc));
+}
 
-static uint32_t next_snap_id = 1; // Статический счетчик ID снапшотов
+static asfs_fs* open_fs(int mode) {
+    asfs_fs* fs;
+    int rc = asfs_open(DEVICE_PATH, mode, &fs);
+    if (rc < 0) {
+        fprintf(stderr, "Error open %s: %s\n", DEVICE_PATH, asfs_strerror(rc));
+        return NULL;
+    }
+    if (trace_path) {
+        rc = asfs_trace_enable(asfs_get_latency(fs), 65536);
+        if (rc < 0) fprintf(stderr, "Trace: %s\n", asfs_strerror(rc));
+    }
+    if (capture_path && (rc = asfs_capture_enable(fs, capture_path)) < 0)
+        fprintf(stderr, "Capture %s: %s\n", capture_path, asfs_strerror(rc));
+    asfs_set_discard(fs, discard);
+    if (direct && (rc = asfs_set_direct(fs, 1)) < 0) {
+        fprintf(stderr, "O_DIRECT on %s: %s\n", DEVICE_PATH, asfs_strerror(rc));
+        asfs_close(fs);
+        return NULL;
+    }
+    if (background && mode == ASFS_RDWR && (rc = asfs_set_reclaim(fs, 1)) < 0)
+        fprintf(stderr, "Reclaimer: %s\n", asfs_strerror(rc));
+    return fs;
+}
 
-typedef struct {
-    uint32_t magic;
-    uint32_t total_blocks;
-    uint32_t inode_count;
-    uint32_t free_inodes;
-    uint32_t free_blocks;
-    uint32_t first_data_block;
-    uint32_t block_size;
-    uint32_t snapshot_count;
+static void close_fs(asfs_fs* fs) {
+    if (show_stats) {
+        asfs_stats st;
+        asfs_get_stats(fs, &st);
+        asfs_stats_json(&st, stderr);
+    }
+    dump_latency(asfs_get_latency(fs));
+    asfs_close(fs);
+}
 
-  uint32_t next_snap_id;
-} SuperBlock;
-typedef struct {
-    uint32_t number;
-    uint32_t snapshot_count; // Добавляем счетчик снапшотов
-    uint32_t size;
-    uint32_t blocks[12];
-    char name[MAX_NAME_LEN];
-    uint8_t used;
-    time_t created;
-    time_t modified;
-    uint32_t snapshot_id;
-    uint8_t padding[12];
-    uint32_t snapshot_parent;
-    uint8_t is_snapshot;
-    uint8_t type; // 0 - файл, 1 - директория
-} Inode;
-typedef struct {
-    char snapshot_name[MAX_NAME_LEN];
-    uint32_t snap_id;       // Уникальный ID снапшота
-    Inode inode;
-    uint8_t* data;
-    time_t timestamp;
-
-    uint32_t original_inode; // Исходный inode
-    uint32_t snapshot_inode; // Inode снапшота
-
-   // uint32_t original_inode;
-} Snapshot;
-int disk_fd;
-SuperBlock sb;
-Snapshot snapshots[MAX_SNAPSHOTS];
-uint8_t* block_bitmap;
-uint8_t* inode_bitmap;
-
-// Прототипы функций
-uint32_t allocate_block();
-void free_blocks(uint32_t* blocks, size_t count);
-uint32_t find_inode(const char* filename);
-void update_bitmaps();
-void load_metadata();
-void save_metadata();
-void list_snapshots();
-// Реализация недостающих функций
-void list_files() {
-    disk_fd = open(DEVICE_PATH, O_RDONLY);
-    load_metadata();
+static int report(int rc, const char* what) {
+    if (rc < 0) printf("%s: %s\n", what, asfs_strerror(rc));
+    return rc < 0;
+}
+
+// -D понимает и трейс задержек, и запись нагрузки - по магии в начале
+static int decode_trace(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return report(-errno, path);
+    uint32_t magic = 0;
+    int rc;
+    if (fread(&magic, sizeof(magic), 1, f) == 1 && magic == WORKLOAD_MAGIC) {
+        rc = workload_print(path, stdout);
+    } else {
+        rewind(f);
+        rc = asfs_trace_print(f, stdout);
+    }
+    fclose(f);
+    return report(rc, path);
+}
+
+static int print_entry(const asfs_stat* st, void* arg) {
+    char created_str[20], modified_str[20];
+    strftime(created_str, 20, "%Y-%m-%d %H:%M:%S", localtime(&st->created));
+    strftime(modified_str, 20, "%Y-%m-%d %H:%M:%S", localtime(&st->modified));
+    if (st->inode == 0) {
+        printf("%-20s %-10s %u  %-10s %-10s\n",
+               st->name, "DIR", 0, created_str, modified_str);
+        return 0;
+    }
+    printf("%-20s %-10s %u  %-10s %-10s %u %u \n",
+           st->name,
+           st->type ? "DIR" : "FILE",
+           st->size,
+           created_str,
+           modified_str, st->inode, st->snapshot_id);
+    return 0;
+}
+
+static void print_list_header() {
     printf("\n%-20s %-10s %-10s %-10s %-10s %-10s %-10s\n",
            "Name", "Type", "Size", "Created", "Modified", "Inode", "Snapshot_id");
     printf("==============================================================\n");
-    // Всегда показываем корневой каталог
-    Inode root;
-    lseek(disk_fd, sizeof(SuperBlock), SEEK_SET);
-    read(disk_fd, &root, sizeof(Inode));
+}
 
-    char created_str[20], modified_str[20];
-    strftime(created_str, 20, "%Y-%m-%d %H:%M:%S", localtime(&root.created));
-    strftime(modified_str, 20, "%Y-%m-%d %H:%M:%S", localtime(&root.modified));
+static int remote_cmd(int op, const char* name, const char* name2, const char* data,
+                      uint64_t offset);
+
+int list_files() {
+    if (remote_path)
+        return view ? report(-ENOTSUP, "-V") : remote_cmd(ASFS_REQ_LIST, NULL, NULL, NULL, 0);
+    asfs_fs* fs = open_fs(ASFS_RDONLY);
+    if (!fs) return 1;
+    print_list_header();
+    int rc = view ? asfs_epoch_files(fs, view, print_entry, NULL)
+                  : asfs_list(fs, print_entry, NULL);
+    close_fs(fs);
+    return report(rc, "List failed");
+}
 
-    printf("%-20s %-10s %u  %-10s %-10s\n",
-           root.name,
-           "DIR",
-           0,
-           created_str,
-           modified_str);
-    // Обработка остальных inodes
-    for (uint32_t i = 1; i < sb.inode_count; i++) {
-        if (!(inode_bitmap[i/8] & (1 << (i%8)))) continue;
-
-        Inode node;
-        lseek(disk_fd, sizeof(SuperBlock) + i * sizeof(Inode), SEEK_SET);
-        read(disk_fd, &node, sizeof(Inode));
-
-        if (!node.used) continue;
-        strftime(created_str, 20, "%Y-%m-%d %H:%M:%S", localtime(&node.created));
-        strftime(modified_str, 20, "%Y-%m-%d %H:%M:%S",
-                node.modified ? localtime(&node.modified) : localtime(&node.created));
-        uint32_t inode_num = find_inode(node.name);
-        printf("%-20s %-10s %u  %-10s %-10s %u %u \n",
-               node.name,
-               node.type ? "DIR" : "FILE",
-               node.size,
-               created_str,
-               modified_str,inode_num,node.snapshot_id);
-    }
-    close(disk_fd);
-}
-void delete_file(const char* filename) {
-    disk_fd = open(DEVICE_PATH, O_RDWR);
-    load_metadata();
-    uint32_t inode_num = find_inode(filename);
-    if (inode_num == (uint32_t)-1) {
-        printf("File not found\n");
-        close(disk_fd);
-        return;
-    }
-    Inode node;
-    lseek(disk_fd, sizeof(SuperBlock) + inode_num * sizeof(Inode), SEEK_SET);
-    read(disk_fd, &node, sizeof(Inode));
-    // Free blocks
-    uint32_t blocks_count = (node.size + sb.block_size - 1) / sb.block_size;
-    free_blocks(node.blocks, blocks_count);
-    // Free inode
-    inode_bitmap[inode_num/8] &= ~(1 << (inode_num%8));
-    sb.free_inodes++;
-
-    save_metadata();
-    close(disk_fd);
-    printf("File '%s' deleted\n", filename);
+static int print_sorted(const asfs_stat* st, void* arg) {
+    strcpy(arg, st->name); // курсор следующей страницы
+    return print_entry(st, NULL);
 }
-void edit_file(const char* filename, const void* new_data) {
-    size_t new_size = strlen(new_data);
-    disk_fd = open(DEVICE_PATH, O_RDWR);
-    load_metadata();
-    uint32_t inode_num = find_inode(filename);
-    if (inode_num == (uint32_t)-1) {
-        printf("File not found\n");
-        close(disk_fd);
-        return;
-    }
-    Inode node;
-    lseek(disk_fd, sizeof(SuperBlock) + inode_num * sizeof(Inode), SEEK_SET);
-    read(disk_fd, &node, sizeof(Inode));
-    // Handle snapshots
-//    if (node.snapshot_id != 0) {
-//        create_snapshot(filename, "auto_snapshot");
-//        node.snapshot_id = 0;
-//    }
-    uint32_t old_blocks = (node.size + sb.block_size - 1) / sb.block_size;
-    uint32_t new_blocks = (new_size + sb.block_size - 1) / sb.block_size;
-    // Free excess blocks
-    for (int i = new_blocks; i < old_blocks; i++) {
-        if (node.blocks[i] == 0) continue;
-        uint32_t byte = node.blocks[i] / 8;
-        uint8_t bit = 1 << (node.blocks[i] % 8);
-        block_bitmap[byte] &= ~bit;
-        sb.free_blocks++;
-        node.blocks[i] = 0;
-    }
-    // Allocate new blocks
-    for (int i = old_blocks; i < new_blocks; i++) {
-        node.blocks[i] = allocate_block();
-        if (!node.blocks[i]) {
-            printf("Not enough space\n");
-            free_blocks(node.blocks, i);
-            close(disk_fd);
-            return;
-        }
-    }
-    // Write new data
-    for (int i = 0; i < new_blocks; i++) {
-        lseek(disk_fd, node.blocks[i] * sb.block_size, SEEK_SET);
-        size_t write_size = (new_size - (i * sb.block_size)) > sb.block_size
-                          ? sb.block_size : (new_size - (i * sb.block_size));
-        ssize_t bytes_written = write(disk_fd, (char*)new_data + i*sb.block_size, write_size);
-        if (bytes_written != write_size) {
-		perror("[ERROR] Write failed");
-    	   return;
-	}
-    }
-    // Update inode
-    node.size = new_size;
-    node.modified = time(0);
-    lseek(disk_fd, sizeof(SuperBlock) + inode_num * sizeof(Inode), SEEK_SET);
-    ssize_t bytes_written = write(disk_fd, &node, sizeof(Inode));
-    if (bytes_written !=  sizeof(Inode)) {
-	perror("[ERROR] Write failed");
-        return;
-    }
-    save_metadata();
-    close(disk_fd);
-    printf("File '%s' updated\n", filename);
+
+// Листинг по индексу имён: префикс, страница не больше limit, после курсора
+int list_prefix(const char* prefix, const char* after, uint32_t limit) {
+    asfs_fs* fs = open_fs(ASFS_RDONLY);
+    if (!fs) return 1;
+    char last[ASFS_NAME_MAX] = "";
+    print_list_header();
+    int rc = asfs_list_sorted(fs, prefix, after, limit, print_sorted, last);
+    if (rc > 0 && limit && (uint32_t)rc == limit) printf("Next page: -C '%s'\n", last);
+    close_fs(fs);
+    return report(rc, "List failed");
 }
-uint32_t find_free_inode() {
-    for (uint32_t i = 1; i < sb.inode_count; i++) { // Начинаем с 1
-        uint32_t byte = i / 8;
-        uint8_t bit = 1 << (i % 8);
-        if (!(inode_bitmap[byte] & bit)) {
-            if (DEBUG) printf("[DEBUG] Found free inode: %u\n", i);
-            return i;
-        }
-    }
-    return (uint32_t)-1;
+
+int build_index() {
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    int rc = asfs_index_build(fs);
+    close_fs(fs);
+    return report(rc, "Index build failed");
+}
+
+static int print_snapshot(const asfs_snapshot_info* snap, void* arg) {
+    char time_buf[30];
+    strftime(time_buf, 30, "%Y-%m-%d %H:%M:%S", localtime(&snap->timestamp));
+    char inode_buf[16] = "-";  // файл удалён, снапшот отвязан
+    if (snap->original_inode != ASFS_NO_INODE)
+        snprintf(inode_buf, sizeof(inode_buf), "%u", snap->original_inode);
+    printf("%-20s %-20s %-30s %-10u %s\n",
+           snap->name, snap->file, time_buf, snap->size, inode_buf);
+    return 0;
 }
-void print_fs_info() {
-    disk_fd = open(DEVICE_PATH, O_RDONLY);
-    load_metadata();
+
+int list_snapshots() {
+    asfs_fs* fs = open_fs(ASFS_RDONLY);
+    if (!fs) return 1;
+    asfs_fsinfo info;
+    asfs_statfs(fs, &info);
+    printf("\n%-20s %-20s %-30s %-10s %s\n",
+           "Snapshot Name", "File", "Timestamp", "Size", "Inode");
+    printf("----------------------------------------------------------------------------------------\n");
+    if (info.snapshot_count == 0) printf("No snapshots available\n");
+    int rc = asfs_snapshot_list(fs, print_snapshot, NULL);
+    close_fs(fs);
+    return report(rc, "List failed");
+}
+
+static int print_epoch(const asfs_epoch_info* info, void* arg) {
+    char time_buf[30];
+    strftime(time_buf, 30, "%Y-%m-%d %H:%M:%S", localtime(&info->created));
+    printf("%-20s %-10u %s\n", info->name, info->epoch, time_buf);
+    (*(int*)arg)++;
+    return 0;
+}
+
+int list_epochs() {
+    asfs_fs* fs = open_fs(ASFS_RDONLY);
+    if (!fs) return 1;
+    int n = 0;
+    printf("\n%-20s %-10s %s\n", "FS Snapshot", "Epoch", "Created");
+    printf("--------------------------------------------------\n");
+    int rc = asfs_epoch_list(fs, print_epoch, &n);
+    if (n == 0) printf("No FS snapshots\n");
+    close_fs(fs);
+    return report(rc, "List failed");
+}
+
+int create_epoch(const char* name) {
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    int rc = asfs_epoch_snapshot(fs, name);
+    close_fs(fs);
+    if (report(rc, "FS snapshot failed")) return 1;
+    printf("FS snapshot '%s' created\n", name);
+    return 0;
+}
+
+int delete_epoch(const char* name) {
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    asfs_fsinfo before, after;
+    asfs_statfs(fs, &before);
+    int rc = asfs_epoch_delete(fs, name);
+    // С -g сборка идёт в фоне - для отчёта дожидаемся её
+    if (rc == 0) rc = asfs_reclaim(fs);
+    asfs_statfs(fs, &after);
+    close_fs(fs);
+    if (report(rc, "FS snapshot delete failed")) return 1;
+    printf("FS snapshot '%s' deleted, %u blocks and %u inodes reclaimed\n", name,
+           after.free_blocks - before.free_blocks, after.free_inodes - before.free_inodes);
+    return 0;
+}
+
+static void print_info(const asfs_fsinfo* info) {
     printf("\nFile System Information:\n");
     printf("===============================\n");
-    printf("Block size:         %u bytes\n", sb.block_size);
-    printf("Total blocks:       %u\n", sb.total_blocks);
+    printf("Block size:         %u bytes\n", info->block_size);
+    printf("Total blocks:       %u\n", info->total_blocks);
     printf("Free blocks:        %u (%.1f%%)\n",
-          sb.free_blocks,
-          100.0 * sb.free_blocks / sb.total_blocks);
-    printf("Total inodes:       %u\n", sb.inode_count);
+          info->free_blocks,
+          100.0 * info->free_blocks / info->total_blocks);
+    printf("Total inodes:       %u\n", info->inode_count);
     printf("Free inodes:        %u (%.1f%%)\n",
-          sb.free_inodes,
-          100.0 * sb.free_inodes / sb.inode_count);
-    printf("Snapshots count:    %u\n", sb.snapshot_count);
-    printf("First data block:   %u\n", sb.first_data_block);
-    printf("Magic number:       0x%08X\n", sb.magic);
+          info->free_inodes,
+          100.0 * info->free_inodes / info->inode_count);
+    printf("Snapshots count:    %u\n", info->snapshot_count);
+    if (info->orphan_count)
+        printf("Pending reclaim:    %u inodes\n", info->orphan_count);
+    printf("First data block:   %u\n", info->first_data_block);
+    printf("Magic number:       0x%08X\n", info->magic);
     printf("===============================\n");
+}
 
-    close(disk_fd);
+int print_fs_info() {
+    if (remote_path) return remote_cmd(ASFS_REQ_STATFS, NULL, NULL, NULL, 0);
+    asfs_fs* fs = open_fs(ASFS_RDONLY);
+    if (!fs) return 1;
+    asfs_fsinfo info;
+    asfs_statfs(fs, &info);
+    close_fs(fs);
+    print_info(&info);
+    return 0;
 }
-void format_disk(int zero_fill, uint32_t block_size) {
-    struct stat dev_stat;
-    disk_fd = open(DEVICE_PATH, O_RDWR|O_CREAT, 0644);
-    if (disk_fd < 0){
-    	printf("Error open file for formating...\n");
-    	return;
-    }
-    //temp!!!!
-    /*if (ftruncate(disk_fd, 1024 * 1024) == -1) {
-        perror("Ошибка установки размера файла");
-        close(disk_fd);
-        return;
-    }*/
-
-    fstat(disk_fd, &dev_stat);
-    if (block_size % 512 != 0 || block_size < 512) {
-        printf("Invalid block size (must be multiple of 512)\n");
-        exit(1);
-    }
-    sb.block_size = block_size;
-    sb.total_blocks = dev_stat.st_size / block_size;
-    //sb.total_blocks = dev_stat.st_size
-    sb.inode_count = sb.total_blocks / 16;
-    sb.first_data_block = 3 + (sb.inode_count * sizeof(Inode)) / block_size;
-    sb.free_blocks = sb.total_blocks - sb.first_data_block;
-    sb.free_inodes = sb.inode_count - 1;
-    sb.magic = MAGIC_NUMBER;
-    if (DEBUG) {
-        printf("[DEBUG] Formatting parameters:\n"
-               "Block size: %u\n"
-               "Total blocks: %u\n"
-               "Inodes: %u\n"
-               "First data block: %u\n",
-               sb.block_size, sb.total_blocks,
-               sb.inode_count, sb.first_data_block);
-    }
-    if (zero_fill) {
-        uint8_t *zero = calloc(1, block_size);
-    	//uint8_t *zero=0;
-        for (uint32_t i = 0; i < sb.total_blocks; i++) {
-            write(disk_fd, zero, block_size);
-        }
-        free(zero);
-    }
-    Inode root = {0};
-    root.used = 1;
-    strcpy(root.name, "/");
-    root.created = time(0);
-    root.type = 1; // Директория
-    lseek(disk_fd, 0, SEEK_SET);
-    if (0 > write(disk_fd, &sb, sizeof(SuperBlock)))
-    {
-    	printf("Error write superblock\n");
-    	return;
-    }
-    if (0 > write(disk_fd, &root, sizeof(Inode)))
-    {
-		printf("Error write superblock\n");
-		return;
-	}
-    printf("Device formatted with %u byte blocks\n", block_size);
-    close(disk_fd);
+
+int resize_fs(const char* size_str) {
+    uint64_t size;
+    if (bench_parse_list(size_str, &size, 1) != 1) return report(-EINVAL, size_str);
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    asfs_fsinfo before, after;
+    asfs_statfs(fs, &before);
+    int rc = asfs_resize(fs, size);
+    asfs_statfs(fs, &after);
+    close_fs(fs);
+    if (report(rc, "Resize failed")) return 1;
+    printf("Resized: %u -> %u blocks, %u -> %u inodes\n",
+           before.total_blocks, after.total_blocks, before.inode_count, after.inode_count);
+    return 0;
 }
-void delete_snapshot(const char* snap_name) {
-    disk_fd = open(DEVICE_PATH, O_RDWR);
-    load_metadata();
 
-    int found_index = -1;
-    Snapshot target_snap;
+int trim_fs() {
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    uint64_t bytes;
+    int rc = asfs_trim(fs, &bytes);
+    close_fs(fs);
+    if (report(rc, "Trim failed")) return 1;
+    printf("Trimmed %.1f MB of free space\n", bytes / (1024.0 * 1024.0));
+    return 0;
+}
 
-    // Поиск снапшота по имени
-    for (int i = 0; i < sb.snapshot_count; i++) {
-        if (strcmp(snapshots[i].snapshot_name, snap_name) == 0) {
-            found_index = i;
-            target_snap = snapshots[i];
-            break;
-        }
-    }
+int check_fs(int repair, int threads) {
+    asfs_fs* fs = open_fs(repair ? ASFS_RDWR : ASFS_RDONLY);
+    if (!fs) return 1;
+    asfs_fsck_report r;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = asfs_fsck(fs, repair ? ASFS_FSCK_REPAIR : 0, threads, &r);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    close_fs(fs);
+    if (report(rc, "fsck failed")) return 1;
+
+    printf("Checked %u inodes (%u files, %u snapshots, %u versions, %u orphans) "
+           "with %d threads in %.3f s\n",
+           r.inodes_checked, r.files, r.snapshots, r.versions, r.orphans, r.threads,
+           (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    printf("Leaked blocks:      %u\n", r.leaked_blocks);
+    printf("Unmarked blocks:    %u\n", r.lost_blocks);
+    printf("Shared blocks:      %u\n", r.double_blocks);
+    printf("Bad block pointers: %u\n", r.bad_blocks);
+    printf("Leaked inodes:      %u\n", r.leaked_inodes);
+    printf("Unmarked inodes:    %u\n", r.lost_inodes);
+    printf("Bad snapshots:      %u\n", r.bad_snapshots);
+    printf("Bad snapshot counts: %u\n", r.bad_counts);
+    printf("Bad free counters:  %u\n", r.counter_errors);
+    if (r.problems == 0) printf("Clean\n");
+    else if (r.repaired) printf("%u problems repaired\n", r.problems);
+    else printf("%u problems found, run with -y -F to repair\n", r.problems);
+    return r.problems && !r.repaired;
+}
 
-    if (found_index == -1) {
-        printf("Snapshot '%s' not found\n", snap_name);
-        close(disk_fd);
-        return;
+static int import_batch(void* ctx, import_file* files, size_t n) {
+    asfs_create_req* reqs = calloc(n, sizeof(*reqs));
+    if (!reqs) return -ENOMEM;
+    for (size_t i = 0; i < n; i++) {
+        reqs[i].name = files[i].name;
+        reqs[i].data = files[i].data;
+        reqs[i].size = files[i].size;
     }
-
-    // 1. Освобождаем inode снапшота
-    Inode snap_inode;
-    lseek(disk_fd, sizeof(SuperBlock) + target_snap.snapshot_inode * sizeof(Inode), SEEK_SET);
-    read(disk_fd, &snap_inode, sizeof(Inode));
-
-    // Освобождаем блоки данных
-    uint32_t blocks_count = (snap_inode.size + sb.block_size - 1) / sb.block_size;
-    free_blocks(snap_inode.blocks, blocks_count);
-
-    // Освобождаем inode в битовой карте
-    uint32_t inode_byte = target_snap.snapshot_inode / 8;
-    uint8_t inode_bit = 1 << (target_snap.snapshot_inode % 8);
-    inode_bitmap[inode_byte] &= ~inode_bit;
-    sb.free_inodes++;
-
-    // 2. Обновляем оригинальный файл
-    Inode orig_inode;
-    lseek(disk_fd, sizeof(SuperBlock) + target_snap.original_inode * sizeof(Inode), SEEK_SET);
-    read(disk_fd, &orig_inode, sizeof(Inode));
-    orig_inode.snapshot_count--;
-    lseek(disk_fd, sizeof(SuperBlock) + target_snap.original_inode * sizeof(Inode), SEEK_SET);
-    write(disk_fd, &orig_inode, sizeof(Inode));
-
-    // 3. Удаляем из массива снапшотов
-    memmove(&snapshots[found_index],
-           &snapshots[found_index + 1],
-           (sb.snapshot_count - found_index - 1) * sizeof(Snapshot));
-    sb.snapshot_count--;
-
-    // 4. Сохраняем изменения
-    save_metadata();
-    close(disk_fd);
-
-    printf("Snapshot '%s' deleted successfully\n", snap_name);
+    int rc = asfs_create_batch(ctx, reqs, n);
+    for (size_t i = 0; i < n; i++) files[i].result = reqs[i].result;
+    free(reqs);
+    return rc;
 }
-void create_file(const char* filename, const void* data) {
-    disk_fd = open(DEVICE_PATH, O_RDWR);
-    load_metadata();
-    // Поиск свободного inode (начиная с 1)
-    uint32_t inode_num = find_free_inode();
-    if(inode_num == (uint32_t)-1) {
-        printf("No free inodes!\n");
-        close(disk_fd);
-        return;
-    }
-    // Выделение блоков
-    size_t size = strlen(data);
-    uint32_t blocks_needed = (size + sb.block_size - 1) / sb.block_size;
-    uint32_t blocks[12] = {0};
-
-    for(int i = 0; i < blocks_needed; i++) {
-        blocks[i] = allocate_block();
-        if(!blocks[i]) {
-            printf("No space!\n");
-            free_blocks(blocks, i);
-            close(disk_fd);
-            return;
-        }
-        lseek(disk_fd, blocks[i] * sb.block_size, SEEK_SET);
-        ssize_t bytes_written = write(disk_fd, (char*)data + i*sb.block_size, sb.block_size);
-        if (bytes_written != sb.block_size) {
-	   perror("[ERROR] Write failed");
-	   return;
-    	}
-    }
-    // Создание inode
-    Inode node = {
-        .used = 1,
-        .type = 0,
-        .size = size,
-        .created = time(0),
-        .modified = time(0)
 
+int import_dir(const char* dir) {
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    asfs_fsinfo info;
+    asfs_statfs(fs, &info);
+    import_ops ops = {
+        .ctx = fs,
+        .max_size = 12 * (size_t)info.block_size,
+        .max_name = ASFS_NAME_MAX,
+        .create_batch = import_batch,
     };
-    strncpy(node.name, filename, MAX_NAME_LEN-1);
-    memcpy(node.blocks, blocks, sizeof(blocks));
-    lseek(disk_fd, sizeof(SuperBlock) + inode_num*sizeof(Inode), SEEK_SET);
-    write(disk_fd, &node, sizeof(Inode));
-    // Обновление битмапов
-    inode_bitmap[inode_num/8] |= 1 << (inode_num%8);
-    sb.free_inodes--;
-    sb.free_blocks -= blocks_needed;
-    save_metadata();
-    close(disk_fd);
-    printf("Created file '%s' in inode %u\n", filename, inode_num);
+    import_config cfg = { .log = stderr };
+    import_report r;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = import_tree(&ops, &cfg, dir, &r);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    close_fs(fs);
+    double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("Imported %lu files (%.2f MB) in %lu batches, %lu failed, %.3f s\n",
+           (unsigned long)r.files, r.bytes / 1048576.0, (unsigned long)r.batches,
+           (unsigned long)r.failed, sec);
+    return report(rc, "Import failed") || r.failed;
 }
-/*
-void create_snapshot(const char* filename, const char* snap_name) {
-    disk_fd = open(DEVICE_PATH, O_RDWR);
-    load_metadata();
-    // Поиск файла
-    uint32_t inode_num = find_inode(filename);
-    if(inode_num == (uint32_t)-1) {
-        printf("File not found!\n");
-        close(disk_fd);
-        return;
-    }
-    // Чтение оригинального inode
-    Inode original;
-    lseek(disk_fd, sizeof(SuperBlock) + inode_num*sizeof(Inode), SEEK_SET);
-    read(disk_fd, &original, sizeof(Inode));
-    // Создание снапшота
-    Snapshot snap = {
-        .snap_id = sb.next_snap_id++,
-        .timestamp = time(0),
-        .original_inode = inode_num,
-        .inode = original
-    };
-    strncpy(snap.snapshot_name, snap_name, MAX_NAME_LEN-1);
-    // Копирование данных
-    uint32_t blocks_needed = (original.size + sb.block_size - 1) / sb.block_size;
-    snap.data = malloc(blocks_needed * sb.block_size);
-
-    for(int i = 0; i < blocks_needed; i++) {
-        lseek(disk_fd, original.blocks[i] * sb.block_size, SEEK_SET);
-        read(disk_fd, snap.data + i*sb.block_size, sb.block_size);
+
+static int tar_entry(const asfs_stat* st, const void* data, size_t len, uint64_t offset,
+                     void* arg) {
+    tar_writer* w = arg;
+    int rc = 0;
+    if (offset == 0)
+        rc = tar_begin_file(w, st->name, st->size, st->modified ? st->modified : st->created);
+    if (rc == 0) rc = tar_write(w, data, len);
+    if (rc == 0 && offset + len == st->size) rc = tar_end_file(w);
+    return rc;
+}
+
+int export_tar(const char* path, const char* prefix) {
+    int to_stdout = strcmp(path, "-") == 0;
+    FILE* out = to_stdout ? stdout : fopen(path, "wb");
+    if (!out) return report(-errno, path);
+    asfs_fs* fs = open_fs(ASFS_RDONLY);
+    if (!fs) {
+        if (!to_stdout) fclose(out);
+        return 1;
     }
-    // Сохранение снапшота
-    snapshots[sb.snapshot_count++] = snap;
-    save_metadata();
-    close(disk_fd);
-    printf("Created snapshot '%s' (ID: %u)\n", snap_name, snap.snap_id);
-}*/
-void create_snapshot(const char* filename, const char* snap_name) {
-    disk_fd = open(DEVICE_PATH, O_RDWR);
-    load_metadata();
-
-    // Находим исходный inode
-    uint32_t orig_inode = find_inode(filename);
-    if(orig_inode == (uint32_t)-1) {
-        printf("File not found!\n");
-        close(disk_fd);
-        return;
+    tar_writer w;
+    tar_init(&w, out);
+    int rc = view ? asfs_epoch_export(fs, view, prefix, tar_entry, &w)
+                  : asfs_export(fs, prefix, tar_entry, &w);
+    if (rc == 0) rc = tar_finish(&w);
+    close_fs(fs);
+    if (!to_stdout && fclose(out) != 0 && rc == 0) rc = -errno;
+    if (rc < 0) {
+        fprintf(stderr, "Export failed: %s\n", asfs_strerror(rc));
+        return 1;
     }
+    fprintf(stderr, "Exported %lu files, %lu bytes of archive\n",
+            (unsigned long)w.files, (unsigned long)w.bytes);
+    return 0;
+}
 
-    // Создаем новый inode для снапшота
-    uint32_t snap_inode = find_free_inode();
-    if(snap_inode == (uint32_t)-1) {
-        printf("No free inodes!\n");
-        close(disk_fd);
-        return;
+int print_file_content(const char* filename) {
+    if (remote_path)
+        return view ? report(-ENOTSUP, "-V") : remote_cmd(ASFS_REQ_READ, filename, NULL, NULL, 0);
+    asfs_fs* fs = open_fs(ASFS_RDONLY);
+    if (!fs) return 1;
+    asfs_stat st;
+    int rc = view ? asfs_epoch_lookup(fs, view, filename, &st) : asfs_lookup(fs, filename, &st);
+    if (rc < 0) {
+        close_fs(fs);
+        return report(rc, "File not found");
     }
+    printf("\nContents of '%s' (%u bytes):\n", filename, st.size);
+    printf("--------------------------------------------------\n");
+    char* buffer = malloc(st.size + 1);
+    ssize_t n = !buffer ? -1 : view ? asfs_epoch_read(fs, view, filename, buffer, st.size, 0)
+                                    : asfs_read(fs, filename, buffer, st.size, 0);
+    if (n > 0) fwrite(buffer, 1, n, stdout);
+    free(buffer);
+    printf("\n--------------------------------------------------\n");
+    close_fs(fs);
+    return report(n, "Read failed");
+}
 
-    // Копируем данные исходного inode
-    Inode orig_node, snap_node;
-    lseek(disk_fd, sizeof(SuperBlock) + orig_inode*sizeof(Inode), SEEK_SET);
-    read(disk_fd, &orig_node, sizeof(Inode));
-
-    // Копируем метаданные
-    memcpy(&snap_node, &orig_node, sizeof(Inode));
-    snap_node.snapshot_count = 0;
-    snap_node.modified = time(0);
-
-    snap_node.is_snapshot = 1;
-    snap_node.snapshot_parent = orig_inode;
-
-    // Копируем данные в новые блоки
-    uint32_t blocks_needed = (orig_node.size + sb.block_size - 1)/sb.block_size;
-    for(int i=0; i<blocks_needed; i++) {
-        uint32_t new_block = allocate_block();
-        if(!new_block) {
-            printf("No space for snapshot!\n");
-            free_blocks(snap_node.blocks, i);
-            close(disk_fd);
-            return;
-        }
-
-        // Копируем данные блока
-        uint8_t* buffer = malloc(sb.block_size);
-        lseek(disk_fd, orig_node.blocks[i] * sb.block_size, SEEK_SET);
-        read(disk_fd, buffer, sb.block_size);
-
-        lseek(disk_fd, new_block * sb.block_size, SEEK_SET);
-        write(disk_fd, buffer, sb.block_size);
-        free(buffer);
-
-        snap_node.blocks[i] = new_block;
+int format_disk(int zero_fill, uint32_t block_size) {
+    int rc = member_count ?
+        asfs_format_striped(DEVICE_PATH, members, member_count, stripe_unit, block_size,
+                            zero_fill) :
+        asfs_format(DEVICE_PATH, block_size, zero_fill);
+    if (rc < 0) {
+        printf("Error formatting %s: %s\n", DEVICE_PATH, asfs_strerror(rc));
+        return 1;
     }
+    printf("Device formatted with %u byte blocks\n", block_size);
+    if (member_count)
+        printf("Striped over %d images, %u byte stripe unit\n",
+               member_count + 1, (uint32_t)stripe_unit);
+    return 0;
+}
 
-    // Сохраняем новый inode
-    lseek(disk_fd, sizeof(SuperBlock) + snap_inode*sizeof(Inode), SEEK_SET);
-    write(disk_fd, &snap_node, sizeof(Inode));
+static int parse_members(char* list) {
+    member_count = 0;
+    for (char* p = strtok(list, ","); p; p = strtok(NULL, ",")) {
+        if (member_count == MAX_MEMBERS) return -1;
+        members[member_count++] = p;
+    }
+    return member_count ? 0 : -1;
+}
 
-    // Обновляем оригинальный inode
-    orig_node.snapshot_count++;
-    lseek(disk_fd, sizeof(SuperBlock) + orig_inode*sizeof(Inode), SEEK_SET);
-    write(disk_fd, &orig_node, sizeof(Inode));
+int create_file(const char* filename, const char* data) {
+    if (remote_path) return remote_cmd(ASFS_REQ_CREATE, filename, NULL, data, 0);
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    uint32_t inode_num;
+    int rc = asfs_create(fs, filename, data, strlen(data), &inode_num);
+    close_fs(fs);
+    if (report(rc, "Create failed")) return 1;
+    printf("Created file '%s' in inode %u\n", filename, inode_num);
+    return 0;
+}
 
-    // Создаем запись снапшота
-    Snapshot snap = {
-        .original_inode = orig_inode,
-        .snapshot_inode = snap_inode,
-        .timestamp = time(0)
-    };
-    strncpy(snap.snapshot_name, snap_name, MAX_NAME_LEN-1);
+int edit_file(const char* filename, const char* data) {
+    if (remote_path) return remote_cmd(ASFS_REQ_EDIT, filename, NULL, data, 0);
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    int rc = asfs_edit(fs, filename, data, strlen(data));
+    close_fs(fs);
+    if (report(rc, "Edit failed")) return 1;
+    printf("File '%s' updated\n", filename);
+    return 0;
+}
 
-    snapshots[sb.snapshot_count++] = snap;
-    save_metadata();
+int append_file(const char* filename, const char* data) {
+    if (remote_path) return remote_cmd(ASFS_REQ_APPEND, filename, NULL, data, 0);
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    ssize_t rc = asfs_append(fs, filename, data, strlen(data));
+    close_fs(fs);
+    if (report(rc, "Append failed")) return 1;
+    printf("Appended %zd bytes to '%s'\n", rc, filename);
+    return 0;
+}
 
-    close(disk_fd);
-    printf("Snapshot '%s' created (inode %u)\n", snap_name, snap_inode);
+int write_at(const char* filename, uint64_t offset, const char* data) {
+    if (remote_path) return remote_cmd(ASFS_REQ_WRITE, filename, NULL, data, offset);
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    ssize_t rc = asfs_write(fs, filename, data, strlen(data), offset);
+    close_fs(fs);
+    if (report(rc, "Write failed")) return 1;
+    printf("Wrote %zd bytes to '%s' at %llu\n", rc, filename, (unsigned long long)offset);
+    return 0;
 }
 
-/*void restore_snapshot(const char* filename, const char* snap_name) {
-    disk_fd = open(DEVICE_PATH, O_RDWR);
-    load_metadata();
+int truncate_file(const char* filename, uint64_t size) {
+    if (remote_path) return remote_cmd(ASFS_REQ_TRUNCATE, filename, NULL, NULL, size);
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    int rc = asfs_truncate(fs, filename, size);
+    close_fs(fs);
+    if (report(rc, "Truncate failed")) return 1;
+    printf("File '%s' truncated to %llu bytes\n", filename, (unsigned long long)size);
+    return 0;
+}
 
-    // Поиск файла
-    uint32_t inode_num = find_inode(filename);
-    if (inode_num == (uint32_t)-1) {
-        printf("File '%s' not found\n", filename);
-        close(disk_fd);
-        return;
-    }
+int delete_file(const char* filename) {
+    if (remote_path) return remote_cmd(ASFS_REQ_DELETE, filename, NULL, NULL, 0);
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    int rc = asfs_delete(fs, filename);
+    close_fs(fs);
+    if (report(rc, "Delete failed")) return 1;
+    printf("File '%s' deleted\n", filename);
+    return 0;
+}
 
-    // Поиск снапшота
-    Snapshot *target_snap = NULL;
-    for (int i = 0; i < sb.snapshot_count; i++) {
-        if (strcmp(snapshots[i].snapshot_name, snap_name) == 0) {
-            target_snap = &snapshots[i];
-            break;
-        }
-    }
+int create_snapshot(const char* filename, const char* snap_name) {
+    if (remote_path) return remote_cmd(ASFS_REQ_SNAP_CREATE, filename, snap_name, NULL, 0);
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    uint32_t snap_inode;
+    int rc = asfs_snapshot_create(fs, filename, snap_name, &snap_inode);
+    close_fs(fs);
+    if (report(rc, "Snapshot failed")) return 1;
+    printf("Snapshot '%s' created (inode %u)\n", snap_name, snap_inode);
+    return 0;
+}
 
-    if (!target_snap) {
-        printf("Snapshot '%s' not found\n", snap_name);
-        close(disk_fd);
-        return;
-    }
+int restore_snapshot(const char* filename, const char* snap_name) {
+    if (remote_path) return remote_cmd(ASFS_REQ_SNAP_RESTORE, filename, snap_name, NULL, 0);
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    int rc = asfs_snapshot_restore(fs, filename, snap_name);
+    close_fs(fs);
+    if (report(rc, "Restore failed")) return 1;
+    printf("Restored snapshot '%s' for file '%s'\n", snap_name, filename);
+    return 0;
+}
 
-    // Полная замена inode из снапшота
-    Inode restored_inode = target_snap->inode;
+int delete_snapshot(const char* snap_name) {
+    if (remote_path) return remote_cmd(ASFS_REQ_SNAP_DELETE, snap_name, NULL, NULL, 0);
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    int rc = asfs_snapshot_delete(fs, snap_name);
+    close_fs(fs);
+    if (report(rc, "Delete failed")) return 1;
+    printf("Snapshot '%s' deleted successfully\n", snap_name);
+    return 0;
+}
 
-    // Сохраняем оригинальное имя (если не должно меняться)
-    strncpy(restored_inode.name, filename, MAX_NAME_LEN-1);
+// ---- демон и тонкий клиент ----
 
-    // Обновление временных меток
-    restored_inode.modified = time(NULL);
+static volatile sig_atomic_t stop_serving;
 
-    // Освобождаем старые блоки
-    //Inode current_inode;
+static void on_stop(int sig) {
+    stop_serving = 1;
+}
 
-    Inode curr_node;
-	lseek(disk_fd, sizeof(SuperBlock) + inode_num*sizeof(Inode), SEEK_SET);
-	read(disk_fd, &curr_node, sizeof(Inode));
+int serve(const char* path) {
+    asfs_fs* fs = open_fs(ASFS_RDWR);
+    if (!fs) return 1;
+    // Без SA_RESTART: сигнал прерывает poll, и сервер закрывает образ как обычно
+    struct sigaction sa = { .sa_handler = on_stop };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    fprintf(stderr, "Serving %s on %s\n", DEVICE_PATH, path);
+    int rc = asfs_serve(fs, path, &stop_serving);
+    close_fs(fs);
+    return report(rc, "Serve failed");
+}
 
-	curr_node.blocks = target->snapshot_inode; // Просто меняем ссылку
-	lseek(disk_fd, sizeof(SuperBlock) + inode_num*sizeof(Inode), SEEK_SET);
-	write(disk_fd, &curr_node, sizeof(Inode));
+// Ответ демона печатается так же, как результат локальной команды;
+// offset - смещение записи или новый размер, как в запросе
+static int remote_print(int op, const char* name, const char* name2, uint64_t offset,
+                        int32_t res, const uint8_t* data, uint32_t len) {
+    static const char* const failed[ASFS_REQ_MAX] = {
+        [ASFS_REQ_CREATE] = "Create failed", [ASFS_REQ_EDIT] = "Edit failed",
+        [ASFS_REQ_APPEND] = "Append failed", [ASFS_REQ_WRITE] = "Write failed",
+        [ASFS_REQ_TRUNCATE] = "Truncate failed", [ASFS_REQ_DELETE] = "Delete failed",
+        [ASFS_REQ_READ] = "File not found", [ASFS_REQ_LOOKUP] = "File not found",
+        [ASFS_REQ_LIST] = "List failed", [ASFS_REQ_STATFS] = "Statfs failed",
+        [ASFS_REQ_SNAP_CREATE] = "Snapshot failed", [ASFS_REQ_SNAP_RESTORE] = "Restore failed",
+        [ASFS_REQ_SNAP_DELETE] = "Delete failed",
+    };
+    if (res < 0) return report(res, failed[op]);
+    const uint8_t* end = data + len;
+    asfs_stat st;
+    int rc = 0;
+    switch (op) {
+    case ASFS_REQ_CREATE: printf("Created file '%s' in inode %d\n", name, res); break;
+    case ASFS_REQ_EDIT: printf("File '%s' updated\n", name); break;
+    case ASFS_REQ_APPEND: printf("Appended %d bytes to '%s'\n", res, name); break;
+    case ASFS_REQ_WRITE:
+        printf("Wrote %d bytes to '%s' at %llu\n", res, name, (unsigned long long)offset);
+        break;
+    case ASFS_REQ_TRUNCATE:
+        printf("File '%s' truncated to %llu bytes\n", name, (unsigned long long)offset);
+        break;
+    case ASFS_REQ_DELETE: printf("File '%s' deleted\n", name); break;
+    case ASFS_REQ_READ:
+        printf("\nContents of '%s' (%u bytes):\n", name, len);
+        printf("--------------------------------------------------\n");
+        fwrite(data, 1, len, stdout);
+        printf("\n--------------------------------------------------\n");
+        break;
+    case ASFS_REQ_LIST:
+        print_list_header();
+        /* fallthrough */
+    case ASFS_REQ_LOOKUP:
+        while ((rc = asfs_wire_stat_next(&data, end, &st)) > 0) print_entry(&st, NULL);
+        break;
+    case ASFS_REQ_STATFS:
+        if (len != sizeof(asfs_fsinfo)) return report(-EPROTO, failed[op]);
+        asfs_fsinfo info;
+        memcpy(&info, data, sizeof(info));
+        print_info(&info);
+        break;
+    case ASFS_REQ_SNAP_CREATE: printf("Snapshot '%s' created (inode %d)\n", name2, res); break;
+    case ASFS_REQ_SNAP_RESTORE:
+        printf("Restored snapshot '%s' for file '%s'\n", name2, name);
+        break;
+    case ASFS_REQ_SNAP_DELETE: printf("Snapshot '%s' deleted successfully\n", name); break;
+    }
+    return report(rc, failed[op]);
+}
 
-    lseek(disk_fd, sizeof(SuperBlock) + inode_num * sizeof(Inode), SEEK_SET);
-    read(disk_fd, &current_inode, sizeof(Inode));
-    free_blocks(current_inode.blocks,
-               (current_inode.size + sb.block_size - 1) / sb.block_size);
+static int remote_cmd(int op, const char* name, const char* name2, const char* data,
+                      uint64_t offset) {
+    asfs_remote* r;
+    int rc = asfs_remote_connect(remote_path, &r);
+    if (rc < 0) return report(rc, remote_path);
+    int32_t res;
+    const void* reply;
+    uint32_t len;
+    rc = asfs_remote_queue(r, op, name, name2, data, data ? strlen(data) : 0, offset);
+    if (rc == 0) rc = asfs_remote_reply(r, &res, &reply, &len);
+    int failed = rc < 0 ? report(rc, remote_path)
+                        : remote_print(op, name, name2, offset, res, reply, len);
+    asfs_remote_close(r);
+    return failed;
+}
 
-    // Выделяем новые блоки
-    uint32_t blocks_needed = (restored_inode.size + sb.block_size - 1) / sb.block_size;
-    for (int i = 0; i < blocks_needed; i++) {
-        restored_inode.blocks[i] = allocate_block();
-        if (!restored_inode.blocks[i]) {
-            printf("No space to restore\n");
-            free_blocks(restored_inode.blocks, i);
-            close(disk_fd);
-            return;
+typedef struct {
+    int op;
+    char name[ASFS_NAME_MAX];
+    char name2[ASFS_NAME_MAX];
+} Pending;
+
+// Строка вида "create <f> <данные>" в запрос; -EINVAL - не разобрали
+static int queue_line(asfs_remote* r, char* line, Pending* p) {
+    static const struct { const char* cmd; int op; int names; int data; } cmds[] = {
+        { "create", ASFS_REQ_CREATE, 1, 1 }, { "edit", ASFS_REQ_EDIT, 1, 1 },
+        { "append", ASFS_REQ_APPEND, 1, 1 }, { "delete", ASFS_REQ_DELETE, 1, 0 },
+        { "read", ASFS_REQ_READ, 1, 0 }, { "stat", ASFS_REQ_LOOKUP, 1, 0 },
+        { "list", ASFS_REQ_LIST, 0, 0 }, { "df", ASFS_REQ_STATFS, 0, 0 },
+        { "snapshot", ASFS_REQ_SNAP_CREATE, 2, 0 }, { "restore", ASFS_REQ_SNAP_RESTORE, 2, 0 },
+        { "rmsnap", ASFS_REQ_SNAP_DELETE, 1, 0 },
+    };
+    char cmd[16];
+    int pos = 0;
+    line[strcspn(line, "\n")] = '\0';
+    if (sscanf(line, "%15s%n", cmd, &pos) != 1) return -EINVAL;
+    for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        if (strcmp(cmd, cmds[i].cmd) != 0) continue;
+        int n = 0;
+        p->op = cmds[i].op;
+        p->name[0] = p->name2[0] = '\0';
+        if (cmds[i].names >= 1 && sscanf(line + pos, " %223s%n", p->name, &n) != 1)
+            return -EINVAL;
+        pos += n;
+        if (cmds[i].names == 2 && sscanf(line + pos, " %223s%n", p->name2, &n) != 1)
+            return -EINVAL;
+        if (cmds[i].names == 2) pos += n;
+        const char* data = NULL;
+        if (cmds[i].data) {
+            data = line + pos + strspn(line + pos, " ");
+            if (!*data) return -EINVAL;
         }
-
-        // Записываем данные снапшота
-        lseek(disk_fd, restored_inode.blocks[i] * sb.block_size, SEEK_SET);
-        write(disk_fd,
-             target_snap->data + i * sb.block_size,
-             sb.block_size);
+        return asfs_remote_queue(r, p->op, p->name, p->name2, data,
+                                 data ? strlen(data) : 0, 0);
     }
+    return -EINVAL;
+}
 
-    // Записываем обновленный inode
-    lseek(disk_fd, sizeof(SuperBlock) + inode_num * sizeof(Inode), SEEK_SET);
-    write(disk_fd, &restored_inode, sizeof(Inode));
-*/
-    // Обновление битмапов
-  /*  save_metadata();
-    close(disk_fd);
-    printf("Snapshot '%s' fully restored to '%s'\n", snap_name, filename);
-}*/
-void restore_snapshot(const char* filename, const char* snap_name) {
-    disk_fd = open(DEVICE_PATH, O_RDWR);
-    load_metadata();
-
-    // Находим текущий inode файла
-    uint32_t curr_inode = find_inode(filename);
-    if(curr_inode == (uint32_t)-1) {
-        printf("File not found!\n");
-        close(disk_fd);
-        return;
+// -i: команды со stdin идут демону конвейером по PIPELINE_DEPTH запросов,
+// ответы печатаются по порядку
+int remote_pipeline() {
+    asfs_remote* r;
+    int rc = asfs_remote_connect(remote_path, &r);
+    if (rc < 0) return report(rc, remote_path);
+    Pending* pend = malloc(PIPELINE_DEPTH * sizeof(Pending));
+    if (!pend) {
+        asfs_remote_close(r);
+        return report(-ENOMEM, "Pipeline");
     }
-
-    // Находим снапшот
-    Snapshot *target = NULL;
-    for(int i=0; i<sb.snapshot_count; i++) {
-        if(strcmp(snapshots[i].snapshot_name, snap_name) == 0) {
-            target = &snapshots[i];
-            break;
+    char line[4096];
+    unsigned long sent = 0, errors = 0;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int eof = 0;
+    while (!eof && rc == 0) {
+        int n = 0;
+        while (n < PIPELINE_DEPTH && !(eof = !fgets(line, sizeof(line), stdin))) {
+            if (line[strspn(line, " \n")] == '\0') continue;
+            int qrc = queue_line(r, line, &pend[n]);
+            if (qrc < 0) {
+                report(qrc, line);
+                errors++;
+                continue;
+            }
+            n++;
+        }
+        for (int i = 0; i < n && rc == 0; i++) {
+            int32_t res;
+            const void* reply;
+            uint32_t len;
+            rc = asfs_remote_reply(r, &res, &reply, &len);
+            if (rc == 0)
+                errors += remote_print(pend[i].op, pend[i].name, pend[i].name2, 0, res,
+                                       reply, len);
         }
+        sent += n;
     }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%lu requests, %lu failed, %.3f s (%.0f req/s)\n",
+            sent, errors, sec, sec > 0 ? sent / sec : 0);
+    free(pend);
+    asfs_remote_close(r);
+    return report(rc, remote_path) || errors;
+}
 
-    if(!target) {
-        printf("Snapshot not found!\n");
-        close(disk_fd);
-        return;
-    }
+// Адаптер libasfs для набора бенчмарков
+typedef struct {
+    asfs_fs* fs;
+    uint32_t block_size;
+} bench_ctx;
+
+static int bench_reset(void* ctx, uint32_t files, uint64_t file_size) {
+    bench_ctx* b = ctx;
+    asfs_close(b->fs);
+    b->fs = NULL;
+
+    // Образ разреженный, поэтому берём с запасом: inode на каждые 16 блоков,
+    // плюс данные файлов и копии для снапшотов
+    uint64_t per_file = (file_size + b->block_size - 1) / b->block_size;
+    uint64_t blocks = 16ull * (files + 64) + (files + 64) * per_file * 2 + 64;
+    if (blocks > UINT32_MAX) return -EFBIG;
+
+    int fd = open(BENCH_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -errno;
+    int rc = ftruncate(fd, blocks * b->block_size) < 0 ? -errno : 0;
+    close(fd);
+    if (rc == 0) rc = asfs_format(BENCH_PATH, b->block_size, 0);
+    if (rc == 0) rc = asfs_open(BENCH_PATH, ASFS_RDWR | ASFS_PRIVATE, &b->fs);
+    if (rc == 0 && trace_path) rc = asfs_trace_enable(asfs_get_latency(b->fs), 65536);
+    if (rc == 0 && direct) rc = asfs_set_direct(b->fs, 1);
+    if (rc == 0 && background) rc = asfs_set_reclaim(b->fs, 1);
+    return rc;
+}
 
-    // Читаем данные снапшота
-    Inode snap_node;
-    lseek(disk_fd, sizeof(SuperBlock) + target->snapshot_inode*sizeof(Inode), SEEK_SET);
-    read(disk_fd, &snap_node, sizeof(Inode));
+static int bench_create(void* ctx, const char* name, const void* data, size_t size) {
+    return asfs_create(((bench_ctx*)ctx)->fs, name, data, size, NULL);
+}
 
-    // Освобождаем старые блоки файла
-    Inode curr_node;
-    lseek(disk_fd, sizeof(SuperBlock) + curr_inode*sizeof(Inode), SEEK_SET);
-    read(disk_fd, &curr_node, sizeof(Inode));
-    free_blocks(curr_node.blocks, (curr_node.size + sb.block_size - 1)/sb.block_size);
+static int bench_lookup(void* ctx, const char* name) {
+    return asfs_lookup(((bench_ctx*)ctx)->fs, name, NULL);
+}
 
-    // Копируем данные из снапшота
-    curr_node.size = snap_node.size;
-    curr_node.modified = time(0);
-    memcpy(curr_node.blocks, snap_node.blocks, sizeof(curr_node.blocks));
+static ssize_t bench_read(void* ctx, const char* name, void* buf, size_t count, uint64_t off) {
+    return asfs_read(((bench_ctx*)ctx)->fs, name, buf, count, off);
+}
 
-    // Записываем обновленный inode
-    lseek(disk_fd, sizeof(SuperBlock) + curr_inode*sizeof(Inode), SEEK_SET);
-    write(disk_fd, &curr_node, sizeof(Inode));
+static int bench_overwrite(void* ctx, const char* name, const void* data, size_t size) {
+    return asfs_edit(((bench_ctx*)ctx)->fs, name, data, size);
+}
 
-    save_metadata();
-    close(disk_fd);
-    printf("Restored snapshot '%s' for file '%s'\n", snap_name, filename);
+static int bench_remove(void* ctx, const char* name) {
+    return asfs_delete(((bench_ctx*)ctx)->fs, name);
 }
-/*void restore_snapshot(const char* filename, const char* snap_name) {
-    disk_fd = open(DEVICE_PATH, O_RDWR);
-    load_metadata();
-    // Поиск файла
-    uint32_t inode_num = find_inode(filename);
-    if(inode_num == (uint32_t)-1) {
-        printf("File '%s' not found\n", filename);
-        close(disk_fd);
-        return;
-    }
-    // Поиск снапшота по имени
-    Snapshot *target_snap = NULL;
-    for(int i = 0; i < sb.snapshot_count; i++) {
-        if(strcmp(snapshots[i].snapshot_name, snap_name) == 0) {
-            target_snap = &snapshots[i];
-            break;
-        }
-    }
 
-    if(!target_snap) {
-        printf("Snapshot '%s' not found\n", snap_name);
-        close(disk_fd);
-        return;
-    }
-    // Проверка принадлежности снапшота файлу
-    if(target_snap->original_inode != inode_num) {
-        printf("Snapshot '%s' doesn't belong to '%s'\n", snap_name, filename);
-        close(disk_fd);
-        return;
-    }
-    // Чтение текущего inode
-    Inode current;
-    lseek(disk_fd, sizeof(SuperBlock) + inode_num * sizeof(Inode), SEEK_SET);
-    read(disk_fd, &current, sizeof(Inode));
-    // Освобождение старых блоков файла
-    uint32_t old_blocks = (current.size + sb.block_size - 1) / sb.block_size;
-    //free_blocks(current.blocks, old_blocks);
-    // Копирование данных из снапшота*/
-    /*uint32_t new_blocks = (target_snap->inode.size + sb.block_size - 1) / sb.block_size;
-    for(int i = 0; i < new_blocks; i++) {
-        uint32_t new_block = allocate_block();
-        if(!new_block) {
-            printf("No space to restore\n");
-            free_blocks(target_snap->inode.blocks, i);
-            close(disk_fd);
-            return;
-        }
-        // Запись данных снапшота в новые блоки
-        lseek(disk_fd, new_block * sb.block_size, SEEK_SET);
-        write(disk_fd, target_snap->data + i * sb.block_size, sb.block_size);
-
-        current.blocks[i] = new_block;
-    }*/
-    // Обновление метаданных файла
-    /*current.size = target_snap->inode.size;
-    //current.modified = time(NULL);
-    current.snapshot_id = 0; // Сбрасываем привязку
-    lseek(disk_fd, sizeof(SuperBlock) + inode_num * sizeof(Inode), SEEK_SET);
-    write(disk_fd, &current, sizeof(Inode));
-    save_metadata();
-    close(disk_fd);
-    printf("Successfully restored snapshot '%s' to '%s'\n", snap_name, filename);
-}*/
-void free_blocks(uint32_t* blocks, size_t count) {
-    for (size_t i = 0; i < count; i++) {
-        if (blocks[i] == 0) continue;
-        uint32_t byte = blocks[i] / 8;
-        uint8_t bit = 1 << (blocks[i] % 8);
-        if (block_bitmap[byte] & bit) {
-            block_bitmap[byte] &= ~bit;
-            sb.free_blocks++;
-        }
-        blocks[i] = 0; // Важно обнулить!
-    }
+static int bench_snap_create(void* ctx, const char* file, const char* snap) {
+    return asfs_snapshot_create(((bench_ctx*)ctx)->fs, file, snap, NULL);
 }
-uint32_t allocate_block() {
-    for (uint32_t i = sb.first_data_block; i < sb.total_blocks; i++) {
-        uint32_t byte = i / 8;
-        uint8_t bit = 1 << (i % 8);
-        if (!(block_bitmap[byte] & bit)) {
-            block_bitmap[byte] |= bit;
-            sb.free_blocks--;
-            return i;
-        }
-    }
-    printf("[ERROR] No free blocks available!\n");
-    return 0; // Невалидный блок
+
+static int bench_snap_restore(void* ctx, const char* file, const char* snap) {
+    return asfs_snapshot_restore(((bench_ctx*)ctx)->fs, file, snap);
 }
-uint32_t find_inode(const char* filename) {
-    for (uint32_t i = 0; i < sb.inode_count; i++) {
-        if (!(inode_bitmap[i/8] & (1 << (i%8)))) continue;
 
-        Inode node;
-        lseek(disk_fd, sizeof(SuperBlock) + i * sizeof(Inode), SEEK_SET);
-        read(disk_fd, &node, sizeof(Inode));
+static int bench_snap_delete(void* ctx, const char* snap) {
+    return asfs_snapshot_delete(((bench_ctx*)ctx)->fs, snap);
+}
 
-        if (node.used && strcmp(node.name, filename) == 0) {
-            return i;
-        }
-    }
-    return (uint32_t)-1;
-}
-void save_metadata() {
-    lseek(disk_fd, 0, SEEK_SET);
-    if(0 > write(disk_fd, &sb, sizeof(SuperBlock)))
-    {
-    	printf("Error save meta1\n");
-    	return;
-    }
-    if(0 > write(disk_fd, block_bitmap, sb.total_blocks / 8))
-    {
-    	printf("Error save meta2\n");
-    	return;
-    }
-    if(0 > write(disk_fd, inode_bitmap, sb.inode_count / 8))
-    {
-    	printf("Error save meta3\n");
-    	return;
-   }
-	// Сохранение снапшотов в выделенные блоки
-	   uint32_t snap_blocks = (sizeof(Snapshot) * MAX_SNAPSHOTS + sb.block_size - 1) / sb.block_size;
-	   uint32_t start_block = sb.first_data_block + 10; // Резервируем 10 блоков после first_data_block
-
-	   lseek(disk_fd, start_block * sb.block_size, SEEK_SET);
-	   if (write(disk_fd, snapshots, sizeof(Snapshot) * MAX_SNAPSHOTS) == -1) {
-		   perror("Error saving snapshots");
-		   return;
-	   }
-
-
-    if (DEBUG) {
-        printf("[DEBUG] Saved metadata:\n");
-        printf("  Free inodes: %u\n", sb.free_inodes);
-        printf("  Free blocks: %u\n", sb.free_blocks);
-    }
+static int count_entry(const asfs_stat* st, void* arg) {
+    (*(uint64_t*)arg)++;
+    return 0;
 }
-void load_metadata() {
-    lseek(disk_fd, 0, SEEK_SET);
-    read(disk_fd, &sb, sizeof(SuperBlock));
 
-    //free(block_bitmap);
-    //free(inode_bitmap);
+static int bench_list(void* ctx, uint64_t* entries) {
+    return asfs_list(((bench_ctx*)ctx)->fs, count_entry, entries);
+}
 
-    block_bitmap = malloc(sb.total_blocks/8);
-    inode_bitmap = malloc(sb.inode_count/8);
+static ssize_t bench_append(void* ctx, const char* name, const void* data, size_t size) {
+    return asfs_append(((bench_ctx*)ctx)->fs, name, data, size);
+}
 
-    read(disk_fd, block_bitmap, sb.total_blocks/8);
-    read(disk_fd, inode_bitmap, sb.inode_count/8);
+static ssize_t bench_write(void* ctx, const char* name, const void* data, size_t size,
+                           uint64_t offset) {
+    return asfs_write(((bench_ctx*)ctx)->fs, name, data, size, offset);
+}
 
-    // Загрузка снапшотов из специальных блоков
-    uint32_t snap_blocks = (sizeof(Snapshot) * MAX_SNAPSHOTS) / sb.block_size + 1;
-    uint32_t start_block = sb.first_data_block + 10;
+static int bench_truncate(void* ctx, const char* name, uint64_t size) {
+    return asfs_truncate(((bench_ctx*)ctx)->fs, name, size);
+}
 
-    lseek(disk_fd, start_block * sb.block_size, SEEK_SET);
-    read(disk_fd, snapshots, sizeof(Snapshot) * MAX_SNAPSHOTS);
+static bench_ops bench_table(bench_ctx* ctx) {
+    return (bench_ops){
+        .engine = "asfs",
+        .ctx = ctx,
+        .reset = bench_reset,
+        .create = bench_create,
+        .lookup = bench_lookup,
+        .read = bench_read,
+        .overwrite = bench_overwrite,
+        .remove = bench_remove,
+        .snapshot_create = bench_snap_create,
+        .snapshot_restore = bench_snap_restore,
+        .snapshot_delete = bench_snap_delete,
+        .list = bench_list,
+        .append = bench_append,
+        .write = bench_write,
+        .truncate = bench_truncate,
+    };
 }
-void print_file_content(const char* filename) {
-    disk_fd = open(DEVICE_PATH, O_RDONLY);
-    load_metadata();
-    uint32_t inode_num = find_inode(filename);
-    if(inode_num == (uint32_t)-1) {
-        printf("File not found\n");
-        close(disk_fd);
-        return;
-    }
-    Inode node;
-    lseek(disk_fd, sizeof(SuperBlock) + inode_num * sizeof(Inode), SEEK_SET);
-    read(disk_fd, &node, sizeof(Inode));
-    /*if(node.size == 0) {
-	printf("<EMPTY FILE>\n");
-	close(disk_fd);
-        return;
-    }
-*/
-    printf("\nContents of '%s' (%u bytes):\n", filename, node.size);
-    printf("--------------------------------------------------\n");
-    uint32_t blocks_needed = (node.size + sb.block_size - 1) / sb.block_size;
-    char* buffer = malloc(sb.block_size);
-    for(int i = 0; i < blocks_needed; i++) {
-        lseek(disk_fd, node.blocks[i] * sb.block_size, SEEK_SET);
-        read(disk_fd, buffer, sb.block_size);
-
-        size_t bytes_to_print = (i == blocks_needed-1)
-                              ? node.size % sb.block_size
-                              : sb.block_size;
-        if(bytes_to_print == 0) bytes_to_print = sb.block_size;
-
-        fwrite(buffer, 1, bytes_to_print, stdout);
-    }
-    free(buffer);
-    printf("\n--------------------------------------------------\n");
-    close(disk_fd);
+
+int run_benchmark(bench_config* cfg, uint32_t block_size) {
+    bench_ctx ctx = { .fs = NULL, .block_size = block_size };
+    bench_ops ops = bench_table(&ctx);
+    int rc = bench_run(&ops, cfg);
+    if (ctx.fs) dump_latency(asfs_get_latency(ctx.fs));
+    asfs_close(ctx.fs);
+    unlink(BENCH_PATH);
+    if (rc < 0) fprintf(stderr, "Benchmark failed: %s\n", asfs_strerror(rc));
+    return rc < 0;
 }
-void list_snapshots() {
-    disk_fd = open(DEVICE_PATH, O_RDONLY);
-    load_metadata();
-    printf("\n%-20s %-20s %-30s %-10s %s\n",
-           "Snapshot Name", "File", "Timestamp", "Size", "Inode");
-    printf("----------------------------------------------------------------------------------------\n");
 
-    if (sb.snapshot_count == 0) {
-        printf("No snapshots available\n");
-        return;
-    }
-    for (int i = 0; i < sb.snapshot_count; i++) {
-        char time_buf[30];
-        struct tm *tm_info = localtime(&snapshots[i].timestamp);
-        strftime(time_buf, 30, "%Y-%m-%d %H:%M:%S", tm_info);
-
-        printf("%-20s %-20s %-30s %-10u %u\n",
-               snapshots[i].snapshot_name,
-               snapshots[i].inode.name,
-               time_buf,
-               snapshots[i].inode.size,
-               snapshots[i].original_inode);
+// Воспроизведение записанной нагрузки на свежем BENCH_PATH
+int replay_workload(const char* path, const workload_config* cfg, uint32_t block_size) {
+    bench_ctx ctx = { .fs = NULL, .block_size = block_size };
+    bench_ops ops = bench_table(&ctx);
+    int rc = workload_replay(&ops, path, cfg);
+    if (ctx.fs) {
+        if (show_stats) {
+            asfs_stats st;
+            asfs_get_stats(ctx.fs, &st);
+            asfs_stats_json(&st, stderr);
+        }
+        dump_latency(asfs_get_latency(ctx.fs));
     }
-    close(disk_fd);
+    asfs_close(ctx.fs);
+    unlink(BENCH_PATH);
+    if (rc < 0) fprintf(stderr, "Replay %s: %s\n", path, asfs_strerror(rc));
+    return rc < 0;
 }
+
 int main(int argc, char *argv[]) {
     int opt;
     int zero_fill = 0;
+    int repair = 0, threads = 0;
+    const char* prefix = NULL;
+    const char* cursor = NULL;
+    uint32_t limit = 0;
     uint32_t block_size = 4096;
     char *filename = NULL, *data = NULL, *snap_name = NULL;
-    while ((opt = getopt(argc, argv, "0b:f:lc:s:r:e:d:phq:wx:")) != -1) {
+    bench_config bench;
+    bench_default_config(&bench);
+    double speed = 0;
+    int benchmark = 0;
+    while ((opt = getopt(argc, argv, "0b:flmc:s:r:e:d:phq:wx:Bn:z:o:W:SHT:D:yj:FI:P:X:uRta:O:K:G:L:N:C:M:U:E:Y:JV:gA:k:iQ:Z:v:")) != -1) {
         switch (opt) {
             case 'b': block_size = atoi(optarg); break;
-            case 'f': {
-            	case '0': {format_disk(0, block_size); return 0;}
-            	case '1': {format_disk(1, block_size); return 0;}
+            case 'n': bench.nfiles = bench_parse_list(optarg, bench.files, BENCH_MAX_PARAMS);
+                     if (bench.nfiles < 0) goto usage;
+                     break;
+            case 'z': bench.nsizes = bench_parse_list(optarg, bench.sizes, BENCH_MAX_PARAMS);
+                     if (bench.nsizes < 0) goto usage;
+                     break;
+            case 'o': bench.format = bench_parse_format(optarg);
+                     if (bench.format < 0) goto usage;
+                     break;
+            case 'W': bench.workloads = optarg; break;
+            case 'S': show_stats = 1; break;
+            case 'H': show_hist = 1; break;
+            case 'T': trace_path = optarg; break;
+            case 'Q': capture_path = optarg; break;
+            case 'v': speed = strtod(optarg, NULL);
+                     if (speed < 0) goto usage;
+                     break;
+            case 'Z': {
+                workload_config wc = { .threads = threads, .speed = speed,
+                                       .format = bench.format, .out = stdout };
+                return replay_workload(optarg, &wc, block_size);
             }
-            case 'l': list_files(); return 0;
-            case 'w': list_snapshots(); return 0;
+            case 'D': return decode_trace(optarg);
+            case 'y': repair = 1; break;
+            case 'j': threads = atoi(optarg); break;
+            case 'F': return check_fs(repair, threads);
+            case 'u': discard = 1; break;
+            case 'R': direct = 1; break;
+            case 'g': background = 1; break;
+            case 'M': if (parse_members(optarg) < 0) goto usage;
+                     break;
+            case 'U': if (bench_parse_list(optarg, &stripe_unit, 1) != 1 ||
+                          stripe_unit > UINT32_MAX) goto usage;
+                     break;
+            case 't': return trim_fs();
+            case 'G': return resize_fs(optarg);
+            case 'I': return import_dir(optarg);
+            case 'P': prefix = optarg; break;
+            case 'X': return export_tar(optarg, prefix);
+            // Бенчмарк - после разбора всех опций: -n/-z/-o/-W/-b/-g могут идти и после -B
+            case 'B': benchmark = 1; break;
+            case '0': zero_fill = 1; break;
+            case 'f': return format_disk(zero_fill, block_size);
+            case 'l': return list_files();
+            case 'N': limit = strtoul(optarg, NULL, 0); break;
+            case 'C': cursor = optarg; break;
+            case 'L': return list_prefix(optarg, cursor, limit);
+            case 'm': return build_index();
+            case 'w': return list_snapshots();
             case 'c': filename = optarg; data = argv[optind++];
-                     create_file(filename, data); return 0;
+                     if (!data) goto usage;
+                     return create_file(filename, data);
             case 's': filename = optarg; snap_name = argv[optind++];
-                     create_snapshot(filename, snap_name); return 0;
+                     if (!snap_name) goto usage;
+                     return create_snapshot(filename, snap_name);
             case 'r': filename = optarg; snap_name = argv[optind++];
-                     restore_snapshot(filename, snap_name); return 0;
+                     if (!snap_name) goto usage;
+                     return restore_snapshot(filename, snap_name);
             case 'e': filename = optarg; data = argv[optind++];
-                     edit_file(filename, data); return 0;
-            case 'd': delete_file(optarg); return 0;
-            case 'p': print_fs_info(); return 0;
-            case 'q': print_file_content(optarg); return 0;
-            case 'x': delete_snapshot(optarg); return 0;
+                     if (!data) goto usage;
+                     return edit_file(filename, data);
+            case 'a': filename = optarg; data = argv[optind++];
+                     if (!data) goto usage;
+                     return append_file(filename, data);
+            case 'O': filename = optarg;
+                     if (optind + 1 >= argc) goto usage;
+                     data = argv[optind + 1];
+                     return write_at(filename, strtoull(argv[optind], NULL, 0), data);
+            case 'K': filename = optarg;
+                     if (optind >= argc) goto usage;
+                     return truncate_file(filename, strtoull(argv[optind], NULL, 0));
+            case 'd': return delete_file(optarg);
+            case 'p': return print_fs_info();
+            case 'q': return print_file_content(optarg);
+            case 'x': return delete_snapshot(optarg);
+            case 'E': return create_epoch(optarg);
+            case 'Y': return delete_epoch(optarg);
+            case 'J': return list_epochs();
+            case 'V': view = optarg; break;
+            case 'A': return serve(optarg);
+            case 'k': remote_path = optarg; break;
+            case 'i': if (!remote_path) goto usage;
+                     return remote_pipeline();
             case 'h':
             default:
-                printf("Usage: %s [options]\n"
-                       "  -b <size>    Set block size (default 4096)\n"
-                       "  -0           Zero fill device on format\n"
-                       "  -f           Format device\n"
-                       "  -c <f> <d>   Create file\n"
-                       "  -l           List files\n"
-                       "  -w           List snapshots\n"
-                       "  -q <f>       Cat file\n"
-                       "  -s <f> <n>   Create snapshot\n"
-                       "  -r <f> <n>   Restore snapshot\n"
-                       "  -e <f> <d>   Edit file\n"
-                       "  -d <f>       Delete file\n"
-                	   "  -x <f>       Delete snapshot\n"
-                       "  -p           Print FS info\n",
-                       argv[0]);
-                return 0;
+                goto usage;
         }
     }
+    if (benchmark) return run_benchmark(&bench, block_size);
+    return 0;
+usage:
+    printf("Usage: %s [options]\n"
+           "  -b <size>    Set block size (default 4096)\n"
+           "  -0           Zero fill device on format\n"
+           "  -f           Format device\n"
+           "  -M <img,..>  Stripe over these images too (up to 7, put before -f)\n"
+           "  -U <size>    Stripe unit for -M, K/M suffixes (default 64K)\n"
+           "  -c <f> <d>   Create file\n"
+           "  -l           List files\n"
+           "  -L <prefix>  List names starting with prefix in name order ('' for all)\n"
+           "  -N <n>       Page size for -L (put before -L)\n"
+           "  -C <name>    Start -L after this name (cursor of the previous page)\n"
+           "  -m           Build the name index for -L (images formatted without one)\n"
+           "  -w           List snapshots\n"
+           "  -q <f>       Cat file\n"
+           "  -s <f> <n>   Create snapshot\n"
+           "  -r <f> <n>   Restore snapshot\n"
+           "  -e <f> <d>   Edit file\n"
+           "  -a <f> <d>   Append to file\n"
+           "  -O <f> <o> <d> Write data at offset\n"
+           "  -K <f> <n>   Truncate (or zero-extend) file to n bytes\n"
+           "  -d <f>       Delete file\n"
+           "  -x <f>       Delete snapshot\n"
+           "  -E <name>    Snapshot the whole FS (O(1), copy-on-write afterwards)\n"
+           "  -Y <name>    Delete a FS snapshot and reclaim what only it kept\n"
+           "  -J           List FS snapshots\n"
+           "  -V <name>    Make -l, -q and -X show a FS snapshot (put before them)\n"
+           "  -p           Print FS info\n"
+           "  -I <dir>     Import a host directory tree (names are relative paths)\n"
+           "  -X <file>    Export files as a ustar archive ('-' for stdout)\n"
+           "  -P <prefix>  Export only names starting with prefix (put before -X)\n"
+           "  -F           Check FS: rebuild bitmaps and counters from reachability\n"
+           "  -y           Repair what -F finds (put before -F)\n"
+           "  -j <n>       fsck threads (default: number of CPUs), replay threads (default 1)\n"
+           "  -u           Punch holes for freed blocks (before -d, -x, -e, -r)\n"
+           "  -t           Trim: punch holes for all free blocks\n"
+           "  -R           O_DIRECT I/O bypassing the page cache (before the command)\n"
+           "  -g           Free deleted files in a background thread (before -d, -x, -Y, -B)\n"
+           "  -A <sock>    Serve the image on a UNIX socket until SIGINT/SIGTERM\n"
+           "  -k <sock>    Send the command to the -A daemon instead (before -c, -e, -a,\n"
+           "               -O, -K, -d, -q, -l, -p, -s, -r, -x)\n"
+           "  -i           With -k: pipeline commands from stdin (create/edit/append <f> <d>,\n"
+           "               delete/read/stat <f>, list, df, snapshot/restore <f> <n>, rmsnap <n>)\n"
+           "  -G <size>    Grow the image to size (K/M/G suffixes)\n"
+           "  -S           Print engine counters as JSON to stderr (before the command)\n"
+           "  -H           Print latency histograms as JSON to stderr (before the command)\n"
+           "  -T <file>    Record an operation trace and dump it to file\n"
+           "  -D <file>    Decode a trace or a workload capture\n"
+           "  -Q <file>    Append every operation to a workload capture (before the command,\n"
+           "               also with -A)\n"
+           "  -Z <file>    Replay a workload capture on a scratch " BENCH_PATH " (-b, -j, -v, -o\n"
+           "               before it)\n"
+           "  -v <x>       Replay speed: 0 - as fast as possible (default), 1 - as captured,\n"
+           "               2 - twice as fast\n"
+           "  -B           Run benchmark suite on a scratch " BENCH_PATH " (after all\n"
+           "               options, so -n, -z, -o, -W may come on either side)\n"
+           "  -n <n,..>    Benchmark file counts (default 1000)\n"
+           "  -z <s,..>    Benchmark file sizes, K/M suffixes (default 256)\n"
+           "  -o <fmt>     Benchmark output: text, csv, json\n"
+           "  -W <w,..>    Benchmark workloads: lookup,seqread,randread,\n"
+           "               overwrite,snapshot,list,delete (create always runs)\n",
+           argv[0]);
     return 0;
 }
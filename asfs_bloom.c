@@ -0,0 +1,55 @@
+#include <stdlib.h>
+#include <errno.h>
+#include "asfs_bloom.h"
+
+// FNV-1a с перемешиванием; k позиций - двойным хэшированием h1 + i*h2
+static uint64_t bloom_hash(const char* s) {
+    uint64_t h = 14695981039346656037ull;
+    while (*s) h = (h ^ (uint8_t)*s++) * 1099511628211ull;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+uint32_t asfs_bloom_bits_for(uint64_t expected) {
+    uint32_t log2 = ASFS_BLOOM_MIN_LOG2;
+    while (log2 < ASFS_BLOOM_MAX_LOG2 && (1ull << log2) < expected * 10) log2++;
+    return log2;
+}
+
+int asfs_bloom_init(asfs_bloom* b, uint32_t bits_log2) {
+    if (bits_log2 < ASFS_BLOOM_MIN_LOG2 || bits_log2 > ASFS_BLOOM_MAX_LOG2) return -EINVAL;
+    b->bits = calloc(1, (size_t)1 << (bits_log2 - 3));
+    b->bits_log2 = bits_log2;
+    return b->bits ? 0 : -ENOMEM;
+}
+
+size_t asfs_bloom_bytes(const asfs_bloom* b) {
+    return b->bits ? (size_t)1 << (b->bits_log2 - 3) : 0;
+}
+
+void asfs_bloom_add(asfs_bloom* b, const char* name) {
+    uint64_t h = bloom_hash(name), mask = (1ull << b->bits_log2) - 1;
+    uint64_t h1 = h, h2 = (h >> 32 | h << 32) | 1;
+    for (int i = 0; i < ASFS_BLOOM_K; i++) {
+        uint64_t bit = (h1 + i * h2) & mask;
+        b->bits[bit / 64] |= 1ull << (bit % 64);
+    }
+}
+
+int asfs_bloom_maybe(const asfs_bloom* b, const char* name) {
+    uint64_t h = bloom_hash(name), mask = (1ull << b->bits_log2) - 1;
+    uint64_t h1 = h, h2 = (h >> 32 | h << 32) | 1;
+    for (int i = 0; i < ASFS_BLOOM_K; i++) {
+        uint64_t bit = (h1 + i * h2) & mask;
+        if (!(b->bits[bit / 64] & (1ull << (bit % 64)))) return 0;
+    }
+    return 1;
+}
+
+void asfs_bloom_free(asfs_bloom* b) {
+    free(b->bits);
+    b->bits = NULL;
+    b->bits_log2 = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef ASFS_BLOOM_H
+#define ASFS_BLOOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Фильтр Блума по именам файлов, общий для обоих движков: "точно нет" без
+// чтения таблицы inode, "может быть" - идём в настоящий поиск.
+// Удалять из него нельзя: после удалений растёт только доля ложных "может быть"
+typedef struct {
+    uint64_t* bits;        // NULL - фильтра нет
+    uint32_t bits_log2;
+} asfs_bloom;
+
+#define ASFS_BLOOM_K 7          // хэшей на имя
+#define ASFS_BLOOM_MIN_LOG2 15  // не меньше 4 КБ
+#define ASFS_BLOOM_MAX_LOG2 32
+
+// Размер под expected имён: ~10 бит на имя, около 1% ложных срабатываний
+uint32_t asfs_bloom_bits_for(uint64_t expected);
+int asfs_bloom_init(asfs_bloom* b, uint32_t bits_log2);
+size_t asfs_bloom_bytes(const asfs_bloom* b);
+void asfs_bloom_add(asfs_bloom* b, const char* name);
+int asfs_bloom_maybe(const asfs_bloom* b, const char* name);
+void asfs_bloom_free(asfs_bloom* b);
+
+#endif
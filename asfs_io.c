@@ -0,0 +1,818 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include "asfs_io.h"
+
+#define ZERO_CHUNK (1 << 20)
+#define DIO_BUF (1 << 20)     // буфер пула O_DIRECT
+#define DIO_BUFS 4            // столько запросов одновременно (потоки fsck)
+
+struct asfs_dio_pool {
+    uint8_t* base;
+    size_t size;
+    uint32_t free_mask;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+// Пул на явных hugepage, если они зарезервированы, иначе на прозрачных
+static asfs_dio_pool* dio_pool_create(void) {
+    asfs_dio_pool* pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pool->size = (size_t)DIO_BUF * DIO_BUFS;
+    pool->base = mmap(NULL, pool->size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pool->base == MAP_FAILED) {
+        pool->base = mmap(NULL, pool->size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pool->base == MAP_FAILED) {
+            free(pool);
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(pool->base, pool->size, MADV_HUGEPAGE);
+#endif
+    }
+    pool->free_mask = (1u << DIO_BUFS) - 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    return pool;
+}
+
+static void dio_pool_free(asfs_dio_pool* pool) {
+    if (!pool) return;
+    munmap(pool->base, pool->size);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    free(pool);
+}
+
+static uint8_t* dio_get(asfs_dio_pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->free_mask) pthread_cond_wait(&pool->cond, &pool->lock);
+    int i = __builtin_ctz(pool->free_mask);
+    pool->free_mask &= ~(1u << i);
+    pthread_mutex_unlock(&pool->lock);
+    return pool->base + (size_t)i * DIO_BUF;
+}
+
+static void dio_put(asfs_dio_pool* pool, uint8_t* buf) {
+    pthread_mutex_lock(&pool->lock);
+    pool->free_mask |= 1u << ((buf - pool->base) / DIO_BUF);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Логический блок: BLKSSZGET для устройства, для файла - требование ФС
+// к O_DIRECT (statx), а если ядро его не сообщает - st_blksize
+static uint32_t logical_block(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return 0;
+#ifdef BLKSSZGET
+    int ssz;
+    if (S_ISBLK(st.st_mode)) return ioctl(fd, BLKSSZGET, &ssz) < 0 ? 0 : (uint32_t)ssz;
+#endif
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+        (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align)
+        return stx.stx_dio_offset_align > 512 ? stx.stx_dio_offset_align : 512;
+#endif
+    return st.st_blksize > 512 ? st.st_blksize : 512;
+}
+
+// Задание одному образу набора. Части запроса, попавшие в один образ, лежат
+// в нём подряд, поэтому на образ уходит один preadv/pwritev
+enum { JOB_READ, JOB_WRITE, JOB_SYNC };
+
+typedef struct stripe_job {
+    struct stripe_job* next;
+    asfs_dev* dev;
+    int op;
+    int fd;
+    struct iovec* iov;
+    int iovcnt;
+    uint64_t pos;
+    int rc;
+    int* pending;
+} stripe_job;
+
+struct asfs_stripe {
+    uint32_t count;
+    uint32_t unit;
+    int fds[ASFS_STRIPE_MAX];    // fds[0] - это dev->fd
+    pthread_t workers[ASFS_STRIPE_MAX];
+    int nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    stripe_job* head;
+    stripe_job* tail;
+    int stop;
+};
+
+// Образы устройства: набор или единственный fd
+static int dev_fds(asfs_dev* dev, const int** fds) {
+    if (dev->stripe) {
+        *fds = dev->stripe->fds;
+        return dev->stripe->count;
+    }
+    *fds = &dev->fd;
+    return 1;
+}
+
+int asfs_dev_open(asfs_dev* dev, const char* path, int flags) {
+    dev->stats = NULL;
+    dev->lat = NULL;
+    dev->align = 0;
+    dev->pool = NULL;
+    dev->stripe = NULL;
+    dev->fd = open(path, flags, 0644);
+    if (dev->fd < 0) return -errno;
+    return 0;
+}
+
+static void stripe_free(asfs_stripe* st) {
+    if (!st) return;
+    pthread_mutex_lock(&st->lock);
+    st->stop = 1;
+    pthread_cond_broadcast(&st->work);
+    pthread_mutex_unlock(&st->lock);
+    for (int i = 0; i < st->nworkers; i++) pthread_join(st->workers[i], NULL);
+    for (uint32_t i = 1; i < st->count; i++)
+        if (st->fds[i] >= 0) close(st->fds[i]);
+    pthread_mutex_destroy(&st->lock);
+    pthread_cond_destroy(&st->work);
+    pthread_cond_destroy(&st->done);
+    free(st);
+}
+
+void asfs_dev_close(asfs_dev* dev) {
+    stripe_free(dev->stripe);
+    dev->stripe = NULL;
+    if (dev->fd >= 0) close(dev->fd);
+    dev->fd = -1;
+    dio_pool_free(dev->pool);
+    dev->pool = NULL;
+    dev->align = 0;
+}
+
+int asfs_dev_set_direct(asfs_dev* dev, int on, uint32_t block_size) {
+    const int* fds;
+    int n = dev_fds(dev, &fds);
+    if (!on) {
+        for (int i = 0; i < n; i++) {
+            int fl = fcntl(fds[i], F_GETFL);
+            if (fl < 0 || fcntl(fds[i], F_SETFL, fl & ~O_DIRECT) < 0) return -errno;
+        }
+        dio_pool_free(dev->pool);
+        dev->pool = NULL;
+        dev->align = 0;
+        return 0;
+    }
+    if (dev->pool) return 0;
+    uint32_t align = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t a = logical_block(fds[i]);
+        if (a == 0) return -EINVAL;
+        if (a > align) align = a;
+    }
+    if (align > DIO_BUF || (align & (align - 1)) || block_size % align) return -EINVAL;
+    for (int i = 0; i < n; i++) {
+        // ФС без поддержки O_DIRECT (tmpfs и т.п.) отвечает здесь EINVAL
+        int fl = fcntl(fds[i], F_GETFL);
+        if (fl < 0 || fcntl(fds[i], F_SETFL, fl | O_DIRECT) < 0) {
+            int rc = -errno;
+            while (i-- > 0) fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) & ~O_DIRECT);
+            return rc;
+        }
+    }
+    dev->pool = dio_pool_create();
+    if (!dev->pool) {
+        for (int i = 0; i < n; i++) fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) & ~O_DIRECT);
+        return -ENOMEM;
+    }
+    dev->align = align;
+    return 0;
+}
+
+static int fd_read(asfs_dev* dev, int fd, void* buf, size_t len, uint64_t off) {
+    uint8_t* p = buf;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, off);
+        STAT_INC(dev->stats, io.read_calls);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            STAT_INC(dev->stats, io.errors);
+            return -errno;
+        }
+        STAT_ADD(dev->stats, io.bytes_read, n);
+        // Конец образа - дальше "дырка". С O_DIRECT короткое чтение - тоже конец:
+        // следующий pread с невыровненного места вернул бы EINVAL
+        if (n == 0 || (dev->align && (size_t)n < len)) {
+            memset(p + n, 0, len - n);
+            return 0;
+        }
+        p += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+static int fd_write(asfs_dev* dev, int fd, const void* buf, size_t len, uint64_t off) {
+    const uint8_t* p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        STAT_INC(dev->stats, io.write_calls);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            STAT_INC(dev->stats, io.errors);
+            return -errno;
+        }
+        if (n == 0) return -EIO;
+        STAT_ADD(dev->stats, io.bytes_written, n);
+        p += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+// Вектор целиком; короткое чтение - конец образа, остаток зануляется
+static int fd_rwv(asfs_dev* dev, int fd, int write, struct iovec* iov, int cnt, uint64_t off) {
+    while (cnt > 0) {
+        int c = cnt < IOV_MAX ? cnt : IOV_MAX;
+        size_t want = 0;
+        for (int i = 0; i < c; i++) want += iov[i].iov_len;
+        ssize_t n = write ? pwritev(fd, iov, c, off) : preadv(fd, iov, c, off);
+        if (write) STAT_INC(dev->stats, io.write_calls);
+        else STAT_INC(dev->stats, io.read_calls);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            STAT_INC(dev->stats, io.errors);
+            return -errno;
+        }
+        if (write && n == 0) return -EIO;
+        if (write) STAT_ADD(dev->stats, io.bytes_written, n);
+        else STAT_ADD(dev->stats, io.bytes_read, n);
+        if (!write && (size_t)n < want && (n == 0 || dev->align)) {
+            for (; cnt > 0; iov++, cnt--) {
+                size_t k = (size_t)n < iov->iov_len ? (size_t)n : iov->iov_len;
+                memset((uint8_t*)iov->iov_base + k, 0, iov->iov_len - k);
+                n -= k;
+            }
+            return 0;
+        }
+        off += n;
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int job_run(stripe_job* j) {
+    if (j->op == JOB_SYNC) return fsync(j->fd) < 0 ? -errno : 0;
+    return fd_rwv(j->dev, j->fd, j->op == JOB_WRITE, j->iov, j->iovcnt, j->pos);
+}
+
+static void* stripe_worker(void* arg) {
+    asfs_stripe* st = arg;
+    pthread_mutex_lock(&st->lock);
+    for (;;) {
+        while (!st->head && !st->stop) pthread_cond_wait(&st->work, &st->lock);
+        stripe_job* j = st->head;
+        if (!j) break;
+        st->head = j->next;
+        pthread_mutex_unlock(&st->lock);
+        j->rc = job_run(j);
+        pthread_mutex_lock(&st->lock);
+        (*j->pending)--;
+        pthread_cond_broadcast(&st->done);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return NULL;
+}
+
+// Первое задание выполняет сам вызывающий, остальные - потоки набора
+static int stripe_run(asfs_stripe* st, stripe_job* jobs, int n) {
+    int pending = n - 1;
+    pthread_mutex_lock(&st->lock);
+    for (int i = 1; i < n; i++) {
+        jobs[i].next = NULL;
+        jobs[i].pending = &pending;
+        if (st->head) st->tail->next = &jobs[i];
+        else st->head = &jobs[i];
+        st->tail = &jobs[i];
+    }
+    pthread_cond_broadcast(&st->work);
+    pthread_mutex_unlock(&st->lock);
+
+    jobs[0].rc = job_run(&jobs[0]);
+
+    pthread_mutex_lock(&st->lock);
+    while (pending) pthread_cond_wait(&st->done, &st->lock);
+    pthread_mutex_unlock(&st->lock);
+    for (int i = 0; i < n; i++)
+        if (jobs[i].rc < 0) return jobs[i].rc;
+    return 0;
+}
+
+// Часть [off, off + len), попавшая в образ m: в нём она непрерывна
+static int stripe_span(asfs_stripe* st, uint32_t m, uint64_t off, uint64_t len,
+                       uint64_t* moff, uint64_t* mlen) {
+    uint64_t unit = st->unit, n = st->count;
+    uint64_t s0 = off / unit, s1 = (off + len - 1) / unit;
+    uint64_t first = s0 + (m + n - s0 % n) % n;
+    if (first > s1) return 0;
+    uint64_t last = s1 - (s1 % n + n - m) % n;
+    *moff = first / n * unit + (first == s0 ? off % unit : 0);
+    *mlen = last / n * unit + (last == s1 ? (off + len - 1) % unit + 1 : unit) - *moff;
+    return 1;
+}
+
+static int stripe_rw(asfs_dev* dev, int write, void* buf, size_t len, uint64_t off) {
+    asfs_stripe* st = dev->stripe;
+    uint64_t unit = st->unit, n = st->count;
+    uint64_t s0 = off / unit, s1 = (off + len - 1) / unit;
+    if (s0 == s1) {
+        int fd = st->fds[s0 % n];
+        uint64_t pos = s0 / n * unit + off % unit;
+        return write ? fd_write(dev, fd, buf, len, pos) : fd_read(dev, fd, buf, len, pos);
+    }
+
+    size_t pieces = s1 - s0 + 1;
+    struct iovec small[64];
+    struct iovec* iov = pieces <= 64 ? small : malloc(pieces * sizeof(struct iovec));
+    if (!iov) return -ENOMEM;
+    stripe_job jobs[ASFS_STRIPE_MAX];
+    int njobs = 0;
+    size_t used = 0;
+    for (uint32_t m = 0; m < n; m++) {
+        uint64_t first = s0 + (m + n - s0 % n) % n;
+        if (first > s1) continue;
+        stripe_job* j = &jobs[njobs++];
+        j->dev = dev;
+        j->op = write ? JOB_WRITE : JOB_READ;
+        j->fd = st->fds[m];
+        j->iov = iov + used;
+        j->iovcnt = 0;
+        j->pos = first / n * unit + (first == s0 ? off % unit : 0);
+        for (uint64_t s = first; s <= s1; s += n) {
+            uint64_t a = s == s0 ? off : s * unit;
+            uint64_t b = s == s1 ? off + len : (s + 1) * unit;
+            iov[used].iov_base = (uint8_t*)buf + (a - off);
+            iov[used].iov_len = b - a;
+            used++;
+            j->iovcnt++;
+        }
+    }
+    int rc = stripe_run(st, jobs, njobs);
+    if (iov != small) free(iov);
+    return rc;
+}
+
+static int dev_read(asfs_dev* dev, void* buf, size_t len, uint64_t off) {
+    if (dev->stripe && len) return stripe_rw(dev, 0, buf, len, off);
+    return fd_read(dev, dev->fd, buf, len, off);
+}
+
+static int dev_write(asfs_dev* dev, const void* buf, size_t len, uint64_t off) {
+    if (dev->stripe && len) return stripe_rw(dev, 1, (void*)buf, len, off);
+    return fd_write(dev, dev->fd, buf, len, off);
+}
+
+// Для каждого образа - его часть диапазона; первая ошибка возвращается
+typedef int (*range_fn)(asfs_dev* dev, int fd, uint64_t off, uint64_t len);
+
+static int dev_ranges(asfs_dev* dev, uint64_t off, uint64_t len, range_fn fn) {
+    if (!dev->stripe) return fn(dev, dev->fd, off, len);
+    int rc = 0;
+    uint64_t moff, mlen;
+    for (uint32_t m = 0; m < dev->stripe->count; m++) {
+        if (!stripe_span(dev->stripe, m, off, len, &moff, &mlen)) continue;
+        int r = fn(dev, dev->stripe->fds[m], moff, mlen);
+        if (r < 0 && rc == 0) rc = r;
+    }
+    return rc;
+}
+
+static int dio_aligned(asfs_dev* dev, const void* buf, size_t len, uint64_t off) {
+    uint64_t mask = dev->align - 1;
+    return !(((uintptr_t)buf | len | off) & mask);
+}
+
+// Через буфер пула: диапазон расширяется до границ логических блоков
+static int dio_read(asfs_dev* dev, void* buf, size_t len, uint64_t off) {
+    if (dio_aligned(dev, buf, len, off)) return dev_read(dev, buf, len, off);
+    uint8_t* p = buf;
+    uint8_t* bounce = dio_get(dev->pool);
+    uint64_t a = dev->align;
+    int rc = 0;
+    while (len > 0 && rc == 0) {
+        uint64_t start = off & ~(a - 1);
+        size_t head = off - start;
+        size_t n = len < DIO_BUF - head ? len : DIO_BUF - head;
+        size_t span = (head + n + a - 1) & ~(a - 1);
+        rc = dev_read(dev, bounce, span, start);
+        if (rc == 0) memcpy(p, bounce + head, n);
+        p += n;
+        off += n;
+        len -= n;
+    }
+    dio_put(dev->pool, bounce);
+    return rc;
+}
+
+// Неполные крайние блоки сначала дочитываются (чтение-изменение-запись)
+static int dio_write(asfs_dev* dev, const void* buf, size_t len, uint64_t off) {
+    if (dio_aligned(dev, buf, len, off)) return dev_write(dev, buf, len, off);
+    const uint8_t* p = buf;
+    uint8_t* bounce = dio_get(dev->pool);
+    uint64_t a = dev->align;
+    int rc = 0;
+    while (len > 0 && rc == 0) {
+        uint64_t start = off & ~(a - 1);
+        size_t head = off - start;
+        size_t n = len < DIO_BUF - head ? len : DIO_BUF - head;
+        size_t span = (head + n + a - 1) & ~(a - 1);
+        if (head) rc = dev_read(dev, bounce, a, start);
+        if (rc == 0 && (head + n) % a && !(head && span == a))
+            rc = dev_read(dev, bounce + span - a, a, start + span - a);
+        if (rc == 0) {
+            memcpy(bounce + head, p, n);
+            rc = dev_write(dev, bounce, span, start);
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+    dio_put(dev->pool, bounce);
+    return rc;
+}
+
+int asfs_dev_read(asfs_dev* dev, void* buf, size_t len, uint64_t off) {
+    uint64_t t = LAT_NOW();
+    int rc = dev->pool ? dio_read(dev, buf, len, off) : dev_read(dev, buf, len, off);
+    LAT_RECORD(dev->lat, ASFS_IO_READ, t, (uint32_t)-1, 0, rc);
+    return rc;
+}
+
+int asfs_dev_write(asfs_dev* dev, const void* buf, size_t len, uint64_t off) {
+    uint64_t t = LAT_NOW();
+    dev->writes++;
+    int rc = dev->pool ? dio_write(dev, buf, len, off) : dev_write(dev, buf, len, off);
+    LAT_RECORD(dev->lat, ASFS_IO_WRITE, t, (uint32_t)-1, 0, rc);
+    return rc;
+}
+
+static int dev_lock(asfs_dev* dev, int type, int wait) {
+    struct flock fl = { .l_type = type, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1 };
+    int cmd = wait ? F_SETLKW : F_SETLK;
+#ifdef F_OFD_SETLKW
+    int ofd = wait ? F_OFD_SETLKW : F_OFD_SETLK;
+    cmd = ofd;
+#endif
+    for (;;) {
+        if (fcntl(dev->fd, cmd, &fl) == 0) return 0;
+        if (errno == EINTR) continue;
+#ifdef F_OFD_SETLKW
+        // Старое ядро без OFD-блокировок
+        if (errno == EINVAL && cmd == ofd) {
+            cmd = wait ? F_SETLKW : F_SETLK;
+            continue;
+        }
+#endif
+        return errno == EACCES ? -EAGAIN : -errno;
+    }
+}
+
+int asfs_dev_lock(asfs_dev* dev, int type) {
+    return dev_lock(dev, type, 1);
+}
+
+int asfs_dev_trylock(asfs_dev* dev, int type) {
+    return dev_lock(dev, type, 0);
+}
+
+// Быстрое зануление: дырка/ZERO_RANGE для файлов, BLKZEROOUT для устройств,
+// и только если ничего не вышло - запись нулей кусками по мегабайту
+static int fd_zero_fast(asfs_dev* dev, int fd, uint64_t off, uint64_t len) {
+    (void)dev;
+    struct stat st;
+    if (fstat(fd, &st) < 0) return -errno;
+#ifdef BLKZEROOUT
+    if (S_ISBLK(st.st_mode)) {
+        uint64_t range[2] = { off, len };
+        return ioctl(fd, BLKZEROOUT, range) < 0 ? -errno : 0;
+    }
+#endif
+#ifdef FALLOC_FL_PUNCH_HOLE
+    // Дырка читается как нули и не занимает места - образы у нас разреженные
+    if (S_ISREG(st.st_mode) && off + len <= (uint64_t)st.st_size &&
+        fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) == 0)
+        return 0;
+#endif
+#ifdef FALLOC_FL_ZERO_RANGE
+    if (fallocate(fd, FALLOC_FL_ZERO_RANGE, off, len) == 0) return 0;
+#endif
+    return -EOPNOTSUPP;
+}
+
+int asfs_dev_zero(asfs_dev* dev, uint64_t off, uint64_t len) {
+    if (len == 0) return 0;
+    dev->writes++;
+    STAT_INC(dev->stats, io.zero_calls);
+    STAT_ADD(dev->stats, io.bytes_zeroed, len);
+    if (dev_ranges(dev, off, len, fd_zero_fast) == 0) return 0;
+
+    size_t chunk = len < ZERO_CHUNK ? len : ZERO_CHUNK;
+    uint8_t* zero = calloc(1, chunk);
+    if (!zero) return -ENOMEM;
+    int rc = 0;
+    while (len > 0 && rc == 0) {
+        size_t n = len < chunk ? len : chunk;
+        rc = asfs_dev_write(dev, zero, n, off);
+        off += n;
+        len -= n;
+    }
+    free(zero);
+    return rc;
+}
+
+static int fd_prefetch(asfs_dev* dev, int fd, uint64_t off, uint64_t len) {
+    STAT_INC(dev->stats, io.prefetch_calls);
+    STAT_ADD(dev->stats, io.bytes_prefetched, len);
+    // posix_fadvise возвращает номер ошибки, а не -1
+    return -posix_fadvise(fd, off, len, POSIX_FADV_WILLNEED);
+}
+
+int asfs_dev_prefetch(asfs_dev* dev, uint64_t off, uint64_t len) {
+    // С O_DIRECT page cache не используется - подтягивать некуда
+    if (len == 0 || dev->pool) return 0;
+    return dev_ranges(dev, off, len, fd_prefetch);
+}
+
+static int fd_discard(asfs_dev* dev, int fd, uint64_t off, uint64_t len) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return -errno;
+    int rc = -EOPNOTSUPP;
+#ifdef BLKDISCARD
+    if (S_ISBLK(st.st_mode)) {
+        uint64_t range[2] = { off, len };
+        rc = ioctl(fd, BLKDISCARD, range) < 0 ? -errno : 0;
+    }
+#endif
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (S_ISREG(st.st_mode))
+        rc = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) < 0 ?
+             -errno : 0;
+#endif
+    if (rc == 0) {
+        STAT_INC(dev->stats, io.discard_calls);
+        STAT_ADD(dev->stats, io.bytes_discarded, len);
+    }
+    return rc;
+}
+
+int asfs_dev_discard(asfs_dev* dev, uint64_t off, uint64_t len) {
+    if (len == 0) return 0;
+    return dev_ranges(dev, off, len, fd_discard);
+}
+
+void asfs_discard_add(asfs_discard_queue* q, uint32_t block) {
+    if (q->count == q->cap) {
+        size_t cap = q->cap ? q->cap * 2 : 256;
+        uint32_t* p = realloc(q->blocks, cap * sizeof(uint32_t));
+        // discard - только подсказка, без памяти блок просто не отдадим
+        if (!p) return;
+        q->blocks = p;
+        q->cap = cap;
+    }
+    q->blocks[q->count++] = block;
+}
+
+static int cmp_block(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int block_used(const uint8_t* bitmap, uint32_t b) {
+    return bitmap[b/8] & (1 << (b%8));
+}
+
+int asfs_discard_flush(asfs_dev* dev, asfs_discard_queue* q, uint32_t block_size,
+                       const uint8_t* bitmap) {
+    if (q->count == 0) return 0;
+    qsort(q->blocks, q->count, sizeof(uint32_t), cmp_block);
+    int rc = 0;
+    for (size_t i = 0; i < q->count; ) {
+        if (block_used(bitmap, q->blocks[i])) {
+            i++;
+            continue;
+        }
+        size_t j = i + 1;
+        uint32_t end = q->blocks[i] + 1;
+        while (j < q->count && q->blocks[j] <= end) {
+            if (q->blocks[j] == end) {
+                if (block_used(bitmap, end)) break;
+                end++;
+            }
+            j++;
+        }
+        int r = asfs_dev_discard(dev, (uint64_t)q->blocks[i] * block_size,
+                                 (uint64_t)(end - q->blocks[i]) * block_size);
+        if (r < 0 && rc == 0) rc = r;
+        i = j;
+    }
+    q->count = 0;
+    return rc;
+}
+
+void asfs_discard_free(asfs_discard_queue* q) {
+    free(q->blocks);
+    q->blocks = NULL;
+    q->count = q->cap = 0;
+}
+
+int asfs_dev_trim(asfs_dev* dev, const uint8_t* bitmap, uint32_t first, uint32_t end,
+                  uint32_t block_size, uint64_t* bytes) {
+    *bytes = 0;
+    for (uint32_t b = first; b < end; ) {
+        // Целиком занятые байты bitmap пропускаем разом
+        if (b % 8 == 0 && b + 8 <= end && bitmap[b/8] == 0xFF) {
+            b += 8;
+            continue;
+        }
+        if (block_used(bitmap, b)) {
+            b++;
+            continue;
+        }
+        uint32_t run = b;
+        while (b < end && !block_used(bitmap, b)) b++;
+        uint64_t len = (uint64_t)(b - run) * block_size;
+        int rc = asfs_dev_discard(dev, (uint64_t)run * block_size, len);
+        if (rc < 0) return rc;
+        *bytes += len;
+    }
+    return 0;
+}
+
+// Размер набора - целые ряды полос по самому короткому образу
+int asfs_dev_size(asfs_dev* dev, uint64_t* size) {
+    const int* fds;
+    int n = dev_fds(dev, &fds);
+    uint64_t min = UINT64_MAX;
+    for (int i = 0; i < n; i++) {
+        struct stat st;
+        if (fstat(fds[i], &st) < 0) return -errno;
+        if ((uint64_t)st.st_size < min) min = st.st_size;
+    }
+    *size = dev->stripe ? min / dev->stripe->unit * dev->stripe->unit * n : min;
+    return 0;
+}
+
+int asfs_dev_truncate(asfs_dev* dev, uint64_t size) {
+    const int* fds;
+    int n = dev_fds(dev, &fds);
+    if (dev->stripe) {
+        uint64_t row = (uint64_t)dev->stripe->unit * n;
+        size = (size + row - 1) / row * dev->stripe->unit;
+    }
+    for (int i = 0; i < n; i++)
+        if (ftruncate(fds[i], size) < 0) return -errno;
+    return 0;
+}
+
+int asfs_dev_sync(asfs_dev* dev) {
+    uint64_t t = LAT_NOW();
+    STAT_INC(dev->stats, io.sync_calls);
+    int rc;
+    if (dev->stripe) {
+        stripe_job jobs[ASFS_STRIPE_MAX] = {{0}};
+        for (uint32_t i = 0; i < dev->stripe->count; i++) {
+            jobs[i].op = JOB_SYNC;
+            jobs[i].fd = dev->stripe->fds[i];
+        }
+        rc = stripe_run(dev->stripe, jobs, dev->stripe->count);
+    } else {
+        rc = fsync(dev->fd) < 0 ? -errno : 0;
+    }
+    LAT_RECORD(dev->lat, ASFS_IO_SYNC, t, (uint32_t)-1, 0, rc);
+    return rc;
+}
+
+static int stripe_start(asfs_dev* dev, const int* fds, uint32_t count, uint32_t unit) {
+    asfs_stripe* st = calloc(1, sizeof(*st));
+    if (!st) return -ENOMEM;
+    st->count = count;
+    st->unit = unit;
+    memcpy(st->fds, fds, count * sizeof(int));
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->work, NULL);
+    pthread_cond_init(&st->done, NULL);
+    // Вызывающий сам обслуживает один образ, потоков нужно на один меньше
+    for (uint32_t i = 1; i < count; i++) {
+        if (pthread_create(&st->workers[st->nworkers], NULL, stripe_worker, st) != 0) break;
+        st->nworkers++;
+    }
+    if (st->nworkers == 0) {
+        st->count = 1;  // чужие fd закроет вызывающий
+        stripe_free(st);
+        return -EAGAIN;
+    }
+    dev->stripe = st;
+    return 0;
+}
+
+int asfs_dev_stripe(asfs_dev* dev, const char* path, const char* const* members, int count,
+                    uint32_t unit, int flags, asfs_stripe_label* label) {
+    if (count < 1 || count >= ASFS_STRIPE_MAX || unit == 0 || unit % 512 || dev->stripe)
+        return -EINVAL;
+    memset(label, 0, sizeof(*label));
+    label->magic = ASFS_STRIPE_MAGIC;
+    label->count = count + 1;
+    label->unit = unit;
+    char full[PATH_MAX];
+    if (!realpath(path, full)) return -errno;
+    if (strlen(full) >= ASFS_STRIPE_PATH) return -ENAMETOOLONG;
+    strcpy(label->paths[0], full);
+
+    int fds[ASFS_STRIPE_MAX] = { dev->fd };
+    int rc = 0, opened = 1;
+    for (; opened <= count && rc == 0; opened++) {
+        fds[opened] = open(members[opened - 1], O_RDWR | flags, 0644);
+        if (fds[opened] < 0) {
+            rc = -errno;
+            break;
+        }
+        if (!realpath(members[opened - 1], full)) rc = -errno;
+        else if (strlen(full) >= ASFS_STRIPE_PATH) rc = -ENAMETOOLONG;
+        else strcpy(label->paths[opened], full);
+    }
+    if (rc == 0) rc = stripe_start(dev, fds, count + 1, unit);
+    if (rc < 0)
+        for (int i = 1; i < opened; i++)
+            if (fds[i] >= 0) close(fds[i]);
+    return rc;
+}
+
+int asfs_dev_attach(asfs_dev* dev, const char* path, const asfs_stripe_label* label) {
+    if (label->magic != ASFS_STRIPE_MAGIC || label->count < 2 ||
+        label->count > ASFS_STRIPE_MAX || label->unit == 0 || label->unit % 512)
+        return -EINVAL;
+    int flags = fcntl(dev->fd, F_GETFL);
+    if (flags < 0) return -errno;
+    flags &= O_ACCMODE;
+
+    // Каталог первого образа - на случай, если набор переносили
+    char dir[PATH_MAX];
+    const char* slash = strrchr(path, '/');
+    int dlen = slash ? (int)(slash - path + 1) : 0;
+    if (dlen >= PATH_MAX) return -ENAMETOOLONG;
+    memcpy(dir, path, dlen);
+    dir[dlen] = '\0';
+
+    int fds[ASFS_STRIPE_MAX] = { dev->fd };
+    int rc = 0;
+    uint32_t i = 1;
+    for (; i < label->count; i++) {
+        char name[ASFS_STRIPE_PATH + 1];
+        memcpy(name, label->paths[i], ASFS_STRIPE_PATH);
+        name[ASFS_STRIPE_PATH] = '\0';
+        fds[i] = open(name, flags);
+        if (fds[i] < 0 && errno == ENOENT) {
+            char near[PATH_MAX + ASFS_STRIPE_PATH];
+            const char* base = strrchr(name, '/');
+            snprintf(near, sizeof(near), "%s%s", dir, base ? base + 1 : name);
+            fds[i] = open(near, flags);
+        }
+        if (fds[i] < 0) {
+            rc = -errno;
+            break;
+        }
+    }
+    if (rc == 0) rc = stripe_start(dev, fds, label->count, label->unit);
+    if (rc < 0)
+        for (uint32_t k = 1; k < i && k < label->count; k++) close(fds[k]);
+    return rc;
+}
@@ -0,0 +1,95 @@
+#ifndef ASFS_IO_H
+#define ASFS_IO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "asfs_stats.h"
+
+// Блочное устройство (файл-образ), общее для обоих движков.
+// Все функции возвращают 0 или -errno.
+typedef struct asfs_dio_pool asfs_dio_pool;
+typedef struct asfs_stripe asfs_stripe;
+
+typedef struct {
+    int fd;
+    asfs_stats* stats;   // счётчики владельца, может быть NULL
+    asfs_latency* lat;   // гистограммы владельца, может быть NULL
+    uint32_t align;      // логический блок устройства в режиме O_DIRECT, иначе 0
+    asfs_dio_pool* pool; // выровненные буферы для O_DIRECT
+    asfs_stripe* stripe; // набор образов с чередованием, NULL - один образ
+    uint64_t writes;     // вызовов записи и зануления - так движок видит, что операция
+                         // что-то поменяла на диске (счётчики stats можно выключить)
+} asfs_dev;
+
+// Чередование (RAID-0): логический адрес режется на полосы по unit байт,
+// полоса k лежит в образе k % count. Первая полоса - в первом образе, так что
+// суперблок движка (а с ним и эта метка) читается до открытия остальных
+#define ASFS_STRIPE_MAX 8
+#define ASFS_STRIPE_PATH 128
+#define ASFS_STRIPE_MAGIC 0x50525453  // "STRP"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;        // образов в наборе, [0] - тот, что открывают
+    uint32_t unit;
+    uint32_t reserved;
+    char paths[ASFS_STRIPE_MAX][ASFS_STRIPE_PATH];  // абсолютные пути
+} asfs_stripe_label;
+
+int asfs_dev_open(asfs_dev* dev, const char* path, int flags);
+void asfs_dev_close(asfs_dev* dev);
+// O_DIRECT: ввод-вывод мимо page cache. Невыровненное по логическому блоку
+// устройства идёт через буферы из пула на hugepage, неполные сектора при записи
+// дочитываются. -EINVAL, если ФС образа не умеет O_DIRECT или block_size
+// движка не кратен логическому блоку
+int asfs_dev_set_direct(asfs_dev* dev, int on, uint32_t block_size);
+// Добавляет к открытому образу path ещё count образов (открываются с
+// O_RDWR | flags) и заполняет метку для суперблока. unit кратен 512
+int asfs_dev_stripe(asfs_dev* dev, const char* path, const char* const* members, int count,
+                    uint32_t unit, int flags, asfs_stripe_label* label);
+// Открывает остальные образы набора по метке из суперблока. Не найденный
+// по сохранённому пути образ ищется рядом с path (набор перенесли целиком)
+int asfs_dev_attach(asfs_dev* dev, const char* path, const asfs_stripe_label* label);
+
+// Читает ровно len байт; всё, что за концом образа, читается как нули.
+// В наборе запрос режется по образам, и образы читаются/пишутся параллельно
+int asfs_dev_read(asfs_dev* dev, void* buf, size_t len, uint64_t off);
+int asfs_dev_write(asfs_dev* dev, const void* buf, size_t len, uint64_t off);
+// Блокировка образа между процессами: F_RDLCK, F_WRLCK или F_UNLCK на первый байт
+// первого образа. Блокировки open file description (F_OFD_*), так что два
+// дескриптора одного процесса тоже исключают друг друга; без них - обычные POSIX
+int asfs_dev_lock(asfs_dev* dev, int type);
+// То же без ожидания: -EAGAIN, если мешает чужая блокировка. Своя F_RDLCK
+// поднимается до F_WRLCK на месте
+int asfs_dev_trylock(asfs_dev* dev, int type);
+
+// Зануляет диапазон, по возможности без записи данных (см. asfs_io.c)
+int asfs_dev_zero(asfs_dev* dev, uint64_t off, uint64_t len);
+// Асинхронно подтягивает диапазон в page cache (упреждающее чтение), не ждёт
+int asfs_dev_prefetch(asfs_dev* dev, uint64_t off, uint64_t len);
+// Отдаёт диапазон хранилищу: дырка в файле-образе, BLKDISCARD на устройстве.
+// Читать его потом можно, но содержимое не гарантировано
+int asfs_dev_discard(asfs_dev* dev, uint64_t off, uint64_t len);
+
+// Очередь освобождённых блоков для discard. Копится за операцию и сбрасывается,
+// когда освобождение уже на диске: блоки сортируются, склеиваются в диапазоны,
+// а снова занятые к этому моменту (бит в bitmap) пропускаются
+typedef struct {
+    uint32_t* blocks;
+    size_t count;
+    size_t cap;
+} asfs_discard_queue;
+
+void asfs_discard_add(asfs_discard_queue* q, uint32_t block);
+int asfs_discard_flush(asfs_dev* dev, asfs_discard_queue* q, uint32_t block_size,
+                       const uint8_t* bitmap);
+void asfs_discard_free(asfs_discard_queue* q);
+// Дырявит все свободные по bitmap блоки из [first, end); *bytes - сколько отдано
+int asfs_dev_trim(asfs_dev* dev, const uint8_t* bitmap, uint32_t first, uint32_t end,
+                  uint32_t block_size, uint64_t* bytes);
+
+int asfs_dev_size(asfs_dev* dev, uint64_t* size);
+int asfs_dev_truncate(asfs_dev* dev, uint64_t size);
+int asfs_dev_sync(asfs_dev* dev);
+
+#endif
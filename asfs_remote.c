@@ -0,0 +1,448 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "asfs_remote.h"
+
+#define RECV_CHUNK (64 << 10)
+#define OUT_HIGH (8 << 20)     // ответов накопилось больше - клиента пока не читаем
+
+typedef struct {
+    uint8_t* data;
+    size_t off, len, cap;      // [off, len) - ещё не отправлено или не разобрано
+} Buf;
+
+static int buf_reserve(Buf* b, size_t n) {
+    if (b->off == b->len) {
+        b->off = b->len = 0;
+    } else if (b->off && b->len + n > b->cap) {
+        memmove(b->data, b->data + b->off, b->len - b->off);
+        b->len -= b->off;
+        b->off = 0;
+    }
+    if (b->len + n <= b->cap) return 0;
+    size_t cap = b->cap ? b->cap : RECV_CHUNK;
+    while (cap < b->len + n) cap *= 2;
+    uint8_t* p = realloc(b->data, cap);
+    if (!p) return -ENOMEM;
+    b->data = p;
+    b->cap = cap;
+    return 0;
+}
+
+static int buf_put(Buf* b, const void* data, size_t n) {
+    int rc = buf_reserve(b, n);
+    if (rc < 0) return rc;
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+    return 0;
+}
+
+// Одно чтение из сокета в хвост буфера: 0 - соединение закрыто
+static ssize_t buf_recv(Buf* b, int fd, int flags) {
+    int rc = buf_reserve(b, RECV_CHUNK);
+    if (rc < 0) return rc;
+    ssize_t n = recv(fd, b->data + b->len, RECV_CHUNK, flags);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? -EAGAIN : -errno;
+    b->len += n;
+    return n;
+}
+
+static int buf_send(Buf* b, int fd) {
+    while (b->off < b->len) {
+        ssize_t n = send(fd, b->data + b->off, b->len - b->off, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -errno;
+        b->off += n;
+    }
+    return 0;
+}
+
+static int put_stat(Buf* b, const asfs_stat* st) {
+    asfs_wire_stat w = {
+        .inode = st->inode,
+        .size = st->size,
+        .snapshot_id = st->snapshot_id,
+        .snapshot_count = st->snapshot_count,
+        .created = st->created,
+        .modified = st->modified,
+        .type = st->type,
+        .is_snapshot = st->is_snapshot,
+        .name_len = strnlen(st->name, ASFS_NAME_MAX),
+    };
+    int rc = buf_put(b, &w, sizeof(w));
+    return rc < 0 ? rc : buf_put(b, st->name, w.name_len);
+}
+
+int asfs_wire_stat_next(const uint8_t** p, const uint8_t* end, asfs_stat* st) {
+    asfs_wire_stat w;
+    if (*p == end) return 0;
+    if ((size_t)(end - *p) < sizeof(w)) return -EPROTO;
+    memcpy(&w, *p, sizeof(w));
+    if (w.name_len >= ASFS_NAME_MAX || (size_t)(end - *p) < sizeof(w) + w.name_len)
+        return -EPROTO;
+    memset(st, 0, sizeof(*st));
+    st->inode = w.inode;
+    st->size = w.size;
+    st->snapshot_id = w.snapshot_id;
+    st->snapshot_count = w.snapshot_count;
+    st->created = w.created;
+    st->modified = w.modified;
+    st->type = w.type;
+    st->is_snapshot = w.is_snapshot;
+    memcpy(st->name, *p + sizeof(w), w.name_len);
+    *p += sizeof(w) + w.name_len;
+    return 1;
+}
+
+// ---- сервер ----
+
+typedef struct {
+    int fd;
+    Buf in, out;
+} Client;
+
+typedef struct {
+    Buf* out;
+    int32_t count;
+} ListReply;
+
+static int list_entry(const asfs_stat* st, void* arg) {
+    ListReply* l = arg;
+    l->count++;
+    return put_stat(l->out, st);
+}
+
+// len = 0 - до конца файла: читаем кусками, пока чтение не выйдет коротким,
+// чтобы не искать имя лишний раз ради размера
+static int64_t do_read(asfs_fs* fs, const char* name, uint64_t offset, uint32_t len, Buf* out) {
+    uint32_t want = len ? len : RECV_CHUNK, total = 0;
+    for (;;) {
+        int rc = buf_reserve(out, want);
+        if (rc < 0) return rc;
+        ssize_t n = asfs_read(fs, name, out->data + out->len, want, offset + total);
+        if (n < 0) return n;
+        out->len += n;
+        total += n;
+        if (len || (uint32_t)n < want || total >= ASFS_WIRE_MAX_DATA) return total;
+        uint32_t left = ASFS_WIRE_MAX_DATA - total;
+        want = want * 2 < left ? want * 2 : left;
+    }
+}
+
+// Выполняет запрос и дописывает ответ в out
+static int execute(asfs_fs* fs, const asfs_wire_req* req, const char* name,
+                   const char* name2, const uint8_t* data, Buf* out) {
+    asfs_wire_reply rep = { 0, 0 };
+    int rc = buf_put(out, &rep, sizeof(rep));
+    if (rc < 0) return rc;
+    // Место заголовка - от off: пока ответ собирается, buf_reserve может сдвинуть
+    // неотправленное к началу буфера
+    size_t at = out->len - out->off - sizeof(rep);
+    uint32_t inode = 0;
+    int64_t res;
+
+    switch (req->op) {
+    case ASFS_REQ_CREATE:
+        res = asfs_create(fs, name, data, req->len, &inode);
+        if (res == 0) res = inode;
+        break;
+    case ASFS_REQ_EDIT:
+        res = asfs_edit(fs, name, data, req->len);
+        break;
+    case ASFS_REQ_APPEND:
+        res = asfs_append(fs, name, data, req->len);
+        break;
+    case ASFS_REQ_WRITE:
+        res = asfs_write(fs, name, data, req->len, req->offset);
+        break;
+    case ASFS_REQ_TRUNCATE:
+        res = asfs_truncate(fs, name, req->offset);
+        break;
+    case ASFS_REQ_DELETE:
+        res = asfs_delete(fs, name);
+        break;
+    case ASFS_REQ_READ:
+        res = do_read(fs, name, req->offset, req->len, out);
+        break;
+    case ASFS_REQ_LOOKUP: {
+        asfs_stat st;
+        res = asfs_lookup(fs, name, &st);
+        if (res == 0) res = put_stat(out, &st);
+        break;
+    }
+    case ASFS_REQ_LIST: {
+        ListReply l = { out, 0 };
+        res = asfs_list(fs, list_entry, &l);
+        if (res == 0) res = l.count;
+        break;
+    }
+    case ASFS_REQ_STATFS: {
+        asfs_fsinfo info;
+        res = asfs_statfs(fs, &info);
+        if (res == 0) res = buf_put(out, &info, sizeof(info));
+        break;
+    }
+    case ASFS_REQ_SNAP_CREATE:
+        res = asfs_snapshot_create(fs, name, name2, &inode);
+        if (res == 0) res = inode;
+        break;
+    case ASFS_REQ_SNAP_RESTORE:
+        res = asfs_snapshot_restore(fs, name, name2);
+        break;
+    case ASFS_REQ_SNAP_DELETE:
+        res = asfs_snapshot_delete(fs, name);
+        break;
+    default:
+        res = -EINVAL;
+    }
+
+    at += out->off;
+    if (res < 0) out->len = at + sizeof(rep);  // частичный ответ не отдаём
+    rep.result = res;
+    rep.len = out->len - at - sizeof(rep);
+    memcpy(out->data + at, &rep, sizeof(rep));
+    return 0;
+}
+
+// Разбирает все целые запросы из in; -EPROTO - клиент шлёт мусор
+static int serve_input(asfs_fs* fs, Client* c) {
+    char name[ASFS_NAME_MAX], name2[ASFS_NAME_MAX];
+    while (c->in.len - c->in.off >= sizeof(asfs_wire_req)) {
+        asfs_wire_req req;
+        memcpy(&req, c->in.data + c->in.off, sizeof(req));
+        if (req.op == 0 || req.op >= ASFS_REQ_MAX || req.len > ASFS_WIRE_MAX_DATA)
+            return -EPROTO;
+        size_t body = (size_t)req.name_len + req.name2_len +
+                      (req.op == ASFS_REQ_READ ? 0 : req.len);
+        if (c->in.len - c->in.off < sizeof(req) + body) break;
+
+        const uint8_t* p = c->in.data + c->in.off + sizeof(req);
+        int rc;
+        if (req.name_len >= ASFS_NAME_MAX || req.name2_len >= ASFS_NAME_MAX) {
+            asfs_wire_reply rep = { -ENAMETOOLONG, 0 };
+            rc = buf_put(&c->out, &rep, sizeof(rep));
+        } else {
+            memcpy(name, p, req.name_len);
+            name[req.name_len] = '\0';
+            memcpy(name2, p + req.name_len, req.name2_len);
+            name2[req.name2_len] = '\0';
+            rc = execute(fs, &req, name, name2, p + req.name_len + req.name2_len, &c->out);
+        }
+        if (rc < 0) return rc;
+        c->in.off += sizeof(req) + body;
+    }
+    return 0;
+}
+
+static int listen_socket(const char* path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) return -ENAMETOOLONG;
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -errno;
+    int rc = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    if (rc < 0 && errno == EADDRINUSE) {
+        // Файл сокета остался от упавшего сервера, если на нём никто не слушает
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int alive = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+        if (probe >= 0) close(probe);
+        if (alive) {
+            close(fd);
+            return -EADDRINUSE;
+        }
+        unlink(path);
+        rc = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    }
+    if (rc < 0 || listen(fd, 64) < 0) {
+        rc = -errno;
+        close(fd);
+        return rc;
+    }
+    return fd;
+}
+
+static void client_drop(Client* c) {
+    close(c->fd);
+    free(c->in.data);
+    free(c->out.data);
+    c->fd = -1;
+}
+
+int asfs_serve(asfs_fs* fs, const char* path, volatile sig_atomic_t* stop) {
+    int lfd = listen_socket(path);
+    if (lfd < 0) return lfd;
+
+    Client* clients = NULL;
+    struct pollfd* pfds = malloc(sizeof(struct pollfd));
+    size_t count = 0, cap = 0;
+    int rc = pfds ? 0 : -ENOMEM;
+
+    while (rc == 0 && !*stop) {
+        pfds[0] = (struct pollfd){ .fd = lfd, .events = POLLIN };
+        for (size_t i = 0; i < count; i++) {
+            Buf* out = &clients[i].out;
+            pfds[i + 1].fd = clients[i].fd;
+            pfds[i + 1].events = (out->len - out->off < OUT_HIGH ? POLLIN : 0) |
+                                 (out->off < out->len ? POLLOUT : 0);
+            pfds[i + 1].revents = 0;
+        }
+        if (poll(pfds, count + 1, -1) < 0) {
+            if (errno != EINTR) rc = -errno;
+            continue;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            Client* c = &clients[i];
+            short ev = pfds[i + 1].revents;
+            int err = 0;
+            if (ev & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = buf_recv(&c->in, c->fd, MSG_DONTWAIT);
+                if (n == 0) err = -ECONNRESET;
+                else if (n < 0 && n != -EAGAIN) err = n;
+                else err = serve_input(fs, c);
+            }
+            // Всё разобранное за это чтение уходит одной записью
+            if (err == 0) err = buf_send(&c->out, c->fd);
+            if (err < 0) client_drop(c);
+        }
+        size_t live = 0;
+        for (size_t i = 0; i < count; i++)
+            if (clients[i].fd >= 0) clients[live++] = clients[i];
+        count = live;
+
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd < 0) continue;
+            if (count == cap) {
+                size_t ncap = cap ? cap * 2 : 16;
+                Client* nc = realloc(clients, ncap * sizeof(Client));
+                struct pollfd* np = nc ? realloc(pfds, (ncap + 1) * sizeof(struct pollfd)) : NULL;
+                if (nc) clients = nc;
+                if (np) pfds = np;
+                if (!nc || !np) {
+                    close(fd);
+                    continue;
+                }
+                cap = ncap;
+            }
+            clients[count++] = (Client){ .fd = fd };
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) client_drop(&clients[i]);
+    free(clients);
+    free(pfds);
+    close(lfd);
+    unlink(path);
+    return rc;
+}
+
+// ---- клиент ----
+
+struct asfs_remote {
+    int fd;
+    Buf tx, rx;
+    size_t consumed;       // длина ответа, выданного прошлым asfs_remote_reply
+    uint32_t pending;      // запросов без прочитанного ответа
+};
+
+int asfs_remote_connect(const char* path, asfs_remote** out) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) return -ENAMETOOLONG;
+    strcpy(addr.sun_path, path);
+    asfs_remote* r = calloc(1, sizeof(asfs_remote));
+    if (!r) return -ENOMEM;
+    r->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (r->fd < 0 || connect(r->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        int rc = -errno;
+        if (r->fd >= 0) close(r->fd);
+        free(r);
+        return rc;
+    }
+    *out = r;
+    return 0;
+}
+
+void asfs_remote_close(asfs_remote* r) {
+    if (!r) return;
+    close(r->fd);
+    free(r->tx.data);
+    free(r->rx.data);
+    free(r);
+}
+
+int asfs_remote_queue(asfs_remote* r, int op, const char* name, const char* name2,
+                      const void* data, uint32_t len, uint64_t offset) {
+    if (len > ASFS_WIRE_MAX_DATA) return -EFBIG;
+    size_t n1 = name ? strlen(name) : 0, n2 = name2 ? strlen(name2) : 0;
+    if (n1 >= ASFS_NAME_MAX || n2 >= ASFS_NAME_MAX) return -ENAMETOOLONG;
+    asfs_wire_req req = {
+        .op = op,
+        .name_len = n1,
+        .name2_len = n2,
+        .len = len,
+        .offset = offset,
+    };
+    size_t body = op == ASFS_REQ_READ ? 0 : len;
+    int rc = buf_reserve(&r->tx, sizeof(req) + n1 + n2 + body);
+    if (rc < 0) return rc;
+    buf_put(&r->tx, &req, sizeof(req));
+    buf_put(&r->tx, name, n1);
+    buf_put(&r->tx, name2, n2);
+    if (body) buf_put(&r->tx, data, body);
+    r->pending++;
+    return 0;
+}
+
+// Пока очередь уходит, ответы принимаются - иначе при длинном конвейере сервер
+// упрётся в наши непрочитанные ответы и перестанет читать запросы
+int asfs_remote_flush(asfs_remote* r) {
+    while (r->tx.off < r->tx.len) {
+        struct pollfd p = { .fd = r->fd, .events = POLLIN | POLLOUT };
+        if (poll(&p, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (p.revents & POLLIN) {
+            ssize_t n = buf_recv(&r->rx, r->fd, MSG_DONTWAIT);
+            if (n == 0) return -ECONNRESET;
+            if (n < 0 && n != -EAGAIN) return n;
+        }
+        if (p.revents & (POLLOUT | POLLERR | POLLHUP)) {
+            int rc = buf_send(&r->tx, r->fd);
+            if (rc < 0) return rc;
+        }
+    }
+    return 0;
+}
+
+int asfs_remote_reply(asfs_remote* r, int32_t* result, const void** data, uint32_t* len) {
+    r->rx.off += r->consumed;
+    r->consumed = 0;
+    if (r->pending == 0) return -EINVAL;
+    int rc = asfs_remote_flush(r);
+    if (rc < 0) return rc;
+
+    asfs_wire_reply rep;
+    for (;;) {
+        size_t have = r->rx.len - r->rx.off;
+        if (have >= sizeof(rep)) {
+            memcpy(&rep, r->rx.data + r->rx.off, sizeof(rep));
+            if (have >= sizeof(rep) + rep.len) break;
+        }
+        ssize_t n = buf_recv(&r->rx, r->fd, 0);
+        if (n == 0) return -ECONNRESET;
+        if (n < 0) return n;
+    }
+    r->consumed = sizeof(rep) + rep.len;
+    r->pending--;
+    *result = rep.result;
+    if (data) *data = r->rx.data + r->rx.off + sizeof(rep);
+    if (len) *len = rep.len;
+    return 0;
+}
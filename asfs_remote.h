@@ -0,0 +1,82 @@
+#ifndef ASFS_REMOTE_H
+#define ASFS_REMOTE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+#include "libasfs.h"
+
+// Демон asfs на UNIX-сокете: один процесс держит образ открытым (метаданные,
+// индексы, кэш общие и тёплые для всех клиентов), клиенты шлют запросы подряд,
+// не дожидаясь ответов. Ответы приходят в порядке запросов, всё, что сервер
+// разобрал за одно чтение, уходит одной записью. Порядок байт - хоста.
+
+enum {
+    ASFS_REQ_CREATE = 1,   // name, данные; результат - номер inode
+    ASFS_REQ_EDIT,         // name, данные
+    ASFS_REQ_APPEND,       // name, данные; результат - записано байт
+    ASFS_REQ_WRITE,        // name, данные с offset
+    ASFS_REQ_TRUNCATE,     // name, offset - новый размер
+    ASFS_REQ_DELETE,       // name
+    ASFS_REQ_READ,         // name, len байт с offset (0 - до конца); ответ - данные
+    ASFS_REQ_LOOKUP,       // name; ответ - одна asfs_wire_stat
+    ASFS_REQ_LIST,         // ответ - asfs_wire_stat подряд, результат - их число
+    ASFS_REQ_STATFS,       // ответ - asfs_fsinfo
+    ASFS_REQ_SNAP_CREATE,  // name, name2 - имя снапшота; результат - inode снапшота
+    ASFS_REQ_SNAP_RESTORE, // name, name2
+    ASFS_REQ_SNAP_DELETE,  // name - имя снапшота
+    ASFS_REQ_MAX
+};
+
+#define ASFS_WIRE_MAX_DATA (64u << 20)
+
+// Запрос: заголовок, затем name, name2 (без нулей) и данные
+typedef struct {
+    uint8_t op;
+    uint8_t reserved;
+    uint16_t name_len;
+    uint16_t name2_len;
+    uint16_t reserved2;
+    uint32_t len;          // байт данных за заголовком; у read - сколько прочитать
+    uint64_t offset;
+} asfs_wire_req;
+
+// Ответ: заголовок и len байт данных
+typedef struct {
+    int32_t result;        // >= 0 или -errno
+    uint32_t len;
+} asfs_wire_reply;
+
+// Файл в ответе lookup/list, за ним name_len байт имени
+typedef struct {
+    uint32_t inode;
+    uint32_t size;
+    uint32_t snapshot_id;
+    uint32_t snapshot_count;
+    int64_t created;
+    int64_t modified;
+    uint8_t type;
+    uint8_t is_snapshot;
+    uint16_t name_len;
+} asfs_wire_stat;
+
+// Обслуживает fs на сокете path, пока *stop не станет ненулевым (сигнал).
+// Существующий сокет без живого сервера удаляется; занятый - -EADDRINUSE
+int asfs_serve(asfs_fs* fs, const char* path, volatile sig_atomic_t* stop);
+
+typedef struct asfs_remote asfs_remote;
+
+int asfs_remote_connect(const char* path, asfs_remote** out);
+void asfs_remote_close(asfs_remote* r);
+// Ставит запрос в очередь без отправки; name2 и data могут быть NULL
+int asfs_remote_queue(asfs_remote* r, int op, const char* name, const char* name2,
+                      const void* data, uint32_t len, uint64_t offset);
+// Отправляет очередь одним потоком записей, попутно принимая ответы
+int asfs_remote_flush(asfs_remote* r);
+// Следующий ответ по порядку (при необходимости сначала flush). *data живёт
+// до следующего вызова asfs_remote_*
+int asfs_remote_reply(asfs_remote* r, int32_t* result, const void** data, uint32_t* len);
+// Разбор ответа lookup/list: 1 - файл разобран, 0 - данные кончились, -EPROTO
+int asfs_wire_stat_next(const uint8_t** p, const uint8_t* end, asfs_stat* st);
+
+#endif
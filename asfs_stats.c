@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include "asfs_stats.h"
+
+const char* const asfs_op_names[ASFS_OP_MAX] = {
+    [ASFS_OP_CREATE] = "create",
+    [ASFS_OP_READ] = "read",
+    [ASFS_OP_EDIT] = "edit",
+    [ASFS_OP_DELETE] = "delete",
+    [ASFS_OP_SNAPSHOT] = "snapshot",
+    [ASFS_OP_RESTORE] = "restore",
+    [ASFS_OP_LOOKUP] = "lookup",
+    [ASFS_OP_LIST] = "list",
+    [ASFS_STEP_LOOKUP_SCAN] = "step.lookup_scan",
+    [ASFS_STEP_ALLOC] = "step.alloc",
+    [ASFS_STEP_DATA_WRITE] = "step.data_write",
+    [ASFS_STEP_INODE_WRITE] = "step.inode_write",
+    [ASFS_STEP_META_WRITE] = "step.meta_write",
+    [ASFS_IO_READ] = "io.read",
+    [ASFS_IO_WRITE] = "io.write",
+    [ASFS_IO_SYNC] = "io.sync",
+};
+
+#define FIELD(group, name, last) \
+    fprintf(out, "    \"%s\": %" PRIu64 "%s\n", #name, st->group.name, last ? "" : ",")
+
+void asfs_stats_json(const asfs_stats* st, FILE* out) {
+    fprintf(out, "{\n  \"enabled\": %s,\n", ASFS_STATS ? "true" : "false");
+
+    fprintf(out, "  \"io\": {\n");
+    FIELD(io, read_calls, 0);
+    FIELD(io, write_calls, 0);
+    FIELD(io, sync_calls, 0);
+    FIELD(io, bytes_read, 0);
+    FIELD(io, bytes_written, 0);
+    FIELD(io, zero_calls, 0);
+    FIELD(io, bytes_zeroed, 0);
+    FIELD(io, prefetch_calls, 0);
+    FIELD(io, bytes_prefetched, 0);
+    FIELD(io, discard_calls, 0);
+    FIELD(io, bytes_discarded, 0);
+    FIELD(io, errors, 1);
+
+    fprintf(out, "  },\n  \"cache\": {\n");
+    FIELD(cache, hits, 0);
+    FIELD(cache, misses, 0);
+    FIELD(cache, inserts, 0);
+    FIELD(cache, evictions, 0);
+    FIELD(cache, pinned_skips, 0);
+    FIELD(cache, overflows, 1);
+
+    fprintf(out, "  },\n  \"alloc\": {\n");
+    FIELD(alloc, block_allocs, 0);
+    FIELD(alloc, block_frees, 0);
+    FIELD(alloc, block_scan, 0);
+    FIELD(alloc, block_failures, 0);
+    FIELD(alloc, inode_allocs, 0);
+    FIELD(alloc, inode_frees, 0);
+    FIELD(alloc, inode_scan, 1);
+
+    fprintf(out, "  },\n  \"inode\": {\n");
+    FIELD(inode, reads, 0);
+    FIELD(inode, writes, 0);
+    FIELD(inode, lookups, 0);
+    FIELD(inode, lookup_scan, 0);
+    FIELD(inode, lookup_misses, 0);
+    FIELD(inode, seq_reads, 0);
+    FIELD(inode, bloom_negatives, 0);
+    FIELD(inode, bloom_false, 1);
+
+    fprintf(out, "  },\n  \"meta\": {\n");
+    FIELD(meta, saves, 1);
+    fprintf(out, "  }\n}\n");
+}
+
+uint64_t asfs_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t v) {
+    if (v < ASFS_HIST_SUB) return v;
+    int msb = 63 - __builtin_clzll(v);
+    if (msb >= ASFS_HIST_MAX_BITS) return ASFS_HIST_BUCKETS - 1;
+    int shift = msb - ASFS_HIST_SUB_BITS;
+    return (shift + 1) * ASFS_HIST_SUB + ((v >> shift) & (ASFS_HIST_SUB - 1));
+}
+
+// Верхняя граница значений, попадающих в корзину
+static uint64_t hist_value(int idx) {
+    if (idx < ASFS_HIST_SUB) return idx;
+    int shift = idx / ASFS_HIST_SUB - 1;
+    uint64_t sub = idx % ASFS_HIST_SUB;
+    return ((ASFS_HIST_SUB + sub) << shift) + ((1ull << shift) - 1);
+}
+
+uint64_t asfs_hist_percentile(const asfs_hist* h, double p) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t)(p * h->count + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < ASFS_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = hist_value(i);
+            return v < h->max_ns ? v : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+void asfs_hist_add(asfs_hist* h, uint64_t ns) {
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[hist_index(ns)], 1, __ATOMIC_RELAXED);
+    if (ns > h->max_ns) h->max_ns = ns;
+}
+
+void asfs_hist_merge(asfs_hist* dst, const asfs_hist* src) {
+    dst->count += src->count;
+    dst->sum_ns += src->sum_ns;
+    if (src->max_ns > dst->max_ns) dst->max_ns = src->max_ns;
+    for (int i = 0; i < ASFS_HIST_BUCKETS; i++) dst->buckets[i] += src->buckets[i];
+}
+
+void asfs_latency_record(asfs_latency* lat, int op, uint64_t start_ns,
+                         uint32_t inode, uint32_t blocks, int64_t result) {
+    if (!lat) return;
+    uint64_t dur = asfs_now_ns() - start_ns;
+    asfs_hist_add(&lat->hist[op], dur);
+
+    if (lat->trace) {
+        uint64_t slot = __atomic_fetch_add(&lat->trace_head, 1, __ATOMIC_RELAXED);
+        asfs_trace_rec* rec = &lat->trace[slot % lat->trace_capacity];
+        rec->ts_ns = start_ns;
+        rec->duration_ns = dur;
+        rec->inode = inode;
+        rec->blocks = blocks;
+        rec->op = op;
+        rec->flags = result < 0;
+        rec->result = result < 0 ? result : 0;
+    }
+}
+
+void asfs_latency_reset(asfs_latency* lat) {
+    memset(lat->hist, 0, sizeof(lat->hist));
+    lat->trace_head = 0;
+}
+
+void asfs_latency_json(const asfs_latency* lat, FILE* out) {
+    int first = 1;
+    fprintf(out, "{\n");
+    for (int op = 0; op < ASFS_OP_MAX; op++) {
+        const asfs_hist* h = &lat->hist[op];
+        if (h->count == 0) continue;
+        fprintf(out, "%s  \"%s\": {\"count\": %" PRIu64 ", \"mean_us\": %.2f, "
+                "\"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f, "
+                "\"p999_us\": %.2f, \"max_us\": %.2f}",
+                first ? "" : ",\n", asfs_op_names[op], h->count,
+                h->sum_ns / 1000.0 / h->count,
+                asfs_hist_percentile(h, 0.50) / 1000.0,
+                asfs_hist_percentile(h, 0.90) / 1000.0,
+                asfs_hist_percentile(h, 0.99) / 1000.0,
+                asfs_hist_percentile(h, 0.999) / 1000.0,
+                h->max_ns / 1000.0);
+        first = 0;
+    }
+    fprintf(out, "%s}\n", first ? "" : "\n");
+}
+
+int asfs_trace_enable(asfs_latency* lat, uint32_t capacity) {
+    if (!ASFS_STATS && capacity) return -ENOTSUP;
+    asfs_trace_rec* old = lat->trace;
+    lat->trace = NULL;
+    lat->trace_capacity = 0;
+    lat->trace_head = 0;
+    free(old);
+    if (capacity == 0) return 0;
+
+    asfs_trace_rec* ring = calloc(capacity, sizeof(asfs_trace_rec));
+    if (!ring) return -ENOMEM;
+    lat->trace_capacity = capacity;
+    lat->trace = ring;
+    return 0;
+}
+
+int asfs_trace_write(const asfs_latency* lat, FILE* out) {
+    if (!lat->trace) return -EINVAL;
+    uint64_t head = lat->trace_head;
+    uint64_t count = head < lat->trace_capacity ? head : lat->trace_capacity;
+    asfs_trace_header hdr = {
+        .magic = ASFS_TRACE_MAGIC,
+        .version = ASFS_TRACE_VERSION,
+        .rec_size = sizeof(asfs_trace_rec),
+        .count = count,
+        .dropped = head - count,
+    };
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) return -EIO;
+    // Пишем в хронологическом порядке, начиная с самой старой записи
+    for (uint64_t i = head - count; i < head; i++)
+        if (fwrite(&lat->trace[i % lat->trace_capacity], sizeof(asfs_trace_rec), 1, out) != 1)
+            return -EIO;
+    return 0;
+}
+
+int asfs_trace_print(FILE* in, FILE* out) {
+    asfs_trace_header hdr;
+    asfs_trace_rec rec;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1) return -EIO;
+    if (hdr.magic != ASFS_TRACE_MAGIC || hdr.version != ASFS_TRACE_VERSION ||
+        hdr.rec_size != sizeof(asfs_trace_rec))
+        return -EINVAL;
+
+    fprintf(out, "# %" PRIu64 " records, %" PRIu64 " dropped\n", hdr.count, hdr.dropped);
+    fprintf(out, "%-14s %-18s %10s %10s %6s %s\n",
+            "offset_us", "op", "inode", "dur_us", "blocks", "result");
+    uint64_t base = 0;
+    for (uint64_t i = 0; i < hdr.count; i++) {
+        if (fread(&rec, sizeof(rec), 1, in) != 1) return -EIO;
+        if (i == 0) base = rec.ts_ns;
+        const char* name = rec.op < ASFS_OP_MAX ? asfs_op_names[rec.op] : "?";
+        // Записи пишутся по завершении, так что вложенные шаги идут раньше
+        // операции и смещение у неё может быть отрицательным
+        fprintf(out, "%-14.3f %-18s ", (int64_t)(rec.ts_ns - base) / 1000.0, name);
+        if (rec.inode == (uint32_t)-1) fprintf(out, "%10s", "-");
+        else fprintf(out, "%10u", rec.inode);
+        fprintf(out, " %10.3f %6u %s\n", rec.duration_ns / 1000.0, rec.blocks,
+                rec.flags & 1 ? strerror(-rec.result) : "ok");
+    }
+    return 0;
+}
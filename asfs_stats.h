@@ -0,0 +1,158 @@
+#ifndef ASFS_STATS_H
+#define ASFS_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Счётчики горячих путей по подсистемам.
+// Собираются с -DASFS_STATS=0 - тогда все STAT_* превращаются в пустоту.
+#ifndef ASFS_STATS
+#define ASFS_STATS 1
+#endif
+
+typedef struct {
+    struct {
+        uint64_t read_calls;
+        uint64_t write_calls;
+        uint64_t sync_calls;
+        uint64_t bytes_read;
+        uint64_t bytes_written;
+        uint64_t zero_calls;     // asfs_dev_zero
+        uint64_t bytes_zeroed;
+        uint64_t prefetch_calls; // asfs_dev_prefetch (readahead)
+        uint64_t bytes_prefetched;
+        uint64_t discard_calls;  // asfs_dev_discard (дырки на месте свободных блоков)
+        uint64_t bytes_discarded;
+        uint64_t errors;
+    } io;
+    struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t inserts;
+        uint64_t evictions;
+        uint64_t pinned_skips;   // закреплённые узлы, пропущенные при вытеснении
+        uint64_t overflows;      // вставка не удалась - всё закреплено
+    } cache;
+    struct {
+        uint64_t block_allocs;
+        uint64_t block_frees;
+        uint64_t block_scan;     // просмотрено бит битмапа в allocate_block
+        uint64_t block_failures;
+        uint64_t inode_allocs;
+        uint64_t inode_frees;
+        uint64_t inode_scan;     // просмотрено inode при поиске свободного
+    } alloc;
+    struct {
+        uint64_t reads;          // чтения inode с диска
+        uint64_t writes;
+        uint64_t lookups;        // вызовы find_inode
+        uint64_t lookup_scan;    // просмотрено inode в find_inode
+        uint64_t lookup_misses;
+        uint64_t seq_reads;      // чтения, опознанные как последовательные
+        uint64_t bloom_negatives; // поиски, отбитые фильтром Блума без чтения таблицы
+        uint64_t bloom_false;    // фильтр сказал "может быть", а имени нет
+    } inode;
+    struct {
+        uint64_t saves;          // полные сбросы суперблока/битмапов
+    } meta;
+} asfs_stats;
+
+#if ASFS_STATS
+#define STAT_ADD(st, field, n) \
+    do { if (st) __atomic_fetch_add(&(st)->field, (n), __ATOMIC_RELAXED); } while (0)
+#else
+#define STAT_ADD(st, field, n) do { (void)(st); } while (0)
+#endif
+#define STAT_INC(st, field) STAT_ADD(st, field, 1)
+
+void asfs_stats_json(const asfs_stats* st, FILE* out);
+
+// Гистограммы задержек (HDR-подобные: 16 линейных корзин на каждую степень двойки,
+// точность ~6%) по операциям, внутренним шагам и видам ввода-вывода
+enum {
+    ASFS_OP_CREATE,
+    ASFS_OP_READ,
+    ASFS_OP_EDIT,
+    ASFS_OP_DELETE,
+    ASFS_OP_SNAPSHOT,
+    ASFS_OP_RESTORE,
+    ASFS_OP_LOOKUP,
+    ASFS_OP_LIST,
+    ASFS_STEP_LOOKUP_SCAN,
+    ASFS_STEP_ALLOC,
+    ASFS_STEP_DATA_WRITE,
+    ASFS_STEP_INODE_WRITE,
+    ASFS_STEP_META_WRITE,
+    ASFS_IO_READ,
+    ASFS_IO_WRITE,
+    ASFS_IO_SYNC,
+    ASFS_OP_MAX
+};
+
+#define ASFS_HIST_SUB_BITS 4
+#define ASFS_HIST_SUB (1 << ASFS_HIST_SUB_BITS)
+#define ASFS_HIST_MAX_BITS 40   // до ~18 минут в наносекундах
+#define ASFS_HIST_BUCKETS ((ASFS_HIST_MAX_BITS - ASFS_HIST_SUB_BITS + 1) * ASFS_HIST_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[ASFS_HIST_BUCKETS];
+} asfs_hist;
+
+// Запись бинарного трейса, 32 байта
+typedef struct {
+    uint64_t ts_ns;        // CLOCK_MONOTONIC на начало операции
+    uint64_t duration_ns;
+    uint32_t inode;        // (uint32_t)-1 если неизвестен
+    uint32_t blocks;       // затронуто блоков данных
+    uint16_t op;
+    uint16_t flags;        // 1 - операция завершилась ошибкой
+    int32_t result;
+} asfs_trace_rec;
+
+#define ASFS_TRACE_MAGIC 0x52545341  // "ASTR"
+#define ASFS_TRACE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t rec_size;
+    uint64_t count;
+    uint64_t dropped;      // перезаписано в кольце до сброса
+} asfs_trace_header;
+
+typedef struct {
+    asfs_hist hist[ASFS_OP_MAX];
+    asfs_trace_rec* trace;   // кольцевой буфер, NULL - трейс выключен
+    uint32_t trace_capacity;
+    uint64_t trace_head;
+} asfs_latency;
+
+extern const char* const asfs_op_names[ASFS_OP_MAX];
+
+uint64_t asfs_now_ns(void);
+void asfs_latency_record(asfs_latency* lat, int op, uint64_t start_ns,
+                         uint32_t inode, uint32_t blocks, int64_t result);
+void asfs_latency_reset(asfs_latency* lat);
+void asfs_latency_json(const asfs_latency* lat, FILE* out);
+uint64_t asfs_hist_percentile(const asfs_hist* h, double p);
+void asfs_hist_add(asfs_hist* h, uint64_t ns);
+void asfs_hist_merge(asfs_hist* dst, const asfs_hist* src);  // без атомиков
+
+int asfs_trace_enable(asfs_latency* lat, uint32_t capacity);  // 0 - выключить
+int asfs_trace_write(const asfs_latency* lat, FILE* out);
+int asfs_trace_print(FILE* in, FILE* out);
+
+#if ASFS_STATS
+#define LAT_NOW() asfs_now_ns()
+#define LAT_RECORD(lat, op, start, inode, blocks, result) \
+    asfs_latency_record(lat, op, start, inode, blocks, result)
+#else
+#define LAT_NOW() 0
+#define LAT_RECORD(lat, op, start, inode, blocks, result) \
+    do { (void)(lat); (void)(start); } while (0)
+#endif
+
+#endif
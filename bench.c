@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include "bench.h"
+
+#define BENCH_NAME_LEN 64
+#define READ_CHUNK (64 * 1024)
+#define RANDOM_READ_SIZE 4096
+
+typedef struct {
+    const char* workload;
+    uint64_t files;
+    uint64_t file_size;
+    uint64_t ops;
+    uint64_t errors;
+    int first_error;
+    uint64_t bytes;
+    double seconds;
+    uint64_t* lat;     // наносекунды на операцию
+    uint64_t lat_cap;
+} bench_result;
+
+typedef struct {
+    const bench_ops* ops;
+    const bench_config* cfg;
+    uint8_t* data;
+    uint8_t* buf;
+    uint64_t buf_size;
+    uint64_t files;     // сколько файлов реально создано
+    uint64_t file_size;
+    uint32_t rng;
+    int emitted;
+} bench_state;
+
+void bench_default_config(bench_config* cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->files[0] = 1000;
+    cfg->nfiles = 1;
+    cfg->sizes[0] = 256;
+    cfg->nsizes = 1;
+    cfg->snapshots = 32;
+    cfg->list_rounds = 5;
+    cfg->seed = 42;
+    cfg->format = BENCH_TEXT;
+    cfg->out = stdout;
+}
+
+int bench_parse_list(const char* str, uint64_t* out, int max) {
+    int n = 0;
+    while (*str) {
+        char* end;
+        unsigned long long v = strtoull(str, &end, 10);
+        if (end == str || n == max) return -EINVAL;
+        switch (*end) {
+            case 'k': case 'K': v <<= 10; end++; break;
+            case 'm': case 'M': v <<= 20; end++; break;
+            case 'g': case 'G': v <<= 30; end++; break;
+        }
+        if (*end != ',' && *end != '\0') return -EINVAL;
+        out[n++] = v;
+        str = *end ? end + 1 : end;
+    }
+    return n ? n : -EINVAL;
+}
+
+int bench_parse_format(const char* str) {
+    if (strcmp(str, "csv") == 0) return BENCH_CSV;
+    if (strcmp(str, "json") == 0) return BENCH_JSON;
+    if (strcmp(str, "text") == 0) return BENCH_TEXT;
+    return -EINVAL;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t next_rand(bench_state* st) {
+    // xorshift32 - детерминированно при одинаковом seed
+    st->rng ^= st->rng << 13;
+    st->rng ^= st->rng >> 17;
+    st->rng ^= st->rng << 5;
+    return st->rng;
+}
+
+static void file_name(char* name, uint64_t i) {
+    snprintf(name, BENCH_NAME_LEN, "bench_%08llu.dat", (unsigned long long)i);
+}
+
+static int workload_enabled(const bench_config* cfg, const char* workload) {
+    if (!cfg->workloads) return 1;
+    size_t len = strlen(workload);
+    const char* p = cfg->workloads;
+    while ((p = strstr(p, workload)) != NULL) {
+        int starts = p == cfg->workloads || p[-1] == ',';
+        int ends = p[len] == ',' || p[len] == '\0';
+        if (starts && ends) return 1;
+        p += len;
+    }
+    return 0;
+}
+
+static int result_begin(bench_state* st, bench_result* r, const char* workload, uint64_t expected) {
+    memset(r, 0, sizeof(*r));
+    r->workload = workload;
+    r->files = st->files;
+    r->file_size = st->file_size;
+    r->lat_cap = expected ? expected : 1;
+    r->lat = malloc(r->lat_cap * sizeof(uint64_t));
+    return r->lat ? 0 : -ENOMEM;
+}
+
+static void result_add(bench_result* r, uint64_t ns, int64_t rc, uint64_t bytes) {
+    if (rc < 0) {
+        if (!r->errors) r->first_error = rc;
+        r->errors++;
+        return;
+    }
+    if (r->ops < r->lat_cap) r->lat[r->ops] = ns;
+    r->ops++;
+    r->bytes += bytes;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const bench_result* r, double p) {
+    uint64_t n = r->ops < r->lat_cap ? r->ops : r->lat_cap;
+    if (n == 0) return 0;
+    uint64_t idx = (uint64_t)(p * n + 0.999999);
+    if (idx > 0) idx--;
+    if (idx >= n) idx = n - 1;
+    return r->lat[idx] / 1000.0;
+}
+
+static void result_emit(bench_state* st, bench_result* r) {
+    const bench_config* cfg = st->cfg;
+    uint64_t n = r->ops < r->lat_cap ? r->ops : r->lat_cap;
+    qsort(r->lat, n, sizeof(uint64_t), cmp_u64);
+
+    double ops_s = r->seconds > 0 ? r->ops / r->seconds : 0;
+    double mb_s = r->seconds > 0 ? r->bytes / (1024.0 * 1024.0) / r->seconds : 0;
+    double p50 = percentile_us(r, 0.50), p99 = percentile_us(r, 0.99), p999 = percentile_us(r, 0.999);
+    const char* err = r->errors ? strerror(-r->first_error) : "";
+
+    switch (cfg->format) {
+        case BENCH_CSV:
+            if (!st->emitted)
+                fprintf(cfg->out, "engine,workload,files,file_size,ops,errors,seconds,"
+                        "ops_per_sec,mb_per_sec,p50_us,p99_us,p999_us,error\n");
+            fprintf(cfg->out, "%s,%s,%llu,%llu,%llu,%llu,%.6f,%.2f,%.2f,%.2f,%.2f,%.2f,%s\n",
+                    st->ops->engine, r->workload,
+                    (unsigned long long)r->files, (unsigned long long)r->file_size,
+                    (unsigned long long)r->ops, (unsigned long long)r->errors,
+                    r->seconds, ops_s, mb_s, p50, p99, p999, err);
+            break;
+        case BENCH_JSON:
+            fprintf(cfg->out, "%s\n  {\"engine\": \"%s\", \"workload\": \"%s\", "
+                    "\"files\": %llu, \"file_size\": %llu, \"ops\": %llu, \"errors\": %llu, "
+                    "\"seconds\": %.6f, \"ops_per_sec\": %.2f, \"mb_per_sec\": %.2f, "
+                    "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, \"error\": \"%s\"}",
+                    st->emitted ? "," : "[",
+                    st->ops->engine, r->workload,
+                    (unsigned long long)r->files, (unsigned long long)r->file_size,
+                    (unsigned long long)r->ops, (unsigned long long)r->errors,
+                    r->seconds, ops_s, mb_s, p50, p99, p999, err);
+            break;
+        default:
+            if (!st->emitted)
+                fprintf(cfg->out, "%-12s %9s %9s %9s %6s %9s %12s %10s %10s %10s %10s\n",
+                        "workload", "files", "size", "ops", "errors", "seconds",
+                        "ops/s", "MB/s", "p50 us", "p99 us", "p999 us");
+            fprintf(cfg->out, "%-12s %9llu %9llu %9llu %6llu %9.3f %12.2f %10.2f %10.2f %10.2f %10.2f",
+                    r->workload,
+                    (unsigned long long)r->files, (unsigned long long)r->file_size,
+                    (unsigned long long)r->ops, (unsigned long long)r->errors,
+                    r->seconds, ops_s, mb_s, p50, p99, p999);
+            if (r->errors) fprintf(cfg->out, "  (%s)", err);
+            fprintf(cfg->out, "\n");
+            break;
+    }
+    st->emitted = 1;
+    free(r->lat);
+    r->lat = NULL;
+}
+
+static int run_create(bench_state* st, uint64_t files) {
+    bench_result r;
+    char name[BENCH_NAME_LEN];
+    if (result_begin(st, &r, "create", files) < 0) return -ENOMEM;
+
+    uint64_t start = now_ns();
+    st->files = 0;
+    for (uint64_t i = 0; i < files; i++) {
+        file_name(name, i);
+        uint64_t t = now_ns();
+        int rc = st->ops->create(st->ops->ctx, name, st->data, st->file_size);
+        result_add(&r, now_ns() - t, rc, st->file_size);
+        if (rc < 0) break; // Нет места или файл слишком большой - дальше смысла нет
+        st->files++;
+    }
+    r.seconds = (now_ns() - start) / 1e9;
+    r.files = st->files;
+    result_emit(st, &r);
+    return 0;
+}
+
+static void run_lookup(bench_state* st) {
+    bench_result r;
+    char name[BENCH_NAME_LEN];
+    if (result_begin(st, &r, "lookup", st->files) < 0) return;
+
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < st->files; i++) {
+        file_name(name, next_rand(st) % st->files);
+        uint64_t t = now_ns();
+        int rc = st->ops->lookup(st->ops->ctx, name);
+        result_add(&r, now_ns() - t, rc, 0);
+    }
+    r.seconds = (now_ns() - start) / 1e9;
+    result_emit(st, &r);
+}
+
+static void run_seqread(bench_state* st) {
+    bench_result r;
+    char name[BENCH_NAME_LEN];
+    if (result_begin(st, &r, "seqread", st->files) < 0) return;
+
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < st->files; i++) {
+        file_name(name, i);
+        uint64_t t = now_ns();
+        uint64_t off = 0;
+        ssize_t n = 0;
+        do {
+            n = st->ops->read(st->ops->ctx, name, st->buf, READ_CHUNK, off);
+            if (n > 0) off += n;
+        } while (n > 0 && off < st->file_size);
+        result_add(&r, now_ns() - t, n < 0 ? n : 0, off);
+    }
+    r.seconds = (now_ns() - start) / 1e9;
+    result_emit(st, &r);
+}
+
+static void run_randread(bench_state* st) {
+    bench_result r;
+    char name[BENCH_NAME_LEN];
+    if (result_begin(st, &r, "randread", st->files) < 0) return;
+
+    uint64_t chunk = st->file_size < RANDOM_READ_SIZE ? st->file_size : RANDOM_READ_SIZE;
+    uint64_t slots = st->file_size / RANDOM_READ_SIZE;
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < st->files; i++) {
+        file_name(name, next_rand(st) % st->files);
+        uint64_t off = slots > 1 ? (next_rand(st) % slots) * RANDOM_READ_SIZE : 0;
+        uint64_t t = now_ns();
+        ssize_t n = st->ops->read(st->ops->ctx, name, st->buf, chunk, off);
+        result_add(&r, now_ns() - t, n < 0 ? n : 0, n > 0 ? n : 0);
+    }
+    r.seconds = (now_ns() - start) / 1e9;
+    result_emit(st, &r);
+}
+
+static void run_overwrite(bench_state* st) {
+    bench_result r;
+    char name[BENCH_NAME_LEN];
+    if (result_begin(st, &r, "overwrite", st->files) < 0) return;
+
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < st->files; i++) {
+        file_name(name, i);
+        uint64_t t = now_ns();
+        int rc = st->ops->overwrite(st->ops->ctx, name, st->data, st->file_size);
+        result_add(&r, now_ns() - t, rc, st->file_size);
+    }
+    r.seconds = (now_ns() - start) / 1e9;
+    result_emit(st, &r);
+}
+
+static void run_snapshots(bench_state* st) {
+    bench_result cr, rr;
+    char name[BENCH_NAME_LEN], snap[BENCH_NAME_LEN];
+    uint64_t count = st->files < st->cfg->snapshots ? st->files : st->cfg->snapshots;
+    if (result_begin(st, &cr, "snap_create", count) < 0) return;
+    if (result_begin(st, &rr, "snap_restore", count) < 0) {
+        free(cr.lat);
+        return;
+    }
+
+    uint64_t made = 0;
+    uint64_t start = now_ns();
+    for (; made < count; made++) {
+        file_name(name, made);
+        snprintf(snap, sizeof(snap), "snap_%08llu", (unsigned long long)made);
+        uint64_t t = now_ns();
+        int rc = st->ops->snapshot_create(st->ops->ctx, name, snap);
+        result_add(&cr, now_ns() - t, rc, st->file_size);
+        if (rc < 0) break;
+    }
+    cr.seconds = (now_ns() - start) / 1e9;
+
+    if (st->ops->snapshot_restore) {
+        start = now_ns();
+        for (uint64_t i = 0; i < made; i++) {
+            file_name(name, i);
+            snprintf(snap, sizeof(snap), "snap_%08llu", (unsigned long long)i);
+            uint64_t t = now_ns();
+            int rc = st->ops->snapshot_restore(st->ops->ctx, name, snap);
+            result_add(&rr, now_ns() - t, rc, st->file_size);
+        }
+        rr.seconds = (now_ns() - start) / 1e9;
+    }
+
+    // Убираем снапшоты, чтобы они не влияли на следующие замеры
+    if (st->ops->snapshot_delete) {
+        for (uint64_t i = 0; i < made; i++) {
+            snprintf(snap, sizeof(snap), "snap_%08llu", (unsigned long long)i);
+            st->ops->snapshot_delete(st->ops->ctx, snap);
+        }
+    }
+    result_emit(st, &cr);
+    if (st->ops->snapshot_restore) result_emit(st, &rr);
+    else free(rr.lat);
+}
+
+static void run_list(bench_state* st) {
+    bench_result r;
+    uint32_t rounds = st->cfg->list_rounds ? st->cfg->list_rounds : 1;
+    if (result_begin(st, &r, "list", rounds) < 0) return;
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < rounds; i++) {
+        uint64_t entries = 0;
+        uint64_t t = now_ns();
+        int rc = st->ops->list(st->ops->ctx, &entries);
+        result_add(&r, now_ns() - t, rc, 0);
+    }
+    r.seconds = (now_ns() - start) / 1e9;
+    result_emit(st, &r);
+}
+
+static void run_delete(bench_state* st) {
+    bench_result r;
+    char name[BENCH_NAME_LEN];
+    if (result_begin(st, &r, "delete", st->files) < 0) return;
+
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < st->files; i++) {
+        file_name(name, i);
+        uint64_t t = now_ns();
+        int rc = st->ops->remove(st->ops->ctx, name);
+        result_add(&r, now_ns() - t, rc, 0);
+    }
+    r.seconds = (now_ns() - start) / 1e9;
+    result_emit(st, &r);
+}
+
+static int run_case(bench_state* st, uint64_t files, uint64_t file_size) {
+    const bench_ops* ops = st->ops;
+    const bench_config* cfg = st->cfg;
+
+    st->file_size = file_size;
+    st->files = 0;
+    if (ops->reset) {
+        int rc = ops->reset(ops->ctx, files, file_size);
+        if (rc < 0) return rc;
+    }
+
+    // Без create остальным нагрузкам не на чем работать
+    int rc = run_create(st, files);
+    if (rc < 0) return rc;
+    if (st->files == 0) return 0;
+
+    if (ops->lookup && workload_enabled(cfg, "lookup")) run_lookup(st);
+    if (ops->read && workload_enabled(cfg, "seqread")) run_seqread(st);
+    if (ops->read && workload_enabled(cfg, "randread")) run_randread(st);
+    if (ops->overwrite && workload_enabled(cfg, "overwrite")) run_overwrite(st);
+    if (ops->snapshot_create && workload_enabled(cfg, "snapshot")) run_snapshots(st);
+    if (ops->list && workload_enabled(cfg, "list")) run_list(st);
+    if (ops->remove && workload_enabled(cfg, "delete")) run_delete(st);
+    return 0;
+}
+
+int bench_run(const bench_ops* ops, const bench_config* cfg) {
+    bench_state st = {0};
+    st.ops = ops;
+    st.cfg = cfg;
+    st.rng = cfg->seed ? cfg->seed : 1;
+
+    uint64_t max_size = 0;
+    for (int i = 0; i < cfg->nsizes; i++)
+        if (cfg->sizes[i] > max_size) max_size = cfg->sizes[i];
+    st.buf_size = max_size > READ_CHUNK ? max_size : READ_CHUNK;
+    st.data = malloc(st.buf_size);
+    st.buf = malloc(st.buf_size);
+    if (!st.data || !st.buf) {
+        free(st.data);
+        free(st.buf);
+        return -ENOMEM;
+    }
+    for (uint64_t i = 0; i < st.buf_size; i++)
+        st.data[i] = next_rand(&st);
+
+    int rc = 0;
+    for (int s = 0; s < cfg->nsizes && rc == 0; s++)
+        for (int f = 0; f < cfg->nfiles && rc == 0; f++)
+            rc = run_case(&st, cfg->files[f], cfg->sizes[s]);
+
+    if (cfg->format == BENCH_JSON) fprintf(cfg->out, st.emitted ? "\n]\n" : "[]\n");
+    free(st.data);
+    free(st.buf);
+    return rc;
+}
@@ -0,0 +1,56 @@
+#ifndef ASFS_BENCH_H
+#define ASFS_BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Набор микро/макро бенчмарков, общий для asfs и Inode-X.
+// Движок подключается через таблицу операций; неподдерживаемые операции = NULL.
+
+#define BENCH_MAX_PARAMS 16
+
+enum { BENCH_TEXT, BENCH_CSV, BENCH_JSON };
+
+typedef struct {
+    const char* engine;
+    void* ctx;
+    // Пересоздаёт пустой образ под files файлов размера file_size
+    int (*reset)(void* ctx, uint32_t files, uint64_t file_size);
+    int (*create)(void* ctx, const char* name, const void* data, size_t size);
+    int (*lookup)(void* ctx, const char* name);
+    ssize_t (*read)(void* ctx, const char* name, void* buf, size_t count, uint64_t offset);
+    int (*overwrite)(void* ctx, const char* name, const void* data, size_t size);
+    int (*remove)(void* ctx, const char* name);
+    int (*snapshot_create)(void* ctx, const char* file, const char* snap);
+    int (*snapshot_restore)(void* ctx, const char* file, const char* snap);
+    int (*snapshot_delete)(void* ctx, const char* snap);
+    int (*list)(void* ctx, uint64_t* entries);
+    // Нужны только воспроизведению нагрузки (workload.h)
+    ssize_t (*append)(void* ctx, const char* name, const void* data, size_t size);
+    ssize_t (*write)(void* ctx, const char* name, const void* data, size_t size,
+                     uint64_t offset);
+    int (*truncate)(void* ctx, const char* name, uint64_t size);
+} bench_ops;
+
+typedef struct {
+    uint64_t files[BENCH_MAX_PARAMS];
+    int nfiles;
+    uint64_t sizes[BENCH_MAX_PARAMS];
+    int nsizes;
+    const char* workloads;   // "create,read,..." или NULL - все
+    uint32_t snapshots;      // максимум снапшотов на прогон
+    uint32_t list_rounds;
+    uint32_t seed;
+    int format;              // BENCH_TEXT / BENCH_CSV / BENCH_JSON
+    FILE* out;
+} bench_config;
+
+void bench_default_config(bench_config* cfg);
+// Разбирает "0,256,4K,1M" в массив; возвращает количество или -EINVAL
+int bench_parse_list(const char* str, uint64_t* out, int max);
+int bench_parse_format(const char* str);
+int bench_run(const bench_ops* ops, const bench_config* cfg);
+
+#endif
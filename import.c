@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "import.h"
+
+typedef struct {
+    char* path;          // путь на хосте
+    size_t size;
+} HostFile;
+
+typedef struct {
+    HostFile* files;
+    size_t count, cap;
+    size_t root_len;
+} FileList;
+
+// nftw не принимает контекст, так что список - глобальный на время обхода
+static FileList* walk_list;
+
+static int walk_cb(const char* path, const struct stat* st, int type, struct FTW* ftw) {
+    (void)ftw;
+    if (type != FTW_F || !S_ISREG(st->st_mode)) return 0;
+    FileList* list = walk_list;
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 1024;
+        HostFile* p = realloc(list->files, cap * sizeof(HostFile));
+        if (!p) return -1;
+        list->files = p;
+        list->cap = cap;
+    }
+    list->files[list->count].path = strdup(path);
+    list->files[list->count].size = st->st_size;
+    if (!list->files[list->count].path) return -1;
+    list->count++;
+    return 0;
+}
+
+// Пачка: файлы [first, first + count) списка и один буфер под все данные
+typedef struct {
+    const FileList* list;
+    import_file* files;
+    size_t first, count;
+    uint8_t* data;
+    size_t next;         // следующий файл для чтения (атомарно)
+    int threads;
+    pthread_t tids[16];
+    int started;
+} Batch;
+
+static int read_host(const char* path, uint8_t* buf, size_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -errno;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, buf + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            int rc = n < 0 ? -errno : -EIO;   // файл укоротился на ходу
+            close(fd);
+            return rc;
+        }
+        done += n;
+    }
+    close(fd);
+    return 0;
+}
+
+static void* batch_reader(void* arg) {
+    Batch* b = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (i >= b->count) break;
+        import_file* f = &b->files[i];
+        if (f->result == 0)
+            f->result = read_host(b->list->files[b->first + i].path, (uint8_t*)f->data, f->size);
+    }
+    return NULL;
+}
+
+static void batch_start(Batch* b) {
+    b->next = 0;
+    b->started = 0;
+    int threads = b->threads < (int)b->count ? b->threads : (int)b->count;
+    for (; b->started < threads; b->started++)
+        if (pthread_create(&b->tids[b->started], NULL, batch_reader, b) != 0) break;
+    if (b->started == 0) batch_reader(b);
+}
+
+static void batch_wait(Batch* b) {
+    for (int t = 0; t < b->started; t++) pthread_join(b->tids[t], NULL);
+    b->started = 0;
+}
+
+// Набирает следующую пачку из списка начиная с first; возвращает -ENOMEM или 0
+static int batch_fill(Batch* b, const import_ops* ops, const import_config* cfg,
+                      size_t first) {
+    const FileList* list = b->list;
+    size_t bytes = 0, n = 0;
+    while (first + n < list->count && n < cfg->batch_files) {
+        size_t size = list->files[first + n].size;
+        if (size <= ops->max_size && n > 0 && bytes + size > cfg->batch_bytes) break;
+        if (size <= ops->max_size) bytes += size;
+        n++;
+    }
+    free(b->data);
+    b->data = malloc(bytes ? bytes : 1);
+    if (!b->data) return -ENOMEM;
+    b->first = first;
+    b->count = n;
+
+    size_t off = 0;
+    for (size_t i = 0; i < n; i++) {
+        const HostFile* h = &list->files[first + i];
+        import_file* f = &b->files[i];
+        f->name = h->path + list->root_len;
+        f->size = h->size;
+        f->data = b->data + off;
+        f->result = 0;
+        if (h->size > ops->max_size) f->result = -EFBIG;
+        else if (strlen(f->name) >= ops->max_name) f->result = -ENAMETOOLONG;
+        else off += h->size;
+    }
+    return 0;
+}
+
+static int batch_commit(Batch* b, const import_ops* ops, const import_config* cfg,
+                        import_report* rep) {
+    // Движку отдаём только прочитанные файлы, сохраняя порядок
+    size_t ok = 0;
+    for (size_t i = 0; i < b->count; i++) {
+        if (b->files[i].result < 0) {
+            rep->failed++;
+            if (cfg->log) fprintf(cfg->log, "%s: %s\n", b->files[i].name,
+                                  strerror(-b->files[i].result));
+            continue;
+        }
+        b->files[ok++] = b->files[i];
+    }
+    if (ok == 0) return 0;
+    int rc = ops->create_batch(ops->ctx, b->files, ok);
+    if (rc < 0) return rc;
+    rep->batches++;
+    for (size_t i = 0; i < ok; i++) {
+        if (b->files[i].result == 0) {
+            rep->files++;
+            rep->bytes += b->files[i].size;
+        } else {
+            rep->failed++;
+            if (cfg->log) fprintf(cfg->log, "%s: %s\n", b->files[i].name,
+                                  strerror(-b->files[i].result));
+        }
+    }
+    return 0;
+}
+
+int import_tree(const import_ops* ops, const import_config* user_cfg, const char* dir,
+                import_report* rep) {
+    import_config cfg = *user_cfg;
+    if (cfg.threads <= 0) cfg.threads = 4;
+    if (cfg.threads > 16) cfg.threads = 16;
+    if (!cfg.batch_files) cfg.batch_files = 4096;
+    if (!cfg.batch_bytes) cfg.batch_bytes = 64u << 20;
+    memset(rep, 0, sizeof(*rep));
+
+    FileList list = {0};
+    size_t dir_len = strlen(dir);
+    while (dir_len > 1 && dir[dir_len-1] == '/') dir_len--;
+    list.root_len = dir_len + 1;
+    walk_list = &list;
+    int rc = nftw(dir, walk_cb, 64, FTW_PHYS) != 0 ? (errno ? -errno : -ENOMEM) : 0;
+    walk_list = NULL;
+
+    // Две пачки: пока одна пишется в образ, вторая читается с хоста
+    Batch batch[2] = {
+        { .list = &list, .threads = cfg.threads },
+        { .list = &list, .threads = cfg.threads },
+    };
+    for (int i = 0; i < 2 && rc == 0; i++) {
+        batch[i].files = calloc(cfg.batch_files, sizeof(import_file));
+        if (!batch[i].files) rc = -ENOMEM;
+    }
+
+    size_t next = 0;
+    int cur = 0;
+    if (rc == 0 && list.count) {
+        rc = batch_fill(&batch[cur], ops, &cfg, next);
+        if (rc == 0) batch_start(&batch[cur]);
+    }
+    while (rc == 0 && next < list.count) {
+        Batch* b = &batch[cur];
+        batch_wait(b);
+        next = b->first + b->count;
+        Batch* nb = &batch[cur ^ 1];
+        if (next < list.count) {
+            rc = batch_fill(nb, ops, &cfg, next);
+            if (rc == 0) batch_start(nb);
+        }
+        int crc = batch_commit(b, ops, &cfg, rep);
+        if (rc == 0) rc = crc;
+        cur ^= 1;
+    }
+    for (int i = 0; i < 2; i++) {
+        batch_wait(&batch[i]);
+        free(batch[i].files);
+        free(batch[i].data);
+    }
+    for (size_t i = 0; i < list.count; i++) free(list.files[i].path);
+    free(list.files);
+    return rc;
+}
@@ -0,0 +1,44 @@
+#ifndef ASFS_IMPORT_H
+#define ASFS_IMPORT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Импорт дерева каталогов хоста, общий для asfs и Inode-X.
+// Файлы читаются пачками в нескольких потоках; пока движок пишет одну пачку,
+// следующая уже читается с хоста. Имена в образе - пути относительно корня.
+
+typedef struct {
+    const char* name;    // относительный путь
+    const void* data;
+    size_t size;
+    int result;          // заполняет движок: 0 или -errno
+} import_file;
+
+typedef struct {
+    void* ctx;
+    size_t max_size;     // файлы больше - сразу -EFBIG, не читая
+    size_t max_name;     // длина имени с завершающим нулём
+    // Создаёт пачку файлов; -errno - пачка не записана вовсе
+    int (*create_batch)(void* ctx, import_file* files, size_t n);
+} import_ops;
+
+typedef struct {
+    int threads;             // потоков чтения, <= 0 - 4
+    size_t batch_files;      // 0 - 4096
+    size_t batch_bytes;      // 0 - 64 МБ
+    FILE* log;               // сюда пишутся пропущенные файлы, может быть NULL
+} import_config;
+
+typedef struct {
+    uint64_t files;          // создано
+    uint64_t bytes;
+    uint64_t failed;         // не прочитались или отвергнуты движком
+    uint64_t batches;
+} import_report;
+
+int import_tree(const import_ops* ops, const import_config* cfg, const char* dir,
+                import_report* rep);
+
+#endif
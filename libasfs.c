@@ -0,0 +1,4053 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include "asfs_io.h"
+#include "asfs_bloom.h"
+#include "workload.h"
+#include "libasfs.h"
+
+#define MAX_NAME_LEN ASFS_NAME_MAX
+#define MAX_SNAPSHOTS 32      // мест в таблице снапшотов старой разметки
+#define MAGIC_NUMBER 0x46534653
+#define FS_VERSION 2
+#define FS_VERSION_NOEXT 1   // до asfs_resize: таблицы приращений в суперблоке нет
+#define MAX_EXTENTS 8
+#define NO_INODE ((uint32_t)-1)
+
+#ifndef ASFS_DEBUG
+#define ASFS_DEBUG 0
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t total_blocks;
+    uint32_t inode_count;
+    uint32_t free_inodes;
+    uint32_t free_blocks;
+    uint32_t first_data_block;
+    uint32_t block_size;
+    uint32_t snapshot_count;
+
+  uint32_t next_snap_id;
+    uint32_t version;
+    // Первые блоки областей метаданных, всё выровнено по блокам
+    uint32_t block_bitmap;
+    uint32_t inode_bitmap;
+    uint32_t inode_table;
+    uint32_t snapshot_table;
+    // Приращения образа (asfs_resize). Новое место дописывается в конец,
+    // его метаданные лежат в начале нового места, старые не переписываются
+    uint32_t ext_count;
+    struct {
+        uint32_t first_block;  // первый блок приращения (прежний total_blocks)
+        uint32_t meta_blocks;  // из них заняты метаданными приращения
+        uint32_t bmap_bit;     // сегмент битмапа блоков: первый бит, где лежит
+        uint32_t bmap_block;   // и сколько блоков (0 - сегмент не понадобился)
+        uint32_t bmap_blocks;
+        uint32_t imap_bit;     // то же для битмапа inode
+        uint32_t imap_block;
+        uint32_t imap_blocks;
+        uint32_t inode_first;  // добавленные inode и их таблица
+        uint32_t inode_count;
+        uint32_t inode_table;
+    } ext[MAX_EXTENTS];
+    // Упорядоченный индекс имён (asfs_list_sorted): прогон и журнал за ним
+    // лежат одним непрерывным куском блоков данных
+    uint32_t index_magic;      // INDEX_MAGIC - индекс есть и ведётся
+    uint32_t index_start;
+    uint32_t index_blocks;
+    uint32_t index_count;      // записей в отсортированном прогоне
+    uint32_t index_log_cap;    // мест в журнале
+    uint32_t index_log_count;
+    // Фильтр Блума по именам: пишется в asfs_close, BLOOM_CLEAN ставится только
+    // после записи и снимается первым же create. Без него фильтр строится заново
+    uint32_t bloom_state;
+    uint32_t bloom_start;
+    uint32_t bloom_blocks;
+    uint32_t bloom_bits_log2;
+    // Набор образов с чередованием: метка (asfs_stripe_label) лежит в блоках сразу
+    // за суперблоком, внутри первой полосы, и читается до открытия остальных образов
+    uint32_t stripe_table;     // 0 - один образ
+    uint32_t stripe_blocks;
+    // Снапшоты всей ФС: текущая эпоха и таблица замороженных эпох (EpochRec)
+    uint32_t epoch;
+    uint32_t epoch_count;
+    uint32_t epoch_start;
+    uint32_t epoch_blocks;
+    // Каталог снапшотов файлов (SnapRec) в непрерывном куске блоков данных;
+    // 0 блоков при snapshot_count != 0 - снапшоты ещё в старой таблице
+    uint32_t catalog_start;
+    uint32_t catalog_blocks;
+    uint32_t catalog_slots;    // занятых и освободившихся мест
+    // Список сирот: удалённые, но ещё не освобождённые inode (номера подряд в куске
+    // блоков данных). Разбирается фоновым потоком, после сбоя - при монтировании
+    uint32_t orphan_start;
+    uint32_t orphan_blocks;
+    uint32_t orphan_count;
+    uint32_t gc_pending;       // удалён снапшот ФС, сборка версий ещё не прошла
+    // Растёт с каждой операцией, что-то записавшей: другой процесс, увидев на диске
+    // не то поколение, что у него в памяти, перечитывает метаданные
+    uint64_t generation;
+} SuperBlock;
+typedef struct {
+    uint32_t number;
+    uint32_t snapshot_count; // Добавляем счетчик снапшотов
+    uint32_t size;
+    uint32_t blocks[12];
+    char name[MAX_NAME_LEN];
+    uint8_t used;
+    time_t created;
+    time_t modified;
+    uint32_t snapshot_id;
+    uint32_t birth;          // эпоха, с которой действует эта версия inode
+    uint32_t death;          // у версии: эпоха, в которой её сменила следующая
+    uint32_t prev;           // предыдущая версия (0 - нет)
+    uint32_t snapshot_parent;
+    uint8_t is_snapshot;     // 1 - снапшот файла, INODE_VERSION - старая версия,
+                             // INODE_ORPHAN - удалён и ждёт освобождения
+    uint8_t type; // 0 - файл, 1 - директория
+} Inode;
+
+#define INODE_VERSION 2
+#define INODE_ORPHAN 3
+// Запись старой таблицы снапшотов (MAX_SNAPSHOTS штук в snapshot_table),
+// читается только для переноса в каталог
+typedef struct {
+    char snapshot_name[MAX_NAME_LEN];
+    uint32_t snap_id;       // Уникальный ID снапшота
+    Inode inode;
+    uint8_t* data;
+    time_t timestamp;
+
+    uint32_t original_inode; // Исходный inode
+    uint32_t snapshot_inode; // Inode снапшота
+} Snapshot;
+
+// Запись каталога снапшотов, 256 байт
+typedef struct {
+    char name[MAX_NAME_LEN];
+    uint32_t snap_id;
+    uint32_t original_inode;
+    uint32_t snapshot_inode;
+    uint32_t used;
+    int64_t timestamp;
+    uint8_t reserved[8];
+} SnapRec;
+
+#define NO_SLOT ((uint32_t)-1)
+
+// Каталог в памяти: все места и цепочки хеша по имени и по исходному inode
+typedef struct {
+    SnapRec* recs;
+    uint32_t cap;
+    uint32_t* by_name;     // головы цепочек, mask + 1 штук
+    uint32_t* by_orig;
+    uint32_t* name_next;   // у свободного места - следующее свободное
+    uint32_t* orig_next;
+    uint32_t mask;
+    uint32_t free_head;
+} SnapCatalog;
+
+// Запись индекса имён: ключ - первые 28 байт имени (без нуля, если имя длиннее)
+#define INDEX_MAGIC 0x58444e49   // "INDX"
+#define INDEX_KEY 28
+#define INDEX_DEL 0x80000000u    // запись журнала об удалении
+#define BLOOM_CLEAN 0x4d4f4c42   // "BLOM"
+typedef struct {
+    char key[INDEX_KEY];
+    uint32_t inode;
+} IndexEntry;
+
+// Запись таблицы снапшотов ФС
+typedef struct {
+    char name[ASFS_EPOCH_NAME];
+    uint32_t epoch;
+    uint32_t reserved;
+    int64_t created;
+} EpochRec;
+
+// Поколения областей метаданных - в блоке 0 сразу за суперблоком (если влезают).
+// Операция с записью продвигает поколения того, что поменяла, и другой процесс
+// перечитывает только это: куски битмапов, каталог, список сирот, таблицу эпох
+#define SHARE_MAGIC 0x52414853   // "SHAR"
+#define SHARE_REGIONS 256        // кусков на каждый битмап
+typedef struct {
+    uint64_t generation;       // поколение суперблока, при котором таблица записана
+    uint64_t origin;           // поколение, с которого таблица ведётся
+    uint32_t magic;
+    uint32_t regions;
+    uint32_t layout;           // разметка (рост, ремонт): перечитывается всё
+    uint32_t catalog;
+    uint32_t orphans;
+    uint32_t epochs;
+    uint32_t names;            // новые имена: фильтр Блума больше не годится
+    uint32_t reserved;
+    uint32_t map[2][SHARE_REGIONS];  // куски битмапа блоков и битмапа inode
+} ShareTable;
+
+struct asfs_fs {
+    asfs_dev dev;
+    int mode;
+    SuperBlock sb;
+    uint8_t* block_bitmap;
+    uint8_t* inode_bitmap;
+    SnapCatalog cat;
+    asfs_stats stats;
+    asfs_latency lat;
+    uint32_t op_inode;     // inode и число блоков текущей операции - для трейса
+    uint32_t op_blocks;
+    uint32_t block_hint;   // откуда начинать поиск свободного блока/inode
+    uint32_t inode_hint;
+    int discard;           // дырявить освобождённые блоки (asfs_set_discard)
+    asfs_discard_queue discard_queue;
+    asfs_bloom bloom;      // фильтр имён, NULL bits - ещё не загружен/не построен
+    EpochRec* epochs;      // таблица снапшотов ФС, sb.epoch_count записей
+    uint32_t epoch_max;    // самая новая замороженная эпоха (0 - снапшотов нет)
+    uint32_t* orphans;     // список сирот, sb.orphan_count записей
+    uint32_t orphan_cap;
+    uint8_t* orphan_map;   // те же inode битами, orphan_bits штук
+    uint32_t orphan_bits;
+    // Операции сериализуются: с ФС параллельно работает фоновый поток освобождения.
+    // Рекурсивная - колбэки обходов могут звать другие операции
+    pthread_mutex_t lock;
+    pthread_cond_t reclaim_cond;
+    pthread_t reclaimer;
+    int reclaiming;        // поток запущен (asfs_set_reclaim)
+    int reclaim_idle;      // поток спит без таймаута - будить на первую же сироту
+    int reclaim_stop;
+    // Образ общий с другими процессами (нет ASFS_PRIVATE): под fs->lock держится
+    // и блокировка fcntl на образ, lock_depth - глубина вложенных fs_lock
+    int shared;
+    uint32_t lock_depth;
+    int lock_type;         // F_RDLCK или F_WRLCK, пока блокировка образа взята
+    uint64_t op_writes;    // dev.writes на входе в блокировку
+    int stale;             // перечитать метаданные не вышло - дальше только чтение
+    int share_on;          // таблица поколений влезает в блок 0
+    ShareTable share;      // поколения, как на диске после нашей последней операции
+    uint8_t map_dirty[2][SHARE_REGIONS / 8];  // куски битмапов, ещё не записанные
+    workload_log* capture; // asfs_capture_enable
+    uint64_t capture_start;
+};
+
+const char* asfs_strerror(int err) {
+    return strerror(err < 0 ? -err : err);
+}
+
+static uint32_t base_inodes(asfs_fs* fs) {
+    return fs->sb.ext_count ? fs->sb.ext[0].inode_first : fs->sb.inode_count;
+}
+
+// Inode приращений лежат в своих таблицах; *run - сколько inode начиная
+// с inode_num идут на диске подряд
+static uint64_t inode_pos(asfs_fs* fs, uint32_t inode_num, uint32_t* run) {
+    uint64_t bs = fs->sb.block_size;
+    uint32_t base = base_inodes(fs);
+    if (inode_num < base) {
+        if (run) *run = base - inode_num;
+        return fs->sb.inode_table * bs + (uint64_t)inode_num * sizeof(Inode);
+    }
+    for (uint32_t k = 0; k < fs->sb.ext_count; k++) {
+        uint32_t rel = inode_num - fs->sb.ext[k].inode_first;
+        if (inode_num < fs->sb.ext[k].inode_first || rel >= fs->sb.ext[k].inode_count) continue;
+        if (run) *run = fs->sb.ext[k].inode_count - rel;
+        return fs->sb.ext[k].inode_table * bs + (uint64_t)rel * sizeof(Inode);
+    }
+    if (run) *run = 1;
+    return 0;
+}
+
+static uint64_t inode_offset(asfs_fs* fs, uint32_t inode_num) {
+    return inode_pos(fs, inode_num, NULL);
+}
+
+// Чтение/запись n подряд идущих по номеру inode, с разбиением по таблицам
+static int inodes_io(asfs_fs* fs, uint32_t first, uint32_t n, void* buf, int write) {
+    uint8_t* p = buf;
+    while (n > 0) {
+        uint32_t run;
+        uint64_t off = inode_pos(fs, first, &run);
+        if (run > n) run = n;
+        int rc = write ? asfs_dev_write(&fs->dev, p, (size_t)run * sizeof(Inode), off)
+                       : asfs_dev_read(&fs->dev, p, (size_t)run * sizeof(Inode), off);
+        if (rc < 0) return rc;
+        p += (size_t)run * sizeof(Inode);
+        first += run;
+        n -= run;
+    }
+    return 0;
+}
+
+// Битмапы лежат сегментами: основной после суперблока и по одному на приращение,
+// каждый начинается с бита, кратного 8 * block_size. Переносит байты
+// [first, first + len) битмапа между памятью и диском
+static int bitmap_io(asfs_fs* fs, int inodes, uint8_t* map, size_t first, size_t len,
+                     int write) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    for (uint32_t k = 0; k <= sb->ext_count && len > 0; k++) {
+        uint64_t seg_bit, seg_block, seg_blocks;
+        if (k == 0) {
+            seg_bit = 0;
+            seg_block = inodes ? sb->inode_bitmap : sb->block_bitmap;
+            seg_blocks = inodes ? sb->inode_table - sb->inode_bitmap
+                                : sb->inode_bitmap - sb->block_bitmap;
+        } else {
+            seg_bit = inodes ? sb->ext[k-1].imap_bit : sb->ext[k-1].bmap_bit;
+            seg_block = inodes ? sb->ext[k-1].imap_block : sb->ext[k-1].bmap_block;
+            seg_blocks = inodes ? sb->ext[k-1].imap_blocks : sb->ext[k-1].bmap_blocks;
+        }
+        size_t seg_first = seg_bit / 8, seg_end = seg_first + seg_blocks * bs;
+        if (!seg_blocks || first >= seg_end || first < seg_first) continue;
+        size_t n = seg_end - first < len ? seg_end - first : len;
+        uint64_t off = seg_block * bs + (first - seg_first);
+        int rc = write ? asfs_dev_write(&fs->dev, map + first, n, off)
+                       : asfs_dev_read(&fs->dev, map + first, n, off);
+        if (rc < 0) return rc;
+        first += n;
+        len -= n;
+    }
+    return len ? -EIO : 0;
+}
+
+static size_t map_bytes(asfs_fs* fs, int inodes) {
+    return ((inodes ? fs->sb.inode_count : fs->sb.total_blocks) + 7) / 8;
+}
+
+// Битмап делится на SHARE_REGIONS кусков поровну (последний короче)
+static size_t region_bytes(asfs_fs* fs, int inodes) {
+    size_t n = (map_bytes(fs, inodes) + SHARE_REGIONS - 1) / SHARE_REGIONS;
+    return n ? n : 1;
+}
+
+static void map_set(asfs_fs* fs, int inodes, uint32_t i, int on) {
+    uint8_t* map = inodes ? fs->inode_bitmap : fs->block_bitmap;
+    if (on) map[i/8] |= 1 << (i%8);
+    else map[i/8] &= ~(1 << (i%8));
+    uint32_t r = i / 8 / region_bytes(fs, inodes);
+    fs->map_dirty[inodes][r/8] |= 1 << (r%8);
+}
+
+static void map_touch_all(asfs_fs* fs) {
+    memset(fs->map_dirty, 0xff, sizeof(fs->map_dirty));
+}
+
+// Переносит куски битмапа, отмеченные в sel; соседние - одним bitmap_io
+static int map_regions_io(asfs_fs* fs, int inodes, const uint8_t* sel, int write) {
+    uint8_t* map = inodes ? fs->inode_bitmap : fs->block_bitmap;
+    size_t total = map_bytes(fs, inodes), rb = region_bytes(fs, inodes);
+    for (uint32_t r = 0; r < SHARE_REGIONS; r++) {
+        if (!(sel[r/8] & (1 << (r%8)))) continue;
+        uint32_t end = r + 1;
+        while (end < SHARE_REGIONS && (sel[end/8] & (1 << (end%8)))) end++;
+        size_t first = r * rb, last = end * rb < total ? end * rb : total;
+        int rc = first < last ? bitmap_io(fs, inodes, map, first, last - first, write) : 0;
+        if (rc < 0) return rc;
+        r = end;
+    }
+    return 0;
+}
+
+// Изменённые куски - на диск, их поколения продвигаются
+static int map_flush(asfs_fs* fs, int inodes) {
+    uint8_t* dirty = fs->map_dirty[inodes];
+    int rc = map_regions_io(fs, inodes, dirty, 1);
+    if (rc < 0) return rc;
+    for (uint32_t r = 0; r < SHARE_REGIONS; r++)
+        if (dirty[r/8] & (1 << (r%8))) fs->share.map[inodes][r]++;
+    memset(dirty, 0, SHARE_REGIONS / 8);
+    return 0;
+}
+
+static int read_inode(asfs_fs* fs, uint32_t inode_num, Inode* node) {
+    STAT_INC(&fs->stats, inode.reads);
+    return asfs_dev_read(&fs->dev, node, sizeof(Inode), inode_offset(fs, inode_num));
+}
+
+static int write_inode(asfs_fs* fs, uint32_t inode_num, const Inode* node) {
+    uint64_t t = LAT_NOW();
+    STAT_INC(&fs->stats, inode.writes);
+    int rc = asfs_dev_write(&fs->dev, node, sizeof(Inode), inode_offset(fs, inode_num));
+    LAT_RECORD(&fs->lat, ASFS_STEP_INODE_WRITE, t, inode_num, 0, rc);
+    fs->op_inode = inode_num;
+    return rc;
+}
+
+static uint32_t bytes_to_blocks(uint64_t bytes, uint32_t block_size) {
+    return (bytes + block_size - 1) / block_size;
+}
+
+static uint32_t blocks_for(asfs_fs* fs, uint64_t size) {
+    return (size + fs->sb.block_size - 1) / fs->sb.block_size;
+}
+
+static int inode_in_use(asfs_fs* fs, uint32_t i) {
+    return fs->inode_bitmap[i/8] & (1 << (i%8));
+}
+
+// Занят и не сирота: сирот поиск по имени и листинг пропускают, не читая
+static int inode_live(asfs_fs* fs, uint32_t i) {
+    if (!inode_in_use(fs, i)) return 0;
+    return i >= fs->orphan_bits || !(fs->orphan_map[i/8] & (1 << (i%8)));
+}
+
+static void fill_stat(uint32_t inode_num, const Inode* node, asfs_stat* st) {
+    memset(st, 0, sizeof(*st));
+    st->inode = inode_num;
+    st->size = node->size;
+    st->type = node->type;
+    st->is_snapshot = node->is_snapshot == 1;
+    st->snapshot_id = node->snapshot_id;
+    st->snapshot_count = node->snapshot_count;
+    st->created = node->created;
+    st->modified = node->modified;
+    memcpy(st->name, node->name, MAX_NAME_LEN);
+    st->name[MAX_NAME_LEN-1] = '\0';
+}
+
+static int check_name(const char* name) {
+    size_t len = strlen(name);
+    if (len == 0) return -EINVAL;
+    if (len >= MAX_NAME_LEN) return -ENAMETOOLONG;
+    return 0;
+}
+
+static void free_blocks(asfs_fs* fs, uint32_t* blocks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (blocks[i] == 0 || blocks[i] >= fs->sb.total_blocks) continue;
+        uint32_t byte = blocks[i] / 8;
+        uint8_t bit = 1 << (blocks[i] % 8);
+        if (fs->block_bitmap[byte] & bit) {
+            map_set(fs, 0, blocks[i], 0);
+            fs->sb.free_blocks++;
+            STAT_INC(&fs->stats, alloc.block_frees);
+            if (fs->discard) asfs_discard_add(&fs->discard_queue, blocks[i]);
+        }
+        blocks[i] = 0; // Важно обнулить!
+    }
+}
+
+// Поиск идёт от места последнего выделения с переходом через конец,
+// так что подряд выделенные блоки лежат подряд и на диске
+static uint32_t allocate_block(asfs_fs* fs) {
+    uint64_t t = LAT_NOW();
+    uint32_t span = fs->sb.total_blocks - fs->sb.first_data_block;
+    uint32_t start = fs->block_hint - fs->sb.first_data_block;
+    if (fs->block_hint < fs->sb.first_data_block || start >= span) start = 0;
+    for (uint32_t n = 0; n < span; n++) {
+        uint32_t i = fs->sb.first_data_block + (start + n) % span;
+        uint32_t byte = i / 8;
+        uint8_t bit = 1 << (i % 8);
+        if (!(fs->block_bitmap[byte] & bit)) {
+            map_set(fs, 0, i, 1);
+            fs->sb.free_blocks--;
+            fs->block_hint = i + 1;
+            STAT_INC(&fs->stats, alloc.block_allocs);
+            STAT_ADD(&fs->stats, alloc.block_scan, n + 1);
+            LAT_RECORD(&fs->lat, ASFS_STEP_ALLOC, t, NO_INODE, 1, 0);
+            return i;
+        }
+    }
+    STAT_INC(&fs->stats, alloc.block_failures);
+    STAT_ADD(&fs->stats, alloc.block_scan, fs->sb.total_blocks - fs->sb.first_data_block);
+    LAT_RECORD(&fs->lat, ASFS_STEP_ALLOC, t, NO_INODE, 0, -ENOSPC);
+    return 0; // Невалидный блок
+}
+
+static uint32_t find_free_inode(asfs_fs* fs) {
+    uint32_t span = fs->sb.inode_count - 1; // Inode 0 - корень
+    uint32_t start = fs->inode_hint ? fs->inode_hint - 1 : 0;
+    if (start >= span) start = 0;
+    for (uint32_t n = 0; n < span; n++) {
+        uint32_t i = 1 + (start + n) % span;
+        if (!inode_in_use(fs, i)) {
+            if (ASFS_DEBUG) fprintf(stderr, "[DEBUG] Found free inode: %u\n", i);
+            STAT_ADD(&fs->stats, alloc.inode_scan, n + 1);
+            fs->inode_hint = i + 1;
+            return i;
+        }
+    }
+    STAT_ADD(&fs->stats, alloc.inode_scan, fs->sb.inode_count);
+    return NO_INODE;
+}
+
+static int find_inode(asfs_fs* fs, const char* filename, uint32_t* out, Inode* node) {
+    uint64_t t = LAT_NOW();
+    uint32_t scanned = 0;
+    int rc = -ENOENT;
+    STAT_INC(&fs->stats, inode.lookups);
+    // Фильтр Блума отвечает "точно нет", не трогая таблицу inode
+    if (fs->bloom.bits && !asfs_bloom_maybe(&fs->bloom, filename)) {
+        STAT_INC(&fs->stats, inode.bloom_negatives);
+        STAT_INC(&fs->stats, inode.lookup_misses);
+        LAT_RECORD(&fs->lat, ASFS_STEP_LOOKUP_SCAN, t, NO_INODE, 0, rc);
+        return rc;
+    }
+    for (uint32_t i = 0; i < fs->sb.inode_count; i++) {
+        if (!inode_live(fs, i)) continue;
+
+        Inode tmp;
+        rc = read_inode(fs, i, &tmp);
+        if (rc < 0) break;
+        rc = -ENOENT;
+        scanned++;
+        STAT_INC(&fs->stats, inode.lookup_scan);
+
+        if (tmp.used && !tmp.is_snapshot && strcmp(tmp.name, filename) == 0) {
+            if (out) *out = i;
+            if (node) *node = tmp;
+            fs->op_inode = i;
+            rc = 0;
+            break;
+        }
+    }
+    if (rc == -ENOENT) STAT_INC(&fs->stats, inode.lookup_misses);
+    if (rc == -ENOENT && fs->bloom.bits) STAT_INC(&fs->stats, inode.bloom_false);
+    // В поле blocks для этого шага - число просмотренных inode
+    LAT_RECORD(&fs->lat, ASFS_STEP_LOOKUP_SCAN, t, rc == 0 ? fs->op_inode : NO_INODE,
+               scanned, rc);
+    return rc;
+}
+
+// ---- каталог снапшотов файлов ----
+// На диске - массив SnapRec; место удалённого снапшота занимает следующий.
+// Изменение пишет одну запись, а если места мало - каталог целиком переезжает
+// в кусок вдвое больше. В памяти поверх массива цепочки хеша по имени и по
+// исходному inode, так что поиск не перебирает каталог
+
+static uint32_t alloc_area(asfs_fs* fs, uint32_t n);
+static void free_area(asfs_fs* fs, uint32_t start, uint32_t count);
+static int index_write(asfs_fs* fs, const IndexEntry* v, uint32_t n, uint32_t extra);
+static uint32_t name_hash(const char* s);
+static int catalog_write(asfs_fs* fs, uint32_t slot);
+
+static uint32_t orig_hash(uint32_t inode) {
+    return inode * 2654435761u;
+}
+
+static void catalog_link(SnapCatalog* c, uint32_t slot) {
+    uint32_t h = name_hash(c->recs[slot].name) & c->mask;
+    c->name_next[slot] = c->by_name[h];
+    c->by_name[h] = slot;
+    h = orig_hash(c->recs[slot].original_inode) & c->mask;
+    c->orig_next[slot] = c->by_orig[h];
+    c->by_orig[h] = slot;
+}
+
+static void chain_remove(uint32_t* head, uint32_t* next, uint32_t slot) {
+    for (uint32_t* p = head; *p != NO_SLOT; p = &next[*p]) {
+        if (*p == slot) {
+            *p = next[slot];
+            return;
+        }
+    }
+}
+
+// Цепочки и список свободных мест заново по первым catalog_slots местам
+static void catalog_reindex(asfs_fs* fs) {
+    SnapCatalog* c = &fs->cat;
+    memset(c->by_name, 0xff, (c->mask + 1) * sizeof(uint32_t));
+    memset(c->by_orig, 0xff, (c->mask + 1) * sizeof(uint32_t));
+    c->free_head = NO_SLOT;
+    for (uint32_t slot = fs->sb.catalog_slots; slot-- > 0; ) {
+        if (c->recs[slot].used) {
+            catalog_link(c, slot);
+        } else {
+            c->name_next[slot] = c->free_head;
+            c->free_head = slot;
+        }
+    }
+}
+
+// Места в памяти хотя бы под need записей
+static int catalog_grow(asfs_fs* fs, uint32_t need) {
+    SnapCatalog* c = &fs->cat;
+    if (need <= c->cap && c->by_name) return 0;
+    uint32_t cap = c->cap ? c->cap : 32;
+    while (cap < need) cap *= 2;
+    SnapRec* recs = realloc(c->recs, cap * sizeof(SnapRec));
+    if (!recs) return -ENOMEM;
+    c->recs = recs;
+    memset(recs + c->cap, 0, (cap - c->cap) * sizeof(SnapRec));
+    uint32_t* name_next = realloc(c->name_next, cap * sizeof(uint32_t));
+    if (name_next) c->name_next = name_next;
+    uint32_t* orig_next = realloc(c->orig_next, cap * sizeof(uint32_t));
+    if (orig_next) c->orig_next = orig_next;
+    uint32_t* by_name = malloc(2 * cap * sizeof(uint32_t));
+    uint32_t* by_orig = malloc(2 * cap * sizeof(uint32_t));
+    if (!name_next || !orig_next || !by_name || !by_orig) {
+        free(by_name);
+        free(by_orig);
+        return -ENOMEM;
+    }
+    free(c->by_name);
+    free(c->by_orig);
+    c->by_name = by_name;
+    c->by_orig = by_orig;
+    c->mask = 2 * cap - 1;
+    c->cap = cap;
+    catalog_reindex(fs);
+    return 0;
+}
+
+static void catalog_free(SnapCatalog* c) {
+    free(c->recs);
+    free(c->by_name);
+    free(c->by_orig);
+    free(c->name_next);
+    free(c->orig_next);
+}
+
+static uint32_t find_snapshot(asfs_fs* fs, const char* snap_name) {
+    SnapCatalog* c = &fs->cat;
+    for (uint32_t slot = c->by_name[name_hash(snap_name) & c->mask]; slot != NO_SLOT;
+         slot = c->name_next[slot])
+        if (c->recs[slot].used && strcmp(c->recs[slot].name, snap_name) == 0) return slot;
+    return NO_SLOT;
+}
+
+static uint32_t snapshots_of(asfs_fs* fs, uint32_t inode_num) {
+    SnapCatalog* c = &fs->cat;
+    uint32_t n = 0;
+    for (uint32_t slot = c->by_orig[orig_hash(inode_num) & c->mask]; slot != NO_SLOT;
+         slot = c->orig_next[slot])
+        if (c->recs[slot].used && c->recs[slot].original_inode == inode_num) n++;
+    return n;
+}
+
+// Снапшоты удаляемого файла остаются, но отвязываются от его inode
+// (original_inode = NO_INODE) - иначе их унаследует файл, занявший inode следующим
+static int catalog_detach(asfs_fs* fs, uint32_t inode_num) {
+    SnapCatalog* c = &fs->cat;
+    uint32_t* p = &c->by_orig[orig_hash(inode_num) & c->mask];
+    int rc = 0;
+    while (*p != NO_SLOT && rc == 0) {
+        uint32_t slot = *p;
+        if (!c->recs[slot].used || c->recs[slot].original_inode != inode_num) {
+            p = &c->orig_next[slot];
+            continue;
+        }
+        *p = c->orig_next[slot];
+        c->recs[slot].original_inode = NO_INODE;
+        uint32_t h = orig_hash(NO_INODE) & c->mask;
+        c->orig_next[slot] = c->by_orig[h];
+        c->by_orig[h] = slot;
+        rc = catalog_write(fs, slot);
+    }
+    return rc;
+}
+
+static int catalog_add(asfs_fs* fs, const SnapRec* rec, uint32_t* out) {
+    SnapCatalog* c = &fs->cat;
+    int rc = catalog_grow(fs, fs->sb.catalog_slots + 1);
+    if (rc < 0) return rc;
+    uint32_t slot = c->free_head;
+    if (slot != NO_SLOT) c->free_head = c->name_next[slot];
+    else slot = fs->sb.catalog_slots++;
+    c->recs[slot] = *rec;
+    c->recs[slot].used = 1;
+    catalog_link(c, slot);
+    fs->sb.snapshot_count++;
+    *out = slot;
+    return 0;
+}
+
+static void catalog_remove(asfs_fs* fs, uint32_t slot) {
+    SnapCatalog* c = &fs->cat;
+    chain_remove(&c->by_name[name_hash(c->recs[slot].name) & c->mask], c->name_next, slot);
+    chain_remove(&c->by_orig[orig_hash(c->recs[slot].original_inode) & c->mask],
+                 c->orig_next, slot);
+    memset(&c->recs[slot], 0, sizeof(SnapRec));
+    if (slot + 1 == fs->sb.catalog_slots) {
+        fs->sb.catalog_slots--;
+    } else {
+        c->name_next[slot] = c->free_head;
+        c->free_head = slot;
+    }
+    fs->sb.snapshot_count--;
+}
+
+// Пишет запись slot; не хватает места на диске - переносит каталог целиком
+static int catalog_write(asfs_fs* fs, uint32_t slot) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    uint64_t bytes = (uint64_t)sb->catalog_slots * sizeof(SnapRec);
+    fs->share.catalog++;
+    if (bytes > (uint64_t)sb->catalog_blocks * bs) {
+        uint32_t blocks = bytes_to_blocks(bytes * 2, bs);
+        uint32_t start = alloc_area(fs, blocks);
+        if (!start) return -ENOSPC;
+        int rc = asfs_dev_write(&fs->dev, fs->cat.recs, bytes, start * bs);
+        if (rc < 0) {
+            free_area(fs, start, blocks);
+            return rc;
+        }
+        free_area(fs, sb->catalog_start, sb->catalog_blocks);
+        sb->catalog_start = start;
+        sb->catalog_blocks = blocks;
+        return 0;
+    }
+    return asfs_dev_write(&fs->dev, &fs->cat.recs[slot], sizeof(SnapRec),
+                          sb->catalog_start * bs + (uint64_t)slot * sizeof(SnapRec));
+}
+
+// Старая таблица переносится в память как есть и уходит на диск каталогом
+// при первом изменении
+static int catalog_load_legacy(asfs_fs* fs) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    uint32_t count = sb->snapshot_count;
+    sb->catalog_slots = 0;
+    int rc = catalog_grow(fs, count);
+    if (rc < 0 || count == 0) return rc;
+    if (count > MAX_SNAPSHOTS || sb->first_data_block < sb->snapshot_table ||
+        sb->first_data_block - sb->snapshot_table <
+            bytes_to_blocks(sizeof(Snapshot) * MAX_SNAPSHOTS, bs))
+        return -EINVAL;
+    Snapshot* old = malloc(sizeof(Snapshot) * MAX_SNAPSHOTS);
+    if (!old) return -ENOMEM;
+    rc = asfs_dev_read(&fs->dev, old, sizeof(Snapshot) * MAX_SNAPSHOTS,
+                       sb->snapshot_table * bs);
+    for (uint32_t i = 0; i < count && rc == 0; i++) {
+        SnapRec* r = &fs->cat.recs[i];
+        memcpy(r->name, old[i].snapshot_name, MAX_NAME_LEN);
+        r->name[MAX_NAME_LEN-1] = '\0';
+        r->snap_id = old[i].snap_id;
+        r->original_inode = old[i].original_inode;
+        r->snapshot_inode = old[i].snapshot_inode;
+        r->timestamp = old[i].timestamp;
+        r->used = 1;
+    }
+    free(old);
+    if (rc < 0) return rc;
+    sb->catalog_slots = count;
+    catalog_reindex(fs);
+    return 0;
+}
+
+static int catalog_load(asfs_fs* fs) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    if (!sb->catalog_blocks) return catalog_load_legacy(fs);
+    if (sb->catalog_start < sb->first_data_block || sb->catalog_start >= sb->total_blocks ||
+        sb->catalog_blocks > sb->total_blocks - sb->catalog_start ||
+        (uint64_t)sb->catalog_slots * sizeof(SnapRec) > (uint64_t)sb->catalog_blocks * bs)
+        return -EINVAL;
+    uint32_t slots = sb->catalog_slots;
+    sb->catalog_slots = 0;
+    int rc = catalog_grow(fs, slots);
+    if (rc == 0)
+        rc = asfs_dev_read(&fs->dev, fs->cat.recs, (size_t)slots * sizeof(SnapRec),
+                           sb->catalog_start * bs);
+    if (rc < 0) return rc;
+    sb->catalog_slots = slots;
+    sb->snapshot_count = 0;
+    for (uint32_t i = 0; i < slots; i++) {
+        fs->cat.recs[i].name[MAX_NAME_LEN-1] = '\0';
+        if (fs->cat.recs[i].used) sb->snapshot_count++;
+    }
+    catalog_reindex(fs);
+    return 0;
+}
+
+// Записывает данные в уже выделенные блоки, хвост последнего блока - нули
+static int write_blocks(asfs_fs* fs, const uint32_t* blocks, const void* data, size_t size) {
+    uint64_t t = LAT_NOW();
+    uint32_t count = blocks_for(fs, size);
+    uint8_t* buffer = malloc(fs->sb.block_size);
+    if (!buffer) return -ENOMEM;
+
+    int rc = 0;
+    for (uint32_t i = 0; i < count && rc == 0; i++) {
+        size_t chunk = size - (size_t)i * fs->sb.block_size;
+        if (chunk > fs->sb.block_size) chunk = fs->sb.block_size;
+        memcpy(buffer, (const uint8_t*)data + (size_t)i * fs->sb.block_size, chunk);
+        memset(buffer + chunk, 0, fs->sb.block_size - chunk);
+        rc = asfs_dev_write(&fs->dev, buffer, fs->sb.block_size,
+                            (uint64_t)blocks[i] * fs->sb.block_size);
+    }
+    free(buffer);
+    fs->op_blocks += count;
+    LAT_RECORD(&fs->lat, ASFS_STEP_DATA_WRITE, t, NO_INODE, count, rc);
+    return rc;
+}
+
+// Копирует count блоков в новые блоки (снапшоты)
+static int copy_blocks(asfs_fs* fs, const uint32_t* src, uint32_t* dst, uint32_t count) {
+    uint8_t* buffer = malloc(fs->sb.block_size);
+    if (!buffer) return -ENOMEM;
+
+    for (uint32_t i = 0; i < count; i++) {
+        dst[i] = allocate_block(fs);
+        int rc = dst[i] ? 0 : -ENOSPC;
+        if (rc == 0)
+            rc = asfs_dev_read(&fs->dev, buffer, fs->sb.block_size,
+                               (uint64_t)src[i] * fs->sb.block_size);
+        if (rc == 0)
+            rc = asfs_dev_write(&fs->dev, buffer, fs->sb.block_size,
+                                (uint64_t)dst[i] * fs->sb.block_size);
+        if (rc < 0) {
+            free_blocks(fs, dst, i + 1);
+            free(buffer);
+            return rc;
+        }
+    }
+    free(buffer);
+    fs->op_blocks += count;
+    return 0;
+}
+
+static int write_metadata(asfs_fs* fs);
+
+static int save_metadata(asfs_fs* fs) {
+    uint64_t t = LAT_NOW();
+    int rc = write_metadata(fs);
+    LAT_RECORD(&fs->lat, ASFS_STEP_META_WRITE, t, NO_INODE, 0, rc);
+    // Дырявим только после того, как битмап с освобождением на диске:
+    // иначе после сбоя файл остался бы со своими блоками, но без данных
+    if (rc == 0 && fs->discard_queue.count)
+        asfs_discard_flush(&fs->dev, &fs->discard_queue, fs->sb.block_size, fs->block_bitmap);
+    return rc;
+}
+
+static int write_metadata(asfs_fs* fs) {
+    SuperBlock* sb = &fs->sb;
+    STAT_INC(&fs->stats, meta.saves);
+    int rc = asfs_dev_write(&fs->dev, sb, sizeof(SuperBlock), 0);
+    if (rc < 0) return rc;
+    rc = map_flush(fs, 0);
+    if (rc < 0) return rc;
+    rc = map_flush(fs, 1);
+    if (rc < 0) return rc;
+
+    if (ASFS_DEBUG) {
+        fprintf(stderr, "[DEBUG] Saved metadata:\n");
+        fprintf(stderr, "  Free inodes: %u\n", sb->free_inodes);
+        fprintf(stderr, "  Free blocks: %u\n", sb->free_blocks);
+    }
+    return 0;
+}
+
+// Остальные образы набора: метка читается из первой полосы, пока открыт один образ
+static int attach_stripe(asfs_fs* fs, const char* path) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    asfs_stripe_label label;
+    if (sb->stripe_table != 1 || sb->stripe_blocks != bytes_to_blocks(sizeof(label), bs))
+        return -EINVAL;
+    int rc = asfs_dev_read(&fs->dev, &label, sizeof(label), bs);
+    if (rc < 0) return rc;
+    if (label.unit % bs || label.unit < (1 + sb->stripe_blocks) * bs) return -EINVAL;
+    return asfs_dev_attach(&fs->dev, path, &label);
+}
+
+// Проверка суперблока с диска; то, что можно построить заново, сбрасывается
+static int sb_check(SuperBlock* sb) {
+    if (sb->magic != MAGIC_NUMBER || sb->block_size == 0) return -EINVAL;
+    // За суперблоком первой версии может быть мусор - приращений там нет
+    if (sb->version == FS_VERSION_NOEXT) {
+        sb->ext_count = 0;
+        memset(sb->ext, 0, sizeof(sb->ext));
+        sb->index_magic = 0;
+        sb->bloom_state = sb->bloom_blocks = 0;
+        sb->stripe_table = sb->stripe_blocks = 0;
+        sb->epoch = sb->epoch_count = sb->epoch_start = sb->epoch_blocks = 0;
+        sb->catalog_start = sb->catalog_blocks = sb->catalog_slots = 0;
+        sb->orphan_start = sb->orphan_blocks = sb->orphan_count = sb->gc_pending = 0;
+    } else if (sb->version != FS_VERSION) {
+        return -EPROTO; // Старая разметка, нужен -f
+    }
+    if (sb->ext_count > MAX_EXTENTS) return -EINVAL;
+    uint64_t bs = sb->block_size;
+    // Индекс с кривыми границами не используем: следующий листинг построит новый
+    if (sb->index_magic == INDEX_MAGIC &&
+        (sb->index_start < sb->first_data_block || sb->index_start >= sb->total_blocks ||
+         sb->index_blocks == 0 || sb->index_blocks > sb->total_blocks - sb->index_start ||
+         sb->index_log_count > sb->index_log_cap ||
+         ((uint64_t)sb->index_count + sb->index_log_cap) * sizeof(IndexEntry) >
+             sb->index_blocks * bs))
+        sb->index_magic = 0;
+    if (sb->index_magic != INDEX_MAGIC)
+        sb->index_start = sb->index_blocks = sb->index_count =
+            sb->index_log_cap = sb->index_log_count = 0;
+    if (sb->bloom_blocks &&
+        (sb->bloom_start < sb->first_data_block || sb->bloom_start >= sb->total_blocks ||
+         sb->bloom_blocks > sb->total_blocks - sb->bloom_start))
+        sb->bloom_blocks = 0;
+    if (!sb->bloom_blocks) sb->bloom_start = 0;
+    if (sb->bloom_state == BLOOM_CLEAN &&
+        (sb->bloom_bits_log2 < ASFS_BLOOM_MIN_LOG2 || sb->bloom_bits_log2 > ASFS_BLOOM_MAX_LOG2 ||
+         (1ull << (sb->bloom_bits_log2 - 3)) > sb->bloom_blocks * bs))
+        sb->bloom_state = 0;
+    // Таблицу снапшотов ФС, в отличие от индекса, не построить заново
+    if (sb->epoch_count &&
+        (sb->epoch_start < sb->first_data_block || sb->epoch_start >= sb->total_blocks ||
+         sb->epoch_blocks > sb->total_blocks - sb->epoch_start ||
+         (uint64_t)sb->epoch_count * sizeof(EpochRec) > (uint64_t)sb->epoch_blocks * bs))
+        return -EINVAL;
+    if (sb->epoch == 0) sb->epoch = 1;
+    if (sb->orphan_blocks &&
+        (sb->orphan_start < sb->first_data_block || sb->orphan_start >= sb->total_blocks ||
+         sb->orphan_blocks > sb->total_blocks - sb->orphan_start))
+        return -EINVAL;
+    if ((uint64_t)sb->orphan_count * sizeof(uint32_t) > (uint64_t)sb->orphan_blocks * bs)
+        return -EINVAL;
+    return 0;
+}
+
+static int orphans_load(asfs_fs* fs) {
+    SuperBlock* sb = &fs->sb;
+    free(fs->orphans);
+    free(fs->orphan_map);
+    fs->orphans = NULL;
+    fs->orphan_map = NULL;
+    fs->orphan_cap = fs->orphan_bits = 0;
+    if (!sb->orphan_count) return 0;
+    fs->orphans = malloc(sb->orphan_count * sizeof(uint32_t));
+    fs->orphan_map = calloc(1, (sb->inode_count + 7) / 8);
+    if (!fs->orphans || !fs->orphan_map) return -ENOMEM;
+    fs->orphan_cap = sb->orphan_count;
+    fs->orphan_bits = sb->inode_count;
+    int rc = asfs_dev_read(&fs->dev, fs->orphans, sb->orphan_count * sizeof(uint32_t),
+                           (uint64_t)sb->orphan_start * sb->block_size);
+    if (rc < 0) return rc;
+    for (uint32_t i = 0; i < sb->orphan_count; i++)
+        if (fs->orphans[i] < sb->inode_count)
+            fs->orphan_map[fs->orphans[i]/8] |= 1 << (fs->orphans[i]%8);
+    return 0;
+}
+
+static int epochs_load(asfs_fs* fs) {
+    SuperBlock* sb = &fs->sb;
+    free(fs->epochs);
+    fs->epochs = NULL;
+    fs->epoch_max = 0;
+    if (!sb->epoch_count) return 0;
+    fs->epochs = malloc(sb->epoch_count * sizeof(EpochRec));
+    if (!fs->epochs) return -ENOMEM;
+    int rc = asfs_dev_read(&fs->dev, fs->epochs, sb->epoch_count * sizeof(EpochRec),
+                           (uint64_t)sb->epoch_start * sb->block_size);
+    if (rc < 0) return rc;
+    for (uint32_t i = 0; i < sb->epoch_count; i++) {
+        fs->epochs[i].name[ASFS_EPOCH_NAME-1] = '\0';
+        if (fs->epochs[i].epoch > fs->epoch_max) fs->epoch_max = fs->epochs[i].epoch;
+    }
+    return fs->epoch_max < sb->epoch ? 0 : -EINVAL;
+}
+
+// Таблица поколений с диска. Нет её или она отстала от суперблока (писали без
+// неё) - начинаем свою с нынешнего поколения: у кого таблица с другим origin,
+// перечитает всё
+static void share_load(asfs_fs* fs) {
+    ShareTable* t = &fs->share;
+    fs->share_on = sizeof(SuperBlock) + sizeof(ShareTable) <= fs->sb.block_size;
+    if (fs->share_on &&
+        asfs_dev_read(&fs->dev, t, sizeof(*t), sizeof(SuperBlock)) == 0 &&
+        t->magic == SHARE_MAGIC && t->regions == SHARE_REGIONS &&
+        t->generation == fs->sb.generation)
+        return;
+    memset(t, 0, sizeof(*t));
+    t->magic = SHARE_MAGIC;
+    t->regions = SHARE_REGIONS;
+    t->origin = fs->sb.generation;
+}
+
+static int load_metadata(asfs_fs* fs, const char* path) {
+    SuperBlock* sb = &fs->sb;
+    int rc = asfs_dev_read(&fs->dev, sb, sizeof(SuperBlock), 0);
+    if (rc == 0) rc = sb_check(sb);
+    if (rc < 0) return rc;
+    // При перечитывании (path = NULL) набор уже открыт
+    if (sb->stripe_table && path && (rc = attach_stripe(fs, path)) < 0) return rc;
+
+    fs->block_bitmap = calloc(1, map_bytes(fs, 0));
+    fs->inode_bitmap = calloc(1, map_bytes(fs, 1));
+    if (!fs->block_bitmap || !fs->inode_bitmap) return -ENOMEM;
+    memset(fs->map_dirty, 0, sizeof(fs->map_dirty));
+
+    rc = bitmap_io(fs, 0, fs->block_bitmap, 0, map_bytes(fs, 0), 0);
+    if (rc < 0) return rc;
+    rc = bitmap_io(fs, 1, fs->inode_bitmap, 0, map_bytes(fs, 1), 0);
+    if (rc < 0) return rc;
+    share_load(fs);
+
+    rc = catalog_load(fs);
+    if (rc == 0) rc = orphans_load(fs);
+    if (rc == 0) rc = epochs_load(fs);
+    return rc;
+}
+
+int asfs_format(const char* path, uint32_t block_size, int zero_fill) {
+    return asfs_format_striped(path, NULL, 0, 0, block_size, zero_fill);
+}
+
+int asfs_format_striped(const char* path, const char* const* members, int count,
+                        uint32_t stripe_unit, uint32_t block_size, int zero_fill) {
+    asfs_dev dev;
+    SuperBlock sb = {0};
+    asfs_stripe_label label;
+    uint64_t dev_size;
+
+    if (block_size % 512 != 0 || block_size < 512) return -EINVAL;
+    if (count > 0) {
+        sb.stripe_table = 1;
+        sb.stripe_blocks = bytes_to_blocks(sizeof(label), block_size);
+        // Суперблок и метка должны лежать в первой полосе первого образа
+        if (stripe_unit % block_size || stripe_unit < (1 + sb.stripe_blocks) * block_size)
+            return -EINVAL;
+    }
+
+    int rc = asfs_dev_open(&dev, path, O_RDWR|O_CREAT);
+    if (rc < 0) return rc;
+    if (count > 0) {
+        rc = asfs_dev_stripe(&dev, path, members, count, stripe_unit, O_CREAT, &label);
+        if (rc < 0) goto out;
+    }
+
+    rc = asfs_dev_size(&dev, &dev_size);
+    if (rc < 0) goto out;
+
+    sb.block_size = block_size;
+    sb.total_blocks = dev_size / block_size;
+    sb.inode_count = sb.total_blocks / 16;
+    // Разметка: суперблок | метка набора | битмап блоков | битмап inode | таблица inode |
+    // данные. Каталог снапшотов выделяется в данных при первом снапшоте
+    sb.version = FS_VERSION;
+    sb.block_bitmap = 1 + sb.stripe_blocks;
+    sb.inode_bitmap = sb.block_bitmap + bytes_to_blocks((sb.total_blocks + 7) / 8, block_size);
+    sb.inode_table = sb.inode_bitmap + bytes_to_blocks((sb.inode_count + 7) / 8, block_size);
+    sb.snapshot_table = sb.inode_table +
+        bytes_to_blocks((uint64_t)sb.inode_count * sizeof(Inode), block_size);
+    sb.first_data_block = sb.snapshot_table;
+    if (sb.inode_count < 2 || sb.first_data_block >= sb.total_blocks) {
+        rc = -ENOSPC;
+        goto out;
+    }
+    sb.free_blocks = sb.total_blocks - sb.first_data_block;
+    sb.free_inodes = sb.inode_count - 1;
+    sb.magic = MAGIC_NUMBER;
+    if (ASFS_DEBUG) {
+        fprintf(stderr, "[DEBUG] Formatting parameters:\n"
+               "Block size: %u\n"
+               "Total blocks: %u\n"
+               "Inodes: %u\n"
+               "First data block: %u\n",
+               sb.block_size, sb.total_blocks,
+               sb.inode_count, sb.first_data_block);
+    }
+    if (zero_fill) {
+        rc = asfs_dev_zero(&dev, 0, (uint64_t)sb.total_blocks * block_size);
+        if (rc < 0) goto out;
+    }
+    if (count > 0) {
+        rc = asfs_dev_write(&dev, &label, sizeof(label), block_size);
+        if (rc < 0) goto out;
+    }
+    Inode root = {0};
+    root.used = 1;
+    strcpy(root.name, "/");
+    root.created = time(0);
+    root.modified = root.created;
+    root.type = 1; // Директория
+
+    // Пишем метаданные теми же функциями, что и при обычной работе
+    asfs_fs* fs = calloc(1, sizeof(asfs_fs));
+    if (!fs) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    fs->dev = dev;
+    fs->mode = ASFS_RDWR;
+    fs->sb = sb;
+    fs->block_bitmap = calloc(1, (sb.total_blocks + 7) / 8);
+    fs->inode_bitmap = calloc(1, (sb.inode_count + 7) / 8);
+    if (fs->block_bitmap && fs->inode_bitmap) {
+        for (uint32_t i = 0; i < sb.first_data_block; i++)
+            fs->block_bitmap[i/8] |= 1 << (i%8);
+        fs->inode_bitmap[0] |= 1;
+        map_touch_all(fs);
+        rc = write_inode(fs, 0, &root);
+        // Пустой индекс имён сразу: дальше его ведут create/delete
+        if (rc == 0) rc = index_write(fs, NULL, 0, 0);
+        if (rc == 0) rc = save_metadata(fs);
+    } else {
+        rc = -ENOMEM;
+    }
+    free(fs->block_bitmap);
+    free(fs->inode_bitmap);
+    free(fs);
+out:
+    asfs_dev_close(&dev);
+    return rc;
+}
+
+// ---- общий образ ----
+// Несколько процессов (и несколько asfs_fs в одном) работают с образом по очереди:
+// на время операции берётся блокировка fcntl - на чтение у операций, которые только
+// читают (такие идут параллельно), на запись у остальных. Если поколение в суперблоке
+// на диске не совпадает с нашим, по таблице поколений перечитывается только то, что
+// поменяли другие. Операция, которая что-то записала, продвигает поколение.
+// Писатели по-прежнему идут по одному: счётчики свободного места и поля индекса
+// в суперблоке общие для любого выделения
+
+// Перечитывание собирает новое состояние рядом со старым: не вышло - старое
+// остаётся, а дескриптор больше не пишет, чтобы не затереть чужие изменения
+static int metadata_reload(asfs_fs* fs) {
+    SuperBlock sb = fs->sb;
+    ShareTable share = fs->share;
+    uint8_t* block_bitmap = fs->block_bitmap;
+    uint8_t* inode_bitmap = fs->inode_bitmap;
+    SnapCatalog cat = fs->cat;
+    EpochRec* epochs = fs->epochs;
+    uint32_t epoch_max = fs->epoch_max;
+    uint32_t* orphans = fs->orphans;
+    uint32_t orphan_cap = fs->orphan_cap;
+    uint8_t* orphan_map = fs->orphan_map;
+    uint32_t orphan_bits = fs->orphan_bits;
+
+    fs->block_bitmap = fs->inode_bitmap = fs->orphan_map = NULL;
+    memset(&fs->cat, 0, sizeof(fs->cat));
+    fs->epochs = NULL;
+    fs->orphans = NULL;
+    fs->epoch_max = fs->orphan_cap = fs->orphan_bits = 0;
+    int rc = load_metadata(fs, NULL);
+    if (rc == 0) {
+        free(block_bitmap);
+        free(inode_bitmap);
+        catalog_free(&cat);
+        free(epochs);
+        free(orphans);
+        free(orphan_map);
+        // Фильтр не знает чужих имён: загрузится с диска или построится заново
+        asfs_bloom_free(&fs->bloom);
+        return 0;
+    }
+    free(fs->block_bitmap);
+    free(fs->inode_bitmap);
+    catalog_free(&fs->cat);
+    free(fs->epochs);
+    free(fs->orphans);
+    free(fs->orphan_map);
+    fs->sb = sb;
+    fs->share = share;
+    fs->block_bitmap = block_bitmap;
+    fs->inode_bitmap = inode_bitmap;
+    fs->cat = cat;
+    fs->epochs = epochs;
+    fs->epoch_max = epoch_max;
+    fs->orphans = orphans;
+    fs->orphan_cap = orphan_cap;
+    fs->orphan_map = orphan_map;
+    fs->orphan_bits = orphan_bits;
+    fs->stale = rc;
+    fs->mode = ASFS_RDONLY;
+    return rc;
+}
+
+// Догоняет чужие операции: суперблок, куски битмапов с другим поколением,
+// каталог, сироты и эпохи - если они менялись. Разметка другая или таблица
+// не сходится с нашей - ошибка, и вызывающий перечитывает всё
+static int share_refresh(asfs_fs* fs, uint64_t gen) {
+    ShareTable t, *own = &fs->share;
+    SuperBlock sb;
+    int rc = asfs_dev_read(&fs->dev, &t, sizeof(t), sizeof(SuperBlock));
+    if (rc == 0) rc = asfs_dev_read(&fs->dev, &sb, sizeof(sb), 0);
+    if (rc == 0) rc = sb_check(&sb);
+    if (rc < 0) return rc;
+    if (t.magic != SHARE_MAGIC || t.regions != SHARE_REGIONS || t.generation != gen ||
+        t.origin != own->origin || t.layout != own->layout ||
+        sb.total_blocks != fs->sb.total_blocks || sb.inode_count != fs->sb.inode_count ||
+        sb.ext_count != fs->sb.ext_count || sb.block_size != fs->sb.block_size)
+        return -ESTALE;
+    SuperBlock old = fs->sb;
+    fs->sb = sb;
+    for (int m = 0; m < 2 && rc == 0; m++) {
+        uint8_t sel[SHARE_REGIONS / 8] = {0};
+        for (uint32_t r = 0; r < SHARE_REGIONS; r++)
+            if (t.map[m][r] != own->map[m][r]) sel[r/8] |= 1 << (r%8);
+        rc = map_regions_io(fs, m, sel, 0);
+    }
+    if (rc == 0 && (t.catalog != own->catalog || sb.catalog_start != old.catalog_start ||
+                    sb.catalog_slots != old.catalog_slots)) {
+        catalog_free(&fs->cat);
+        memset(&fs->cat, 0, sizeof(fs->cat));
+        rc = catalog_load(fs);
+    }
+    if (rc == 0 && (t.orphans != own->orphans || sb.orphan_count != old.orphan_count))
+        rc = orphans_load(fs);
+    if (rc == 0 && (t.epochs != own->epochs || sb.epoch_count != old.epoch_count))
+        rc = epochs_load(fs);
+    // Фильтр не знает чужих имён: загрузится с диска или построится заново
+    if (t.names != own->names) asfs_bloom_free(&fs->bloom);
+    if (rc == 0) *own = t;
+    return rc;
+}
+
+static void shared_begin(asfs_fs* fs, int type) {
+    fs->op_writes = fs->dev.writes;
+    if (!fs->shared) return;
+    if (fs->mode != ASFS_RDWR) type = F_RDLCK;
+    if (asfs_dev_lock(&fs->dev, type) < 0) {
+        fs->stale = -ENOLCK;
+        fs->mode = ASFS_RDONLY;
+        fs->lock_type = F_UNLCK;
+        return;
+    }
+    fs->lock_type = type;
+    uint64_t gen;
+    if (asfs_dev_read(&fs->dev, &gen, sizeof(gen), offsetof(SuperBlock, generation)) < 0 ||
+        (gen != fs->sb.generation && (!fs->share_on || share_refresh(fs, gen) < 0)))
+        metadata_reload(fs);
+}
+
+// Поколение и таблица за ним (суперблок кончается полем generation) - одной записью
+static void shared_end(asfs_fs* fs) {
+    if (!fs->shared) return;
+    if (fs->dev.writes != fs->op_writes) {
+        struct {
+            uint64_t generation;
+            ShareTable share;
+        } tail;
+        fs->sb.generation++;
+        fs->share.generation = fs->sb.generation;
+        tail.generation = fs->sb.generation;
+        tail.share = fs->share;
+        asfs_dev_write(&fs->dev, &tail,
+                       sizeof(tail.generation) + (fs->share_on ? sizeof(tail.share) : 0),
+                       offsetof(SuperBlock, generation));
+    }
+    if (fs->lock_type != F_UNLCK) asfs_dev_lock(&fs->dev, F_UNLCK);
+    fs->lock_type = F_UNLCK;
+}
+
+// Запись внутри операции чтения (колбэк обхода зовёт create/delete). Другие
+// читатели не дают поднять блокировку сразу - отпускаем и ждём, а пока ждали,
+// образ мог поменяться: shared_begin догонит
+static void shared_upgrade(asfs_fs* fs) {
+    if (!fs->shared || fs->mode != ASFS_RDWR || fs->lock_type != F_RDLCK) return;
+    if (asfs_dev_trylock(&fs->dev, F_WRLCK) == 0) {
+        fs->lock_type = F_WRLCK;
+        return;
+    }
+    asfs_dev_lock(&fs->dev, F_UNLCK);
+    shared_begin(fs, F_WRLCK);
+}
+
+static void fs_lock_as(asfs_fs* fs, int type) {
+    pthread_mutex_lock(&fs->lock);
+    if (fs->lock_depth++ == 0) shared_begin(fs, type);
+    else if (type == F_WRLCK) shared_upgrade(fs);
+}
+
+static void fs_lock(asfs_fs* fs) {
+    fs_lock_as(fs, F_WRLCK);
+}
+
+// Для операций, которые только читают: у ASFS_RDWR тоже блокировка на чтение
+static void fs_lock_read(asfs_fs* fs) {
+    fs_lock_as(fs, F_RDLCK);
+}
+
+static void fs_unlock(asfs_fs* fs) {
+    if (--fs->lock_depth == 0) shared_end(fs);
+    pthread_mutex_unlock(&fs->lock);
+}
+
+// Ожидание на reclaim_cond под fs_lock: на это время образ отпускается другим процессам
+static int fs_wait(asfs_fs* fs, const struct timespec* until) {
+    uint32_t depth = fs->lock_depth;
+    int type = fs->lock_type == F_WRLCK ? F_WRLCK : F_RDLCK;
+    fs->lock_depth = 0;
+    shared_end(fs);
+    int rc = until ? pthread_cond_timedwait(&fs->reclaim_cond, &fs->lock, until)
+                   : pthread_cond_wait(&fs->reclaim_cond, &fs->lock);
+    fs->lock_depth = depth;
+    shared_begin(fs, type);
+    return rc;
+}
+
+static int reclaim_all(asfs_fs* fs);
+
+int asfs_open(const char* path, int mode, asfs_fs** out) {
+    asfs_fs* fs = calloc(1, sizeof(asfs_fs));
+    if (!fs) return -ENOMEM;
+    fs->mode = mode & ASFS_RDWR;
+    fs->shared = !(mode & ASFS_PRIVATE);
+
+    int rc = asfs_dev_open(&fs->dev, path, fs->mode == ASFS_RDWR ? O_RDWR : O_RDONLY);
+    if (rc < 0) {
+        free(fs);
+        return rc;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&fs->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_cond_init(&fs->reclaim_cond, NULL);
+    fs->dev.stats = &fs->stats;
+    fs->dev.lat = &fs->lat;
+    // Загрузка - под той же блокировкой образа, что и операции
+    fs->lock_depth = 1;
+    fs->op_writes = fs->dev.writes;
+    fs->lock_type = fs->mode == ASFS_RDWR ? F_WRLCK : F_RDLCK;
+    rc = fs->shared ? asfs_dev_lock(&fs->dev, fs->lock_type) : 0;
+    if (rc < 0) fs->lock_type = F_UNLCK;
+    if (rc == 0) rc = load_metadata(fs, path);
+    // Прошлое монтирование не успело разобрать удалённое - доделываем сейчас
+    if (rc == 0 && fs->mode == ASFS_RDWR) rc = reclaim_all(fs);
+    fs->lock_depth = 0;
+    shared_end(fs);
+    if (rc < 0) {
+        fs->mode = ASFS_RDONLY;   // полузагруженную ФС close не трогает
+        asfs_close(fs);
+        return rc;
+    }
+    *out = fs;
+    return 0;
+}
+
+static void bloom_save(asfs_fs* fs);
+
+int asfs_close(asfs_fs* fs) {
+    if (!fs) return 0;
+    // Фоновый поток останавливается, остаток списка сирот разбирается здесь
+    if (fs->mode == ASFS_RDWR) asfs_set_reclaim(fs, 0);
+    if (fs->mode == ASFS_RDWR) {
+        fs_lock(fs);
+        if (fs->mode == ASFS_RDWR && fs->bloom.bits && fs->sb.bloom_state != BLOOM_CLEAN)
+            bloom_save(fs);
+        fs_unlock(fs);
+    }
+    asfs_dev_close(&fs->dev);
+    asfs_trace_enable(&fs->lat, 0);
+    workload_close(fs->capture);
+    asfs_discard_free(&fs->discard_queue);
+    asfs_bloom_free(&fs->bloom);
+    free(fs->block_bitmap);
+    free(fs->inode_bitmap);
+    free(fs->epochs);
+    free(fs->orphans);
+    free(fs->orphan_map);
+    catalog_free(&fs->cat);
+    pthread_cond_destroy(&fs->reclaim_cond);
+    pthread_mutex_destroy(&fs->lock);
+    free(fs);
+    return 0;
+}
+
+int asfs_statfs(asfs_fs* fs, asfs_fsinfo* info) {
+    fs_lock_read(fs);
+    info->magic = fs->sb.magic;
+    info->block_size = fs->sb.block_size;
+    info->total_blocks = fs->sb.total_blocks;
+    info->free_blocks = fs->sb.free_blocks;
+    info->inode_count = fs->sb.inode_count;
+    info->free_inodes = fs->sb.free_inodes;
+    info->snapshot_count = fs->sb.snapshot_count;
+    info->first_data_block = fs->sb.first_data_block;
+    info->orphan_count = fs->sb.orphan_count;
+    fs_unlock(fs);
+    return 0;
+}
+
+int asfs_get_stats(asfs_fs* fs, asfs_stats* out) {
+    *out = fs->stats;
+    return 0;
+}
+
+void asfs_reset_stats(asfs_fs* fs) {
+    memset(&fs->stats, 0, sizeof(fs->stats));
+    asfs_latency_reset(&fs->lat);
+}
+
+asfs_latency* asfs_get_latency(asfs_fs* fs) {
+    return &fs->lat;
+}
+
+void asfs_set_discard(asfs_fs* fs, int on) {
+    fs->discard = on;
+}
+
+int asfs_capture_enable(asfs_fs* fs, const char* path) {
+    workload_log* log = NULL;
+    int rc = path ? workload_open(path, &log) : 0;
+    if (rc < 0) return rc;
+    fs_lock_read(fs);
+    workload_log* old = fs->capture;
+    fs->capture = log;
+    fs_unlock(fs);
+    return workload_close(old);
+}
+
+int asfs_set_direct(asfs_fs* fs, int on) {
+    fs_lock_read(fs);
+    int rc = asfs_dev_set_direct(&fs->dev, on, fs->sb.block_size);
+    fs_unlock(fs);
+    return rc;
+}
+
+int asfs_trim(asfs_fs* fs, uint64_t* bytes) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    fs_lock(fs);
+    int rc = asfs_dev_trim(&fs->dev, fs->block_bitmap, fs->sb.first_data_block,
+                           fs->sb.total_blocks, fs->sb.block_size, bytes);
+    fs_unlock(fs);
+    return rc;
+}
+
+// Публичные операции - тонкие обёртки, замеряющие время и пишущие трейс
+static uint64_t op_started(asfs_fs* fs) {
+    fs->op_inode = NO_INODE;
+    fs->op_blocks = 0;
+    if (fs->capture) fs->capture_start = workload_clock();
+    return LAT_NOW();
+}
+
+static uint64_t op_begin(asfs_fs* fs) {
+    fs_lock(fs);
+    return op_started(fs);
+}
+
+static uint64_t op_begin_read(asfs_fs* fs) {
+    fs_lock_read(fs);
+    return op_started(fs);
+}
+
+// Захват нагрузки - до op_end, пока держим блокировку: порядок записей в файле
+// тот же, что у операций
+static void capture(asfs_fs* fs, int op, const char* name, const char* name2,
+                    uint64_t size, uint64_t offset, int64_t rc) {
+    if (fs->capture)
+        workload_record(fs->capture, op, fs->capture_start, name, name2, size, offset, rc);
+}
+
+static int64_t op_end(asfs_fs* fs, int op, uint64_t start, int64_t rc) {
+    LAT_RECORD(&fs->lat, op, start, fs->op_inode, fs->op_blocks, rc);
+    fs_unlock(fs);
+    return rc;
+}
+
+static void index_log(asfs_fs* fs, const char* name, uint32_t inode);
+static void bloom_prepare(asfs_fs* fs);
+static void bloom_note(asfs_fs* fs, const char* name);
+
+static int do_create(asfs_fs* fs, const char* filename, const void* data, size_t size,
+                     uint32_t* inode_out) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    int rc = check_name(filename);
+    if (rc < 0) return rc;
+    if (blocks_for(fs, size) > 12) return -EFBIG;
+
+    bloom_prepare(fs);
+    rc = find_inode(fs, filename, NULL, NULL);
+    if (rc == 0) return -EEXIST;
+    if (rc != -ENOENT) return rc;
+
+    // Поиск свободного inode (начиная с 1)
+    uint32_t inode_num = find_free_inode(fs);
+    if (inode_num == NO_INODE) return -ENOSPC;
+
+    // Выделение блоков
+    uint32_t blocks_needed = blocks_for(fs, size);
+    uint32_t blocks[12] = {0};
+    for (uint32_t i = 0; i < blocks_needed; i++) {
+        blocks[i] = allocate_block(fs);
+        if (!blocks[i]) {
+            free_blocks(fs, blocks, i);
+            return -ENOSPC;
+        }
+    }
+    rc = write_blocks(fs, blocks, data, size);
+    if (rc < 0) {
+        free_blocks(fs, blocks, blocks_needed);
+        return rc;
+    }
+    // Создание inode
+    Inode node = {
+        .used = 1,
+        .type = 0,
+        .size = size,
+        .created = time(0),
+        .modified = time(0),
+        .birth = fs->sb.epoch
+    };
+    strncpy(node.name, filename, MAX_NAME_LEN-1);
+    memcpy(node.blocks, blocks, sizeof(blocks));
+    rc = write_inode(fs, inode_num, &node);
+    if (rc < 0) {
+        free_blocks(fs, blocks, blocks_needed);
+        return rc;
+    }
+    // Обновление битмапов
+    map_set(fs, 1, inode_num, 1);
+    fs->sb.free_inodes--;
+    STAT_INC(&fs->stats, alloc.inode_allocs);
+    index_log(fs, filename, inode_num);
+    bloom_note(fs, filename);
+    if (inode_out) *inode_out = inode_num;
+    return save_metadata(fs);
+}
+
+int asfs_create(asfs_fs* fs, const char* filename, const void* data, size_t size,
+                uint32_t* inode_out) {
+    uint64_t t = op_begin(fs);
+    int rc = do_create(fs, filename, data, size, inode_out);
+    capture(fs, WORKLOAD_CREATE, filename, NULL, size, 0, rc);
+    return op_end(fs, ASFS_OP_CREATE, t, rc);
+}
+
+// ---- пакетное создание (импорт) ----
+
+#define SCAN_CHUNK 4096               // inode за одно чтение таблицы
+#define BATCH_IO (4u << 20)           // максимум байт в одном pwrite пакета
+
+typedef struct {
+    const char** slots;
+    uint32_t mask;
+} NameSet;
+
+static uint32_t name_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+static int nameset_init(NameSet* set, size_t expect) {
+    uint32_t cap = 64;
+    while (cap < expect * 2) cap *= 2;
+    set->slots = calloc(cap, sizeof(char*));
+    set->mask = cap - 1;
+    return set->slots ? 0 : -ENOMEM;
+}
+
+// 1 - имя уже есть, 0 - добавлено. Строка не копируется
+static int nameset_add(NameSet* set, const char* name) {
+    for (uint32_t i = name_hash(name) & set->mask; ; i = (i + 1) & set->mask) {
+        if (!set->slots[i]) {
+            set->slots[i] = name;
+            return 0;
+        }
+        if (strcmp(set->slots[i], name) == 0) return 1;
+    }
+}
+
+// Обход живых файлов: таблица inode читается большими кусками, куски без
+// единого занятого inode пропускаются. Ненулевой возврат fn прекращает обход
+typedef int (*LiveFn)(asfs_fs* fs, uint32_t inode_num, const Inode* node, void* arg);
+
+// Виден ли inode в снапшоте ФС с эпохой epoch (0 - текущее состояние)
+static int visible_at(const Inode* node, uint32_t epoch) {
+    if (!node->used) return 0;
+    if (!epoch) return !node->is_snapshot;
+    if (node->is_snapshot && node->is_snapshot != INODE_VERSION) return 0;
+    return node->birth <= epoch && (!node->is_snapshot || node->death > epoch);
+}
+
+static int scan_at(asfs_fs* fs, uint32_t epoch, LiveFn fn, void* arg) {
+    Inode* chunk = malloc(SCAN_CHUNK * sizeof(Inode));
+    if (!chunk) return -ENOMEM;
+    int rc = 0, stop = 0;
+    for (uint32_t first = 1; first < fs->sb.inode_count && rc == 0 && !stop;
+         first += SCAN_CHUNK) {
+        uint32_t n = fs->sb.inode_count - first;
+        if (n > SCAN_CHUNK) n = SCAN_CHUNK;
+        uint32_t any = 0;
+        for (uint32_t i = first; i < first + n && !any; i++) any = inode_in_use(fs, i);
+        if (!any) continue;
+
+        rc = inodes_io(fs, first, n, chunk, 0);
+        STAT_ADD(&fs->stats, inode.reads, n);
+        for (uint32_t i = 0; i < n && rc == 0 && !stop; i++) {
+            if (!inode_in_use(fs, first + i) || !visible_at(&chunk[i], epoch)) continue;
+            chunk[i].name[MAX_NAME_LEN-1] = '\0';
+            stop = fn(fs, first + i, &chunk[i], arg);
+        }
+    }
+    free(chunk);
+    return rc;
+}
+
+static int scan_live(asfs_fs* fs, LiveFn fn, void* arg) {
+    return scan_at(fs, 0, fn, arg);
+}
+
+typedef struct {
+    NameSet* set;
+    char* arena;
+    uint32_t stored;
+    uint32_t live;
+} NameCollect;
+
+static int collect_one(asfs_fs* fs, uint32_t inode_num, const Inode* node, void* arg) {
+    NameCollect* c = arg;
+    if (c->stored == c->live) return 1;   // битмап и счётчик разошлись - хватит
+    char* name = c->arena + (size_t)c->stored++ * MAX_NAME_LEN;
+    memcpy(name, node->name, MAX_NAME_LEN);
+    nameset_add(c->set, name);
+    return 0;
+}
+
+// Имена всех живых файлов
+static int collect_names(asfs_fs* fs, NameSet* set, char** arena) {
+    NameCollect c = { .set = set, .live = fs->sb.inode_count - fs->sb.free_inodes };
+    *arena = c.arena = malloc((size_t)c.live * MAX_NAME_LEN + 1);
+    if (!c.arena) return -ENOMEM;
+    return scan_live(fs, collect_one, &c);
+}
+
+// ---- упорядоченный индекс имён ----
+//
+// Отсортированный по имени прогон записей {ключ, inode} и журнал изменений за ним.
+// create/delete только дописывают запись в журнал; полный журнал вливается
+// в прогон - новый кусок пишется целиком, старый освобождается. Листинг ищет
+// начало бинарным поиском по прогону и дальше читает только подходящие записи
+
+#define INDEX_LOG_MIN 1024     // мест в журнале: 1/16 прогона в этих пределах
+#define INDEX_LOG_MAX 65536
+#define INDEX_CHUNK 256        // записей прогона за одно чтение
+
+typedef struct {
+    IndexEntry e;
+    const char* name;      // полное имя
+} IndexName;
+
+// Разобранный журнал: живые добавления по порядку имён и отсортированные
+// inode, записи которых в прогоне удалены
+typedef struct {
+    IndexName* adds;
+    uint32_t nadds;
+    uint32_t* dels;
+    uint32_t ndels;
+    char* arena;
+} IndexLog;
+
+typedef struct {
+    IndexEntry e;
+    uint32_t seq;
+} LogRec;
+
+static int index_present(asfs_fs* fs) {
+    return fs->sb.index_magic == INDEX_MAGIC;
+}
+
+static uint64_t index_off(asfs_fs* fs, uint64_t i) {
+    return (uint64_t)fs->sb.index_start * fs->sb.block_size + i * sizeof(IndexEntry);
+}
+
+static void index_entry(IndexEntry* e, const char* name, uint32_t inode) {
+    memset(e->key, 0, INDEX_KEY);
+    memcpy(e->key, name, strnlen(name, INDEX_KEY));
+    e->inode = inode;
+}
+
+static int key_full(const IndexEntry* e) {
+    return memchr(e->key, 0, INDEX_KEY) != NULL;
+}
+
+// Сравнение записи с именем; длинное имя с совпавшим ключом дочитывается из inode
+static int index_cmp(asfs_fs* fs, const IndexEntry* e, const char* name, int* rc) {
+    int c = strncmp(e->key, name, INDEX_KEY);
+    if (c || key_full(e)) return c;
+    Inode node;
+    int r = read_inode(fs, e->inode & ~INDEX_DEL, &node);
+    if (r < 0) {
+        *rc = r;
+        return 0;
+    }
+    node.name[MAX_NAME_LEN-1] = '\0';
+    return strcmp(node.name, name);
+}
+
+// Запись жива, если её inode занят файлом с тем же началом имени
+static int index_live(asfs_fs* fs, const IndexEntry* e, Inode* node, int* rc) {
+    if (e->inode >= fs->sb.inode_count || !inode_in_use(fs, e->inode)) return 0;
+    int r = read_inode(fs, e->inode, node);
+    if (r < 0) {
+        *rc = r;
+        return 0;
+    }
+    node->name[MAX_NAME_LEN-1] = '\0';
+    return node->used && !node->is_snapshot && strncmp(node->name, e->key, INDEX_KEY) == 0;
+}
+
+// Первые n свободных блоков подряд (first fit); 0 - не нашлось
+static uint32_t alloc_area(asfs_fs* fs, uint32_t n) {
+    uint32_t run = 0;
+    for (uint32_t i = fs->sb.first_data_block; i < fs->sb.total_blocks; i++) {
+        if (fs->block_bitmap[i/8] & (1 << (i%8))) {
+            run = 0;
+            continue;
+        }
+        if (++run < n) continue;
+        uint32_t first = i + 1 - n;
+        for (uint32_t b = first; b <= i; b++) map_set(fs, 0, b, 1);
+        fs->sb.free_blocks -= n;
+        STAT_ADD(&fs->stats, alloc.block_allocs, n);
+        return first;
+    }
+    STAT_INC(&fs->stats, alloc.block_failures);
+    return 0;
+}
+
+static void free_area(asfs_fs* fs, uint32_t start, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t b = start + i;
+        free_blocks(fs, &b, 1);
+    }
+}
+
+// Индекс не записался - выкидываем, следующий листинг построит заново
+static void index_drop(asfs_fs* fs) {
+    SuperBlock* sb = &fs->sb;
+    if (index_present(fs)) free_area(fs, sb->index_start, sb->index_blocks);
+    sb->index_magic = 0;
+    sb->index_start = sb->index_blocks = sb->index_count =
+        sb->index_log_cap = sb->index_log_count = 0;
+}
+
+// Новый кусок: прогон из n записей и пустой журнал минимум на extra мест.
+// Старый кусок освобождается; суперблок пишет вызывающий
+static int index_write(asfs_fs* fs, const IndexEntry* v, uint32_t n, uint32_t extra) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    uint32_t cap = n / 16;
+    if (cap < INDEX_LOG_MIN) cap = INDEX_LOG_MIN;
+    if (cap > INDEX_LOG_MAX) cap = INDEX_LOG_MAX;
+    if (cap < extra) cap = extra;
+    uint32_t blocks = bytes_to_blocks(((uint64_t)n + cap) * sizeof(IndexEntry), bs);
+    uint32_t start = alloc_area(fs, blocks);
+    if (!start) return -ENOSPC;
+    int rc = n ? asfs_dev_write(&fs->dev, v, (size_t)n * sizeof(IndexEntry), start * bs) : 0;
+    if (rc < 0) {
+        free_area(fs, start, blocks);
+        return rc;
+    }
+    index_drop(fs);
+    sb->index_magic = INDEX_MAGIC;
+    sb->index_start = start;
+    sb->index_blocks = blocks;
+    sb->index_count = n;
+    sb->index_log_cap = blocks * bs / sizeof(IndexEntry) - n;  // хвост блока - журналу
+    sb->index_log_count = 0;
+    return 0;
+}
+
+static int cmp_index_name(const void* a, const void* b) {
+    return strcmp(((const IndexName*)a)->name, ((const IndexName*)b)->name);
+}
+
+typedef struct {
+    IndexName* out;
+    char* arena;
+    uint32_t count;
+    uint32_t live;
+} IndexCollect;
+
+static int index_collect_one(asfs_fs* fs, uint32_t inode_num, const Inode* node, void* arg) {
+    IndexCollect* c = arg;
+    if (c->count == c->live) return 1;
+    char* name = c->arena + (size_t)c->count * MAX_NAME_LEN;
+    memcpy(name, node->name, MAX_NAME_LEN);
+    index_entry(&c->out[c->count].e, name, inode_num);
+    c->out[c->count++].name = name;
+    return 0;
+}
+
+// Все живые файлы из таблицы inode по порядку имён; имена - в *arena
+static int index_collect(asfs_fs* fs, IndexName** out, uint32_t* count, char** arena) {
+    IndexCollect c = { .live = fs->sb.inode_count - fs->sb.free_inodes };
+    *out = c.out = malloc(((size_t)c.live + 1) * sizeof(IndexName));
+    *arena = c.arena = malloc(((size_t)c.live + 1) * MAX_NAME_LEN);
+    int rc = c.out && c.arena ? scan_live(fs, index_collect_one, &c) : -ENOMEM;
+    *count = c.count;
+    if (rc == 0) qsort(c.out, c.count, sizeof(IndexName), cmp_index_name);
+    return rc;
+}
+
+static int cmp_logrec(const void* a, const void* b) {
+    const LogRec* x = a;
+    const LogRec* y = b;
+    uint32_t i = x->e.inode & ~INDEX_DEL, j = y->e.inode & ~INDEX_DEL;
+    if (i != j) return i < j ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void index_log_free(IndexLog* log) {
+    free(log->adds);
+    free(log->dels);
+    free(log->arena);
+}
+
+// Разбор журнала. Записи группируются по inode: последняя операция решает,
+// жив ли файл из журнала, любое удаление в группе снимает запись прогона.
+// Добавления не на prefix отсеиваются по ключу, не читая inode
+static int index_log_load(asfs_fs* fs, const char* prefix, IndexLog* log) {
+    memset(log, 0, sizeof(*log));
+    uint32_t n = fs->sb.index_log_count;
+    if (n == 0) return 0;
+    size_t plen = strlen(prefix);
+    size_t klen = plen < INDEX_KEY ? plen : INDEX_KEY;
+    IndexEntry* raw = malloc((size_t)n * sizeof(IndexEntry));
+    LogRec* recs = malloc((size_t)n * sizeof(LogRec));
+    log->adds = malloc((size_t)n * sizeof(IndexName));
+    log->dels = malloc((size_t)n * sizeof(uint32_t));
+    log->arena = malloc((size_t)n * MAX_NAME_LEN);
+    int rc = raw && recs && log->adds && log->dels && log->arena ? 0 : -ENOMEM;
+    if (rc == 0)
+        rc = asfs_dev_read(&fs->dev, raw, (size_t)n * sizeof(IndexEntry),
+                           index_off(fs, fs->sb.index_count));
+    if (rc == 0) {
+        for (uint32_t i = 0; i < n; i++) recs[i] = (LogRec){raw[i], i};
+        qsort(recs, n, sizeof(LogRec), cmp_logrec);
+    }
+    for (uint32_t i = 0, j; i < n && rc == 0; i = j) {
+        uint32_t inode = recs[i].e.inode & ~INDEX_DEL;
+        int deleted = 0;
+        for (j = i; j < n && (recs[j].e.inode & ~INDEX_DEL) == inode; j++)
+            deleted |= !!(recs[j].e.inode & INDEX_DEL);
+        if (deleted) log->dels[log->ndels++] = inode;
+
+        const IndexEntry* last = &recs[j-1].e;
+        if ((last->inode & INDEX_DEL) || strncmp(last->key, prefix, klen)) continue;
+        char* name = log->arena + (size_t)log->nadds * MAX_NAME_LEN;
+        if (key_full(last)) {
+            strcpy(name, last->key);
+        } else {
+            Inode node;
+            rc = read_inode(fs, inode, &node);
+            if (rc < 0) break;
+            memcpy(name, node.name, MAX_NAME_LEN);
+            name[MAX_NAME_LEN-1] = '\0';
+        }
+        if (strncmp(name, prefix, plen)) continue;
+        log->adds[log->nadds++] = (IndexName){*last, name};
+    }
+    free(raw);
+    free(recs);
+    if (rc == 0) qsort(log->adds, log->nadds, sizeof(IndexName), cmp_index_name);
+    else index_log_free(log);
+    return rc;
+}
+
+static int cmp_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int index_deleted(const IndexLog* log, uint32_t inode) {
+    return log->ndels && bsearch(&inode, log->dels, log->ndels, sizeof(uint32_t), cmp_u32);
+}
+
+// Журнал вливается в прогон; новому журналу нужно не меньше extra мест
+static int index_merge(asfs_fs* fs, uint32_t extra) {
+    uint32_t n = fs->sb.index_count;
+    IndexLog log;
+    int rc = index_log_load(fs, "", &log);
+    if (rc < 0) return rc;
+    IndexEntry* run = malloc(((size_t)n + 1) * sizeof(IndexEntry));
+    IndexEntry* out = malloc(((size_t)n + log.nadds + 1) * sizeof(IndexEntry));
+    if (!run || !out) rc = -ENOMEM;
+    if (rc == 0 && n)
+        rc = asfs_dev_read(&fs->dev, run, (size_t)n * sizeof(IndexEntry), index_off(fs, 0));
+    uint32_t m = 0, k = 0;
+    for (uint32_t i = 0; i < n && rc == 0; i++) {
+        if (index_deleted(&log, run[i].inode)) continue;
+        while (k < log.nadds && index_cmp(fs, &run[i], log.adds[k].name, &rc) > 0)
+            out[m++] = log.adds[k++].e;
+        out[m++] = run[i];
+    }
+    while (k < log.nadds) out[m++] = log.adds[k++].e;
+    if (rc == 0) rc = index_write(fs, out, m, extra);
+    free(run);
+    free(out);
+    index_log_free(&log);
+    return rc;
+}
+
+// Дописывает записи в журнал (при переполнении сначала сливает его с прогоном).
+// Ошибка индекса операцию не валит: индекс выкидывается и строится заново
+static void index_append(asfs_fs* fs, const IndexEntry* v, uint32_t n) {
+    SuperBlock* sb = &fs->sb;
+    if (!index_present(fs) || n == 0) return;
+    int rc = 0;
+    if (sb->index_log_cap - sb->index_log_count < n) rc = index_merge(fs, n);
+    if (rc == 0)
+        rc = asfs_dev_write(&fs->dev, v, (size_t)n * sizeof(IndexEntry),
+                            index_off(fs, (uint64_t)sb->index_count + sb->index_log_count));
+    if (rc < 0) {
+        index_drop(fs);
+        return;
+    }
+    sb->index_log_count += n;
+}
+
+static void index_log(asfs_fs* fs, const char* name, uint32_t inode) {
+    IndexEntry e;
+    index_entry(&e, name, inode);
+    index_append(fs, &e, 1);
+}
+
+// Построение с нуля по таблице inode и сохранение
+static int index_build(asfs_fs* fs) {
+    IndexName* names;
+    uint32_t n;
+    char* arena;
+    int rc = index_collect(fs, &names, &n, &arena);
+    IndexEntry* v = rc == 0 ? malloc(((size_t)n + 1) * sizeof(IndexEntry)) : NULL;
+    if (rc == 0 && !v) rc = -ENOMEM;
+    for (uint32_t i = 0; i < n && rc == 0; i++) v[i] = names[i].e;
+    if (rc == 0) rc = index_write(fs, v, n, 0);
+    if (rc == 0) rc = save_metadata(fs);
+    free(v);
+    free(names);
+    free(arena);
+    return rc;
+}
+
+// ---- фильтр Блума по именам ----
+
+static int bloom_add_live(asfs_fs* fs, uint32_t inode_num, const Inode* node, void* arg) {
+    asfs_bloom_add(&fs->bloom, node->name);
+    return 0;
+}
+
+// Чистый фильтр с диска или, если его нет или он устарел, построение по таблице.
+// Не вышло - работаем без фильтра, поиск просто идёт по таблице
+static void bloom_prepare(asfs_fs* fs) {
+    SuperBlock* sb = &fs->sb;
+    if (fs->bloom.bits) return;
+    if (sb->bloom_state == BLOOM_CLEAN && asfs_bloom_init(&fs->bloom, sb->bloom_bits_log2) == 0 &&
+        asfs_dev_read(&fs->dev, fs->bloom.bits, asfs_bloom_bytes(&fs->bloom),
+                      (uint64_t)sb->bloom_start * sb->block_size) == 0)
+        return;
+    asfs_bloom_free(&fs->bloom);
+    sb->bloom_state = 0;
+    if (asfs_bloom_init(&fs->bloom, asfs_bloom_bits_for(sb->inode_count)) < 0 ||
+        scan_live(fs, bloom_add_live, NULL) < 0)
+        asfs_bloom_free(&fs->bloom);
+}
+
+// Новое имя: в фильтр, а копия на диске с этого момента устарела
+static void bloom_note(asfs_fs* fs, const char* name) {
+    if (fs->bloom.bits) asfs_bloom_add(&fs->bloom, name);
+    fs->sb.bloom_state = 0;
+    fs->share.names++;
+}
+
+// Фильтр - в непрерывный кусок блоков, затем суперблок с BLOOM_CLEAN
+static void bloom_save(asfs_fs* fs) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    size_t bytes = asfs_bloom_bytes(&fs->bloom);
+    uint32_t blocks = bytes_to_blocks(bytes, bs);
+    if (sb->bloom_blocks != blocks) {
+        free_area(fs, sb->bloom_start, sb->bloom_blocks);
+        sb->bloom_start = alloc_area(fs, blocks);
+        sb->bloom_blocks = sb->bloom_start ? blocks : 0;
+    }
+    if (sb->bloom_blocks &&
+        asfs_dev_write(&fs->dev, fs->bloom.bits, bytes, (uint64_t)sb->bloom_start * bs) == 0) {
+        sb->bloom_state = BLOOM_CLEAN;
+        sb->bloom_bits_log2 = fs->bloom.bits_log2;
+    }
+    save_metadata(fs);
+}
+
+// Откат выделений одного запроса (только в памяти - на диск ещё ничего не ушло)
+static void batch_release(asfs_fs* fs, asfs_create_req* req, uint32_t* blocks, uint32_t count) {
+    free_blocks(fs, blocks, count);
+    map_set(fs, 1, req->inode, 0);
+    fs->sb.free_inodes++;
+    req->inode = NO_INODE;
+}
+
+// Копит подряд идущие блоки или inode и пишет их одним pwrite
+typedef struct {
+    asfs_fs* fs;
+    uint8_t* buf;
+    uint64_t base;     // смещение нулевого элемента
+    uint32_t unit;     // размер элемента
+    int inodes;        // элементы - inode, пишутся через inodes_io
+    uint32_t first;    // первый элемент текущего прогона
+    uint32_t len;      // байт в буфере
+} RunWriter;
+
+static int run_flush(RunWriter* w) {
+    if (!w->len) return 0;
+    int rc = w->inodes ? inodes_io(w->fs, w->first, w->len / w->unit, w->buf, 1)
+                       : asfs_dev_write(&w->fs->dev, w->buf, w->len,
+                                        w->base + (uint64_t)w->first * w->unit);
+    w->len = 0;
+    return rc;
+}
+
+static int run_add(RunWriter* w, uint32_t index, const void* data, size_t size) {
+    int rc = 0;
+    if (w->len && (index != w->first + w->len / w->unit || w->len + w->unit > BATCH_IO))
+        rc = run_flush(w);
+    if (!w->len) w->first = index;
+    memcpy(w->buf + w->len, data, size);
+    memset(w->buf + w->len + size, 0, w->unit - size);
+    w->len += w->unit;
+    return rc;
+}
+
+static int cmp_inode(const void* a, const void* b) {
+    uint32_t x = (*(asfs_create_req* const*)a)->inode;
+    uint32_t y = (*(asfs_create_req* const*)b)->inode;
+    return x < y ? -1 : x > y;
+}
+
+static int do_create_batch(asfs_fs* fs, asfs_create_req* reqs, size_t n) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    uint32_t bs = fs->sb.block_size;
+    NameSet names = {0};
+    char* arena = NULL;
+    uint32_t (*blocks)[12] = calloc(n, sizeof(*blocks));
+    asfs_create_req** order = calloc(n, sizeof(*order));
+    RunWriter w = { .fs = fs, .buf = malloc(BATCH_IO), .unit = bs };
+    int rc = 0;
+    size_t created = 0;
+
+    if (!blocks || !order || !w.buf ||
+        nameset_init(&names, fs->sb.inode_count - fs->sb.free_inodes + n) < 0) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    // Если фильтр ручается за все имена пакета, таблицу не читаем
+    bloom_prepare(fs);
+    int maybe = !fs->bloom.bits;
+    for (size_t r = 0; r < n && !maybe; r++) maybe = asfs_bloom_maybe(&fs->bloom, reqs[r].name);
+    if (maybe) rc = collect_names(fs, &names, &arena);
+    if (rc < 0) goto out;
+
+    // 1. Проверки и выделение inode и блоков - только в памяти
+    for (size_t r = 0; r < n; r++) {
+        asfs_create_req* req = &reqs[r];
+        uint32_t count = blocks_for(fs, req->size);
+        req->inode = NO_INODE;
+        req->result = check_name(req->name);
+        if (req->result == 0 && count > 12) req->result = -EFBIG;
+        if (req->result == 0 && nameset_add(&names, req->name)) req->result = -EEXIST;
+        if (req->result < 0) continue;
+
+        // Когда место кончилось, не сканируем битмапы заново на каждый файл
+        if (fs->sb.free_inodes == 0 || fs->sb.free_blocks < count) {
+            req->result = -ENOSPC;
+            continue;
+        }
+        req->inode = find_free_inode(fs);
+        if (req->inode == NO_INODE) {
+            req->result = -ENOSPC;
+            continue;
+        }
+        map_set(fs, 1, req->inode, 1);
+        fs->sb.free_inodes--;
+        for (uint32_t b = 0; b < count; b++) {
+            blocks[r][b] = allocate_block(fs);
+            if (!blocks[r][b]) {
+                batch_release(fs, req, blocks[r], b);
+                req->result = -ENOSPC;
+                break;
+            }
+        }
+        if (req->result == 0) order[created++] = req;
+    }
+
+    // 2. Данные: подряд идущие блоки уходят одним pwrite
+    for (size_t r = 0; r < n && rc == 0; r++) {
+        if (reqs[r].result < 0) continue;
+        const uint8_t* data = reqs[r].data;
+        for (uint32_t b = 0; b < blocks_for(fs, reqs[r].size) && rc == 0; b++) {
+            size_t chunk = reqs[r].size - (size_t)b * bs;
+            if (chunk > bs) chunk = bs;
+            rc = run_add(&w, blocks[r][b], data + (size_t)b * bs, chunk);
+            fs->op_blocks++;
+        }
+    }
+    if (rc == 0) rc = run_flush(&w);
+
+    // 3. Inode по возрастанию номеров, соседние - одним pwrite
+    qsort(order, created, sizeof(*order), cmp_inode);
+    w.inodes = 1;
+    w.unit = sizeof(Inode);
+    time_t now = time(0);
+    for (size_t k = 0; k < created && rc == 0; k++) {
+        asfs_create_req* req = order[k];
+        Inode node = {
+            .used = 1,
+            .size = req->size,
+            .created = now,
+            .modified = now,
+            .birth = fs->sb.epoch
+        };
+        strncpy(node.name, req->name, MAX_NAME_LEN-1);
+        memcpy(node.blocks, blocks[req - reqs], sizeof(node.blocks));
+        rc = run_add(&w, req->inode, &node, sizeof(Inode));
+        STAT_INC(&fs->stats, inode.writes);
+        STAT_INC(&fs->stats, alloc.inode_allocs);
+    }
+    if (rc == 0) rc = run_flush(&w);
+
+    // 4. Журнал индекса имён - одной записью, метаданные - один раз на пакет
+    if (rc == 0 && created && index_present(fs)) {
+        IndexEntry* log = malloc(created * sizeof(IndexEntry));
+        for (size_t k = 0; k < created && log; k++)
+            index_entry(&log[k], order[k]->name, order[k]->inode);
+        if (log) index_append(fs, log, created);
+        else index_drop(fs);
+        free(log);
+    }
+    for (size_t k = 0; k < created && rc == 0; k++) bloom_note(fs, order[k]->name);
+    if (rc == 0) rc = save_metadata(fs);
+out:
+    if (rc < 0) {
+        // На диск битмапы не попали - возвращаем выделенное в памяти
+        for (size_t k = 0; k < created; k++) {
+            asfs_create_req* req = order[k];
+            batch_release(fs, req, blocks[req - reqs], blocks_for(fs, req->size));
+            req->result = rc;
+        }
+    }
+    free(names.slots);
+    free(arena);
+    free(blocks);
+    free(order);
+    free(w.buf);
+    return rc < 0 ? rc : (int)created;
+}
+
+int asfs_create_batch(asfs_fs* fs, asfs_create_req* reqs, size_t n) {
+    uint64_t t = op_begin(fs);
+    int rc = do_create_batch(fs, reqs, n);
+    for (size_t i = 0; fs->capture && rc >= 0 && i < n; i++)
+        capture(fs, WORKLOAD_CREATE, reqs[i].name, NULL, reqs[i].size, 0, reqs[i].result);
+    return op_end(fs, ASFS_OP_CREATE, t, rc);
+}
+
+// ---- экспорт ----
+// Таблица inode читается окнами по EXPORT_WINDOW файлов; внутри окна файлы
+// отдаются в порядке первого блока, так что данные читаются почти подряд,
+// а память ограничена окном и буфером в 12 блоков.
+
+#define EXPORT_WINDOW 16384
+
+typedef struct {
+    uint32_t inode;
+    Inode node;
+} ExportEntry;
+
+static int cmp_first_block(const void* a, const void* b) {
+    uint32_t x = ((const ExportEntry*)a)->node.blocks[0];
+    uint32_t y = ((const ExportEntry*)b)->node.blocks[0];
+    return x < y ? -1 : x > y;
+}
+
+static int export_file(asfs_fs* fs, const ExportEntry* e, uint8_t* buf,
+                       asfs_export_cb cb, void* arg) {
+    asfs_stat st;
+    uint32_t bs = fs->sb.block_size;
+    fill_stat(e->inode, &e->node, &st);
+    uint32_t count = blocks_for(fs, e->node.size);
+    if (count > 12) return -EIO;
+    if (count == 0) return cb(&st, NULL, 0, 0, arg);
+
+    // Подряд идущие блоки файла читаются одним pread
+    for (uint32_t b = 0; b < count; ) {
+        uint32_t run = 1;
+        while (b + run < count && e->node.blocks[b + run] == e->node.blocks[b] + run) run++;
+        uint32_t first = e->node.blocks[b];
+        if (first < fs->sb.first_data_block || first + run > fs->sb.total_blocks) return -EIO;
+
+        uint64_t offset = (uint64_t)b * bs;
+        size_t len = (size_t)run * bs;
+        if (len > e->node.size - offset) len = e->node.size - offset;
+        int rc = asfs_dev_read(&fs->dev, buf, len, (uint64_t)first * bs);
+        if (rc < 0) return rc;
+        fs->op_blocks += run;
+        rc = cb(&st, buf, len, offset, arg);
+        if (rc) return rc;
+        b += run;
+    }
+    return 0;
+}
+
+static int do_export(asfs_fs* fs, uint32_t epoch, const char* prefix, asfs_export_cb cb,
+                     void* arg) {
+    size_t plen = prefix ? strlen(prefix) : 0;
+    Inode* chunk = malloc(SCAN_CHUNK * sizeof(Inode));
+    ExportEntry* window = malloc(EXPORT_WINDOW * sizeof(ExportEntry));
+    uint8_t* buf = malloc(12 * (size_t)fs->sb.block_size);
+    int rc = 0;
+    if (!chunk || !window || !buf) {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    size_t n = 0;
+    for (uint32_t first = 1; first < fs->sb.inode_count && rc == 0; first += SCAN_CHUNK) {
+        uint32_t count = fs->sb.inode_count - first;
+        if (count > SCAN_CHUNK) count = SCAN_CHUNK;
+        uint32_t any = 0;
+        for (uint32_t i = first; i < first + count && !any; i++) any = inode_in_use(fs, i);
+        if (any) {
+            rc = inodes_io(fs, first, count, chunk, 0);
+            STAT_ADD(&fs->stats, inode.reads, count);
+        }
+        for (uint32_t i = 0; any && i < count && rc == 0; i++) {
+            Inode* node = &chunk[i];
+            if (!inode_in_use(fs, first + i) || !visible_at(node, epoch)) continue;
+            node->name[MAX_NAME_LEN-1] = '\0';
+            if (plen && strncmp(node->name, prefix, plen) != 0) continue;
+            window[n].inode = first + i;
+            window[n].node = *node;
+            n++;
+            if (n < EXPORT_WINDOW) continue;
+            // Окно заполнено - сбрасываем в физическом порядке
+            qsort(window, n, sizeof(ExportEntry), cmp_first_block);
+            for (size_t k = 0; k < n && rc == 0; k++)
+                rc = export_file(fs, &window[k], buf, cb, arg);
+            n = 0;
+        }
+        int last = first + count >= fs->sb.inode_count;
+        if (last && rc == 0 && n) {
+            qsort(window, n, sizeof(ExportEntry), cmp_first_block);
+            for (size_t k = 0; k < n && rc == 0; k++)
+                rc = export_file(fs, &window[k], buf, cb, arg);
+        }
+    }
+out:
+    free(chunk);
+    free(window);
+    free(buf);
+    return rc;
+}
+
+int asfs_export(asfs_fs* fs, const char* prefix, asfs_export_cb cb, void* arg) {
+    uint64_t t = op_begin_read(fs);
+    return op_end(fs, ASFS_OP_READ, t, do_export(fs, 0, prefix, cb, arg));
+}
+
+// ---- версии inode для снапшотов ФС ----
+// Inode заморожен, если его видит какой-то снапшот (эпоха рождения не новее
+// последнего снапшота). Перед первым изменением в новой эпохе прежнее содержимое
+// inode уходит в свободный inode как версия, а живой inode ссылается на неё
+// через prev. Блоки версии и живого файла общие, пока файл их не перезапишет:
+// такие блоки закреплены - на месте не меняются и не освобождаются
+
+static int inode_frozen(asfs_fs* fs, const Inode* node) {
+    return fs->sb.epoch_count && node->birth <= fs->epoch_max;
+}
+
+static int has_block(asfs_fs* fs, const Inode* node, uint32_t block) {
+    uint32_t n = blocks_for(fs, node->size);
+    if (n > 12) n = 12;
+    for (uint32_t i = 0; i < n; i++)
+        if (node->blocks[i] == block) return 1;
+    return 0;
+}
+
+// Маска блоков, общих с предыдущей версией
+static int shared_blocks(asfs_fs* fs, const Inode* node, uint32_t* mask) {
+    uint32_t n = blocks_for(fs, node->size);
+    if (n > 12) n = 12;
+    *mask = 0;
+    if (!node->prev) return 0;
+    Inode prev;
+    int rc = read_inode(fs, node->prev, &prev);
+    if (rc < 0) return rc;
+    for (uint32_t i = 0; i < n; i++)
+        if (has_block(fs, &prev, node->blocks[i])) *mask |= 1u << i;
+    return 0;
+}
+
+// Маска закреплённых блоков: у замороженного inode - все, иначе общие с prev
+static int pinned_blocks(asfs_fs* fs, const Inode* node, uint32_t* mask) {
+    if (inode_frozen(fs, node)) {
+        uint32_t n = blocks_for(fs, node->size);
+        *mask = (1u << (n > 12 ? 12 : n)) - 1;
+        return 0;
+    }
+    return shared_blocks(fs, node, mask);
+}
+
+// Освобождает незакреплённые блоки [from, to)
+static void release_blocks(asfs_fs* fs, Inode* node, uint32_t mask, uint32_t from, uint32_t to) {
+    for (uint32_t i = from; i < to; i++) {
+        if (mask & (1u << i)) node->blocks[i] = 0;
+        else free_blocks(fs, &node->blocks[i], 1);
+    }
+}
+
+static void drop_fresh(asfs_fs* fs, Inode* node, uint32_t fresh) {
+    for (uint32_t i = 0; i < 12; i++)
+        if (fresh & (1u << i)) free_blocks(fs, &node->blocks[i], 1);
+}
+
+// Закреплённые блоки [lo, hi) заменяются копиями; *fresh - маска заменённых
+static int cow_blocks(asfs_fs* fs, Inode* node, uint32_t mask, uint32_t lo, uint32_t hi,
+                      uint32_t* fresh) {
+    *fresh = 0;
+    for (uint32_t i = lo; i < hi; i++) {
+        if (!(mask & (1u << i))) continue;
+        uint32_t copy;
+        int rc = copy_blocks(fs, &node->blocks[i], &copy, 1);
+        if (rc < 0) {
+            drop_fresh(fs, node, *fresh);
+            return rc;
+        }
+        node->blocks[i] = copy;
+        *fresh |= 1u << i;
+    }
+    return 0;
+}
+
+// Пишет изменённый inode; замороженный orig перед этим сохраняется версией.
+// 1 - версия создана (изменился битмап inode), 0 - нет
+static int commit_inode(asfs_fs* fs, uint32_t inode_num, const Inode* orig, Inode* node) {
+    uint32_t v = NO_INODE;
+    int rc;
+    if (inode_frozen(fs, orig)) {
+        v = find_free_inode(fs);
+        if (v == NO_INODE) return -ENOSPC;
+        Inode old = *orig;
+        old.is_snapshot = INODE_VERSION;
+        old.death = fs->sb.epoch;
+        rc = write_inode(fs, v, &old);
+        if (rc < 0) return rc;
+        node->prev = v;
+        node->birth = fs->sb.epoch;
+    }
+    rc = write_inode(fs, inode_num, node);
+    if (rc < 0 || v == NO_INODE) {
+        node->prev = orig->prev;
+        node->birth = orig->birth;
+        return rc;
+    }
+    map_set(fs, 1, v, 1);
+    fs->sb.free_inodes--;
+    STAT_INC(&fs->stats, alloc.inode_allocs);
+    return 1;
+}
+
+static int do_edit(asfs_fs* fs, const char* filename, const void* new_data, size_t new_size) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    uint32_t inode_num;
+    Inode node;
+    int rc = find_inode(fs, filename, &inode_num, &node);
+    if (rc < 0) return rc;
+
+    uint32_t old_blocks = blocks_for(fs, node.size);
+    uint32_t new_blocks = blocks_for(fs, new_size);
+    if (new_blocks > 12) return -EFBIG;
+    Inode orig = node;
+    uint32_t mask, fresh = 0;
+    rc = pinned_blocks(fs, &node, &mask);
+    if (rc < 0) return rc;
+    // Новые блоки - в хвост и вместо закреплённых, остальные переписываются на месте
+    for (uint32_t i = 0; i < new_blocks && rc == 0; i++) {
+        if (i < old_blocks && !(mask & (1u << i))) continue;
+        node.blocks[i] = allocate_block(fs);
+        if (!node.blocks[i]) rc = -ENOSPC;
+        else fresh |= 1u << i;
+    }
+    for (uint32_t i = new_blocks; i < old_blocks; i++) node.blocks[i] = 0;
+    // Write new data
+    if (rc == 0) rc = write_blocks(fs, node.blocks, new_data, new_size);
+    // Update inode
+    node.size = new_size;
+    node.modified = time(0);
+    if (rc == 0) rc = commit_inode(fs, inode_num, &orig, &node);
+    if (rc < 0) {
+        drop_fresh(fs, &node, fresh);
+        return rc;
+    }
+    // Free excess blocks
+    if (new_blocks < old_blocks) release_blocks(fs, &orig, mask, new_blocks, old_blocks);
+    return save_metadata(fs);
+}
+
+int asfs_edit(asfs_fs* fs, const char* filename, const void* new_data, size_t new_size) {
+    uint64_t t = op_begin(fs);
+    int rc = do_edit(fs, filename, new_data, new_size);
+    capture(fs, WORKLOAD_EDIT, filename, NULL, new_size, 0, rc);
+    return op_end(fs, ASFS_OP_EDIT, t, rc);
+}
+
+// Суперблок и изменённые куски битмапа блоков - вместо полного сохранения
+// метаданных, когда операция трогала только блоки
+static int save_block_map(asfs_fs* fs) {
+    uint64_t t = LAT_NOW();
+    STAT_INC(&fs->stats, meta.saves);
+    int rc = asfs_dev_write(&fs->dev, &fs->sb, sizeof(SuperBlock), 0);
+    if (rc == 0) rc = map_flush(fs, 0);
+    LAT_RECORD(&fs->lat, ASFS_STEP_META_WRITE, t, NO_INODE, 0, rc);
+    if (rc == 0 && fs->discard_queue.count)
+        asfs_discard_flush(&fs->dev, &fs->discard_queue, fs->sb.block_size, fs->block_bitmap);
+    return rc;
+}
+
+// Пишет байты [pos, pos + len) файла прямо в его блоки, физически смежные
+// блоки - одним pwrite. data == NULL - нули
+static int write_range(asfs_fs* fs, const Inode* node, const void* data, size_t len,
+                       uint64_t pos) {
+    uint64_t t = LAT_NOW();
+    uint32_t bs = fs->sb.block_size;
+    uint8_t* zero = NULL;
+    if (!data && len) {
+        zero = calloc(1, len);
+        if (!zero) return -ENOMEM;
+        data = zero;
+    }
+    int rc = 0;
+    uint32_t count = 0;
+    size_t done = 0;
+    while (done < len && rc == 0) {
+        uint32_t idx = (pos + done) / bs;
+        uint32_t in_block = (pos + done) % bs;
+        uint32_t last = idx;
+        while (last + 1 < 12 && (uint64_t)(last + 1) * bs < pos + len &&
+               node->blocks[last+1] == node->blocks[last] + 1)
+            last++;
+        size_t chunk = (size_t)(last - idx + 1) * bs - in_block;
+        if (chunk > len - done) chunk = len - done;
+        rc = asfs_dev_write(&fs->dev, (const uint8_t*)data + done, chunk,
+                            (uint64_t)node->blocks[idx] * bs + in_block);
+        count += last - idx + 1;
+        done += chunk;
+    }
+    free(zero);
+    fs->op_blocks += count;
+    LAT_RECORD(&fs->lat, ASFS_STEP_DATA_WRITE, t, NO_INODE, count, rc);
+    return rc;
+}
+
+// Выделяет блоки [from, to) в хвост файла; при нехватке откатывает выделенное
+static int grow_blocks(asfs_fs* fs, Inode* node, uint32_t from, uint32_t to) {
+    for (uint32_t i = from; i < to; i++) {
+        node->blocks[i] = allocate_block(fs);
+        if (!node->blocks[i]) {
+            free_blocks(fs, node->blocks + from, i - from);
+            return -ENOSPC;
+        }
+    }
+    return 0;
+}
+
+// Общая часть write/append/truncate: меняется только затронутое - байты данных,
+// новые блоки в хвосте, inode и кусок битмапа, если выделение менялось
+static int64_t do_write_at(asfs_fs* fs, const char* filename, const void* data, size_t size,
+                           uint64_t offset, int append) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    uint32_t inode_num;
+    Inode node;
+    int rc = find_inode(fs, filename, &inode_num, &node);
+    if (rc < 0) return rc;
+    if (append) offset = node.size;
+    if (size == 0) return 0;
+    uint64_t end = offset + size;
+    if (end > 12ull * fs->sb.block_size) return -EFBIG;
+
+    uint32_t old_blocks = blocks_for(fs, node.size);
+    uint32_t new_blocks = blocks_for(fs, end > node.size ? end : node.size);
+    Inode orig = node;
+    uint32_t mask, fresh;
+    rc = pinned_blocks(fs, &node, &mask);
+    if (rc < 0) return rc;
+    // Закреплённые блоки под записью (и под нулями дыры) заменяются копиями
+    uint64_t from = offset < node.size ? offset : node.size;
+    uint32_t hi = blocks_for(fs, end) < old_blocks ? blocks_for(fs, end) : old_blocks;
+    rc = cow_blocks(fs, &node, mask, from / fs->sb.block_size, hi, &fresh);
+    if (rc < 0) return rc;
+    rc = grow_blocks(fs, &node, old_blocks, new_blocks);
+    if (rc < 0) {
+        drop_fresh(fs, &node, fresh);
+        return rc;
+    }
+
+    // Дыра между старым концом и offset читается как нули
+    if (offset > node.size) rc = write_range(fs, &node, NULL, offset - node.size, node.size);
+    if (rc == 0) rc = write_range(fs, &node, data, size, offset);
+    if (rc == 0) {
+        if (end > node.size) node.size = end;
+        node.modified = time(0);
+        rc = commit_inode(fs, inode_num, &orig, &node);
+    }
+    if (rc < 0) {
+        free_blocks(fs, node.blocks + old_blocks, new_blocks - old_blocks);
+        drop_fresh(fs, &node, fresh);
+        return rc;
+    }
+    // Появилась версия или копии блоков - битмапы меняются не одним куском
+    if (rc > 0 || fresh) {
+        rc = save_metadata(fs);
+        return rc < 0 ? rc : (int64_t)size;
+    }
+    if (new_blocks > old_blocks) {
+        rc = save_block_map(fs);
+        if (rc < 0) return rc;
+    }
+    return size;
+}
+
+ssize_t asfs_write(asfs_fs* fs, const char* filename, const void* data, size_t size,
+                   uint64_t offset) {
+    uint64_t t = op_begin(fs);
+    ssize_t rc = do_write_at(fs, filename, data, size, offset, 0);
+    capture(fs, WORKLOAD_WRITE, filename, NULL, size, offset, rc);
+    return op_end(fs, ASFS_OP_EDIT, t, rc);
+}
+
+ssize_t asfs_append(asfs_fs* fs, const char* filename, const void* data, size_t size) {
+    uint64_t t = op_begin(fs);
+    ssize_t rc = do_write_at(fs, filename, data, size, 0, 1);
+    capture(fs, WORKLOAD_APPEND, filename, NULL, size, 0, rc);
+    return op_end(fs, ASFS_OP_EDIT, t, rc);
+}
+
+static int do_truncate(asfs_fs* fs, const char* filename, uint64_t size) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    uint32_t inode_num;
+    Inode node;
+    int rc = find_inode(fs, filename, &inode_num, &node);
+    if (rc < 0) return rc;
+    if (size > 12ull * fs->sb.block_size) return -EFBIG;
+    if (size == node.size) return 0;
+
+    uint32_t old_blocks = blocks_for(fs, node.size);
+    uint32_t new_blocks = blocks_for(fs, size);
+    Inode orig = node;
+    uint32_t mask, fresh = 0;
+    rc = pinned_blocks(fs, &node, &mask);
+    if (rc < 0) return rc;
+    if (size > node.size) {
+        // Хвост последнего блока дописывается нулями - закреплённый копируем
+        rc = cow_blocks(fs, &node, mask, node.size / fs->sb.block_size, old_blocks, &fresh);
+        if (rc < 0) return rc;
+        rc = grow_blocks(fs, &node, old_blocks, new_blocks);
+        if (rc == 0) {
+            rc = write_range(fs, &node, NULL, size - node.size, node.size);
+            if (rc < 0) free_blocks(fs, node.blocks + old_blocks, new_blocks - old_blocks);
+        }
+        if (rc < 0) {
+            drop_fresh(fs, &node, fresh);
+            return rc;
+        }
+    }
+
+    // Inode с новым размером пишется до освобождения: после сбоя блоки
+    // в худшем случае утекут, но не окажутся у двух файлов
+    Inode updated = node;
+    updated.size = size;
+    updated.modified = time(0);
+    for (uint32_t i = new_blocks; i < old_blocks; i++) updated.blocks[i] = 0;
+    rc = commit_inode(fs, inode_num, &orig, &updated);
+    if (rc < 0) {
+        if (new_blocks > old_blocks)
+            free_blocks(fs, node.blocks + old_blocks, new_blocks - old_blocks);
+        drop_fresh(fs, &node, fresh);
+        return rc;
+    }
+    if (new_blocks < old_blocks) release_blocks(fs, &node, mask, new_blocks, old_blocks);
+    if (rc > 0 || fresh) return save_metadata(fs);
+    if (new_blocks == old_blocks) return 0;
+    return save_block_map(fs);
+}
+
+int asfs_truncate(asfs_fs* fs, const char* filename, uint64_t size) {
+    uint64_t t = op_begin(fs);
+    int rc = do_truncate(fs, filename, size);
+    capture(fs, WORKLOAD_TRUNCATE, filename, NULL, 0, size, rc);
+    return op_end(fs, ASFS_OP_EDIT, t, rc);
+}
+
+// Сколько бит вмещают сегменты битмапа
+static uint64_t bitmap_capacity(asfs_fs* fs, int inodes) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t blocks = inodes ? sb->inode_table - sb->inode_bitmap
+                             : sb->inode_bitmap - sb->block_bitmap;
+    for (uint32_t k = 0; k < sb->ext_count; k++)
+        blocks += inodes ? sb->ext[k].imap_blocks : sb->ext[k].bmap_blocks;
+    return blocks * sb->block_size * 8;
+}
+
+static int grow_map(uint8_t** map, uint32_t old_bits, uint32_t new_bits) {
+    size_t old_bytes = (old_bits + 7) / 8, new_bytes = (new_bits + 7) / 8;
+    uint8_t* p = realloc(*map, new_bytes);
+    if (!p) return -ENOMEM;
+    memset(p + old_bytes, 0, new_bytes - old_bytes);
+    *map = p;
+    return 0;
+}
+
+// Рост на месте: новое место - в конце образа, в его начале сегменты битмапов
+// (если старым не хватает ёмкости) и таблица новых inode. На диск уходят
+// только новые метаданные и байты битмапов, покрывающие новое; суперблок -
+// последним, до него образ остаётся прежним
+static int do_resize(asfs_fs* fs, uint64_t new_size) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    if (new_size / bs > UINT32_MAX) return -EFBIG;
+    uint32_t old_total = sb->total_blocks, old_inodes = sb->inode_count;
+    uint32_t new_total = new_size / bs;
+    if (new_total <= old_total) return -EINVAL;
+    if (sb->ext_count == MAX_EXTENTS) return -ENOSPC;
+
+    uint32_t add_blocks = new_total - old_total;
+    uint32_t add_inodes = add_blocks / 16;   // та же пропорция, что при форматировании
+    uint64_t per_block = bs * 8;
+    uint64_t bmap_cap = bitmap_capacity(fs, 0), imap_cap = bitmap_capacity(fs, 1);
+    uint32_t bmap_blocks = new_total > bmap_cap ? (new_total - bmap_cap + per_block - 1) / per_block : 0;
+    uint32_t imap_blocks = 0, itable_blocks = 0;
+    if (add_inodes) {
+        uint64_t need = (uint64_t)old_inodes + add_inodes;
+        imap_blocks = need > imap_cap ? (need - imap_cap + per_block - 1) / per_block : 0;
+        itable_blocks = bytes_to_blocks((uint64_t)add_inodes * sizeof(Inode), bs);
+    }
+    uint32_t meta = bmap_blocks + imap_blocks + itable_blocks;
+    if (meta >= add_blocks) return -ENOSPC;
+
+    uint64_t dev_size;
+    int rc = asfs_dev_size(&fs->dev, &dev_size);
+    if (rc < 0) return rc;
+    if (dev_size < (uint64_t)new_total * bs) {
+        rc = asfs_dev_truncate(&fs->dev, (uint64_t)new_total * bs);
+        if (rc < 0) return rc;
+    }
+    // На блочном устройстве там может быть что угодно
+    rc = asfs_dev_zero(&fs->dev, (uint64_t)old_total * bs, (uint64_t)meta * bs);
+    if (rc < 0) return rc;
+
+    rc = grow_map(&fs->block_bitmap, old_total, new_total);
+    if (rc == 0) rc = grow_map(&fs->inode_bitmap, old_inodes, old_inodes + add_inodes);
+    if (rc < 0) return rc;
+
+    SuperBlock saved = *sb;
+    uint32_t k = sb->ext_count;
+    memset(&sb->ext[k], 0, sizeof(sb->ext[k]));
+    sb->ext[k].first_block = old_total;
+    sb->ext[k].meta_blocks = meta;
+    if (bmap_blocks) {
+        sb->ext[k].bmap_bit = bmap_cap;
+        sb->ext[k].bmap_block = old_total;
+        sb->ext[k].bmap_blocks = bmap_blocks;
+    }
+    if (imap_blocks) {
+        sb->ext[k].imap_bit = imap_cap;
+        sb->ext[k].imap_block = old_total + bmap_blocks;
+        sb->ext[k].imap_blocks = imap_blocks;
+    }
+    sb->ext[k].inode_first = old_inodes;
+    sb->ext[k].inode_count = add_inodes;
+    sb->ext[k].inode_table = add_inodes ? old_total + bmap_blocks + imap_blocks : 0;
+    sb->ext_count++;
+    sb->version = FS_VERSION;
+    sb->bloom_state = 0;   // фильтр рассчитан на прежнее число inode - построим больший
+    sb->total_blocks = new_total;
+    sb->inode_count = old_inodes + add_inodes;
+    sb->free_blocks += add_blocks - meta;
+    sb->free_inodes += add_inodes;
+    for (uint32_t i = old_total; i < old_total + meta; i++)
+        fs->block_bitmap[i/8] |= 1 << (i%8);
+
+    // Байты битмапов с новыми битами (граничный байт со старыми - как есть в памяти)
+    rc = bitmap_io(fs, 0, fs->block_bitmap, old_total / 8,
+                   (new_total + 7) / 8 - old_total / 8, 1);
+    if (rc == 0 && add_inodes)
+        rc = bitmap_io(fs, 1, fs->inode_bitmap, old_inodes / 8,
+                       (sb->inode_count + 7) / 8 - old_inodes / 8, 1);
+    if (rc == 0) {
+        STAT_INC(&fs->stats, meta.saves);
+        rc = asfs_dev_write(&fs->dev, sb, sizeof(SuperBlock), 0);
+    }
+    if (rc == 0) rc = asfs_dev_sync(&fs->dev);
+    if (rc < 0) {
+        *sb = saved;
+        return rc;
+    }
+    fs->block_hint = old_total + meta;
+    asfs_bloom_free(&fs->bloom);
+    // Куски битмапов теперь другой длины: другие процессы перечитают всё,
+    // а мы при следующем сохранении запишем битмапы целиком
+    fs->share.layout++;
+    map_touch_all(fs);
+    return 0;
+}
+
+int asfs_resize(asfs_fs* fs, uint64_t new_size) {
+    uint64_t t = op_begin(fs);
+    return op_end(fs, ASFS_OP_EDIT, t, do_resize(fs, new_size));
+}
+
+// ---- освобождение в фоне ----
+// С asfs_set_reclaim удаление не освобождает блоки: inode помечается сиротой, его
+// номер дописывается в список сирот, на диск уходят inode, одна запись списка и
+// суперблок. Блоки и inode освобождает фоновый поток пачками, отпуская блокировку
+// между ними. Список лежит на диске, так что после сбоя его разбирает монтирование
+
+#define RECLAIM_BATCH 64        // сирот за одну пачку
+#define RECLAIM_DELAY_MS 10     // неполная пачка ждёт не дольше
+
+static int epoch_collect(asfs_fs* fs);
+
+// Дописывает inode в список; не хватает места - список переезжает целиком.
+// 1 - переехал (изменился битмап блоков), 0 - дописана одна запись
+static int orphan_add(asfs_fs* fs, uint32_t inode_num) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    if (fs->orphan_bits < sb->inode_count) {
+        int rc = grow_map(&fs->orphan_map, fs->orphan_bits, sb->inode_count);
+        if (rc < 0) return rc;
+        fs->orphan_bits = sb->inode_count;
+    }
+    if (sb->orphan_count == fs->orphan_cap) {
+        uint32_t cap = fs->orphan_cap ? fs->orphan_cap * 2 : 64;
+        uint32_t* p = realloc(fs->orphans, cap * sizeof(uint32_t));
+        if (!p) return -ENOMEM;
+        fs->orphans = p;
+        fs->orphan_cap = cap;
+    }
+    fs->orphans[sb->orphan_count] = inode_num;
+    fs->share.orphans++;
+    uint64_t bytes = (uint64_t)(sb->orphan_count + 1) * sizeof(uint32_t);
+    int rc;
+    if (bytes > (uint64_t)sb->orphan_blocks * bs) {
+        uint32_t blocks = bytes_to_blocks(bytes * 2, bs);
+        uint32_t start = alloc_area(fs, blocks);
+        if (!start) return -ENOSPC;
+        rc = asfs_dev_write(&fs->dev, fs->orphans, bytes, start * bs);
+        if (rc < 0) {
+            free_area(fs, start, blocks);
+            return rc;
+        }
+        free_area(fs, sb->orphan_start, sb->orphan_blocks);
+        sb->orphan_start = start;
+        sb->orphan_blocks = blocks;
+        sb->orphan_count++;
+        return 1;
+    }
+    rc = asfs_dev_write(&fs->dev, &fs->orphans[sb->orphan_count], sizeof(uint32_t),
+                        sb->orphan_start * bs + bytes - sizeof(uint32_t));
+    if (rc < 0) return rc;
+    sb->orphan_count++;
+    return 0;
+}
+
+// Делает inode сиротой; -ENOSPC - списку некуда расти, освобождать надо сразу
+static int orphan_inode(asfs_fs* fs, uint32_t inode_num, Inode* node, int* moved) {
+    int rc = orphan_add(fs, inode_num);
+    if (rc < 0) return rc;
+    *moved = rc;
+    node->is_snapshot = INODE_ORPHAN;
+    rc = write_inode(fs, inode_num, node);
+    if (rc < 0) {
+        fs->sb.orphan_count--;
+        return rc;
+    }
+    fs->orphan_map[inode_num/8] |= 1 << (inode_num%8);
+    return 0;
+}
+
+// Завершает отложенное удаление: суперблок (или все метаданные, если менялся
+// битмап). Поток будится, только если спит или набралась пачка: иначе каждое
+// удаление платило бы за два переключения контекста
+static int reclaim_commit(asfs_fs* fs, int full) {
+    int rc;
+    if (full) {
+        rc = save_metadata(fs);
+    } else {
+        STAT_INC(&fs->stats, meta.saves);
+        rc = asfs_dev_write(&fs->dev, &fs->sb, sizeof(SuperBlock), 0);
+    }
+    if (fs->reclaim_idle || fs->sb.orphan_count >= RECLAIM_BATCH || fs->sb.gc_pending)
+        pthread_cond_signal(&fs->reclaim_cond);
+    return rc;
+}
+
+// Блоки, общие с предыдущей версией, остаются ей. Замороженность не важна:
+// сиротой становится только inode, которого не видит ни один снапшот ФС
+static int orphan_release(asfs_fs* fs, uint32_t inode_num) {
+    Inode node;
+    if (inode_num == 0 || inode_num >= fs->sb.inode_count || !inode_in_use(fs, inode_num))
+        return 0;
+    if (inode_num < fs->orphan_bits) fs->orphan_map[inode_num/8] &= ~(1 << (inode_num%8));
+    fs->share.orphans++;
+    int rc = read_inode(fs, inode_num, &node);
+    if (rc < 0) return rc;
+    if (!node.used || node.is_snapshot != INODE_ORPHAN) return 0;
+    uint32_t mask;
+    rc = shared_blocks(fs, &node, &mask);
+    if (rc < 0) return rc;
+    uint32_t n = blocks_for(fs, node.size);
+    release_blocks(fs, &node, mask, 0, n > 12 ? 12 : n);
+    map_set(fs, 1, inode_num, 0);
+    fs->sb.free_inodes++;
+    STAT_INC(&fs->stats, alloc.inode_frees);
+    return 0;
+}
+
+static int reclaim_pending(asfs_fs* fs) {
+    return fs->sb.orphan_count || fs->sb.gc_pending;
+}
+
+// Одна пачка: отложенная сборка версий и до max сирот с конца списка
+static int reclaim_batch(asfs_fs* fs, uint32_t max) {
+    SuperBlock* sb = &fs->sb;
+    int rc = 0;
+    if (sb->gc_pending) {
+        rc = epoch_collect(fs);
+        if (rc == 0) sb->gc_pending = 0;
+    }
+    for (uint32_t n = 0; n < max && sb->orphan_count && rc == 0; n++) {
+        rc = orphan_release(fs, fs->orphans[sb->orphan_count - 1]);
+        if (rc == 0) sb->orphan_count--;
+    }
+    int saved = save_metadata(fs);
+    return rc < 0 ? rc : saved;
+}
+
+static int reclaim_all(asfs_fs* fs) {
+    int rc = 0;
+    while (rc == 0 && reclaim_pending(fs)) rc = reclaim_batch(fs, RECLAIM_BATCH);
+    return rc;
+}
+
+static void* reclaim_main(void* arg) {
+    asfs_fs* fs = arg;
+    fs_lock(fs);
+    while (!fs->reclaim_stop) {
+        // Дескриптор мог стать только для чтения (не перечитались метаданные)
+        if (fs->mode != ASFS_RDWR || !reclaim_pending(fs)) {
+            fs->reclaim_idle = 1;
+            fs_wait(fs, NULL);
+            fs->reclaim_idle = 0;
+            continue;
+        }
+        // Копим пачку, но неполную не держим дольше RECLAIM_DELAY_MS
+        if (fs->sb.orphan_count < RECLAIM_BATCH && !fs->sb.gc_pending) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += RECLAIM_DELAY_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            if (fs_wait(fs, &ts) == 0) continue;
+        }
+        // Ошибка ввода-вывода: не крутимся, а ждём следующего удаления
+        if (reclaim_batch(fs, RECLAIM_BATCH) < 0 && !fs->reclaim_stop)
+            fs_wait(fs, NULL);
+        fs_unlock(fs);
+        sched_yield();
+        fs_lock(fs);
+    }
+    fs_unlock(fs);
+    return NULL;
+}
+
+int asfs_set_reclaim(asfs_fs* fs, int on) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    fs_lock(fs);
+    int running = fs->reclaiming;
+    if (on && !running) {
+        fs->reclaim_stop = 0;
+        int err = pthread_create(&fs->reclaimer, NULL, reclaim_main, fs);
+        fs->reclaiming = err == 0;
+        fs_unlock(fs);
+        return -err;
+    }
+    if (!on && running) {
+        fs->reclaim_stop = 1;
+        fs->reclaiming = 0;
+        pthread_cond_signal(&fs->reclaim_cond);
+        fs_unlock(fs);
+        pthread_join(fs->reclaimer, NULL);
+        fs_lock(fs);
+    }
+    int rc = on ? 0 : reclaim_all(fs);
+    fs_unlock(fs);
+    return rc;
+}
+
+int asfs_reclaim(asfs_fs* fs) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    fs_lock(fs);
+    int rc = reclaim_all(fs);
+    fs_unlock(fs);
+    return rc;
+}
+
+static int do_delete(asfs_fs* fs, const char* filename) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    uint32_t inode_num;
+    Inode node;
+    int rc = find_inode(fs, filename, &inode_num, &node);
+    if (rc < 0) return rc;
+    rc = catalog_detach(fs, inode_num);
+    if (rc < 0) return rc;
+
+    if (inode_frozen(fs, &node)) {
+        // Файл виден в снапшоте ФС: inode вместе с блоками становится версией
+        node.is_snapshot = INODE_VERSION;
+        node.death = fs->sb.epoch;
+        rc = write_inode(fs, inode_num, &node);
+        if (rc < 0) return rc;
+        index_log(fs, filename, inode_num | INDEX_DEL);
+        return save_metadata(fs);
+    }
+    if (fs->reclaiming) {
+        int moved;
+        rc = orphan_inode(fs, inode_num, &node, &moved);
+        if (rc == 0) {
+            index_log(fs, filename, inode_num | INDEX_DEL);
+            return reclaim_commit(fs, moved);
+        }
+        if (rc != -ENOSPC) return rc;
+    }
+    uint32_t mask;
+    rc = pinned_blocks(fs, &node, &mask);
+    if (rc < 0) return rc;
+    // Free blocks
+    release_blocks(fs, &node, mask, 0, blocks_for(fs, node.size));
+    // Free inode
+    map_set(fs, 1, inode_num, 0);
+    fs->sb.free_inodes++;
+    STAT_INC(&fs->stats, alloc.inode_frees);
+    index_log(fs, filename, inode_num | INDEX_DEL);
+    return save_metadata(fs);
+}
+
+int asfs_delete(asfs_fs* fs, const char* filename) {
+    uint64_t t = op_begin(fs);
+    int rc = do_delete(fs, filename);
+    capture(fs, WORKLOAD_DELETE, filename, NULL, 0, 0, rc);
+    return op_end(fs, ASFS_OP_DELETE, t, rc);
+}
+
+static int do_lookup(asfs_fs* fs, const char* filename, asfs_stat* st) {
+    uint32_t inode_num;
+    Inode node;
+    int rc = find_inode(fs, filename, &inode_num, &node);
+    if (rc < 0) return rc;
+    if (st) fill_stat(inode_num, &node, st);
+    return 0;
+}
+
+int asfs_lookup(asfs_fs* fs, const char* filename, asfs_stat* st) {
+    asfs_stat found;
+    if (!st && fs->capture) st = &found;  // воспроизведению нужен размер
+    uint64_t t = op_begin_read(fs);
+    int rc = do_lookup(fs, filename, st);
+    capture(fs, WORKLOAD_LOOKUP, filename, NULL, rc == 0 && st ? st->size : 0, 0, rc);
+    return op_end(fs, ASFS_OP_LOOKUP, t, rc);
+}
+
+static ssize_t read_node(asfs_fs* fs, const Inode* node, void* buf, size_t count,
+                         uint64_t offset) {
+    if (offset >= node->size) return 0;
+    if (count > node->size - offset) count = node->size - offset;
+
+    uint8_t* out = buf;
+    size_t done = 0;
+    while (done < count) {
+        uint64_t pos = offset + done;
+        uint32_t idx = pos / fs->sb.block_size;
+        uint32_t in_block = pos % fs->sb.block_size;
+        size_t chunk = fs->sb.block_size - in_block;
+        if (chunk > count - done) chunk = count - done;
+        int rc = asfs_dev_read(&fs->dev, out + done, chunk,
+                               (uint64_t)node->blocks[idx] * fs->sb.block_size + in_block);
+        if (rc < 0) return rc;
+        fs->op_blocks++;
+        done += chunk;
+    }
+    return done;
+}
+
+static ssize_t do_read(asfs_fs* fs, const char* filename, void* buf, size_t count,
+                       uint64_t offset) {
+    Inode node;
+    int rc = find_inode(fs, filename, NULL, &node);
+    if (rc < 0) return rc;
+    return read_node(fs, &node, buf, count, offset);
+}
+
+ssize_t asfs_read(asfs_fs* fs, const char* filename, void* buf, size_t count,
+                  uint64_t offset) {
+    uint64_t t = op_begin_read(fs);
+    ssize_t rc = do_read(fs, filename, buf, count, offset);
+    capture(fs, WORKLOAD_READ, filename, NULL, count, offset, rc);
+    return op_end(fs, ASFS_OP_READ, t, rc);
+}
+
+static int do_list(asfs_fs* fs, asfs_list_cb cb, void* arg) {
+    asfs_stat st;
+    Inode node;
+
+    // Всегда показываем корневой каталог
+    int rc = read_inode(fs, 0, &node);
+    if (rc < 0) return rc;
+    fill_stat(0, &node, &st);
+    st.type = 1;
+    st.size = 0;
+    if (cb(&st, arg)) return 0;
+
+    // Обработка остальных inodes
+    for (uint32_t i = 1; i < fs->sb.inode_count; i++) {
+        if (!inode_live(fs, i)) continue;
+        rc = read_inode(fs, i, &node);
+        if (rc < 0) return rc;
+        if (!node.used || node.is_snapshot) continue;
+        fill_stat(i, &node, &st);
+        if (!st.modified) st.modified = st.created;
+        if (cb(&st, arg)) break;
+    }
+    return 0;
+}
+
+int asfs_list(asfs_fs* fs, asfs_list_cb cb, void* arg) {
+    uint64_t t = op_begin_read(fs);
+    int rc = do_list(fs, cb, arg);
+    capture(fs, WORKLOAD_LIST, NULL, NULL, 0, 0, rc);
+    return op_end(fs, ASFS_OP_LIST, t, rc);
+}
+
+typedef struct {
+    asfs_list_cb cb;
+    void* arg;
+    uint32_t limit;
+    uint32_t emitted;
+} SortedOut;
+
+// 1 - хватит: набран лимит или колбэк попросил остановиться
+static int sorted_emit(SortedOut* out, uint32_t inode_num, const Inode* node) {
+    asfs_stat st;
+    fill_stat(inode_num, node, &st);
+    if (!st.modified) st.modified = st.created;
+    out->emitted++;
+    if (out->cb(&st, out->arg)) return 1;
+    return out->limit && out->emitted >= out->limit;
+}
+
+// Первая запись прогона не меньше name (strict - строго больше). Удалённую
+// запись с имени не сравнить (её inode мог достаться другому файлу), поэтому
+// вместо неё берётся ближайшая живая справа
+static int index_bound(asfs_fs* fs, const IndexLog* log, const char* name, int strict,
+                       uint32_t* pos) {
+    uint32_t lo = 0, hi = fs->sb.index_count;
+    int rc = 0;
+    while (lo < hi && rc == 0) {
+        uint32_t mid = lo + (hi - lo) / 2, probe = mid;
+        IndexEntry e;
+        while ((rc = asfs_dev_read(&fs->dev, &e, sizeof(e), index_off(fs, probe))) == 0 &&
+               index_deleted(log, e.inode) && ++probe < hi)
+            ;
+        if (rc < 0) break;
+        if (probe == hi) {
+            hi = mid;
+            continue;
+        }
+        int c = index_cmp(fs, &e, name, &rc);
+        if (c < 0 || (strict && c == 0)) lo = probe + 1;
+        else hi = mid;
+    }
+    *pos = lo;
+    return rc;
+}
+
+// Без индекса (образ старше индекса или не хватило места) - сортировка всей
+// таблицы в памяти
+static int list_unindexed(asfs_fs* fs, const char* prefix, const char* after, SortedOut* out) {
+    IndexName* names;
+    uint32_t n;
+    char* arena;
+    size_t plen = strlen(prefix);
+    int rc = index_collect(fs, &names, &n, &arena);
+    for (uint32_t i = 0; i < n && rc == 0; i++) {
+        if (strncmp(names[i].name, prefix, plen) || (after && strcmp(names[i].name, after) <= 0))
+            continue;
+        Inode node;
+        if (index_live(fs, &names[i].e, &node, &rc) && sorted_emit(out, names[i].e.inode, &node))
+            break;
+    }
+    free(names);
+    free(arena);
+    return rc;
+}
+
+// Прогон с позиции бинарного поиска сливается на лету с добавлениями из журнала;
+// записи прогона, удалённые в журнале или разошедшиеся с inode, пропускаются
+static int do_list_sorted(asfs_fs* fs, const char* prefix, const char* after, uint32_t limit,
+                          asfs_list_cb cb, void* arg) {
+    SortedOut out = {cb, arg, limit, 0};
+    if (!prefix) prefix = "";
+    if (after && !*after) after = NULL;
+    if (!index_present(fs)) {
+        int rc = list_unindexed(fs, prefix, after, &out);
+        return rc < 0 ? rc : (int)out.emitted;
+    }
+
+    IndexLog log;
+    int rc = index_log_load(fs, prefix, &log);
+    if (rc < 0) return rc;
+    size_t plen = strlen(prefix);
+    uint32_t pos = 0, k = 0;
+    if (plen) rc = index_bound(fs, &log, prefix, 0, &pos);
+    if (rc == 0 && after) {
+        uint32_t next;
+        rc = index_bound(fs, &log, after, 1, &next);
+        if (next > pos) pos = next;
+        while (k < log.nadds && strcmp(log.adds[k].name, after) <= 0) k++;
+    }
+    IndexEntry* chunk = malloc(INDEX_CHUNK * sizeof(IndexEntry));
+    if (!chunk && rc == 0) rc = -ENOMEM;
+    int stop = 0;
+    Inode node;
+    while (rc == 0 && !stop && pos < fs->sb.index_count) {
+        uint32_t n = fs->sb.index_count - pos;
+        if (n > INDEX_CHUNK) n = INDEX_CHUNK;
+        rc = asfs_dev_read(&fs->dev, chunk, n * sizeof(IndexEntry), index_off(fs, pos));
+        pos += n;
+        for (uint32_t i = 0; i < n && rc == 0 && !stop; i++) {
+            const IndexEntry* e = &chunk[i];
+            // Прогон отсортирован: первая запись не на префикс - конец диапазона
+            int c = strncmp(e->key, prefix, plen < INDEX_KEY ? plen : INDEX_KEY);
+            if (c > 0) {
+                pos = fs->sb.index_count;
+                break;
+            }
+            if (c < 0 || index_deleted(&log, e->inode) || !index_live(fs, e, &node, &rc))
+                continue;
+            if (plen > INDEX_KEY && (c = strncmp(node.name, prefix, plen)) != 0) {
+                if (c < 0) continue;
+                pos = fs->sb.index_count;
+                break;
+            }
+            while (!stop && rc == 0 && k < log.nadds && strcmp(log.adds[k].name, node.name) < 0) {
+                Inode added;
+                const IndexEntry* a = &log.adds[k++].e;
+                if (index_live(fs, a, &added, &rc)) stop = sorted_emit(&out, a->inode, &added);
+            }
+            if (!stop && rc == 0) stop = sorted_emit(&out, e->inode, &node);
+        }
+    }
+    while (!stop && rc == 0 && k < log.nadds) {
+        const IndexEntry* a = &log.adds[k++].e;
+        if (index_live(fs, a, &node, &rc)) stop = sorted_emit(&out, a->inode, &node);
+    }
+    free(chunk);
+    index_log_free(&log);
+    return rc < 0 ? rc : (int)out.emitted;
+}
+
+int asfs_list_sorted(asfs_fs* fs, const char* prefix, const char* after, uint32_t limit,
+                     asfs_list_cb cb, void* arg) {
+    uint64_t t = op_begin_read(fs);
+    return op_end(fs, ASFS_OP_LIST, t, do_list_sorted(fs, prefix, after, limit, cb, arg));
+}
+
+static int do_index_build(asfs_fs* fs) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    if (index_present(fs)) return 0;
+    return index_build(fs);
+}
+
+int asfs_index_build(asfs_fs* fs) {
+    uint64_t t = op_begin(fs);
+    return op_end(fs, ASFS_OP_LIST, t, do_index_build(fs));
+}
+
+static int do_snapshot_create(asfs_fs* fs, const char* filename, const char* snap_name,
+                              uint32_t* inode_out) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    int rc = check_name(snap_name);
+    if (rc < 0) return rc;
+    if (find_snapshot(fs, snap_name) != NO_SLOT) return -EEXIST;
+
+    // Находим исходный inode
+    uint32_t orig_inode;
+    Inode orig_node, snap_node;
+    rc = find_inode(fs, filename, &orig_inode, &orig_node);
+    if (rc < 0) return rc;
+
+    // Создаем новый inode для снапшота
+    uint32_t snap_inode = find_free_inode(fs);
+    if (snap_inode == NO_INODE) return -ENOSPC;
+
+    // Копируем метаданные
+    memcpy(&snap_node, &orig_node, sizeof(Inode));
+    snap_node.snapshot_count = 0;
+    snap_node.modified = time(0);
+    snap_node.is_snapshot = 1;
+    snap_node.snapshot_parent = orig_inode;
+    snap_node.prev = snap_node.death = 0;
+
+    // Копируем данные в новые блоки
+    rc = copy_blocks(fs, orig_node.blocks, snap_node.blocks, blocks_for(fs, orig_node.size));
+    if (rc < 0) return rc;
+
+    // Сохраняем новый inode
+    rc = write_inode(fs, snap_inode, &snap_node);
+    if (rc < 0) return rc;
+    map_set(fs, 1, snap_inode, 1);
+    fs->sb.free_inodes--;
+    STAT_INC(&fs->stats, alloc.inode_allocs);
+
+    // Обновляем оригинальный inode
+    orig_node.snapshot_count++;
+    rc = write_inode(fs, orig_inode, &orig_node);
+    if (rc < 0) return rc;
+
+    // Создаем запись снапшота
+    SnapRec snap = {
+        .snap_id = fs->sb.next_snap_id++,
+        .original_inode = orig_inode,
+        .snapshot_inode = snap_inode,
+        .timestamp = time(0)
+    };
+    strncpy(snap.name, snap_name, MAX_NAME_LEN-1);
+    uint32_t slot;
+    rc = catalog_add(fs, &snap, &slot);
+    if (rc < 0) return rc;
+    rc = catalog_write(fs, slot);
+    if (rc < 0) {
+        catalog_remove(fs, slot);
+        return rc;
+    }
+
+    if (inode_out) *inode_out = snap_inode;
+    return save_metadata(fs);
+}
+
+int asfs_snapshot_create(asfs_fs* fs, const char* filename, const char* snap_name,
+                         uint32_t* inode_out) {
+    uint64_t t = op_begin(fs);
+    int rc = do_snapshot_create(fs, filename, snap_name, inode_out);
+    capture(fs, WORKLOAD_SNAP_CREATE, filename, snap_name, 0, 0, rc);
+    return op_end(fs, ASFS_OP_SNAPSHOT, t, rc);
+}
+
+static int do_snapshot_restore(asfs_fs* fs, const char* filename, const char* snap_name) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    // Находим текущий inode файла
+    uint32_t curr_inode;
+    Inode curr_node, snap_node;
+    int rc = find_inode(fs, filename, &curr_inode, &curr_node);
+    if (rc < 0) return rc;
+
+    // Находим снапшот
+    uint32_t slot = find_snapshot(fs, snap_name);
+    if (slot == NO_SLOT) return -ENOENT;
+
+    // Читаем данные снапшота
+    rc = read_inode(fs, fs->cat.recs[slot].snapshot_inode, &snap_node);
+    if (rc < 0) return rc;
+
+    uint32_t mask;
+    rc = pinned_blocks(fs, &curr_node, &mask);
+    if (rc < 0) return rc;
+
+    // Копируем данные снапшота, чтобы файл не делил блоки со снапшотом
+    uint32_t new_blocks[12] = {0};
+    rc = copy_blocks(fs, snap_node.blocks, new_blocks, blocks_for(fs, snap_node.size));
+    if (rc < 0) return rc;
+
+    Inode orig = curr_node;
+    curr_node.size = snap_node.size;
+    curr_node.modified = time(0);
+    memcpy(curr_node.blocks, new_blocks, sizeof(curr_node.blocks));
+
+    // Записываем обновленный inode
+    rc = commit_inode(fs, curr_inode, &orig, &curr_node);
+    if (rc < 0) {
+        free_blocks(fs, new_blocks, blocks_for(fs, snap_node.size));
+        return rc;
+    }
+    // Освобождаем старые блоки файла (закреплённые остаются версиям)
+    release_blocks(fs, &orig, mask, 0, blocks_for(fs, orig.size));
+    return save_metadata(fs);
+}
+
+int asfs_snapshot_restore(asfs_fs* fs, const char* filename, const char* snap_name) {
+    uint64_t t = op_begin(fs);
+    int rc = do_snapshot_restore(fs, filename, snap_name);
+    capture(fs, WORKLOAD_SNAP_RESTORE, filename, snap_name, 0, 0, rc);
+    return op_end(fs, ASFS_OP_RESTORE, t, rc);
+}
+
+static int do_snapshot_delete(asfs_fs* fs, const char* snap_name) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    // Поиск снапшота по имени
+    uint32_t slot = find_snapshot(fs, snap_name);
+    if (slot == NO_SLOT) return -ENOENT;
+    SnapRec target_snap = fs->cat.recs[slot];
+
+    // 1. Освобождаем inode снапшота
+    Inode snap_inode;
+    int rc = read_inode(fs, target_snap.snapshot_inode, &snap_inode);
+    if (rc < 0) return rc;
+
+    // В фоновом режиме inode снапшота уходит в список сирот
+    int moved = -1;
+    if (fs->reclaiming) {
+        rc = orphan_inode(fs, target_snap.snapshot_inode, &snap_inode, &moved);
+        if (rc < 0 && rc != -ENOSPC) return rc;
+    }
+    if (moved < 0) {
+        // Освобождаем блоки данных
+        free_blocks(fs, snap_inode.blocks, blocks_for(fs, snap_inode.size));
+
+        // Освобождаем inode в битовой карте
+        uint32_t inode_byte = target_snap.snapshot_inode / 8;
+        uint8_t inode_bit = 1 << (target_snap.snapshot_inode % 8);
+        if (fs->inode_bitmap[inode_byte] & inode_bit) {
+            map_set(fs, 1, target_snap.snapshot_inode, 0);
+            fs->sb.free_inodes++;
+            STAT_INC(&fs->stats, alloc.inode_frees);
+        }
+    }
+
+    // 2. Обновляем оригинальный файл, если он ещё есть
+    if (target_snap.original_inode != NO_INODE) {
+        Inode orig_inode;
+        rc = read_inode(fs, target_snap.original_inode, &orig_inode);
+        if (rc < 0) return rc;
+        if (orig_inode.snapshot_count) orig_inode.snapshot_count--;
+        rc = write_inode(fs, target_snap.original_inode, &orig_inode);
+        if (rc < 0) return rc;
+    }
+
+    // 3. Удаляем из каталога - пишется одна запись
+    uint32_t cat_start = fs->sb.catalog_start;
+    catalog_remove(fs, slot);
+    rc = catalog_write(fs, slot);
+    if (rc < 0) return rc;
+
+    // 4. Сохраняем изменения
+    if (moved < 0) return save_metadata(fs);
+    return reclaim_commit(fs, moved || fs->sb.catalog_start != cat_start);
+}
+
+int asfs_snapshot_delete(asfs_fs* fs, const char* snap_name) {
+    uint64_t t = op_begin(fs);
+    int rc = do_snapshot_delete(fs, snap_name);
+    capture(fs, WORKLOAD_SNAP_DELETE, snap_name, NULL, 0, 0, rc);
+    return op_end(fs, ASFS_OP_DELETE, t, rc);
+}
+
+int asfs_snapshot_list(asfs_fs* fs, asfs_snapshot_cb cb, void* arg) {
+    int rc = 0;
+    fs_lock_read(fs);
+    for (uint32_t i = 0; i < fs->sb.catalog_slots; i++) {
+        SnapRec* snap = &fs->cat.recs[i];
+        if (!snap->used) continue;
+        asfs_snapshot_info info = {0};
+        Inode node;
+        rc = read_inode(fs, snap->snapshot_inode, &node);
+        if (rc < 0) break;
+
+        memcpy(info.name, snap->name, MAX_NAME_LEN-1);
+        memcpy(info.file, node.name, MAX_NAME_LEN-1);
+        info.original_inode = snap->original_inode;
+        info.snapshot_inode = snap->snapshot_inode;
+        info.size = node.size;
+        info.timestamp = snap->timestamp;
+        if (cb(&info, arg)) break;
+    }
+    fs_unlock(fs);
+    return rc;
+}
+
+// ---- снапшоты ФС ----
+// Таблица снапшотов - массив EpochRec в непрерывном куске блоков данных;
+// новый снапшот дописывает одну запись и суперблок
+
+static int epoch_find(asfs_fs* fs, const char* name) {
+    for (uint32_t i = 0; i < fs->sb.epoch_count; i++)
+        if (strcmp(fs->epochs[i].name, name) == 0) return i;
+    return -1;
+}
+
+// Пишет записи таблицы начиная с first; если кусок мал - таблица переезжает целиком
+static int epoch_save(asfs_fs* fs, uint32_t first) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    uint64_t bytes = (uint64_t)sb->epoch_count * sizeof(EpochRec);
+    fs->share.epochs++;
+    if (bytes > (uint64_t)sb->epoch_blocks * bs) {
+        uint32_t blocks = bytes_to_blocks(bytes * 2, bs);
+        uint32_t start = alloc_area(fs, blocks);
+        if (!start) return -ENOSPC;
+        int rc = asfs_dev_write(&fs->dev, fs->epochs, bytes, start * bs);
+        if (rc < 0) {
+            free_area(fs, start, blocks);
+            return rc;
+        }
+        free_area(fs, sb->epoch_start, sb->epoch_blocks);
+        sb->epoch_start = start;
+        sb->epoch_blocks = blocks;
+        return 0;
+    }
+    if (first >= sb->epoch_count) return 0;
+    return asfs_dev_write(&fs->dev, fs->epochs + first,
+                          (sb->epoch_count - first) * sizeof(EpochRec),
+                          sb->epoch_start * bs + first * sizeof(EpochRec));
+}
+
+static int do_epoch_snapshot(asfs_fs* fs, const char* name) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    SuperBlock* sb = &fs->sb;
+    size_t len = strlen(name);
+    if (len == 0) return -EINVAL;
+    if (len >= ASFS_EPOCH_NAME) return -ENAMETOOLONG;
+    if (epoch_find(fs, name) >= 0) return -EEXIST;
+    if (sb->epoch == UINT32_MAX) return -EOVERFLOW;
+
+    EpochRec* p = realloc(fs->epochs, (sb->epoch_count + 1) * sizeof(EpochRec));
+    if (!p) return -ENOMEM;
+    fs->epochs = p;
+    EpochRec* rec = &p[sb->epoch_count];
+    memset(rec, 0, sizeof(*rec));
+    memcpy(rec->name, name, len);
+    rec->epoch = sb->epoch;
+    rec->created = time(0);
+    uint32_t moved = sb->epoch_start;
+    sb->epoch_count++;
+    int rc = epoch_save(fs, sb->epoch_count - 1);
+    if (rc < 0) {
+        sb->epoch_count--;
+        return rc;
+    }
+    // Заморозка - это просто переход к следующей эпохе
+    fs->epoch_max = sb->epoch++;
+    if (sb->epoch_start != moved) return save_metadata(fs);
+    STAT_INC(&fs->stats, meta.saves);
+    return asfs_dev_write(&fs->dev, sb, sizeof(SuperBlock), 0);
+}
+
+int asfs_epoch_snapshot(asfs_fs* fs, const char* name) {
+    uint64_t t = op_begin(fs);
+    return op_end(fs, ASFS_OP_SNAPSHOT, t, do_epoch_snapshot(fs, name));
+}
+
+// Версия нужна, пока её видит хоть один снапшот
+static int epoch_retained(asfs_fs* fs, const Inode* node) {
+    for (uint32_t i = 0; i < fs->sb.epoch_count; i++)
+        if (node->birth <= fs->epochs[i].epoch && fs->epochs[i].epoch < node->death) return 1;
+    return 0;
+}
+
+// Вырезает из цепочки версии drop[0..n), лежащие между newer и older (0 - соседа
+// нет). Блок, общий с соседом, остаётся ему; блоки, которых у соседей нет,
+// освобождаются: общими бывают только подряд идущие звенья цепочки
+static int epoch_unlink(asfs_fs* fs, uint32_t newer, uint32_t older, const uint32_t* drop,
+                        uint32_t n) {
+    Inode nn, on, v;
+    int rc = 0;
+    if (older) rc = read_inode(fs, older, &on);
+    if (rc == 0 && newer) rc = read_inode(fs, newer, &nn);
+    if (rc == 0 && newer) {
+        nn.prev = older;
+        rc = write_inode(fs, newer, &nn);
+    }
+    for (uint32_t k = 0; k < n && rc == 0; k++) {
+        rc = read_inode(fs, drop[k], &v);
+        if (rc < 0) break;
+        uint32_t count = blocks_for(fs, v.size);
+        if (count > 12) count = 12;
+        for (uint32_t b = 0; b < count; b++)
+            if (!(newer && has_block(fs, &nn, v.blocks[b])) &&
+                !(older && has_block(fs, &on, v.blocks[b])))
+                free_blocks(fs, &v.blocks[b], 1);
+        map_set(fs, 1, drop[k], 0);
+        fs->sb.free_inodes++;
+        STAT_INC(&fs->stats, alloc.inode_frees);
+    }
+    return rc;
+}
+
+// Сборка мусора после удаления снапшота: по таблице inode строятся цепочки
+// версий, из каждой вырезаются версии, не видимые ни в одном снапшоте
+static int epoch_collect(asfs_fs* fs) {
+    uint32_t count = fs->sb.inode_count;
+    uint32_t* prev = calloc(count, sizeof(uint32_t));
+    uint32_t* drop = malloc(count * sizeof(uint32_t));
+    uint8_t* kind = calloc(count, 1);          // 1 - файл, 2 - версия, 3 - нужная версия
+    uint8_t* has_next = calloc((count + 7) / 8, 1);
+    Inode* chunk = malloc(SCAN_CHUNK * sizeof(Inode));
+    int rc = 0;
+    if (!prev || !drop || !kind || !has_next || !chunk) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    for (uint32_t first = 1; first < count && rc == 0; first += SCAN_CHUNK) {
+        uint32_t n = count - first;
+        if (n > SCAN_CHUNK) n = SCAN_CHUNK;
+        uint32_t any = 0;
+        for (uint32_t i = first; i < first + n && !any; i++) any = inode_in_use(fs, i);
+        if (!any) continue;
+        rc = inodes_io(fs, first, n, chunk, 0);
+        STAT_ADD(&fs->stats, inode.reads, n);
+        for (uint32_t i = 0; i < n && rc == 0; i++) {
+            const Inode* node = &chunk[i];
+            if (!inode_in_use(fs, first + i) || !node->used) continue;
+            // Сирота держит свои блоки до освобождения - как живой файл
+            if (!node->is_snapshot || node->is_snapshot == INODE_ORPHAN) kind[first + i] = 1;
+            else if (node->is_snapshot == INODE_VERSION)
+                kind[first + i] = epoch_retained(fs, node) ? 3 : 2;
+            else continue;
+            if (node->prev < count) prev[first + i] = node->prev;
+        }
+    }
+    // prev, указывающий не на версию, цепочку обрывает
+    for (uint32_t i = 1; i < count && rc == 0; i++) {
+        if (prev[i] && kind[prev[i]] < 2) prev[i] = 0;
+        if (kind[i] && prev[i]) has_next[prev[i]/8] |= 1 << (prev[i]%8);
+    }
+    for (uint32_t head = 1; head < count && rc == 0; head++) {
+        if (!kind[head] || (has_next[head/8] & (1 << (head%8)))) continue;
+        uint32_t kept = 0, n = 0, steps = 0;
+        for (uint32_t cur = head; cur && steps < count && rc == 0; cur = prev[cur], steps++) {
+            if (kind[cur] == 2) {
+                drop[n++] = cur;
+                continue;
+            }
+            if (n) rc = epoch_unlink(fs, kept, cur, drop, n);
+            kept = cur;
+            n = 0;
+        }
+        if (n && rc == 0) rc = epoch_unlink(fs, kept, 0, drop, n);
+    }
+out:
+    free(prev);
+    free(drop);
+    free(kind);
+    free(has_next);
+    free(chunk);
+    return rc;
+}
+
+static int do_epoch_delete(asfs_fs* fs, const char* name) {
+    if (fs->mode != ASFS_RDWR) return -EROFS;
+    SuperBlock* sb = &fs->sb;
+    int idx = epoch_find(fs, name);
+    if (idx < 0) return -ENOENT;
+
+    memmove(&fs->epochs[idx], &fs->epochs[idx + 1],
+            (sb->epoch_count - idx - 1) * sizeof(EpochRec));
+    sb->epoch_count--;
+    fs->epoch_max = 0;
+    for (uint32_t i = 0; i < sb->epoch_count; i++)
+        if (fs->epochs[i].epoch > fs->epoch_max) fs->epoch_max = fs->epochs[i].epoch;
+    int rc = epoch_save(fs, idx);
+    // Сборку версий сделает фоновый поток; таблица при удалении не переезжает
+    if (rc == 0 && fs->reclaiming) {
+        sb->gc_pending = 1;
+        return reclaim_commit(fs, 0);
+    }
+    if (rc == 0) rc = epoch_collect(fs);
+    if (rc == 0) sb->gc_pending = 0;
+    // Даже после ошибки сборки: снапшот из таблицы уже удалён, остатки
+    // соберёт следующее удаление
+    int saved = save_metadata(fs);
+    return rc < 0 ? rc : saved;
+}
+
+int asfs_epoch_delete(asfs_fs* fs, const char* name) {
+    uint64_t t = op_begin(fs);
+    return op_end(fs, ASFS_OP_DELETE, t, do_epoch_delete(fs, name));
+}
+
+int asfs_epoch_list(asfs_fs* fs, asfs_epoch_cb cb, void* arg) {
+    fs_lock_read(fs);
+    for (uint32_t i = 0; i < fs->sb.epoch_count; i++) {
+        asfs_epoch_info info = {0};
+        memcpy(info.name, fs->epochs[i].name, ASFS_EPOCH_NAME);
+        info.epoch = fs->epochs[i].epoch;
+        info.created = fs->epochs[i].created;
+        if (cb(&info, arg)) break;
+    }
+    fs_unlock(fs);
+    return 0;
+}
+
+static int epoch_of(asfs_fs* fs, const char* name, uint32_t* epoch) {
+    int idx = epoch_find(fs, name);
+    if (idx < 0) return -ENOENT;
+    *epoch = fs->epochs[idx].epoch;
+    return 0;
+}
+
+typedef struct {
+    asfs_list_cb cb;
+    void* arg;
+} EpochList;
+
+static int epoch_list_one(asfs_fs* fs, uint32_t inode_num, const Inode* node, void* arg) {
+    EpochList* l = arg;
+    asfs_stat st;
+    fill_stat(inode_num, node, &st);
+    if (!st.modified) st.modified = st.created;
+    return l->cb(&st, l->arg);
+}
+
+static int do_epoch_files(asfs_fs* fs, const char* name, asfs_list_cb cb, void* arg) {
+    uint32_t epoch;
+    int rc = epoch_of(fs, name, &epoch);
+    if (rc < 0) return rc;
+    EpochList l = {cb, arg};
+    return scan_at(fs, epoch, epoch_list_one, &l);
+}
+
+int asfs_epoch_files(asfs_fs* fs, const char* name, asfs_list_cb cb, void* arg) {
+    uint64_t t = op_begin_read(fs);
+    return op_end(fs, ASFS_OP_LIST, t, do_epoch_files(fs, name, cb, arg));
+}
+
+typedef struct {
+    const char* name;
+    uint32_t inode;
+    Inode node;
+    int found;
+} EpochFind;
+
+static int epoch_find_one(asfs_fs* fs, uint32_t inode_num, const Inode* node, void* arg) {
+    EpochFind* f = arg;
+    if (strcmp(node->name, f->name) != 0) return 0;
+    f->inode = inode_num;
+    f->node = *node;
+    f->found = 1;
+    fs->op_inode = inode_num;
+    return 1;
+}
+
+// Старые версии не в фильтре Блума и не в индексе - ищем проходом по таблице
+static int find_at(asfs_fs* fs, const char* name, const char* file, EpochFind* f) {
+    uint32_t epoch;
+    int rc = epoch_of(fs, name, &epoch);
+    if (rc < 0) return rc;
+    *f = (EpochFind){ .name = file };
+    rc = scan_at(fs, epoch, epoch_find_one, f);
+    if (rc < 0) return rc;
+    return f->found ? 0 : -ENOENT;
+}
+
+static int do_epoch_lookup(asfs_fs* fs, const char* name, const char* file, asfs_stat* st) {
+    EpochFind f;
+    int rc = find_at(fs, name, file, &f);
+    if (rc == 0 && st) fill_stat(f.inode, &f.node, st);
+    return rc;
+}
+
+int asfs_epoch_lookup(asfs_fs* fs, const char* name, const char* file, asfs_stat* st) {
+    uint64_t t = op_begin_read(fs);
+    return op_end(fs, ASFS_OP_LOOKUP, t, do_epoch_lookup(fs, name, file, st));
+}
+
+static ssize_t do_epoch_read(asfs_fs* fs, const char* name, const char* file, void* buf,
+                             size_t count, uint64_t offset) {
+    EpochFind f;
+    int rc = find_at(fs, name, file, &f);
+    if (rc < 0) return rc;
+    return read_node(fs, &f.node, buf, count, offset);
+}
+
+ssize_t asfs_epoch_read(asfs_fs* fs, const char* name, const char* file, void* buf,
+                        size_t count, uint64_t offset) {
+    uint64_t t = op_begin_read(fs);
+    return op_end(fs, ASFS_OP_READ, t, do_epoch_read(fs, name, file, buf, count, offset));
+}
+
+static int do_epoch_export(asfs_fs* fs, const char* name, const char* prefix,
+                           asfs_export_cb cb, void* arg) {
+    uint32_t epoch;
+    int rc = epoch_of(fs, name, &epoch);
+    if (rc < 0) return rc;
+    return do_export(fs, epoch, prefix, cb, arg);
+}
+
+int asfs_epoch_export(asfs_fs* fs, const char* name, const char* prefix,
+                      asfs_export_cb cb, void* arg) {
+    uint64_t t = op_begin_read(fs);
+    return op_end(fs, ASFS_OP_READ, t, do_epoch_export(fs, name, prefix, cb, arg));
+}
+
+// ---- fsck ----
+// Битмапы и счётчики пересобираются по достижимости: живы корень, файлы
+// (бит в битмапе inode + used), их старые версии и inode снапшотов из таблицы
+// снапшотов. Файл и его версии делят блоки законно, чужие блоки - нет.
+// Таблица inode читается кусками по FSCK_CHUNK в несколько потоков.
+
+#define FSCK_CHUNK 4096
+#define FSCK_MAX_THREADS 64
+
+typedef struct {
+    uint32_t inode;
+    uint16_t dup_mask;     // блоки, уже занятые другим inode
+    uint16_t bad_mask;     // номера блоков вне области данных
+    uint8_t fix_count;     // неверный snapshot_count у файла
+} FsckFix;
+
+typedef struct {
+    asfs_fs* fs;
+    uint8_t* blocks;            // новый битмап блоков, общий
+    uint8_t* inodes;            // новый битмап inode, общий
+    uint8_t* plain;             // блоки inode вне цепочек версий
+    const uint8_t* snap_ref;    // inode, на которые ссылаются каталог и список сирот
+    uint32_t* next_chunk;
+    asfs_fsck_report rep;
+    FsckFix* fixes;
+    size_t nfixes, cap;
+    int rc;
+} FsckWorker;
+
+static int bit_test(const uint8_t* map, uint32_t i) {
+    return map[i/8] & (1 << (i%8));
+}
+
+// Возвращает прежнее значение бита
+static int bit_set_atomic(uint8_t* map, uint32_t i) {
+    uint8_t bit = 1 << (i%8);
+    return __atomic_fetch_or(&map[i/8], bit, __ATOMIC_SEQ_CST) & bit;
+}
+
+static int bit_test_atomic(const uint8_t* map, uint32_t i) {
+    return __atomic_load_n(&map[i/8], __ATOMIC_SEQ_CST) & (1 << (i%8));
+}
+
+static int fsck_add_fix(FsckWorker* w, const FsckFix* fix) {
+    if (w->nfixes == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 64;
+        FsckFix* p = realloc(w->fixes, cap * sizeof(FsckFix));
+        if (!p) return -ENOMEM;
+        w->fixes = p;
+        w->cap = cap;
+    }
+    w->fixes[w->nfixes++] = *fix;
+    return 0;
+}
+
+static void fsck_inode(FsckWorker* w, uint32_t i, const Inode* node) {
+    asfs_fs* fs = w->fs;
+    int in_bitmap = inode_in_use(fs, i);
+    int live;
+    if (i == 0) live = 1;
+    else if (w->snap_ref[i/8] & (1 << (i%8))) live = node->used && node->is_snapshot;
+    else live = in_bitmap && node->used &&
+                (!node->is_snapshot || node->is_snapshot == INODE_VERSION);
+
+    if (!live) {
+        if (in_bitmap) w->rep.leaked_inodes++;
+        return;
+    }
+    if (!in_bitmap) w->rep.lost_inodes++;
+    bit_set_atomic(w->inodes, i);
+    w->rep.inodes_checked++;
+    if (i == 0) return;
+    if (node->is_snapshot == INODE_VERSION) w->rep.versions++;
+    else if (node->is_snapshot == INODE_ORPHAN) w->rep.orphans++;
+    else if (node->is_snapshot) w->rep.snapshots++;
+    else w->rep.files++;
+    // Звенья цепочки версий делят блоки между собой - но не с посторонними
+    int chain = node->is_snapshot == INODE_VERSION || node->prev;
+
+    FsckFix fix = { .inode = i };
+    uint32_t count = blocks_for(fs, node->size);
+    if (count > 12) {
+        count = 12;
+        fix.bad_mask = 1 << 12;   // размер больше 12 блоков - обрезать
+        w->rep.bad_blocks++;
+    }
+    for (uint32_t b = 0; b < count; b++) {
+        uint32_t blk = node->blocks[b];
+        if (blk < fs->sb.first_data_block || blk >= fs->sb.total_blocks) {
+            fix.bad_mask |= 1 << b;
+            w->rep.bad_blocks++;
+            continue;
+        }
+        // Посторонний ставит plain до blocks, звено цепочки проверяет plain после
+        // blocks - так пересечение замечает тот, кто пришёл вторым
+        int dup;
+        if (chain) {
+            dup = bit_set_atomic(w->blocks, blk) && bit_test_atomic(w->plain, blk);
+        } else {
+            bit_set_atomic(w->plain, blk);
+            dup = bit_set_atomic(w->blocks, blk);
+        }
+        if (dup) {
+            fix.dup_mask |= 1 << b;
+            w->rep.double_blocks++;
+        }
+    }
+    // Висячие записи каталога погашены, так что чужие снапшоты здесь не считаются
+    if (!node->is_snapshot && node->snapshot_count != snapshots_of(fs, i)) {
+        fix.fix_count = 1;
+        w->rep.bad_counts++;
+    }
+    if ((fix.dup_mask || fix.bad_mask || fix.fix_count) && w->rc == 0)
+        w->rc = fsck_add_fix(w, &fix);
+}
+
+static void* fsck_worker(void* arg) {
+    FsckWorker* w = arg;
+    asfs_fs* fs = w->fs;
+    Inode* chunk = malloc(FSCK_CHUNK * sizeof(Inode));
+    if (!chunk) {
+        w->rc = -ENOMEM;
+        return NULL;
+    }
+    for (;;) {
+        uint32_t first = __atomic_fetch_add(w->next_chunk, FSCK_CHUNK, __ATOMIC_RELAXED);
+        if (first >= fs->sb.inode_count || w->rc < 0) break;
+        uint32_t n = fs->sb.inode_count - first;
+        if (n > FSCK_CHUNK) n = FSCK_CHUNK;
+
+        // Пустые куски (ни бита в битмапе, ни ссылки из снапшотов) не читаем
+        uint32_t any = 0;
+        for (uint32_t i = first; i < first + n && !any; i++)
+            any = inode_in_use(fs, i) || (w->snap_ref[i/8] & (1 << (i%8)));
+        if (!any) continue;
+
+        int rc = inodes_io(fs, first, n, chunk, 0);
+        if (rc < 0) {
+            w->rc = rc;
+            break;
+        }
+        STAT_ADD(&fs->stats, inode.reads, n);
+        for (uint32_t i = 0; i < n; i++)
+            fsck_inode(w, first + i, &chunk[i]);
+    }
+    free(chunk);
+    return NULL;
+}
+
+// Чинит inode с плохими/общими блоками и неверным счётчиком снапшотов.
+// Блоки берутся уже из пересобранного битмапа.
+static int fsck_repair_inode(asfs_fs* fs, const FsckFix* fix) {
+    Inode node;
+    int rc = read_inode(fs, fix->inode, &node);
+    if (rc < 0) return rc;
+
+    uint32_t count = blocks_for(fs, node.size);
+    if (count > 12) count = 12;
+    for (uint32_t b = 0; b < count; b++) {
+        if (!(fix->bad_mask & (1 << b))) continue;
+        // Всё начиная с первого плохого блока отрезаем
+        node.size = b * fs->sb.block_size;
+        count = b;
+        break;
+    }
+    if (fix->bad_mask & (1 << 12) && node.size > 12 * fs->sb.block_size)
+        node.size = 12 * fs->sb.block_size;
+    // Отрезанные целые блоки, которые не делим с другими, возвращаем в битмап
+    for (uint32_t b = count; b < 12; b++) {
+        if (!(fix->dup_mask & (1 << b)) && !(fix->bad_mask & (1 << b)))
+            free_blocks(fs, &node.blocks[b], 1);
+        node.blocks[b] = 0;
+    }
+
+    for (uint32_t b = 0; b < count; b++) {
+        if (!(fix->dup_mask & (1 << b))) continue;
+        uint32_t copy;
+        rc = copy_blocks(fs, &node.blocks[b], &copy, 1);
+        if (rc < 0) return rc;
+        node.blocks[b] = copy;
+    }
+    if (fix->fix_count) node.snapshot_count = snapshots_of(fs, fix->inode);
+    return write_inode(fs, fix->inode, &node);
+}
+
+static uint32_t count_clear(const uint8_t* map, uint32_t bits) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < bits; i++)
+        if (!bit_test(map, i)) n++;
+    return n;
+}
+
+static int do_fsck(asfs_fs* fs, int flags, int threads, asfs_fsck_report* rep) {
+    int repair = flags & ASFS_FSCK_REPAIR;
+    if (repair && fs->mode != ASFS_RDWR) return -EROFS;
+    if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    if (threads > FSCK_MAX_THREADS) threads = FSCK_MAX_THREADS;
+    memset(rep, 0, sizeof(*rep));
+    rep->threads = threads;
+
+    SuperBlock* sb = &fs->sb;
+    size_t block_bytes = (sb->total_blocks + 7) / 8;
+    size_t inode_bytes = (sb->inode_count + 7) / 8;
+    uint8_t* blocks = calloc(1, block_bytes);
+    uint8_t* inodes = calloc(1, inode_bytes);
+    uint8_t* snap_ref = calloc(1, inode_bytes);
+    uint8_t* plain = calloc(1, block_bytes);
+    uint32_t* bad_slots = malloc((sb->catalog_slots + 1) * sizeof(uint32_t));
+    uint32_t nbad = 0;
+    FsckWorker* workers = calloc(threads, sizeof(FsckWorker));
+    pthread_t* tids = calloc(threads, sizeof(pthread_t));
+    int rc = 0;
+    if (!blocks || !inodes || !snap_ref || !plain || !bad_slots || !workers || !tids) {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    // Битые записи каталога на время проверки гасятся (в памяти). Висячая запись -
+    // исходный inode освобождён или занят уже другим файлом (старые образы не
+    // отвязывали снапшоты при удалении): имя, время создания и эпоха рождения файла
+    // не сходятся с копией в inode снапшота. Такой снапшот чужому файлу не отдаём
+    for (uint32_t i = 0; i < sb->catalog_slots; i++) {
+        SnapRec* s = &fs->cat.recs[i];
+        Inode node, orig;
+        if (!s->used) continue;
+        int detached = s->original_inode == NO_INODE;
+        int bad = s->snapshot_inode == 0 || s->snapshot_inode >= sb->inode_count ||
+                  (!detached && s->original_inode >= sb->inode_count) ||
+                  (snap_ref[s->snapshot_inode/8] & (1 << (s->snapshot_inode%8)));
+        if (!bad) {
+            rc = read_inode(fs, s->snapshot_inode, &node);
+            if (rc < 0) goto out;
+            bad = !node.used || !node.is_snapshot;
+        }
+        if (!bad && !detached) {
+            rc = read_inode(fs, s->original_inode, &orig);
+            if (rc < 0) goto out;
+            bad = !inode_in_use(fs, s->original_inode) || !orig.used || orig.is_snapshot ||
+                  strncmp(orig.name, node.name, MAX_NAME_LEN) != 0 ||
+                  orig.created != node.created || orig.birth < node.birth;
+        }
+        if (!bad) {
+            snap_ref[s->snapshot_inode/8] |= 1 << (s->snapshot_inode%8);
+            continue;
+        }
+        rep->bad_snapshots++;
+        s->used = 0;
+        bad_slots[nbad++] = i;
+    }
+    // Сироты из списка живы до освобождения; записи не на сироту пропускает и поток
+    for (uint32_t i = 0; i < sb->orphan_count; i++) {
+        uint32_t o = fs->orphans[i];
+        Inode node;
+        if (o == 0 || o >= sb->inode_count) continue;
+        rc = read_inode(fs, o, &node);
+        if (rc < 0) goto out;
+        if (node.used && node.is_snapshot == INODE_ORPHAN)
+            snap_ref[o/8] |= 1 << (o%8);
+    }
+
+    for (uint32_t i = 0; i < sb->first_data_block; i++)
+        blocks[i/8] |= 1 << (i%8);
+    for (uint32_t k = 0; k < sb->ext_count; k++)
+        for (uint32_t i = 0; i < sb->ext[k].meta_blocks; i++) {
+            uint32_t b = sb->ext[k].first_block + i;
+            blocks[b/8] |= 1 << (b%8);
+        }
+    for (uint32_t i = 0; i < sb->index_blocks; i++) {
+        uint32_t b = sb->index_start + i;
+        blocks[b/8] |= 1 << (b%8);
+    }
+    for (uint32_t i = 0; i < sb->bloom_blocks; i++) {
+        uint32_t b = sb->bloom_start + i;
+        blocks[b/8] |= 1 << (b%8);
+    }
+    for (uint32_t i = 0; i < sb->epoch_blocks; i++) {
+        uint32_t b = sb->epoch_start + i;
+        blocks[b/8] |= 1 << (b%8);
+    }
+    for (uint32_t i = 0; i < sb->catalog_blocks; i++) {
+        uint32_t b = sb->catalog_start + i;
+        blocks[b/8] |= 1 << (b%8);
+    }
+    for (uint32_t i = 0; i < sb->orphan_blocks; i++) {
+        uint32_t b = sb->orphan_start + i;
+        blocks[b/8] |= 1 << (b%8);
+    }
+
+    uint32_t next_chunk = 0;
+    int started = 0;
+    for (int t = 0; t < threads; t++)
+        workers[t] = (FsckWorker){
+            .fs = fs, .blocks = blocks, .inodes = inodes, .plain = plain,
+            .snap_ref = snap_ref, .next_chunk = &next_chunk
+        };
+    for (; started < threads; started++)
+        if (pthread_create(&tids[started], NULL, fsck_worker, &workers[started]) != 0) break;
+    // Недостающие потоки не страшны: куски разбирают те, что запустились
+    if (started == 0) fsck_worker(&workers[0]);
+    for (int t = 0; t < threads; t++) {
+        if (t < started) pthread_join(tids[t], NULL);
+        FsckWorker* w = &workers[t];
+        if (w->rc < 0 && rc == 0) rc = w->rc;
+        rep->inodes_checked += w->rep.inodes_checked;
+        rep->files += w->rep.files;
+        rep->snapshots += w->rep.snapshots;
+        rep->versions += w->rep.versions;
+        rep->orphans += w->rep.orphans;
+        rep->double_blocks += w->rep.double_blocks;
+        rep->bad_blocks += w->rep.bad_blocks;
+        rep->leaked_inodes += w->rep.leaked_inodes;
+        rep->lost_inodes += w->rep.lost_inodes;
+        rep->bad_counts += w->rep.bad_counts;
+    }
+    if (rc < 0) goto out;
+
+    for (uint32_t i = 0; i < sb->total_blocks; i++) {
+        int was = bit_test(fs->block_bitmap, i), now = bit_test(blocks, i);
+        if (was && !now) rep->leaked_blocks++;
+        if (!was && now) rep->lost_blocks++;
+    }
+    uint32_t free_blocks = count_clear(blocks, sb->total_blocks);
+    uint32_t free_inodes = count_clear(inodes, sb->inode_count);
+    rep->counter_errors = (sb->free_blocks != free_blocks) + (sb->free_inodes != free_inodes);
+    rep->problems = rep->leaked_blocks + rep->lost_blocks + rep->double_blocks +
+                    rep->bad_blocks + rep->leaked_inodes + rep->lost_inodes +
+                    rep->bad_snapshots + rep->bad_counts + rep->counter_errors;
+    if (!repair || rep->problems == 0) goto out;
+
+    // Ремонт: новые битмапы и счётчики, битые записи каталога, затем inode
+    // с общими/плохими блоками
+    memcpy(fs->block_bitmap, blocks, block_bytes);
+    memcpy(fs->inode_bitmap, inodes, inode_bytes);
+    map_touch_all(fs);
+    fs->share.layout++;
+    sb->free_blocks = free_blocks;
+    sb->free_inodes = free_inodes;
+    for (; nbad > 0 && rc == 0; nbad--) {
+        catalog_remove(fs, bad_slots[nbad - 1]);
+        rc = catalog_write(fs, bad_slots[nbad - 1]);
+    }
+    for (int t = 0; t < threads && rc == 0; t++)
+        for (size_t i = 0; i < workers[t].nfixes && rc == 0; i++)
+            rc = fsck_repair_inode(fs, &workers[t].fixes[i]);
+    if (rc == 0) rc = save_metadata(fs);
+    if (rc == 0) rc = asfs_dev_sync(&fs->dev);
+    if (rc == 0) rep->repaired = 1;
+out:
+    // Без ремонта каталог в памяти остаётся как на диске
+    for (uint32_t k = 0; k < nbad; k++) fs->cat.recs[bad_slots[k]].used = 1;
+    free(bad_slots);
+    if (workers)
+        for (int t = 0; t < threads; t++) free(workers[t].fixes);
+    free(workers);
+    free(tids);
+    free(blocks);
+    free(inodes);
+    free(snap_ref);
+    free(plain);
+    return rc;
+}
+
+int asfs_fsck(asfs_fs* fs, int flags, int threads, asfs_fsck_report* rep) {
+    if (flags & ASFS_FSCK_REPAIR) fs_lock(fs);
+    else fs_lock_read(fs);
+    int rc = do_fsck(fs, flags, threads, rep);
+    fs_unlock(fs);
+    return rc;
+}
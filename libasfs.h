@@ -0,0 +1,209 @@
+#ifndef LIBASFS_H
+#define LIBASFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include "asfs_stats.h"
+
+// Встраиваемая библиотека asfs.
+// Все функции возвращают 0 (или неотрицательный результат) при успехе
+// и -errno при ошибке. Библиотека ничего не печатает и не завершает процесс.
+
+#define ASFS_API_VERSION 1
+#define ASFS_NAME_MAX 224
+#define ASFS_NO_INODE ((uint32_t)-1)
+
+#define ASFS_RDONLY 0
+#define ASFS_RDWR   1
+// Добавляется к режиму: образ открыт только этим дескриптором, блокировка образа
+// и проверка поколения на каждой операции не нужны (бенчмарки, монопольные утилиты)
+#define ASFS_PRIVATE 4
+
+typedef struct asfs_fs asfs_fs;
+
+typedef struct {
+    uint32_t inode;
+    uint32_t size;
+    uint8_t type;          // 0 - файл, 1 - директория
+    uint8_t is_snapshot;
+    uint32_t snapshot_id;
+    uint32_t snapshot_count;
+    time_t created;
+    time_t modified;
+    char name[ASFS_NAME_MAX];
+} asfs_stat;
+
+typedef struct {
+    char name[ASFS_NAME_MAX];
+    char file[ASFS_NAME_MAX];
+    uint32_t original_inode;   // ASFS_NO_INODE - файл удалён, снапшот отвязан
+    uint32_t snapshot_inode;
+    uint32_t size;
+    time_t timestamp;
+} asfs_snapshot_info;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t free_blocks;
+    uint32_t inode_count;
+    uint32_t free_inodes;
+    uint32_t snapshot_count;
+    uint32_t first_data_block;
+    uint32_t orphan_count;     // удалено, но ещё не освобождено
+} asfs_fsinfo;
+
+// Возврат ненулевого значения из колбэка прекращает обход
+typedef int (*asfs_list_cb)(const asfs_stat* st, void* arg);
+typedef int (*asfs_snapshot_cb)(const asfs_snapshot_info* snap, void* arg);
+
+const char* asfs_strerror(int err);
+
+int asfs_format(const char* path, uint32_t block_size, int zero_fill);
+// Одна ФС на нескольких образах (RAID-0): path - первый, members - ещё count штук,
+// данные идут полосами по stripe_unit байт (кратно block_size, не меньше двух блоков).
+// Набор записывается в суперблок, дальше asfs_open(path) открывает его целиком
+int asfs_format_striped(const char* path, const char* const* members, int count,
+                        uint32_t stripe_unit, uint32_t block_size, int zero_fill);
+// Образ можно открывать из нескольких процессов сразу: каждая операция идёт под
+// блокировкой fcntl на образ и видит изменения, сделанные другими
+int asfs_open(const char* path, int mode, asfs_fs** out);
+int asfs_close(asfs_fs* fs);
+int asfs_statfs(asfs_fs* fs, asfs_fsinfo* info);
+int asfs_get_stats(asfs_fs* fs, asfs_stats* out);
+void asfs_reset_stats(asfs_fs* fs);
+// Гистограммы задержек и кольцо трейса; живут, пока открыт fs
+asfs_latency* asfs_get_latency(asfs_fs* fs);
+// Режим discard: освобождённые блоки отдаются хранилищу (дырки в образе)
+// пачкой после сохранения метаданных операции. По умолчанию выключен
+void asfs_set_discard(asfs_fs* fs, int on);
+// Захват нагрузки (workload.h): create, edit, write, read, delete, снапшоты и
+// т.д. с именами, размерами и задержками дописываются в path; NULL - выключить
+int asfs_capture_enable(asfs_fs* fs, const char* path);
+// O_DIRECT: данные идут мимо page cache через выровненные буферы (hugepage).
+// -EINVAL, если ФС образа не умеет O_DIRECT или блок ФС не кратен сектору
+int asfs_set_direct(asfs_fs* fs, int on);
+// Фоновое освобождение: delete, snapshot_delete и epoch_delete только ставят inode
+// в список сирот на диске (или помечают сборку версий) и сразу возвращаются, блоки
+// освобождает поток пачками. Выключение и asfs_close дожидаются остановки потока
+// и разбирают остаток; после сбоя список разбирает asfs_open. Не звать из колбэков
+int asfs_set_reclaim(asfs_fs* fs, int on);
+// Разобрать всё отложенное прямо сейчас
+int asfs_reclaim(asfs_fs* fs);
+// Онлайн-рост до new_size байт: образ удлиняется, добавляются блоки и inode
+// (1 на 16 блоков). Старые метаданные не переписываются. Не больше 8 раз
+int asfs_resize(asfs_fs* fs, uint64_t new_size);
+// Offline trim: дырявит все свободные блоки данных, *bytes - сколько отдано
+int asfs_trim(asfs_fs* fs, uint64_t* bytes);
+
+int asfs_create(asfs_fs* fs, const char* name, const void* data, size_t size,
+                uint32_t* inode_out);
+// Пакетное создание: одна проверка имён, выделение подряд, данные и inode
+// крупными последовательными записями, метаданные - один раз на пакет.
+// Результат по каждому файлу - в result/inode запроса; функция возвращает
+// число созданных файлов или -errno, если пакет целиком не записан
+typedef struct {
+    const char* name;
+    const void* data;
+    size_t size;
+    int result;
+    uint32_t inode;
+} asfs_create_req;
+
+int asfs_create_batch(asfs_fs* fs, asfs_create_req* reqs, size_t n);
+int asfs_edit(asfs_fs* fs, const char* name, const void* data, size_t size);
+// Запись с offset трогает только затронутые блоки, новые выделяются в хвосте,
+// промежуток за старым концом читается как нули. Возвращают число записанных байт
+ssize_t asfs_write(asfs_fs* fs, const char* name, const void* data, size_t size,
+                   uint64_t offset);
+ssize_t asfs_append(asfs_fs* fs, const char* name, const void* data, size_t size);
+// Блоки за новым концом освобождаются, при росте файл дополняется нулями
+int asfs_truncate(asfs_fs* fs, const char* name, uint64_t size);
+int asfs_delete(asfs_fs* fs, const char* name);
+int asfs_lookup(asfs_fs* fs, const char* name, asfs_stat* st);
+ssize_t asfs_read(asfs_fs* fs, const char* name, void* buf, size_t count,
+                  uint64_t offset);
+int asfs_list(asfs_fs* fs, asfs_list_cb cb, void* arg);
+// Листинг по порядку имён через упорядоченный индекс: файлы с именем на prefix
+// (NULL - все), строго после after (курсор - имя последнего файла прошлой
+// страницы, NULL - с начала), не больше limit (0 - без ограничения).
+// Индекс создаётся при форматировании и ведётся create/delete; без индекса
+// листинг сортирует таблицу в памяти. Только читает образ.
+// Возвращает число выданных файлов
+int asfs_list_sorted(asfs_fs* fs, const char* prefix, const char* after, uint32_t limit,
+                     asfs_list_cb cb, void* arg);
+// Строит индекс имён по таблице inode, если его нет (образ старше индекса или
+// индекс выкинут после ошибки записи). Нужен ASFS_RDWR
+int asfs_index_build(asfs_fs* fs);
+
+// Потоковый экспорт файлов с именем на prefix (NULL - все) в порядке
+// расположения данных на диске. Для каждого файла колбэк получает куски
+// данных по возрастанию offset (пустой файл - один вызов с len = 0).
+// Ненулевой возврат колбэка прерывает экспорт и возвращается как есть
+typedef int (*asfs_export_cb)(const asfs_stat* st, const void* data, size_t len,
+                              uint64_t offset, void* arg);
+int asfs_export(asfs_fs* fs, const char* prefix, asfs_export_cb cb, void* arg);
+
+int asfs_snapshot_create(asfs_fs* fs, const char* file, const char* snap_name,
+                         uint32_t* inode_out);
+int asfs_snapshot_restore(asfs_fs* fs, const char* file, const char* snap_name);
+int asfs_snapshot_delete(asfs_fs* fs, const char* snap_name);
+int asfs_snapshot_list(asfs_fs* fs, asfs_snapshot_cb cb, void* arg);
+
+// Снапшоты всей ФС. Снапшот только замораживает текущую эпоху и начинает
+// следующую - за O(1), без копирования. Inode, видимый в снапшоте, перед
+// изменением сохраняется как старая версия, а общие с ней блоки при записи
+// копируются (copy-on-write). Удаление снапшота освобождает версии и блоки,
+// которые больше ни в одном снапшоте не видны
+#define ASFS_EPOCH_NAME 48
+
+typedef struct {
+    char name[ASFS_EPOCH_NAME];
+    uint32_t epoch;
+    time_t created;
+} asfs_epoch_info;
+
+typedef int (*asfs_epoch_cb)(const asfs_epoch_info* info, void* arg);
+
+int asfs_epoch_snapshot(asfs_fs* fs, const char* name);
+int asfs_epoch_delete(asfs_fs* fs, const char* name);
+int asfs_epoch_list(asfs_fs* fs, asfs_epoch_cb cb, void* arg);
+// Файлы, чтение и экспорт в том виде, какой ФС имела в момент снапшота name
+int asfs_epoch_files(asfs_fs* fs, const char* name, asfs_list_cb cb, void* arg);
+int asfs_epoch_lookup(asfs_fs* fs, const char* name, const char* file, asfs_stat* st);
+ssize_t asfs_epoch_read(asfs_fs* fs, const char* name, const char* file, void* buf,
+                        size_t count, uint64_t offset);
+int asfs_epoch_export(asfs_fs* fs, const char* name, const char* prefix,
+                      asfs_export_cb cb, void* arg);
+
+// Проверка и ремонт: битмапы и счётчики пересобираются по достижимости
+// inode из таблицы inode и таблицы снапшотов
+#define ASFS_FSCK_REPAIR 1
+
+typedef struct {
+    int threads;
+    uint32_t inodes_checked;   // живые inode, включая корень
+    uint32_t files;
+    uint32_t snapshots;
+    uint32_t versions;         // старые версии inode для снапшотов ФС
+    uint32_t orphans;          // удалённые inode, ждущие освобождения
+    uint32_t leaked_blocks;    // помечены в битмапе, но никому не принадлежат
+    uint32_t lost_blocks;      // используются, но не помечены
+    uint32_t double_blocks;    // один блок у нескольких inode
+    uint32_t bad_blocks;       // ссылки за пределы области данных
+    uint32_t leaked_inodes;    // бит стоит, inode недостижим
+    uint32_t lost_inodes;      // inode снапшота без бита в битмапе
+    uint32_t bad_snapshots;    // записи таблицы снапшотов на мусор
+    uint32_t bad_counts;       // неверный snapshot_count у файла
+    uint32_t counter_errors;   // free_blocks/free_inodes в суперблоке
+    uint32_t problems;         // всего
+    int repaired;
+} asfs_fsck_report;
+
+// threads <= 0 - по числу процессоров
+int asfs_fsck(asfs_fs* fs, int flags, int threads, asfs_fsck_report* rep);
+
+#endif
@@ -0,0 +1,1744 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <errno.h>
+#include "asfs_io.h"
+#include "asfs_bloom.h"
+#include "workload.h"
+#include "libinodex.h"
+
+#define MAGIC_NUMBER 0x3258494E            // inode v2 по 128 байт
+#define MAGIC_V1 0x5844494E                // inode v1 по 512 байт, только ix_convert
+#define DEFAULT_BLOCK_SIZE 4096
+#define MICRODATA_SIZE 48
+#define INODE_SIZE 128
+#define NAME_MAX_LEN IX_NAME_MAX
+#define INLINE_NAME 40                     // столько байт имени лежит в самом inode
+#define NAME_SLOT (NAME_MAX_LEN - INLINE_NAME)  // хвост длинного имени в таблице имён
+#define V1_MICRODATA_SIZE 256
+#define V1_INODE_SIZE 512
+#define NO_INODE ((uint32_t)-1)
+#define ITABLE_MAP_BYTES 1024            // до 8192 групп таблицы inode
+#define ITABLE_MIN_GROUP_BLOCKS 64
+#define MAX_EXTENTS 8
+// Упреждающее чтение: окно данных файла в блоках и окно таблицы inode в байтах,
+// удваиваются, пока доступ остаётся последовательным
+#define RA_MIN_BLOCKS 2
+#define RA_MAX_BLOCKS 12
+#define RA_ITABLE_MIN (64 << 10)
+#define RA_ITABLE_MAX (4 << 20)
+#define HOT_PINNED 0x80000000u
+#define HOT_GAP 64                       // inode: дыру короче дочитываем одним запросом
+#define BLOOM_CLEAN 0x4d4f4c42           // bloom_state: копия фильтра на диске годна
+#define LRU_MIN_BUCKETS 16
+#define LRU_REHASH_STEP 4                // цепочек старой таблицы за одно обращение к кэшу
+#define LRU_EVICT_STEP 2                 // узлов сверх ёмкости за вставку после уменьшения
+#define LRU_TRIM_STEP 64                 // узлов сверх ёмкости в начале каждой операции
+
+// Приращение образа (ix_resize): метаданные лежат в начале нового места
+typedef struct {
+    uint32_t first_block;   // первый блок приращения (прежний total_blocks)
+    uint32_t meta_blocks;   // из них заняты метаданными приращения
+    uint32_t bmap_byte;     // сегмент битмапа блоков: первый байт битмапа,
+    uint32_t bmap_block;    // где лежит и сколько блоков (0 - не понадобился)
+    uint32_t bmap_blocks;
+    uint32_t inode_first;   // добавленные inode и их таблица (занулена сразу),
+    uint32_t inode_count;   // за ней таблица имён
+    uint32_t inode_table;
+} Extent;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t block_size;
+    uint32_t inode_count;
+    uint32_t free_inodes;
+    uint32_t free_blocks;
+    uint32_t inode_table;
+    uint32_t bitmap_blocks;
+    uint32_t root_inode;
+    uint32_t l1_cache_size;
+    uint32_t free_inode_hint;
+    // Ленивая таблица inode: группы по itable_group_blocks блоков зануляются
+    // при первой записи. 0 - старый образ, таблица занулена целиком
+    uint32_t itable_group_blocks;
+    uint32_t itable_groups;
+    uint8_t itable_init[ITABLE_MAP_BYTES];
+    // Живых inode с этим номером и дальше нет - поиск по имени дальше не смотрит.
+    // 0 - образ без удалений, граница вычисляется при монтировании
+    uint32_t inode_end;
+    uint32_t total_blocks;  // 0 - по размеру образа (до первого ix_resize)
+    uint32_t ext_count;
+    Extent ext[MAX_EXTENTS];
+    // Набор образов с чередованием (ix_format_striped), magic 0 - один образ
+    asfs_stripe_label stripe;
+    // Горячий набор L1 на момент ix_sync: номера inode от свежих к старым
+    // (HOT_PINNED - закреплён) в непрерывном куске блоков данных
+    uint32_t hot_start;
+    uint32_t hot_blocks;
+    uint32_t hot_count;
+    // Фильтр Блума имён на момент ix_sync, годен при bloom_state == BLOOM_CLEAN.
+    // Первое создание файла после монтирования снимает флаг прямо на диске
+    uint32_t bloom_state;
+    uint32_t bloom_start;
+    uint32_t bloom_blocks;
+    uint32_t bloom_bits_log2;
+    uint8_t padding[4036 - 48 - ITABLE_MAP_BYTES - MAX_EXTENTS * sizeof(Extent) -
+                    sizeof(asfs_stripe_label)];
+} SuperBlock;
+
+// Inode v2, 128 байт. Всё, что смотрят поиск по имени и обход таблицы, - в первых
+// 16 байтах. Имя до INLINE_NAME байт лежит здесь целиком; у длинного здесь начало,
+// а хвост - в слоте таблицы имён с тем же номером, она идёт сразу за таблицей inode
+typedef struct {
+    uint32_t name_hash;       // FNV-1a полного имени
+    uint8_t name_len;         // 0 - inode свободен
+    uint8_t reserved[3];
+    uint32_t size;
+    uint32_t flags;
+    union {
+        uint8_t micro_data[MICRODATA_SIZE];
+        uint32_t blocks[12];
+    };
+    uint32_t last_block;      // блок, следующий за последним прочитанным
+    uint32_t access_pattern;  // RA_* ниже: серия, окно, докуда уже подтянуто
+    int64_t created;
+    int64_t modified;
+    char name[INLINE_NAME];   // без нуля на конце, если имя не короче
+} Inode;
+
+// Inode v1: имя целиком в inode, 512 байт. Читает только ix_convert
+typedef struct {
+    char name[NAME_MAX_LEN];
+    uint32_t size;
+    uint32_t flags;
+    time_t created;
+    time_t modified;
+    union {
+        uint8_t micro_data[V1_MICRODATA_SIZE];
+        struct {
+            uint32_t blocks[12];
+            uint32_t indirect_block;
+        };
+    };
+    uint32_t last_block;
+    uint32_t access_pattern;
+} InodeV1;
+
+#define RA_STREAK(p) ((p) & 0xFF)
+#define RA_WINDOW(p) (((p) >> 8) & 0xFF)
+#define RA_UNTIL(p) (((p) >> 16) & 0xFF)
+#define RA_PATTERN(streak, window, until) \
+    ((streak) | (window) << 8 | (uint32_t)(until) << 16)
+
+typedef struct LRUNode {
+    uint32_t inode_num;
+    Inode inode;
+    uint8_t pinned;
+    struct LRUNode* prev;
+    struct LRUNode* next;
+    struct LRUNode* next_hash;
+} LRUNode;
+
+// Индекс - цепочки в таблице из степени двойки корзин. При смене размера
+// старая таблица переносится в новую по LRU_REHASH_STEP корзин за обращение:
+// корзины old ниже rehash_pos уже перенесены, их узлы ищутся в buckets
+typedef struct {
+    LRUNode** buckets;
+    uint32_t mask;
+    LRUNode** old;         // NULL - перенос не идёт
+    uint32_t old_mask;
+    uint32_t rehash_pos;
+    LRUNode* head;
+    LRUNode* tail;
+    uint32_t capacity;
+    uint32_t size;
+    asfs_stats* stats;
+} LRUCache;
+
+struct ix_fs {
+    asfs_dev dev;
+    SuperBlock sb;
+    uint8_t* block_bitmap;
+    LRUCache* l1_cache;
+    uint32_t names_start;  // первый блок таблицы имён (конец основной таблицы inode)
+    uint32_t data_start;   // первый блок после таблицы имён
+    uint32_t total_blocks;
+    Inode scratch; // inode, не поместившийся в кэш
+    asfs_stats stats;
+    asfs_latency lat;
+    uint32_t op_inode;     // inode и число блоков текущей операции - для трейса
+    uint32_t op_blocks;
+    uint32_t ra_inode;     // промах по какому inode продолжит последовательный обход
+    uint64_t ra_until;     // до какого байта таблица inode уже запрошена
+    uint32_t ra_window;
+    int discard;           // дырявить освобождённые блоки (ix_set_discard)
+    asfs_discard_queue discard_queue;
+    asfs_bloom bloom;      // фильтр имён: с диска при монтировании или по таблице
+    workload_log* capture; // ix_capture_enable
+    uint64_t capture_start;
+};
+
+const char* ix_strerror(int err) {
+    return strerror(err < 0 ? -err : err);
+}
+
+// Перемешивание (финализатор murmur3): номера inode идут подряд, а корзина
+// берётся по младшим битам
+static uint32_t inode_hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t lru_buckets_for(uint32_t capacity) {
+    uint32_t n = LRU_MIN_BUCKETS;
+    while (n < capacity && n < (1u << 31)) n *= 2;
+    return n;
+}
+
+static LRUNode** lru_bucket(LRUCache* cache, uint32_t inode_num) {
+    uint32_t h = inode_hash(inode_num);
+    if (cache->old && (h & cache->old_mask) >= cache->rehash_pos)
+        return &cache->old[h & cache->old_mask];
+    return &cache->buckets[h & cache->mask];
+}
+
+static void lru_rehash_step(LRUCache* cache, uint32_t steps) {
+    while (cache->old && steps--) {
+        LRUNode* node = cache->old[cache->rehash_pos];
+        while (node) {
+            LRUNode* next = node->next_hash;
+            LRUNode** b = &cache->buckets[inode_hash(node->inode_num) & cache->mask];
+            node->next_hash = *b;
+            *b = node;
+            node = next;
+        }
+        if (++cache->rehash_pos > cache->old_mask) {
+            free(cache->old);
+            cache->old = NULL;
+        }
+    }
+}
+
+// Переход на новое число корзин. Незаконченный прошлый перенос доделывается сразу
+static int lru_rehash_start(LRUCache* cache, uint32_t nbuckets) {
+    if (nbuckets == cache->mask + 1) return 0;
+    LRUNode** buckets = calloc(nbuckets, sizeof(LRUNode*));
+    if (!buckets) return -ENOMEM;
+    lru_rehash_step(cache, UINT32_MAX);
+    cache->old = cache->buckets;
+    cache->old_mask = cache->mask;
+    cache->rehash_pos = 0;
+    cache->buckets = buckets;
+    cache->mask = nbuckets - 1;
+    return 0;
+}
+
+static LRUCache* lru_cache_create(uint32_t capacity, asfs_stats* stats) {
+    LRUCache* cache = calloc(1, sizeof(LRUCache));
+    if (!cache) return NULL;
+
+    cache->stats = stats;
+    cache->capacity = capacity;
+    uint32_t nbuckets = lru_buckets_for(capacity);
+    cache->buckets = calloc(nbuckets, sizeof(LRUNode*));
+    if (!cache->buckets) {
+        free(cache);
+        return NULL;
+    }
+    cache->mask = nbuckets - 1;
+    return cache;
+}
+
+static void lru_cache_free(LRUCache* cache) {
+    if (!cache) return;
+    LRUNode* current = cache->head;
+    while (current) {
+        LRUNode* next = current->next;
+        free(current);
+        current = next;
+    }
+    free(cache->buckets);
+    free(cache->old);
+    free(cache);
+}
+
+static Inode* lru_cache_get(LRUCache* cache, uint32_t inode_num) {
+    if (!cache || cache->size == 0) return NULL;
+    lru_rehash_step(cache, LRU_REHASH_STEP);
+
+    LRUNode* node = *lru_bucket(cache, inode_num);
+    while (node) {
+        if (node->inode_num == inode_num) {
+            if (node != cache->head) {
+                if (node->prev) node->prev->next = node->next;
+                if (node->next) node->next->prev = node->prev;
+                if (node == cache->tail) cache->tail = node->prev;
+
+                node->prev = NULL;
+                node->next = cache->head;
+                if (cache->head) cache->head->prev = node;
+                cache->head = node;
+            }
+            return &node->inode;
+        }
+        node = node->next_hash;
+    }
+    return NULL;
+}
+
+// Вытесняет самый старый незакреплённый узел; 0 - всё закреплено
+static int lru_evict(LRUCache* cache) {
+    LRUNode* tail = cache->tail;
+    while (tail && tail->pinned) {
+        STAT_INC(cache->stats, cache.pinned_skips);
+        tail = tail->prev;
+    }
+    if (!tail) return 0;
+
+    if (tail->prev) tail->prev->next = tail->next;
+    else cache->head = tail->next;
+    if (tail->next) tail->next->prev = tail->prev;
+    else cache->tail = tail->prev;
+
+    LRUNode** ptr = lru_bucket(cache, tail->inode_num);
+    while (*ptr != tail) ptr = &(*ptr)->next_hash;
+    *ptr = tail->next_hash;
+
+    free(tail);
+    cache->size--;
+    STAT_INC(cache->stats, cache.evictions);
+    return 1;
+}
+
+// Возвращает 0, -ENOMEM или -ENOSPC (кэш забит закреплёнными узлами)
+static int lru_cache_put(LRUCache* cache, uint32_t inode_num, const Inode* inode, uint8_t pinned) {
+    if (!cache || cache->capacity == 0) return -ENOSPC;
+    lru_rehash_step(cache, LRU_REHASH_STEP);
+
+    LRUNode* node = *lru_bucket(cache, inode_num);
+    while (node) {
+        if (node->inode_num == inode_num) {
+            node->inode = *inode;
+            node->pinned |= pinned;
+            lru_cache_get(cache, inode_num);
+            return 0;
+        }
+        node = node->next_hash;
+    }
+
+    // Сначала освобождаем место, чтобы не вытеснить только что вставленный узел.
+    // После уменьшения кэша лишнее уходит по LRU_EVICT_STEP узлов на вставку
+    for (int n = 0; n < LRU_EVICT_STEP && cache->size >= cache->capacity; n++) {
+        if (lru_evict(cache)) continue;
+        if (n > 0) break;
+        STAT_INC(cache->stats, cache.overflows);
+        return -ENOSPC;
+    }
+
+    LRUNode* new_node = malloc(sizeof(LRUNode));
+    if (!new_node) return -ENOMEM;
+
+    LRUNode** bucket = lru_bucket(cache, inode_num);
+    new_node->inode_num = inode_num;
+    new_node->inode = *inode;
+    new_node->pinned = pinned;
+    new_node->prev = NULL;
+    new_node->next = cache->head;
+    new_node->next_hash = *bucket;
+
+    *bucket = new_node;
+
+    if (cache->head) cache->head->prev = new_node;
+    cache->head = new_node;
+    if (!cache->tail) cache->tail = new_node;
+
+    cache->size++;
+    STAT_INC(cache->stats, cache.inserts);
+    return 0;
+}
+
+// До max узлов сверх ёмкости; возвращает число вытесненных (0 - лишних нет
+// или остались только закреплённые)
+static uint32_t lru_trim(LRUCache* cache, uint32_t max) {
+    uint32_t n = 0;
+    while (n < max && cache->size > cache->capacity && lru_evict(cache)) n++;
+    return n;
+}
+
+// Новая ёмкость вступает сразу, а индекс и лишние узлы догоняют её постепенно
+static int lru_cache_resize(LRUCache* cache, uint32_t capacity) {
+    int rc = lru_rehash_start(cache, lru_buckets_for(capacity));
+    if (rc < 0) return rc;
+    cache->capacity = capacity;
+    return 0;
+}
+
+static uint32_t base_inodes(ix_fs* fs) {
+    return fs->sb.ext_count ? fs->sb.ext[0].inode_first : fs->sb.inode_count;
+}
+
+// Таблица inode, где лежит inode_num: её первый блок, номер первого inode в ней
+// и их число. Разметка таблиц одна и та же в v1 и v2, отличается размер inode
+static uint64_t inode_table_of(const SuperBlock* sb, uint32_t inode_num,
+                               uint32_t* first, uint32_t* count) {
+    uint32_t base = sb->ext_count ? sb->ext[0].inode_first : sb->inode_count;
+    if (inode_num < base) {
+        *first = 0;
+        *count = base;
+        return sb->inode_table;
+    }
+    for (uint32_t k = 0; k < sb->ext_count; k++) {
+        const Extent* e = &sb->ext[k];
+        if (inode_num < e->inode_first || inode_num - e->inode_first >= e->inode_count) continue;
+        *first = e->inode_first;
+        *count = e->inode_count;
+        return e->inode_table;
+    }
+    *first = inode_num;
+    *count = 1;
+    return 0;
+}
+
+static uint32_t itable_blocks(uint32_t inodes, uint32_t bs) {
+    return ((uint64_t)inodes * INODE_SIZE + bs - 1) / bs;
+}
+
+static uint32_t names_blocks(uint32_t inodes, uint32_t bs) {
+    return ((uint64_t)inodes * NAME_SLOT + bs - 1) / bs;
+}
+
+// *run - сколько inode начиная с inode_num идут на диске подряд
+static uint64_t inode_pos(ix_fs* fs, uint32_t inode_num, uint32_t* run) {
+    uint32_t first, count;
+    uint64_t table = inode_table_of(&fs->sb, inode_num, &first, &count);
+    if (run) *run = count - (inode_num - first);
+    return table * fs->sb.block_size + (uint64_t)(inode_num - first) * INODE_SIZE;
+}
+
+static uint64_t inode_offset(ix_fs* fs, uint32_t inode_num) {
+    return inode_pos(fs, inode_num, NULL);
+}
+
+// Слот хвоста имени: таблица имён идёт сразу за таблицей inode с тем же номером
+static uint64_t name_offset(ix_fs* fs, uint32_t inode_num) {
+    uint32_t first, count, bs = fs->sb.block_size;
+    uint64_t table = inode_table_of(&fs->sb, inode_num, &first, &count);
+    return (table + itable_blocks(count, bs)) * bs + (uint64_t)(inode_num - first) * NAME_SLOT;
+}
+
+static uint32_t name_hash(const char* name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t)name[i]) * 16777619u;
+    return h;
+}
+
+static void inode_set_name(Inode* inode, const char* name, size_t len) {
+    inode->name_hash = name_hash(name, len);
+    inode->name_len = len;
+    memcpy(inode->name, name, len < INLINE_NAME ? len : INLINE_NAME);
+}
+
+// Полное имя в out (NAME_MAX_LEN байт); хвост длинного читается из таблицы имён
+static int inode_name(ix_fs* fs, uint32_t inode_num, const Inode* inode, char* out) {
+    size_t len = inode->name_len;
+    if (len >= NAME_MAX_LEN) return -EIO;
+    memcpy(out, inode->name, len < INLINE_NAME ? len : INLINE_NAME);
+    out[len] = '\0';
+    if (len <= INLINE_NAME) return 0;
+    return asfs_dev_read(&fs->dev, out + INLINE_NAME, len - INLINE_NAME,
+                         name_offset(fs, inode_num));
+}
+
+// Хэш, длина и встроенное начало сверяются по inode; таблица имён читается,
+// только если всё это совпало. 1 - совпало, 0 - нет
+static int name_match(ix_fs* fs, uint32_t inode_num, const Inode* inode,
+                      const char* name, size_t len, uint32_t hash) {
+    if (inode->name_len != len || inode->name_hash != hash ||
+        memcmp(inode->name, name, len < INLINE_NAME ? len : INLINE_NAME) != 0)
+        return 0;
+    if (len <= INLINE_NAME) return 1;
+    char tail[NAME_SLOT];
+    int rc = asfs_dev_read(&fs->dev, tail, len - INLINE_NAME, name_offset(fs, inode_num));
+    if (rc < 0) return rc;
+    return memcmp(tail, name + INLINE_NAME, len - INLINE_NAME) == 0;
+}
+
+// Битмап блоков лежит сегментами: основной за суперблоком и по одному на
+// приращение. Переносит байты [first, first + len) между памятью и диском
+static int bitmap_io(ix_fs* fs, size_t first, size_t len, int write) {
+    uint64_t bs = fs->sb.block_size;
+    for (uint32_t k = 0; k <= fs->sb.ext_count && len > 0; k++) {
+        size_t seg_first = k ? fs->sb.ext[k-1].bmap_byte : 0;
+        uint64_t seg_block = k ? fs->sb.ext[k-1].bmap_block : 1;
+        size_t seg_end = seg_first +
+            (k ? fs->sb.ext[k-1].bmap_blocks : fs->sb.bitmap_blocks) * bs;
+        if (first < seg_first || first >= seg_end) continue;
+        size_t n = seg_end - first < len ? seg_end - first : len;
+        uint64_t off = seg_block * bs + (first - seg_first);
+        int rc = write ? asfs_dev_write(&fs->dev, fs->block_bitmap + first, n, off)
+                       : asfs_dev_read(&fs->dev, fs->block_bitmap + first, n, off);
+        if (rc < 0) return rc;
+        first += n;
+        len -= n;
+    }
+    return len ? -EIO : 0;
+}
+
+// Байт битмапа, который вмещают все сегменты
+static size_t bitmap_bytes(ix_fs* fs) {
+    size_t blocks = fs->sb.bitmap_blocks;
+    for (uint32_t k = 0; k < fs->sb.ext_count; k++) blocks += fs->sb.ext[k].bmap_blocks;
+    return blocks * fs->sb.block_size;
+}
+
+static uint32_t itable_group(ix_fs* fs, uint32_t inode_num) {
+    return (uint64_t)inode_num * INODE_SIZE / fs->sb.block_size / fs->sb.itable_group_blocks;
+}
+
+static int itable_group_ready(ix_fs* fs, uint32_t group) {
+    return fs->sb.itable_init[group/8] & (1 << (group%8));
+}
+
+static uint32_t itable_group_inodes(ix_fs* fs) {
+    return (uint64_t)fs->sb.itable_group_blocks * fs->sb.block_size / INODE_SIZE;
+}
+
+static int itable_ready(ix_fs* fs, uint32_t inode_num) {
+    if (!fs->sb.itable_group_blocks || inode_num >= base_inodes(fs)) return 1;
+    return itable_group_ready(fs, itable_group(fs, inode_num));
+}
+
+// Зануляет группу таблицы inode и отмечает это в суперблоке
+static int itable_init_group(ix_fs* fs, uint32_t group) {
+    uint64_t bs = fs->sb.block_size;
+    uint64_t start = fs->sb.inode_table + (uint64_t)group * fs->sb.itable_group_blocks;
+    uint64_t end = start + fs->sb.itable_group_blocks;
+    if (end > fs->names_start) end = fs->names_start;
+
+    int rc = asfs_dev_zero(&fs->dev, start * bs, (end - start) * bs);
+    if (rc < 0) return rc;
+    fs->sb.itable_init[group/8] |= 1 << (group%8);
+    STAT_INC(&fs->stats, meta.saves);
+    return asfs_dev_write(&fs->dev, &fs->sb, sizeof(SuperBlock), 0);
+}
+
+// Промахи по идущим вперёд inode (list, поиск по имени, поиск свободного)
+// подтягивают таблицу окном, растущим от 64 КБ до 4 МБ. Закэшированные inode
+// между промахами не сбивают серию, прыжок назад или далеко вперёд - сбивает
+static void itable_readahead(ix_fs* fs, uint32_t inode_num) {
+    uint64_t off = inode_offset(fs, inode_num);
+    if (inode_num < fs->ra_inode || off > fs->ra_until + fs->ra_window) {
+        fs->ra_window = 0;
+        fs->ra_until = off + INODE_SIZE;
+    }
+    fs->ra_inode = inode_num + 1;
+    if (off + fs->ra_window / 2 < fs->ra_until) return;
+
+    fs->ra_window = fs->ra_window ? fs->ra_window * 2 : RA_ITABLE_MIN;
+    if (fs->ra_window > RA_ITABLE_MAX) fs->ra_window = RA_ITABLE_MAX;
+    uint64_t end = off + fs->ra_window;
+    uint64_t table_end = (uint64_t)fs->names_start * fs->sb.block_size;
+    if (end > table_end) end = table_end;
+    if (end > fs->ra_until) asfs_dev_prefetch(&fs->dev, fs->ra_until, end - fs->ra_until);
+    fs->ra_until = end;
+}
+
+// Указатель действителен до следующего обращения к кэшу
+static Inode* get_inode(ix_fs* fs, uint32_t inode_num) {
+    Inode* cached = lru_cache_get(fs->l1_cache, inode_num);
+    if (cached) {
+        STAT_INC(&fs->stats, cache.hits);
+        return cached;
+    }
+    STAT_INC(&fs->stats, cache.misses);
+    if (!itable_ready(fs, inode_num)) {
+        // На диске в незанулённой группе мусор - отдаём пустой inode, не кэшируя
+        memset(&fs->scratch, 0, sizeof(Inode));
+        return &fs->scratch;
+    }
+    STAT_INC(&fs->stats, inode.reads);
+    itable_readahead(fs, inode_num);
+
+    Inode inode;
+    if (asfs_dev_read(&fs->dev, &inode, INODE_SIZE, inode_offset(fs, inode_num)) < 0)
+        return NULL;
+
+    if (lru_cache_put(fs->l1_cache, inode_num, &inode, 0) == 0)
+        return lru_cache_get(fs->l1_cache, inode_num);
+    fs->scratch = inode;
+    return &fs->scratch;
+}
+
+int ix_format(const char* path, uint64_t size, uint32_t l1_cache_size) {
+    return ix_format_striped(path, NULL, 0, 0, size, l1_cache_size);
+}
+
+int ix_format_striped(const char* path, const char* const* members, int count,
+                      uint32_t stripe_unit, uint64_t size, uint32_t l1_cache_size) {
+    asfs_dev dev;
+    asfs_stripe_label label = {0};
+    // Суперблок должен целиком лежать в первой полосе
+    if (count > 0 && (stripe_unit == 0 || stripe_unit % DEFAULT_BLOCK_SIZE)) return -EINVAL;
+    int rc = asfs_dev_open(&dev, path, O_RDWR | O_CREAT | O_TRUNC);
+    if (rc < 0) return rc;
+    if (count > 0) {
+        rc = asfs_dev_stripe(&dev, path, members, count, stripe_unit, O_CREAT | O_TRUNC, &label);
+        if (rc < 0) goto out;
+    }
+
+    rc = asfs_dev_truncate(&dev, size);
+    if (rc < 0) goto out;
+
+    uint32_t block_size = DEFAULT_BLOCK_SIZE;
+    uint32_t total_blocks = size / block_size;
+    uint32_t inode_count = total_blocks / 4;  // Исправлено
+    uint32_t bitmap_size = (total_blocks + 7) / 8;
+    uint32_t bitmap_blocks = (bitmap_size + block_size - 1) / block_size;
+    // Таблица inode идёт сразу за битмапом, каким бы длинным он ни был, за ней
+    // таблица имён (её не зануляем: слот читается, только если inode на него указывает)
+    uint32_t table_start = 1 + bitmap_blocks;
+    uint32_t table_blocks = itable_blocks(inode_count, block_size);
+    uint32_t data_start = table_start + table_blocks + names_blocks(inode_count, block_size);
+    if (inode_count < 2 || data_start >= total_blocks) {
+        rc = -ENOSPC;
+        goto out;
+    }
+
+    // Группы таблицы inode: не меньше 64 блоков и не больше 8192 штук
+    uint32_t group_blocks = (table_blocks + ITABLE_MAP_BYTES * 8 - 1) / (ITABLE_MAP_BYTES * 8);
+    if (group_blocks < ITABLE_MIN_GROUP_BLOCKS) group_blocks = ITABLE_MIN_GROUP_BLOCKS;
+
+    SuperBlock sb = {
+        .magic = MAGIC_NUMBER,
+        .block_size = block_size,
+        .inode_count = inode_count,
+        .free_inodes = inode_count - 1,
+        .free_blocks = total_blocks - data_start,
+        .inode_table = table_start,
+        .bitmap_blocks = bitmap_blocks,
+        .root_inode = 0,
+        .l1_cache_size = l1_cache_size,
+        .free_inode_hint = 1,
+        .itable_group_blocks = group_blocks,
+        .itable_groups = (table_blocks + group_blocks - 1) / group_blocks,
+        .itable_init = { 1 },  // группа 0 с корнем зануляется сразу
+        .inode_end = 1,
+        .stripe = label
+    };
+
+    uint8_t* block_bitmap = calloc(sb.bitmap_blocks, block_size);
+    if (!block_bitmap) {
+        rc = -ENOMEM;
+        goto out;
+    }
+    for (uint32_t i = 0; i < data_start; i++)
+        block_bitmap[i/8] |= 1 << (i%8);
+
+    rc = asfs_dev_write(&dev, block_bitmap, sb.bitmap_blocks * block_size, block_size);
+    free(block_bitmap);
+    if (rc < 0) goto out;
+
+    // Остальные группы таблицы inode занулятся при первой записи или ix_itable_init
+    uint32_t first_group = group_blocks < table_blocks ? group_blocks : table_blocks;
+    rc = asfs_dev_zero(&dev, (uint64_t)table_start * block_size,
+                       (uint64_t)first_group * block_size);
+    if (rc < 0) goto out;
+
+    Inode root = {
+        .flags = 1,
+        .created = time(NULL),
+        .modified = time(NULL)
+    };
+    inode_set_name(&root, "/", 1);
+    rc = asfs_dev_write(&dev, &root, INODE_SIZE, (uint64_t)table_start * block_size);
+    if (rc < 0) goto out;
+
+    // Суперблок последним: до этого момента образ не монтируется
+    rc = asfs_dev_write(&dev, &sb, sizeof(SuperBlock), 0);
+out:
+    asfs_dev_close(&dev);
+    return rc;
+}
+
+static uint32_t allocate_block(ix_fs* fs) {
+    uint64_t t = LAT_NOW();
+    for (uint32_t i = fs->data_start; i < fs->total_blocks; i++) {
+        if (!(fs->block_bitmap[i/8] & (1 << (i%8)))) {
+            fs->block_bitmap[i/8] |= 1 << (i%8);
+            fs->sb.free_blocks--;
+            STAT_INC(&fs->stats, alloc.block_allocs);
+            STAT_ADD(&fs->stats, alloc.block_scan, i - fs->data_start + 1);
+
+            if (bitmap_io(fs, i/8, 1, 1) < 0) {
+                fs->block_bitmap[i/8] &= ~(1 << (i%8));
+                fs->sb.free_blocks++;
+                LAT_RECORD(&fs->lat, ASFS_STEP_ALLOC, t, NO_INODE, 0, -EIO);
+                return 0;
+            }
+            LAT_RECORD(&fs->lat, ASFS_STEP_ALLOC, t, NO_INODE, 1, 0);
+            return i;
+        }
+    }
+    STAT_INC(&fs->stats, alloc.block_failures);
+    STAT_ADD(&fs->stats, alloc.block_scan, fs->total_blocks - fs->data_start);
+    LAT_RECORD(&fs->lat, ASFS_STEP_ALLOC, t, NO_INODE, 0, -ENOSPC);
+    return 0;
+}
+
+static void release_block(ix_fs* fs, uint32_t block) {
+    if (!block) return;
+    fs->block_bitmap[block/8] &= ~(1 << (block%8));
+    fs->sb.free_blocks++;
+    STAT_INC(&fs->stats, alloc.block_frees);
+    bitmap_io(fs, block/8, 1, 1);
+    // Бит уже на диске, так что дырявить можно в конце операции
+    if (fs->discard) asfs_discard_add(&fs->discard_queue, block);
+}
+
+// n свободных блоков подряд (первый подходящий кусок), 0 - не нашлось
+static uint32_t allocate_run(ix_fs* fs, uint32_t n) {
+    uint32_t run = 0;
+    for (uint32_t i = fs->data_start; i < fs->total_blocks; i++) {
+        if (fs->block_bitmap[i/8] & (1 << (i%8))) {
+            run = 0;
+            continue;
+        }
+        if (++run < n) continue;
+        uint32_t first = i + 1 - n;
+        for (uint32_t b = first; b <= i; b++) fs->block_bitmap[b/8] |= 1 << (b%8);
+        if (bitmap_io(fs, first / 8, i / 8 - first / 8 + 1, 1) < 0) {
+            for (uint32_t b = first; b <= i; b++) fs->block_bitmap[b/8] &= ~(1 << (b%8));
+            return 0;
+        }
+        fs->sb.free_blocks -= n;
+        STAT_ADD(&fs->stats, alloc.block_allocs, n);
+        return first;
+    }
+    STAT_INC(&fs->stats, alloc.block_failures);
+    return 0;
+}
+
+static int scan_inodes(ix_fs* fs, const char* filename, uint32_t* scanned) {
+    STAT_INC(&fs->stats, inode.lookups);
+    size_t len = strlen(filename);
+    uint32_t hash = name_hash(filename, len);
+    // После удалений в таблице есть дыры, поэтому смотрим всё до inode_end
+    for (uint32_t i = 1; i < fs->sb.inode_end; i++) {
+        if (!itable_ready(fs, i)) {
+            i += itable_group_inodes(fs) - i % itable_group_inodes(fs) - 1;
+            continue;
+        }
+        Inode* inode = get_inode(fs, i);
+        if (!inode) return -EIO;
+        STAT_INC(&fs->stats, inode.lookup_scan);
+        (*scanned)++;
+        int rc = name_match(fs, i, inode, filename, len, hash);
+        if (rc < 0) return rc;
+        if (rc) return i;
+    }
+    STAT_INC(&fs->stats, inode.lookup_misses);
+    return -ENOENT;
+}
+
+static int find_inode(ix_fs* fs, const char* filename) {
+    uint64_t t = LAT_NOW();
+    uint32_t scanned = 0;
+    // Фильтр Блума отвечает "точно нет", не трогая таблицу inode
+    if (fs->bloom.bits && !asfs_bloom_maybe(&fs->bloom, filename)) {
+        STAT_INC(&fs->stats, inode.lookups);
+        STAT_INC(&fs->stats, inode.lookup_misses);
+        STAT_INC(&fs->stats, inode.bloom_negatives);
+        LAT_RECORD(&fs->lat, ASFS_STEP_LOOKUP_SCAN, t, NO_INODE, 0, -ENOENT);
+        return -ENOENT;
+    }
+    int rc = scan_inodes(fs, filename, &scanned);
+    if (rc == -ENOENT && fs->bloom.bits) STAT_INC(&fs->stats, inode.bloom_false);
+    if (rc >= 0) fs->op_inode = rc;
+    // В поле blocks для этого шага - число просмотренных inode
+    LAT_RECORD(&fs->lat, ASFS_STEP_LOOKUP_SCAN, t, rc >= 0 ? (uint32_t)rc : NO_INODE,
+               scanned, rc < 0 ? rc : 0);
+    return rc;
+}
+
+// Чистая копия фильтра с диска; поля суперблока проверяются, как у горячего списка
+static int bloom_load(ix_fs* fs) {
+    SuperBlock* sb = &fs->sb;
+    if (sb->bloom_state != BLOOM_CLEAN || sb->bloom_bits_log2 < ASFS_BLOOM_MIN_LOG2 ||
+        sb->bloom_bits_log2 > ASFS_BLOOM_MAX_LOG2 || sb->bloom_start < fs->data_start ||
+        sb->bloom_start >= fs->total_blocks || sb->bloom_blocks > fs->total_blocks - sb->bloom_start ||
+        (1ull << (sb->bloom_bits_log2 - 3)) > (uint64_t)sb->bloom_blocks * sb->block_size)
+        return -EINVAL;
+    int rc = asfs_bloom_init(&fs->bloom, sb->bloom_bits_log2);
+    if (rc == 0)
+        rc = asfs_dev_read(&fs->dev, fs->bloom.bits, asfs_bloom_bytes(&fs->bloom),
+                           (uint64_t)sb->bloom_start * sb->block_size);
+    if (rc < 0) asfs_bloom_free(&fs->bloom);
+    return rc;
+}
+
+// Фильтр по всем живым именам. Удаления его не трогают, так что копия с диска
+// годится, пока не было создания; нет её - строится по таблице. Не вышло - поиск
+// просто идёт по таблице
+static void bloom_prepare(ix_fs* fs) {
+    if (fs->bloom.bits || bloom_load(fs) == 0) return;
+    if (asfs_bloom_init(&fs->bloom, asfs_bloom_bits_for(fs->sb.inode_count)) < 0) return;
+    char name[NAME_MAX_LEN];
+    for (uint32_t i = 1; i < fs->sb.inode_end; i++) {
+        if (!itable_ready(fs, i)) {
+            i += itable_group_inodes(fs) - i % itable_group_inodes(fs) - 1;
+            continue;
+        }
+        Inode* inode = get_inode(fs, i);
+        if (!inode || (inode->name_len && inode_name(fs, i, inode, name) < 0)) {
+            asfs_bloom_free(&fs->bloom);
+            return;
+        }
+        if (inode->name_len) asfs_bloom_add(&fs->bloom, name);
+    }
+}
+
+// Новое имя делает копию на диске устаревшей. Суперблок пишется только в ix_sync,
+// поэтому флаг снимается на диске сразу, до записи inode - иначе после сбоя
+// загрузится фильтр без этого имени
+static int bloom_dirty(ix_fs* fs) {
+    if (fs->sb.bloom_state != BLOOM_CLEAN) return 0;
+    uint32_t state = 0;
+    STAT_INC(&fs->stats, meta.saves);
+    int rc = asfs_dev_write(&fs->dev, &state, sizeof(state), offsetof(SuperBlock, bloom_state));
+    if (rc == 0) fs->sb.bloom_state = 0;
+    return rc;
+}
+
+// Фильтр - в непрерывный кусок блоков; кусок другого размера (после ix_resize)
+// выделяется заново, прежний отдаётся после записи суперблока, как у горячего списка
+static void bloom_save(ix_fs* fs, uint32_t* old_start, uint32_t* old_blocks) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    size_t bytes = asfs_bloom_bytes(&fs->bloom);
+    uint32_t blocks = (bytes + bs - 1) / bs;
+    *old_blocks = 0;
+    if (sb->bloom_blocks != blocks) {
+        uint32_t start = allocate_run(fs, blocks);
+        if (!start) return;
+        *old_start = sb->bloom_start;
+        *old_blocks = sb->bloom_blocks;
+        sb->bloom_start = start;
+        sb->bloom_blocks = blocks;
+    }
+    if (asfs_dev_write(&fs->dev, fs->bloom.bits, bytes, (uint64_t)sb->bloom_start * bs) == 0) {
+        sb->bloom_state = BLOOM_CLEAN;
+        sb->bloom_bits_log2 = fs->bloom.bits_log2;
+    }
+}
+
+static int find_free_inode(ix_fs* fs) {
+    for (uint32_t i = fs->sb.free_inode_hint; i < fs->sb.inode_count; i++) {
+        Inode* inode = get_inode(fs, i);
+        if (!inode) return -EIO;
+        STAT_INC(&fs->stats, alloc.inode_scan);
+        if (inode->name_len == 0) return i;
+    }
+    for (uint32_t i = 1; i < fs->sb.free_inode_hint && i < fs->sb.inode_count; i++) {
+        Inode* inode = get_inode(fs, i);
+        if (!inode) return -EIO;
+        STAT_INC(&fs->stats, alloc.inode_scan);
+        if (inode->name_len == 0) return i;
+    }
+    return -ENOSPC;
+}
+
+// Публичные операции - тонкие обёртки, замеряющие время и пишущие трейс
+static uint64_t op_begin(ix_fs* fs) {
+    // После уменьшения кэша лишнее уходит и без вставок - здесь указатели
+    // на узлы кэша ещё никто не держит
+    if (fs->l1_cache->size > fs->l1_cache->capacity) lru_trim(fs->l1_cache, LRU_TRIM_STEP);
+    fs->op_inode = NO_INODE;
+    fs->op_blocks = 0;
+    if (fs->capture) fs->capture_start = workload_clock();
+    return LAT_NOW();
+}
+
+static void capture(ix_fs* fs, int op, const char* name, uint64_t size, uint64_t offset,
+                    int64_t rc) {
+    if (fs->capture)
+        workload_record(fs->capture, op, fs->capture_start, name, NULL, size, offset, rc);
+}
+
+static int64_t op_end(ix_fs* fs, int op, uint64_t start, int64_t rc) {
+    if (fs->discard_queue.count)
+        asfs_discard_flush(&fs->dev, &fs->discard_queue, fs->sb.block_size, fs->block_bitmap);
+    LAT_RECORD(&fs->lat, op, start, fs->op_inode, fs->op_blocks, rc);
+    return rc;
+}
+
+static int do_write(ix_fs* fs, const char* dst, const void* data, size_t size,
+                    uint32_t flags, time_t created, time_t modified) {
+    size_t name_len = strlen(dst);
+    if (name_len == 0) return -EINVAL;
+    if (name_len >= NAME_MAX_LEN) return -ENAMETOOLONG;
+    if (size > MICRODATA_SIZE &&
+        (size + fs->sb.block_size - 1) / fs->sb.block_size > 12)
+        return -EFBIG;
+
+    bloom_prepare(fs);
+    int rc = find_inode(fs, dst);
+    if (rc >= 0) return -EEXIST;
+    if (rc != -ENOENT) return rc;
+
+    int inode_num = find_free_inode(fs);
+    if (inode_num < 0) return inode_num;
+    rc = bloom_dirty(fs);
+    if (rc < 0) return rc;
+    if (!itable_ready(fs, inode_num)) {
+        rc = itable_init_group(fs, itable_group(fs, inode_num));
+        if (rc < 0) return rc;
+    }
+
+    // Хвост имени пишется раньше inode: до записи inode слот ничей
+    if (name_len > INLINE_NAME) {
+        rc = asfs_dev_write(&fs->dev, dst + INLINE_NAME, name_len - INLINE_NAME,
+                            name_offset(fs, inode_num));
+        if (rc < 0) return rc;
+    }
+
+    Inode inode;
+    memset(&inode, 0, sizeof(Inode));
+    inode_set_name(&inode, dst, name_len);
+    inode.size = size;
+    inode.flags = flags;
+    inode.created = created;
+    inode.modified = modified;
+
+    if (size <= MICRODATA_SIZE) {
+        memcpy(inode.micro_data, data, size);
+    } else {
+        uint32_t blocks_needed = (size + fs->sb.block_size - 1) / fs->sb.block_size;
+        for (uint32_t i = 0; i < blocks_needed; i++) {
+            inode.blocks[i] = allocate_block(fs);
+            size_t write_size = (i == blocks_needed-1) ?
+                size % fs->sb.block_size : fs->sb.block_size;
+            if (write_size == 0) write_size = fs->sb.block_size;
+
+            rc = inode.blocks[i] ? 0 : -ENOSPC;
+            if (rc == 0) {
+                uint64_t t = LAT_NOW();
+                rc = asfs_dev_write(&fs->dev, (const uint8_t*)data + (size_t)i*fs->sb.block_size,
+                                    write_size, (uint64_t)inode.blocks[i] * fs->sb.block_size);
+                LAT_RECORD(&fs->lat, ASFS_STEP_DATA_WRITE, t, inode_num, 1, rc);
+                fs->op_blocks++;
+            }
+            if (rc < 0) {
+                for (uint32_t j = 0; j <= i; j++) release_block(fs, inode.blocks[j]);
+                return rc;
+            }
+        }
+    }
+
+    uint64_t t = LAT_NOW();
+    STAT_INC(&fs->stats, inode.writes);
+    rc = asfs_dev_write(&fs->dev, &inode, INODE_SIZE, inode_offset(fs, inode_num));
+    LAT_RECORD(&fs->lat, ASFS_STEP_INODE_WRITE, t, inode_num, 0, rc);
+    fs->op_inode = inode_num;
+    if (rc < 0) return rc;
+
+    fs->sb.free_inode_hint = inode_num + 1;
+    if ((uint32_t)inode_num >= fs->sb.inode_end) fs->sb.inode_end = inode_num + 1;
+    fs->sb.free_inodes--;
+    STAT_INC(&fs->stats, alloc.inode_allocs);
+    if (fs->bloom.bits) asfs_bloom_add(&fs->bloom, dst);
+    lru_cache_put(fs->l1_cache, inode_num, &inode, 0);
+    return 0;
+}
+
+int ix_write(ix_fs* fs, const char* dst, const void* data, size_t size) {
+    uint64_t t = op_begin(fs);
+    time_t now = time(NULL);
+    int rc = do_write(fs, dst, data, size, 0, now, now);
+    capture(fs, WORKLOAD_CREATE, dst, size, 0, rc);
+    return op_end(fs, ASFS_OP_CREATE, t, rc);
+}
+
+static int do_delete(ix_fs* fs, const char* filename) {
+    int inode_num = find_inode(fs, filename);
+    if (inode_num < 0) return inode_num;
+    Inode* cached = get_inode(fs, inode_num);
+    if (!cached) return -EIO;
+    Inode inode = *cached;
+
+    // Сначала пустой inode: после сбоя в худшем случае утекут блоки
+    Inode empty;
+    memset(&empty, 0, sizeof(Inode));
+    uint64_t t = LAT_NOW();
+    STAT_INC(&fs->stats, inode.writes);
+    int rc = asfs_dev_write(&fs->dev, &empty, INODE_SIZE, inode_offset(fs, inode_num));
+    LAT_RECORD(&fs->lat, ASFS_STEP_INODE_WRITE, t, inode_num, 0, rc);
+    if (rc < 0) return rc;
+    cached = lru_cache_get(fs->l1_cache, inode_num);
+    if (cached) *cached = empty;
+
+    if (inode.size > MICRODATA_SIZE) {
+        uint32_t nblocks = (inode.size + fs->sb.block_size - 1) / fs->sb.block_size;
+        for (uint32_t i = 0; i < nblocks && i < 12; i++) release_block(fs, inode.blocks[i]);
+        fs->op_blocks = nblocks;
+    }
+    fs->sb.free_inodes++;
+    if ((uint32_t)inode_num < fs->sb.free_inode_hint) fs->sb.free_inode_hint = inode_num;
+    STAT_INC(&fs->stats, alloc.inode_frees);
+    return 0;
+}
+
+int ix_delete(ix_fs* fs, const char* filename) {
+    uint64_t t = op_begin(fs);
+    int rc = do_delete(fs, filename);
+    capture(fs, WORKLOAD_DELETE, filename, 0, 0, rc);
+    return op_end(fs, ASFS_OP_DELETE, t, rc);
+}
+
+static int do_lookup(ix_fs* fs, const char* filename, ix_stat* st) {
+    int inode_num = find_inode(fs, filename);
+    if (inode_num < 0) return inode_num;
+    Inode* inode = get_inode(fs, inode_num);
+    if (!inode) return -EIO;
+    if (st) {
+        memset(st, 0, sizeof(*st));
+        st->inode = inode_num;
+        st->size = inode->size;
+        st->flags = inode->flags;
+        st->created = inode->created;
+        st->modified = inode->modified;
+        return inode_name(fs, inode_num, inode, st->name);
+    }
+    return 0;
+}
+
+int ix_lookup(ix_fs* fs, const char* filename, ix_stat* st) {
+    ix_stat found;
+    if (!st && fs->capture) st = &found;  // воспроизведению нужен размер
+    uint64_t t = op_begin(fs);
+    int rc = do_lookup(fs, filename, st);
+    capture(fs, WORKLOAD_LOOKUP, filename, rc == 0 && st ? st->size : 0, 0, rc);
+    return op_end(fs, ASFS_OP_LOOKUP, t, rc);
+}
+
+// Запоминает в кэшированном inode, где кончилось чтение, и при последовательном
+// доступе асинхронно подтягивает следующие блоки файла. Окно удваивается
+// от RA_MIN_BLOCKS до RA_MAX_BLOCKS, смежные блоки уходят одним запросом
+static void file_readahead(ix_fs* fs, Inode* inode, uint32_t first, uint32_t end) {
+    uint32_t p = inode->access_pattern;
+    uint32_t streak = RA_STREAK(p), window = RA_WINDOW(p), until = RA_UNTIL(p);
+    // Дочитывание того же блока с места, где остановились, тоже последовательно
+    if (first == inode->last_block || (inode->last_block && first == inode->last_block - 1)) {
+        if (streak < 0xFF) streak++;
+        window = window ? window * 2 : RA_MIN_BLOCKS;
+        if (window > RA_MAX_BLOCKS) window = RA_MAX_BLOCKS;
+        STAT_INC(&fs->stats, inode.seq_reads);
+    } else {
+        streak = window = until = 0;
+    }
+    inode->last_block = end;
+
+    uint32_t nblocks = (inode->size + fs->sb.block_size - 1) / fs->sb.block_size;
+    uint32_t target = end + window;
+    if (target > nblocks) target = nblocks;
+    uint32_t from = until > end ? until : end;
+    if (streak && from < target) {
+        uint64_t bs = fs->sb.block_size;
+        for (uint32_t i = from; i < target; ) {
+            uint32_t j = i + 1;
+            while (j < target && inode->blocks[j] == inode->blocks[j-1] + 1) j++;
+            asfs_dev_prefetch(&fs->dev, (uint64_t)inode->blocks[i] * bs, (j - i) * bs);
+            i = j;
+        }
+        until = target;
+    }
+    inode->access_pattern = RA_PATTERN(streak, window, until);
+}
+
+static ssize_t do_read(ix_fs* fs, const char* filename, void* buf, size_t count,
+                       uint64_t offset) {
+    int inode_num = find_inode(fs, filename);
+    if (inode_num < 0) return inode_num;
+
+    Inode* cached = get_inode(fs, inode_num);
+    if (!cached) return -EIO;
+
+    if (offset >= cached->size) return 0;
+    if (count > cached->size - offset) count = cached->size - offset;
+
+    if (cached->size <= MICRODATA_SIZE) {
+        memcpy(buf, cached->micro_data + offset, count);
+        return count;
+    }
+
+    uint32_t bs = fs->sb.block_size;
+    uint32_t first = offset / bs;
+    uint32_t end = (offset + count + bs - 1) / bs;
+    if (end > 12) end = 12;
+    // Состояние readahead живёт в кэше и на диск пишется только вместе с inode
+    file_readahead(fs, cached, first, end);
+    Inode inode = *cached;
+
+    uint8_t* out = buf;
+    size_t done = 0;
+    while (done < count) {
+        uint64_t pos = offset + done;
+        uint32_t idx = pos / bs;
+        uint32_t in_block = pos % bs;
+        if (idx >= 12) break;
+        // Физически смежные блоки читаются одним pread
+        uint32_t last = idx;
+        while (last + 1 < end && inode.blocks[last+1] == inode.blocks[last] + 1) last++;
+        size_t chunk = (size_t)(last - idx + 1) * bs - in_block;
+        if (chunk > count - done) chunk = count - done;
+
+        int rc = asfs_dev_read(&fs->dev, out + done, chunk,
+                               (uint64_t)inode.blocks[idx] * bs + in_block);
+        if (rc < 0) return rc;
+        fs->op_blocks += last - idx + 1;
+        done += chunk;
+    }
+    return done;
+}
+
+ssize_t ix_read(ix_fs* fs, const char* filename, void* buf, size_t count, uint64_t offset) {
+    uint64_t t = op_begin(fs);
+    ssize_t rc = do_read(fs, filename, buf, count, offset);
+    capture(fs, WORKLOAD_READ, filename, count, offset, rc);
+    return op_end(fs, ASFS_OP_READ, t, rc);
+}
+
+static int do_list(ix_fs* fs, ix_list_cb cb, void* arg) {
+    for (uint32_t i = 0; i < fs->sb.inode_count; i++) {
+        if (!itable_ready(fs, i)) {
+            // Незанулённая группа целиком пуста
+            i += itable_group_inodes(fs) - i % itable_group_inodes(fs) - 1;
+            continue;
+        }
+        Inode* inode = get_inode(fs, i);
+        if (!inode) return -EIO;
+        if (inode->name_len == 0) continue;
+
+        ix_stat st = {0};
+        st.inode = i;
+        st.size = inode->size;
+        st.flags = inode->flags;
+        st.created = inode->created;
+        st.modified = inode->modified;
+        int rc = inode_name(fs, i, inode, st.name);
+        if (rc < 0) return rc;
+        if (cb(&st, arg)) break;
+    }
+    return 0;
+}
+
+int ix_list(ix_fs* fs, ix_list_cb cb, void* arg) {
+    uint64_t t = op_begin(fs);
+    int rc = do_list(fs, cb, arg);
+    capture(fs, WORKLOAD_LIST, NULL, 0, 0, rc);
+    return op_end(fs, ASFS_OP_LIST, t, rc);
+}
+
+// ---- экспорт ----
+// Таблица inode читается напрямую большими кусками (мимо L1 кэша, чтобы
+// не вымывать его), файлы окна отдаются в порядке первого блока данных.
+
+#define SCAN_CHUNK 1024
+#define EXPORT_WINDOW 16384
+
+typedef struct {
+    uint32_t inode;
+    Inode node;
+} ExportEntry;
+
+static uint32_t first_block(const Inode* node) {
+    return node->size > MICRODATA_SIZE ? node->blocks[0] : 0;
+}
+
+static int cmp_first_block(const void* a, const void* b) {
+    uint32_t x = first_block(&((const ExportEntry*)a)->node);
+    uint32_t y = first_block(&((const ExportEntry*)b)->node);
+    return x < y ? -1 : x > y;
+}
+
+static int export_file(ix_fs* fs, const ExportEntry* e, uint8_t* buf,
+                       ix_export_cb cb, void* arg) {
+    ix_stat st = {0};
+    uint32_t bs = fs->sb.block_size;
+    st.inode = e->inode;
+    st.size = e->node.size;
+    st.flags = e->node.flags;
+    st.created = e->node.created;
+    st.modified = e->node.modified;
+    int rc = inode_name(fs, e->inode, &e->node, st.name);
+    if (rc < 0) return rc;
+
+    if (e->node.size <= MICRODATA_SIZE)
+        return cb(&st, e->node.micro_data, e->node.size, 0, arg);
+
+    uint32_t count = (e->node.size + bs - 1) / bs;
+    if (count > 12) return -EIO;
+    for (uint32_t b = 0; b < count; ) {
+        uint32_t run = 1;
+        while (b + run < count && e->node.blocks[b + run] == e->node.blocks[b] + run) run++;
+        uint32_t first = e->node.blocks[b];
+        if (first < fs->data_start || first + run > fs->total_blocks) return -EIO;
+
+        uint64_t offset = (uint64_t)b * bs;
+        size_t len = (size_t)run * bs;
+        if (len > e->node.size - offset) len = e->node.size - offset;
+        rc = asfs_dev_read(&fs->dev, buf, len, (uint64_t)first * bs);
+        if (rc < 0) return rc;
+        fs->op_blocks += run;
+        rc = cb(&st, buf, len, offset, arg);
+        if (rc) return rc;
+        b += run;
+    }
+    return 0;
+}
+
+static int export_window(ix_fs* fs, ExportEntry* window, size_t n, uint8_t* buf,
+                         ix_export_cb cb, void* arg) {
+    qsort(window, n, sizeof(ExportEntry), cmp_first_block);
+    for (size_t k = 0; k < n; k++) {
+        int rc = export_file(fs, &window[k], buf, cb, arg);
+        if (rc) return rc;
+    }
+    return 0;
+}
+
+static int do_export(ix_fs* fs, const char* prefix, ix_export_cb cb, void* arg) {
+    size_t plen = prefix ? strlen(prefix) : 0;
+    char name[NAME_MAX_LEN];
+    uint8_t* chunk = malloc((size_t)SCAN_CHUNK * INODE_SIZE);
+    ExportEntry* window = malloc(EXPORT_WINDOW * sizeof(ExportEntry));
+    uint8_t* buf = malloc(12 * (size_t)fs->sb.block_size);
+    int rc = 0;
+    size_t n = 0;
+    if (!chunk || !window || !buf) {
+        rc = -ENOMEM;
+        goto out;
+    }
+
+    uint32_t count;
+    for (uint32_t first = 1; first < fs->sb.inode_count && rc == 0; first += count) {
+        // Кусок не пересекает границу таблиц приращений
+        uint64_t off = inode_pos(fs, first, &count);
+        if (count > SCAN_CHUNK) count = SCAN_CHUNK;
+        rc = asfs_dev_read(&fs->dev, chunk, (size_t)count * INODE_SIZE, off);
+        STAT_ADD(&fs->stats, inode.reads, count);
+        for (uint32_t i = 0; i < count && rc == 0; i++) {
+            // Незанулённые группы таблицы содержат мусор
+            if (!itable_ready(fs, first + i)) continue;
+            Inode* node = (Inode*)(chunk + (size_t)i * INODE_SIZE);
+            if (node->name_len == 0 || node->name_len < plen) continue;
+            if (plen && memcmp(node->name, prefix, plen < INLINE_NAME ? plen : INLINE_NAME))
+                continue;
+            // Префикс длиннее встроенного начала - дочитываем имя
+            if (plen > INLINE_NAME) {
+                rc = inode_name(fs, first + i, node, name);
+                if (rc < 0) break;
+                if (strncmp(name, prefix, plen) != 0) continue;
+            }
+            window[n].inode = first + i;
+            window[n++].node = *node;
+            if (n == EXPORT_WINDOW) {
+                rc = export_window(fs, window, n, buf, cb, arg);
+                n = 0;
+            }
+        }
+    }
+    if (rc == 0 && n) rc = export_window(fs, window, n, buf, cb, arg);
+out:
+    free(chunk);
+    free(window);
+    free(buf);
+    return rc;
+}
+
+int ix_export(ix_fs* fs, const char* prefix, ix_export_cb cb, void* arg) {
+    uint64_t t = op_begin(fs);
+    return op_end(fs, ASFS_OP_READ, t, do_export(fs, prefix, cb, arg));
+}
+
+int ix_pin(ix_fs* fs, const char* filename, uint32_t* inode_out) {
+    int inode_num = find_inode(fs, filename);
+    if (inode_num < 0) return inode_num;
+    Inode* inode = get_inode(fs, inode_num);
+    if (!inode) return -EIO;
+    Inode copy = *inode;
+    int rc = lru_cache_put(fs->l1_cache, inode_num, &copy, 1);
+    if (rc < 0) return rc;
+    if (inode_out) *inode_out = inode_num;
+    return 0;
+}
+
+// ---- горячий набор L1 ----
+// ix_sync сохраняет номера закэшированных inode в порядке LRU, монтирование
+// читает их крупными последовательными кусками таблицы inode, а не по одному
+
+// Пишет список; *old_blocks != 0 - список переехал, прежний кусок освободить
+// после записи суперблока. Не вышло - набор просто не сохраняется
+static void hot_save(ix_fs* fs, uint32_t* old_start, uint32_t* old_blocks) {
+    SuperBlock* sb = &fs->sb;
+    LRUCache* cache = fs->l1_cache;
+    uint64_t bs = sb->block_size;
+    *old_blocks = 0;
+    uint32_t* list = malloc((cache->size ? cache->size : 1) * sizeof(uint32_t));
+    if (!list) {
+        sb->hot_count = 0;
+        return;
+    }
+    // Корень читается при монтировании и так, пустые inode (удалённые) не нужны
+    uint32_t n = 0;
+    for (LRUNode* node = cache->head; node; node = node->next)
+        if (node->inode_num != sb->root_inode && node->inode.name_len)
+            list[n++] = node->inode_num | (node->pinned ? HOT_PINNED : 0);
+
+    uint64_t bytes = (uint64_t)n * sizeof(uint32_t);
+    int rc = 0;
+    if (bytes > (uint64_t)sb->hot_blocks * bs) {
+        uint32_t blocks = (bytes * 2 + bs - 1) / bs;
+        uint32_t start = allocate_run(fs, blocks);
+        if (start) {
+            *old_start = sb->hot_start;
+            *old_blocks = sb->hot_blocks;
+            sb->hot_start = start;
+            sb->hot_blocks = blocks;
+        } else {
+            rc = -ENOSPC;
+        }
+    }
+    if (rc == 0 && n) rc = asfs_dev_write(&fs->dev, list, bytes, (uint64_t)sb->hot_start * bs);
+    sb->hot_count = rc == 0 ? n : 0;
+    free(list);
+}
+
+static int cmp_hot(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a & ~HOT_PINNED, y = *(const uint32_t*)b & ~HOT_PINNED;
+    return x < y ? -1 : x > y;
+}
+
+// Номера сортируются, близкие (дыра до HOT_GAP inode) читаются одним запросом
+// до RA_ITABLE_MAX байт; затем кэш выстраивается в сохранённом порядке LRU
+static void hot_load(ix_fs* fs) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    uint32_t n = sb->hot_count;
+    if (n > fs->l1_cache->capacity) n = fs->l1_cache->capacity;
+    if (n == 0 || sb->hot_start < fs->data_start || sb->hot_start >= fs->total_blocks ||
+        (uint64_t)sb->hot_count * sizeof(uint32_t) > (uint64_t)sb->hot_blocks * bs)
+        return;
+
+    uint32_t* list = malloc(n * sizeof(uint32_t));
+    uint32_t* sorted = malloc(n * sizeof(uint32_t));
+    uint8_t* buf = malloc(RA_ITABLE_MAX);
+    if (!list || !sorted || !buf ||
+        asfs_dev_read(&fs->dev, list, n * sizeof(uint32_t), (uint64_t)sb->hot_start * bs) < 0)
+        goto out;
+    memcpy(sorted, list, n * sizeof(uint32_t));
+    qsort(sorted, n, sizeof(uint32_t), cmp_hot);
+
+    for (uint32_t i = 0; i < n;) {
+        uint32_t first = sorted[i] & ~HOT_PINNED;
+        if (first >= sb->inode_count || !itable_ready(fs, first)) {
+            i++;
+            continue;
+        }
+        uint32_t run;
+        uint64_t off = inode_pos(fs, first, &run);
+        if (run > RA_ITABLE_MAX / INODE_SIZE) run = RA_ITABLE_MAX / INODE_SIZE;
+        uint32_t j = i + 1, last = first;
+        for (; j < n; j++) {
+            uint32_t next = sorted[j] & ~HOT_PINNED;
+            if (next - first >= run || next - last > HOT_GAP || !itable_ready(fs, next)) break;
+            last = next;
+        }
+        if (asfs_dev_read(&fs->dev, buf, (uint64_t)(last - first + 1) * INODE_SIZE, off) < 0)
+            break;
+        STAT_ADD(&fs->stats, inode.reads, j - i);
+        for (uint32_t k = i; k < j; k++) {
+            uint32_t num = sorted[k] & ~HOT_PINNED;
+            const Inode* node = (const Inode*)(buf + (uint64_t)(num - first) * INODE_SIZE);
+            if (node->name_len)
+                lru_cache_put(fs->l1_cache, num, node, !!(sorted[k] & HOT_PINNED));
+        }
+        i = j;
+    }
+    // От старых к свежим: каждый поднимается в голову, свежий оказывается первым
+    for (uint32_t k = n; k-- > 0;) lru_cache_get(fs->l1_cache, list[k] & ~HOT_PINNED);
+out:
+    free(list);
+    free(sorted);
+    free(buf);
+}
+
+int ix_mount(const char* path, ix_fs** out) {
+    ix_fs* fs = calloc(1, sizeof(ix_fs));
+    if (!fs) return -ENOMEM;
+
+    int rc = asfs_dev_open(&fs->dev, path, O_RDWR);
+    if (rc < 0) {
+        free(fs);
+        return rc;
+    }
+    fs->dev.stats = &fs->stats;
+    fs->dev.lat = &fs->lat;
+
+    rc = asfs_dev_read(&fs->dev, &fs->sb, sizeof(SuperBlock), 0);
+    if (rc == 0 && fs->sb.magic == MAGIC_V1)
+        rc = -EPROTO;  // inode v1, нужен ix_convert
+    else if (rc == 0 && (fs->sb.magic != MAGIC_NUMBER || fs->sb.block_size == 0 ||
+                    fs->sb.itable_groups > ITABLE_MAP_BYTES * 8 ||
+                    fs->sb.ext_count > MAX_EXTENTS))
+        rc = -EINVAL;
+    if (rc == 0 && fs->sb.stripe.magic)
+        rc = fs->sb.stripe.unit % fs->sb.block_size ? -EINVAL :
+             asfs_dev_attach(&fs->dev, path, &fs->sb.stripe);
+    if (rc < 0) goto fail;
+
+    size_t map_bytes = bitmap_bytes(fs);
+    fs->block_bitmap = malloc(map_bytes);
+    if (!fs->block_bitmap) {
+        rc = -ENOMEM;
+        goto fail;
+    }
+    rc = bitmap_io(fs, 0, map_bytes, 0);
+    if (rc < 0) goto fail;
+
+    uint64_t dev_size;
+    rc = asfs_dev_size(&fs->dev, &dev_size);
+    if (rc < 0) goto fail;
+    fs->total_blocks = fs->sb.total_blocks ? fs->sb.total_blocks : dev_size / fs->sb.block_size;
+    if (fs->total_blocks > map_bytes * 8) fs->total_blocks = map_bytes * 8;
+    fs->names_start = fs->sb.inode_table + itable_blocks(base_inodes(fs), fs->sb.block_size);
+    fs->data_start = fs->names_start + names_blocks(base_inodes(fs), fs->sb.block_size);
+
+    fs->l1_cache = lru_cache_create(fs->sb.l1_cache_size, &fs->stats);
+    if (!fs->l1_cache) {
+        rc = -ENOMEM;
+        goto fail;
+    }
+    if (!get_inode(fs, fs->sb.root_inode)) {
+        rc = -EIO;
+        goto fail;
+    }
+    if (fs->sb.inode_end == 0) {
+        // Старый образ: удалений не было, inode заняты подряд с 1
+        uint32_t i = 1;
+        Inode* inode;
+        while (i < fs->sb.inode_count && itable_ready(fs, i) &&
+               (inode = get_inode(fs, i)) && inode->name_len)
+            i++;
+        fs->sb.inode_end = i;
+    }
+    hot_load(fs);
+    bloom_load(fs);
+    *out = fs;
+    return 0;
+fail:
+    asfs_dev_close(&fs->dev);
+    free(fs->block_bitmap);
+    lru_cache_free(fs->l1_cache);
+    free(fs);
+    return rc;
+}
+
+int ix_sync(ix_fs* fs) {
+    uint32_t old_start = 0, old_blocks = 0, bloom_old_start = 0, bloom_old_blocks = 0;
+    hot_save(fs, &old_start, &old_blocks);
+    if (fs->bloom.bits && fs->sb.bloom_state != BLOOM_CLEAN)
+        bloom_save(fs, &bloom_old_start, &bloom_old_blocks);
+    STAT_INC(&fs->stats, meta.saves);
+    int rc = asfs_dev_write(&fs->dev, &fs->sb, sizeof(SuperBlock), 0);
+    if (rc < 0) return rc;
+    // Прежние куски списка и фильтра отдаём, когда суперблок уже указывает на новые
+    if (old_blocks || bloom_old_blocks) {
+        for (uint32_t i = 0; i < old_blocks; i++) release_block(fs, old_start + i);
+        for (uint32_t i = 0; i < bloom_old_blocks; i++) release_block(fs, bloom_old_start + i);
+        STAT_INC(&fs->stats, meta.saves);
+        rc = asfs_dev_write(&fs->dev, &fs->sb, sizeof(SuperBlock), 0);
+        if (rc < 0) return rc;
+        if (fs->discard_queue.count)
+            asfs_discard_flush(&fs->dev, &fs->discard_queue, fs->sb.block_size, fs->block_bitmap);
+    }
+    return asfs_dev_sync(&fs->dev);
+}
+
+int ix_unmount(ix_fs* fs) {
+    if (!fs) return 0;
+    int rc = ix_sync(fs);
+    lru_cache_free(fs->l1_cache);
+    free(fs->block_bitmap);
+    asfs_dev_close(&fs->dev);
+    asfs_trace_enable(&fs->lat, 0);
+    workload_close(fs->capture);
+    asfs_discard_free(&fs->discard_queue);
+    asfs_bloom_free(&fs->bloom);
+    free(fs);
+    return rc;
+}
+
+int ix_statfs(ix_fs* fs, ix_fsinfo* info) {
+    info->block_size = fs->sb.block_size;
+    info->inode_count = fs->sb.inode_count;
+    info->free_inodes = fs->sb.free_inodes;
+    info->free_blocks = fs->sb.free_blocks;
+    info->l1_cache_size = fs->l1_cache->capacity;
+    info->cached_inodes = fs->l1_cache->size;
+    info->total_blocks = fs->total_blocks;
+    info->itable_groups = fs->sb.itable_groups;
+    info->itable_uninit = 0;
+    for (uint32_t g = 0; g < fs->sb.itable_groups; g++)
+        if (!itable_group_ready(fs, g)) info->itable_uninit++;
+    return 0;
+}
+
+int ix_itable_init(ix_fs* fs, uint32_t max_groups) {
+    int done = 0;
+    for (uint32_t g = 0; g < fs->sb.itable_groups && (uint32_t)done < max_groups; g++) {
+        if (itable_group_ready(fs, g)) continue;
+        int rc = itable_init_group(fs, g);
+        if (rc < 0) return rc;
+        done++;
+    }
+    return done;
+}
+
+// Рост на месте: в начале нового места сегмент битмапа (если старым не хватает
+// ёмкости), занулённая таблица новых inode и их таблица имён. Пишутся только они, байты битмапа
+// с новыми битами и суперблок - последним, до него образ остаётся прежним
+static int do_resize(ix_fs* fs, uint64_t new_size) {
+    SuperBlock* sb = &fs->sb;
+    uint64_t bs = sb->block_size;
+    if (new_size / bs > UINT32_MAX) return -EFBIG;
+    uint32_t old_total = fs->total_blocks, old_inodes = sb->inode_count;
+    uint32_t new_total = new_size / bs;
+    if (new_total <= old_total) return -EINVAL;
+    if (sb->ext_count == MAX_EXTENTS) return -ENOSPC;
+
+    uint32_t add_blocks = new_total - old_total;
+    uint32_t add_inodes = add_blocks / 4;   // как при форматировании
+    uint64_t cap_bytes = bitmap_bytes(fs);
+    uint32_t bmap_blocks = 0;
+    if (new_total > cap_bytes * 8)
+        bmap_blocks = ((new_total + 7) / 8 - cap_bytes + bs - 1) / bs;
+    uint32_t meta = bmap_blocks + itable_blocks(add_inodes, bs) + names_blocks(add_inodes, bs);
+    if (meta >= add_blocks) return -ENOSPC;
+
+    uint64_t dev_size;
+    int rc = asfs_dev_size(&fs->dev, &dev_size);
+    if (rc < 0) return rc;
+    if (dev_size < (uint64_t)new_total * bs) {
+        rc = asfs_dev_truncate(&fs->dev, (uint64_t)new_total * bs);
+        if (rc < 0) return rc;
+    }
+    rc = asfs_dev_zero(&fs->dev, (uint64_t)old_total * bs, (uint64_t)meta * bs);
+    if (rc < 0) return rc;
+
+    if (bmap_blocks) {
+        uint8_t* map = realloc(fs->block_bitmap, cap_bytes + (uint64_t)bmap_blocks * bs);
+        if (!map) return -ENOMEM;
+        memset(map + cap_bytes, 0, (uint64_t)bmap_blocks * bs);
+        fs->block_bitmap = map;
+    }
+
+    SuperBlock saved = *sb;
+    Extent* e = &sb->ext[sb->ext_count++];
+    memset(e, 0, sizeof(*e));
+    e->first_block = old_total;
+    e->meta_blocks = meta;
+    if (bmap_blocks) {
+        e->bmap_byte = cap_bytes;
+        e->bmap_block = old_total;
+        e->bmap_blocks = bmap_blocks;
+    }
+    e->inode_first = old_inodes;
+    e->inode_count = add_inodes;
+    e->inode_table = old_total + bmap_blocks;
+    sb->total_blocks = new_total;
+    sb->inode_count += add_inodes;
+    sb->free_inodes += add_inodes;
+    sb->free_blocks += add_blocks - meta;
+    sb->bloom_state = 0;  // фильтр пересчитывается под новое число inode
+    for (uint32_t i = old_total; i < old_total + meta; i++)
+        fs->block_bitmap[i/8] |= 1 << (i%8);
+
+    rc = bitmap_io(fs, old_total / 8, (new_total + 7) / 8 - old_total / 8, 1);
+    if (rc == 0) {
+        STAT_INC(&fs->stats, meta.saves);
+        rc = asfs_dev_write(&fs->dev, sb, sizeof(SuperBlock), 0);
+    }
+    if (rc == 0) rc = asfs_dev_sync(&fs->dev);
+    if (rc < 0) {
+        *sb = saved;
+        return rc;
+    }
+    fs->total_blocks = new_total;
+    asfs_bloom_free(&fs->bloom);  // рассчитан на прежнее число inode
+    return 0;
+}
+
+int ix_resize(ix_fs* fs, uint64_t new_size) {
+    uint64_t t = op_begin(fs);
+    return op_end(fs, ASFS_OP_EDIT, t, do_resize(fs, new_size));
+}
+
+// ---- перевод образа v1 ----
+// Файлы переносятся в свежий образ v2 того же размера через do_write
+
+// Данные файла v1 в buf (12 блоков); *data - откуда их брать
+static int v1_file_data(asfs_dev* dev, const SuperBlock* sb, uint32_t total_blocks,
+                        const InodeV1* node, uint8_t* buf, const void** data) {
+    uint32_t bs = sb->block_size;
+    if (node->size <= V1_MICRODATA_SIZE) {
+        *data = node->micro_data;
+        return 0;
+    }
+    uint32_t count = (node->size + bs - 1) / bs;
+    if (count > 12) return -EIO;
+    for (uint32_t b = 0; b < count; b++) {
+        if (node->blocks[b] == 0 || node->blocks[b] >= total_blocks) return -EIO;
+        size_t len = node->size - (size_t)b * bs < bs ? node->size - (size_t)b * bs : bs;
+        int rc = asfs_dev_read(dev, buf + (size_t)b * bs, len, (uint64_t)node->blocks[b] * bs);
+        if (rc < 0) return rc;
+    }
+    *data = buf;
+    return 0;
+}
+
+// *uninlined - файлы, что в v1 жили в inode, а в v2 не влезли в MICRODATA_SIZE
+static int convert_files(asfs_dev* dev, const SuperBlock* sb, uint32_t total_blocks,
+                         ix_fs* fs, uint32_t* uninlined) {
+    uint32_t bs = sb->block_size;
+    uint32_t base = sb->ext_count ? sb->ext[0].inode_first : sb->inode_count;
+    uint8_t* chunk = malloc((size_t)SCAN_CHUNK * V1_INODE_SIZE);
+    uint8_t* buf = malloc(12 * (size_t)bs);
+    int rc = chunk && buf ? 0 : -ENOMEM;
+    int files = 0;
+
+    uint32_t count;
+    for (uint32_t first = 1; first < sb->inode_count && rc == 0; first += count) {
+        uint32_t table_first;
+        uint64_t table = inode_table_of(sb, first, &table_first, &count);
+        count -= first - table_first;
+        if (count > SCAN_CHUNK) count = SCAN_CHUNK;
+        rc = asfs_dev_read(dev, chunk, (size_t)count * V1_INODE_SIZE,
+                           table * bs + (uint64_t)(first - table_first) * V1_INODE_SIZE);
+        for (uint32_t i = 0; i < count && rc == 0; i++) {
+            uint32_t num = first + i;
+            // Незанулённые группы таблицы v1 содержат мусор
+            uint32_t group = sb->itable_group_blocks ?
+                (uint64_t)num * V1_INODE_SIZE / bs / sb->itable_group_blocks : 0;
+            if (sb->itable_group_blocks && num < base &&
+                !(sb->itable_init[group/8] & (1 << (group%8))))
+                continue;
+            InodeV1* node = (InodeV1*)(chunk + (size_t)i * V1_INODE_SIZE);
+            if (node->name[0] == '\0') continue;
+            node->name[NAME_MAX_LEN-1] = '\0';
+            const void* data;
+            rc = v1_file_data(dev, sb, total_blocks, node, buf, &data);
+            if (rc == 0)
+                rc = do_write(fs, node->name, data, node->size, node->flags,
+                              node->created, node->modified);
+            if (rc < 0) break;
+            files++;
+            if (node->size > MICRODATA_SIZE && node->size <= V1_MICRODATA_SIZE) (*uninlined)++;
+        }
+    }
+    free(chunk);
+    free(buf);
+    return rc < 0 ? rc : files;
+}
+
+int ix_convert(const char* src, const char* dst, uint32_t* uninlined) {
+    uint32_t moved = 0;
+    asfs_dev dev;
+    SuperBlock sb;
+    uint64_t dev_size = 0;
+    int rc = asfs_dev_open(&dev, src, O_RDONLY);
+    if (rc < 0) return rc;
+    rc = asfs_dev_read(&dev, &sb, sizeof(SuperBlock), 0);
+    if (rc == 0 && sb.magic == MAGIC_NUMBER)
+        rc = -EALREADY;
+    else if (rc == 0 && (sb.magic != MAGIC_V1 || sb.block_size == 0 ||
+                         sb.itable_groups > ITABLE_MAP_BYTES * 8 || sb.ext_count > MAX_EXTENTS))
+        rc = -EINVAL;
+    else if (rc == 0 && sb.stripe.magic)
+        rc = -EOPNOTSUPP;  // набор с чередованием переводить по частям нельзя
+    if (rc == 0) rc = asfs_dev_size(&dev, &dev_size);
+    if (rc < 0) {
+        asfs_dev_close(&dev);
+        return rc;
+    }
+
+    uint32_t total_blocks = sb.total_blocks ? sb.total_blocks : dev_size / sb.block_size;
+    ix_fs* fs = NULL;
+    rc = ix_format(dst, (uint64_t)total_blocks * sb.block_size, sb.l1_cache_size);
+    if (rc == 0) rc = ix_mount(dst, &fs);
+    if (rc == 0) {
+        rc = convert_files(&dev, &sb, total_blocks, fs, &moved);
+        int urc = ix_unmount(fs);
+        if (rc >= 0 && urc < 0) rc = urc;
+    }
+    asfs_dev_close(&dev);
+    // Недоделанный образ не оставляем, исходный не тронут
+    if (rc < 0) unlink(dst);
+    if (uninlined) *uninlined = rc < 0 ? 0 : moved;
+    return rc;
+}
+
+int ix_cache_resize(ix_fs* fs, uint32_t capacity) {
+    if (capacity == 0) return -EINVAL;
+    int rc = lru_cache_resize(fs->l1_cache, capacity);
+    if (rc == 0) fs->sb.l1_cache_size = capacity;  // уйдёт на диск с ix_sync
+    return rc;
+}
+
+int ix_cache_trim(ix_fs* fs, uint32_t max) {
+    return lru_trim(fs->l1_cache, max);
+}
+
+void ix_set_discard(ix_fs* fs, int on) {
+    fs->discard = on;
+}
+
+int ix_capture_enable(ix_fs* fs, const char* path) {
+    workload_log* log = NULL;
+    int rc = path ? workload_open(path, &log) : 0;
+    if (rc < 0) return rc;
+    rc = workload_close(fs->capture);
+    fs->capture = log;
+    return rc;
+}
+
+int ix_set_direct(ix_fs* fs, int on) {
+    return asfs_dev_set_direct(&fs->dev, on, fs->sb.block_size);
+}
+
+int ix_trim(ix_fs* fs, uint64_t* bytes) {
+    return asfs_dev_trim(&fs->dev, fs->block_bitmap, fs->data_start, fs->total_blocks,
+                         fs->sb.block_size, bytes);
+}
+
+int ix_get_stats(ix_fs* fs, asfs_stats* out) {
+    *out = fs->stats;
+    return 0;
+}
+
+void ix_reset_stats(ix_fs* fs) {
+    memset(&fs->stats, 0, sizeof(fs->stats));
+    asfs_latency_reset(&fs->lat);
+}
+
+asfs_latency* ix_get_latency(ix_fs* fs) {
+    return &fs->lat;
+}
@@ -0,0 +1,109 @@
+#ifndef LIBINODEX_H
+#define LIBINODEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include "asfs_stats.h"
+
+// Встраиваемый движок Inode-X (файловая система с LRU L1 кэшем).
+// Все функции возвращают 0 (или неотрицательный результат) при успехе
+// и -errno при ошибке.
+
+#define IX_API_VERSION 1
+#define IX_NAME_MAX 224
+#define IX_DEFAULT_PATH "disk.img"
+
+typedef struct ix_fs ix_fs;
+
+typedef struct {
+    uint32_t inode;
+    uint32_t size;
+    uint32_t flags;
+    time_t created;
+    time_t modified;
+    char name[IX_NAME_MAX];
+} ix_stat;
+
+typedef struct {
+    uint32_t block_size;
+    uint32_t inode_count;
+    uint32_t free_inodes;
+    uint32_t free_blocks;
+    uint32_t l1_cache_size;
+    uint32_t cached_inodes;
+    uint32_t itable_groups;   // группы таблицы inode (0 - образ без ленивой инициализации)
+    uint32_t itable_uninit;   // из них ещё не занулено
+    uint32_t total_blocks;
+} ix_fsinfo;
+
+// Возврат ненулевого значения из колбэка прекращает обход
+typedef int (*ix_list_cb)(const ix_stat* st, void* arg);
+
+const char* ix_strerror(int err);
+
+int ix_format(const char* path, uint64_t size, uint32_t l1_cache_size);
+// Одна ФС на нескольких образах (RAID-0): path - первый, members - ещё count штук,
+// size делится между ними полосами по stripe_unit байт (кратно 4096).
+// Набор записывается в суперблок, дальше ix_mount(path) открывает его целиком
+int ix_format_striped(const char* path, const char* const* members, int count,
+                      uint32_t stripe_unit, uint64_t size, uint32_t l1_cache_size);
+// ix_sync (и ix_unmount) сохраняет горячий набор кэша L1, ix_mount прогревает
+// кэш по нему - после перезапуска первые обращения не идут на диск
+int ix_mount(const char* path, ix_fs** out);
+int ix_sync(ix_fs* fs);
+int ix_unmount(ix_fs* fs);
+int ix_statfs(ix_fs* fs, ix_fsinfo* info);
+// Офлайн-перевод образа со старыми inode по 512 байт (v1) в текущий формат:
+// в dst (другой файл) форматируется образ того же размера, и в него переносятся
+// файлы с флагами и временами. src не меняется, при ошибке dst удаляется.
+// Номера inode и горячий набор L1 не сохраняются, наборы с чередованием не
+// переводятся (-EOPNOTSUPP). Возвращает число перенесённых файлов; в *uninlined
+// (можно NULL) - сколько из них (от 49 до 256 байт) жили в inode v1, а теперь
+// занимают блок данных. ix_mount на образе v1 отвечает -EPROTO
+int ix_convert(const char* src, const char* dst, uint32_t* uninlined);
+// Зануляет до max_groups ещё не готовых групп таблицы inode (фоновая
+// дозагрузка после быстрого форматирования). Возвращает число занулённых групп
+int ix_itable_init(ix_fs* fs, uint32_t max_groups);
+// Онлайн-рост до new_size байт: образ удлиняется, добавляются блоки и inode
+// (1 на 4 блока). Старые метаданные не переписываются. Не больше 8 раз
+int ix_resize(ix_fs* fs, uint64_t new_size);
+// Новая ёмкость кэша L1 без остановки: индекс перестраивается по нескольку
+// корзин за обращение, лишние узлы вытесняются по мере вставок и в начале
+// каждой операции. Сохраняется в суперблоке при ix_sync
+int ix_cache_resize(ix_fs* fs, uint32_t capacity);
+// Вытесняет до max узлов сверх ёмкости сразу; возвращает число вытесненных
+// (0 - кэш уже в пределах ёмкости или сверх неё только закреплённые)
+int ix_cache_trim(ix_fs* fs, uint32_t max);
+// Режим discard: блоки удалённых файлов сразу отдаются хранилищу (дырки
+// в образе), склеенными диапазонами в конце операции. По умолчанию выключен
+void ix_set_discard(ix_fs* fs, int on);
+// Захват нагрузки (workload.h): write, read, lookup, delete, list с именами,
+// размерами и задержками дописываются в path; NULL - выключить
+int ix_capture_enable(ix_fs* fs, const char* path);
+// O_DIRECT: данные идут мимо page cache через выровненные буферы (hugepage).
+// -EINVAL, если ФС образа не умеет O_DIRECT или блок ФС не кратен сектору
+int ix_set_direct(ix_fs* fs, int on);
+// Offline trim: дырявит все свободные блоки данных, *bytes - сколько отдано
+int ix_trim(ix_fs* fs, uint64_t* bytes);
+int ix_get_stats(ix_fs* fs, asfs_stats* out);
+void ix_reset_stats(ix_fs* fs);
+// Гистограммы задержек и кольцо трейса; живут, пока fs смонтирована
+asfs_latency* ix_get_latency(ix_fs* fs);
+
+int ix_write(ix_fs* fs, const char* name, const void* data, size_t size);
+int ix_delete(ix_fs* fs, const char* name);
+int ix_lookup(ix_fs* fs, const char* name, ix_stat* st);
+ssize_t ix_read(ix_fs* fs, const char* name, void* buf, size_t count,
+                uint64_t offset);
+int ix_list(ix_fs* fs, ix_list_cb cb, void* arg);
+// Потоковый экспорт файлов с именем на prefix (NULL - все) в порядке
+// расположения данных. Колбэк получает куски данных по возрастанию offset
+// (пустой файл - один вызов с len = 0); ненулевой возврат прерывает экспорт
+typedef int (*ix_export_cb)(const ix_stat* st, const void* data, size_t len,
+                            uint64_t offset, void* arg);
+int ix_export(ix_fs* fs, const char* prefix, ix_export_cb cb, void* arg);
+int ix_pin(ix_fs* fs, const char* name, uint32_t* inode_out);
+
+#endif
@@ -0,0 +1,143 @@
+#include <string.h>
+#include <errno.h>
+#include "tar.h"
+
+#define TAR_BLOCK 512
+
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} TarHeader;
+
+static const uint8_t zeros[TAR_BLOCK];
+
+void tar_init(tar_writer* w, FILE* out) {
+    memset(w, 0, sizeof(*w));
+    w->out = out;
+}
+
+static int put(tar_writer* w, const void* data, size_t len) {
+    if (len && fwrite(data, 1, len, w->out) != len) return -EIO;
+    w->bytes += len;
+    return 0;
+}
+
+static int pad(tar_writer* w, uint64_t len) {
+    size_t tail = len % TAR_BLOCK;
+    return tail ? put(w, zeros, TAR_BLOCK - tail) : 0;
+}
+
+// Восьмеричное число во всю ширину поля минус завершающий ноль
+static void octal(char* field, size_t width, uint64_t value) {
+    for (size_t i = width - 1; i-- > 0; value >>= 3)
+        field[i] = '0' + (value & 7);
+    field[width - 1] = '\0';
+}
+
+// Поля имён не обязаны завершаться нулём
+static void field(char* dst, size_t width, const char* src) {
+    size_t len = strlen(src);
+    memcpy(dst, src, len < width ? len : width);
+}
+
+static int put_header(tar_writer* w, const char* name, const char* prefix,
+                      char type, uint64_t size, time_t mtime) {
+    TarHeader h;
+    memset(&h, 0, sizeof(h));
+    field(h.name, sizeof(h.name), name);
+    if (prefix) field(h.prefix, sizeof(h.prefix), prefix);
+    octal(h.mode, sizeof(h.mode), 0644);
+    octal(h.uid, sizeof(h.uid), 0);
+    octal(h.gid, sizeof(h.gid), 0);
+    octal(h.size, sizeof(h.size), size);
+    octal(h.mtime, sizeof(h.mtime), mtime > 0 ? (uint64_t)mtime : 0);
+    h.typeflag = type;
+    memcpy(h.magic, "ustar", 6);
+    memcpy(h.version, "00", 2);
+
+    memset(h.chksum, ' ', sizeof(h.chksum));
+    unsigned sum = 0;
+    for (size_t i = 0; i < sizeof(h); i++) sum += ((uint8_t*)&h)[i];
+    snprintf(h.chksum, sizeof(h.chksum), "%06o", sum);
+    return put(w, &h, sizeof(h));
+}
+
+// Имя, не влезающее в name/prefix ustar, уходит отдельной pax-записью path=
+static int put_pax_path(tar_writer* w, const char* name) {
+    char rec[1024];
+    size_t body = strlen(name) + sizeof(" path=\n") - 1;
+    // Длина записи включает собственные цифры
+    size_t total = body + 1;
+    while (total != body + (size_t)snprintf(NULL, 0, "%zu", total))
+        total = body + snprintf(NULL, 0, "%zu", total);
+    int n = snprintf(rec, sizeof(rec), "%zu path=%s\n", total, name);
+    if (n < 0 || (size_t)n >= sizeof(rec)) return -ENAMETOOLONG;
+
+    int rc = put_header(w, "././@PaxHeader", NULL, 'x', n, 0);
+    if (rc == 0) rc = put(w, rec, n);
+    if (rc == 0) rc = pad(w, n);
+    return rc;
+}
+
+int tar_begin_file(tar_writer* w, const char* name, uint64_t size, time_t mtime) {
+    char prefix[156] = "";
+    const char* base = name;
+    size_t len = strlen(name);
+    int rc = 0;
+
+    if (len > 100) {
+        // Ищем '/', чтобы разбить на prefix (<=155) и name (<=100)
+        const char* cut = NULL;
+        for (const char* p = name; *p; p++)
+            if (*p == '/' && p - name <= 155 && len - (p - name) - 1 <= 100 && p != name)
+                cut = p;
+        if (cut) {
+            memcpy(prefix, name, cut - name);
+            base = cut + 1;
+        } else {
+            rc = put_pax_path(w, name);
+        }
+    }
+    if (rc == 0) rc = put_header(w, base, prefix[0] ? prefix : NULL, '0', size, mtime);
+    w->size = w->left = size;
+    w->files++;
+    return rc;
+}
+
+int tar_write(tar_writer* w, const void* data, size_t len) {
+    if (len > w->left) return -EINVAL;
+    w->left -= len;
+    return put(w, data, len);
+}
+
+int tar_end_file(tar_writer* w) {
+    int rc = 0;
+    while (w->left && rc == 0) {
+        size_t n = w->left < TAR_BLOCK ? w->left : TAR_BLOCK;
+        rc = tar_write(w, zeros, n);
+    }
+    if (rc == 0) rc = pad(w, w->size);
+    return rc;
+}
+
+int tar_finish(tar_writer* w) {
+    int rc = put(w, zeros, TAR_BLOCK);
+    if (rc == 0) rc = put(w, zeros, TAR_BLOCK);
+    if (rc == 0 && fflush(w->out) != 0) rc = -errno;
+    return rc;
+}
@@ -0,0 +1,28 @@
+#ifndef ASFS_TAR_H
+#define ASFS_TAR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// Потоковая запись архива ustar (длинные имена - через pax-заголовок),
+// общая для экспорта asfs и Inode-X. Функции возвращают 0 или -errno.
+
+typedef struct {
+    FILE* out;
+    uint64_t left;       // байт данных текущего файла ещё не записано
+    uint64_t size;       // размер текущего файла
+    uint64_t files;
+    uint64_t bytes;      // всего байт архива
+} tar_writer;
+
+void tar_init(tar_writer* w, FILE* out);
+int tar_begin_file(tar_writer* w, const char* name, uint64_t size, time_t mtime);
+int tar_write(tar_writer* w, const void* data, size_t len);
+// Закрывает текущий файл: добивает нулями недописанное и выравнивание
+int tar_end_file(tar_writer* w);
+// Два нулевых блока в конце архива
+int tar_finish(tar_writer* w);
+
+#endif
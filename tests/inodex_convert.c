@@ -0,0 +1,139 @@
+// Регрессия: перевод образа v1 (inode по 512 байт) в v2. Образ v1 собирается
+// вручную, поэтому libinodex.c включается целиком - нужны его внутренние
+// структуры. Файлы: данные в inode (до 48 байт и от 49 до 256 - второй
+// выходит в блок данных), в блоках, и с длинным именем (хвост в таблице имён).
+// После перевода содержимое, размеры, флаги и времена совпадают, а -C
+// сообщает число файлов, вышедших из inode
+// Сборка и запуск - в README, раздел "Сборка"
+#include "libinodex.c"
+
+#define IMAGE_BLOCKS 1024
+#define V1_INODES 64
+#define V1_TABLE 2
+#define V1_DATA 16
+
+typedef struct {
+    const char* name;
+    uint32_t size;
+    uint32_t flags;
+    int uninlined;
+} V1File;
+
+static char long_name[NAME_MAX_LEN];
+static char src[] = "/tmp/ix_v1_XXXXXX";
+static char dst[sizeof(src) + 4];
+
+static int fail(const char* what, int rc) {
+    fprintf(stderr, "%s: %s\n", what, ix_strerror(rc));
+    return 1;
+}
+
+static uint8_t content(const V1File* f, uint32_t k) {
+    return (uint8_t)(k * 7 + f->size);
+}
+
+static int write_v1(const V1File* files, int n) {
+    SuperBlock sb = {
+        .magic = MAGIC_V1,
+        .block_size = DEFAULT_BLOCK_SIZE,
+        .inode_count = V1_INODES,
+        .inode_table = V1_TABLE,
+        .l1_cache_size = 64,
+    };
+    asfs_dev dev;
+    int rc = asfs_dev_open(&dev, src, O_RDWR);
+    if (rc < 0) return rc;
+    rc = asfs_dev_write(&dev, &sb, sizeof(sb), 0);
+    uint32_t next_block = V1_DATA;
+    static uint8_t buf[12 * DEFAULT_BLOCK_SIZE];
+    for (int i = 0; i < n && rc == 0; i++) {
+        const V1File* f = &files[i];
+        InodeV1 node;
+        memset(&node, 0, sizeof(node));
+        strncpy(node.name, f->name, NAME_MAX_LEN - 1);
+        node.size = f->size;
+        node.flags = f->flags;
+        node.created = 1000000 + i;
+        node.modified = 2000000 + i;
+        for (uint32_t k = 0; k < f->size; k++) buf[k] = content(f, k);
+        if (f->size <= V1_MICRODATA_SIZE) {
+            memcpy(node.micro_data, buf, f->size);
+        } else {
+            uint32_t count = (f->size + DEFAULT_BLOCK_SIZE - 1) / DEFAULT_BLOCK_SIZE;
+            for (uint32_t b = 0; b < count; b++) node.blocks[b] = next_block + b;
+            rc = asfs_dev_write(&dev, buf, f->size, (uint64_t)next_block * DEFAULT_BLOCK_SIZE);
+            next_block += count;
+        }
+        if (rc == 0)
+            rc = asfs_dev_write(&dev, &node, sizeof(node),
+                                (uint64_t)V1_TABLE * DEFAULT_BLOCK_SIZE +
+                                (uint64_t)(i + 1) * V1_INODE_SIZE);
+    }
+    asfs_dev_close(&dev);
+    return rc;
+}
+
+static int check_file(ix_fs* fs, const V1File* f, int i) {
+    static uint8_t buf[12 * DEFAULT_BLOCK_SIZE];
+    ix_stat st;
+    int rc = ix_lookup(fs, f->name, &st);
+    if (rc < 0) return fail(f->name, rc);
+    if (st.size != f->size || st.flags != f->flags || st.created != 1000000 + i ||
+        st.modified != 2000000 + i) {
+        fprintf(stderr, "%s: size %u flags %u times %lld/%lld\n", f->name, st.size, st.flags,
+                (long long)st.created, (long long)st.modified);
+        return 1;
+    }
+    ssize_t n = ix_read(fs, f->name, buf, sizeof(buf), 0);
+    if (n != (ssize_t)f->size) return fail(f->name, n < 0 ? (int)n : -EIO);
+    for (uint32_t k = 0; k < f->size; k++) {
+        if (buf[k] != content(f, k)) {
+            fprintf(stderr, "%s: byte %u differs\n", f->name, k);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    memset(long_name, 'n', 150);
+    memcpy(long_name, "long/", 5);
+    const V1File files[] = {
+        { "inline48", MICRODATA_SIZE, 0, 0 },
+        { "mid200", 200, 1, 1 },
+        { long_name, 100, 0, 1 },
+        { "full256", V1_MICRODATA_SIZE, 0, 1 },
+        { "blocks", 5000, 0, 0 },
+    };
+    int n = sizeof(files) / sizeof(files[0]);
+    int expect_uninlined = 0;
+    for (int i = 0; i < n; i++) expect_uninlined += files[i].uninlined;
+
+    int fd = mkstemp(src);
+    if (fd < 0 || ftruncate(fd, (off_t)IMAGE_BLOCKS * DEFAULT_BLOCK_SIZE) < 0)
+        return fail("image", -errno);
+    close(fd);
+    snprintf(dst, sizeof(dst), "%s.v2", src);
+
+    uint32_t uninlined = 0;
+    int rc = write_v1(files, n);
+    if (rc == 0) rc = ix_convert(src, dst, &uninlined);
+    int failed = 0;
+    if (rc < 0) {
+        failed = fail("convert", rc);
+    } else if (rc != n || uninlined != (uint32_t)expect_uninlined) {
+        fprintf(stderr, "converted %d files (want %d), uninlined %u (want %d)\n", rc, n,
+                uninlined, expect_uninlined);
+        failed = 1;
+    } else {
+        ix_fs* fs;
+        rc = ix_mount(dst, &fs);
+        if (rc < 0) failed = fail("mount", rc);
+        for (int i = 0; i < n && !failed; i++) failed = check_file(fs, &files[i], i);
+        if (rc == 0) ix_unmount(fs);
+    }
+    unlink(src);
+    unlink(dst);
+    printf("%s\n", failed ? "FAIL" : "OK");
+    return failed;
+}
@@ -0,0 +1,143 @@
+// Регрессия: ответы демона при медленном клиенте. Клиент шлёт две пачки
+// конвейерных read по 40 КБ и читает ответы понемногу - сервер отправляет
+// частично, и следующие ответы собираются в буфере со сдвинутым началом.
+// Каждый ответ должен прийти целым и по порядку.
+// Сборка и запуск - в README, раздел "Сборка"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "libasfs.h"
+#include "asfs_remote.h"
+
+#define FILE_SIZE 40000
+#define BATCH 300
+
+static char image[] = "/tmp/asfs_bp_XXXXXX";
+static char sock_path[sizeof(image) + 8];
+static volatile sig_atomic_t stop;
+
+static void on_term(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static int fail(const char* what, int rc) {
+    fprintf(stderr, "%s: %s\n", what, asfs_strerror(rc));
+    return 1;
+}
+
+static int serve(void) {
+    struct sigaction sa = { .sa_handler = on_term };
+    sigaction(SIGTERM, &sa, NULL);
+    asfs_fs* fs = NULL;
+    int rc = asfs_open(image, ASFS_RDWR, &fs);
+    if (rc == 0) rc = asfs_serve(fs, sock_path, &stop);
+    if (fs) asfs_close(fs);
+    return rc < 0;
+}
+
+static int send_all(int fd, const void* p, size_t n) {
+    while (n) {
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if (k < 0) return -errno;
+        p = (const uint8_t*)p + k;
+        n -= k;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void* p, size_t n) {
+    while (n) {
+        ssize_t k = recv(fd, p, n, 0);
+        if (k <= 0) return k < 0 ? -errno : -ECONNRESET;
+        p = (uint8_t*)p + k;
+        n -= k;
+    }
+    return 0;
+}
+
+static int client(void) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, sock_path);
+    int fd = -1;
+    for (int i = 0; i < 100 && fd < 0; i++) {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) break;
+        close(fd);
+        fd = -1;
+        usleep(20000);
+    }
+    if (fd < 0) return fail("connect", -errno);
+
+    const char name[] = "big";
+    uint8_t req[sizeof(asfs_wire_req) + sizeof(name) - 1];
+    asfs_wire_req r = { .op = ASFS_REQ_READ, .name_len = sizeof(name) - 1, .len = FILE_SIZE };
+    memcpy(req, &r, sizeof(r));
+    memcpy(req + sizeof(r), name, sizeof(name) - 1);
+    uint8_t* batch = malloc(sizeof(req) * BATCH);
+    uint8_t* data = malloc(FILE_SIZE);
+    if (!batch || !data) return fail("malloc", -ENOMEM);
+    for (int i = 0; i < BATCH; i++) memcpy(batch + i * sizeof(req), req, sizeof(req));
+
+    // Вторая пачка приходит, когда сервер уже упёрся в непрочитанные ответы
+    int rc = send_all(fd, batch, sizeof(req) * BATCH);
+    usleep(300000);
+    if (rc == 0) rc = send_all(fd, batch, sizeof(req) * BATCH);
+    for (int i = 0; i < 2 * BATCH && rc == 0; i++) {
+        asfs_wire_reply rep;
+        rc = recv_all(fd, &rep, sizeof(rep));
+        if (rc == 0 && (rep.result != FILE_SIZE || rep.len != FILE_SIZE)) {
+            fprintf(stderr, "reply %d: result %d len %u\n", i, rep.result, rep.len);
+            rc = -EPROTO;
+        }
+        if (rc == 0) rc = recv_all(fd, data, FILE_SIZE);
+        for (int k = 0; k < FILE_SIZE && rc == 0; k++)
+            if (data[k] != (uint8_t)k) rc = -EPROTO;
+        if (i % 50 == 0) usleep(20000);
+    }
+    close(fd);
+    free(batch);
+    free(data);
+    return rc < 0 ? fail("read replies", rc) : 0;
+}
+
+int main(void) {
+    int fd = mkstemp(image);
+    if (fd < 0 || ftruncate(fd, 64 << 20) < 0) return fail("image", -errno);
+    close(fd);
+    snprintf(sock_path, sizeof(sock_path), "%s.sock", image);
+
+    uint8_t* content = malloc(FILE_SIZE);
+    asfs_fs* fs;
+    int rc = content ? asfs_format(image, 4096, 0) : -ENOMEM;
+    if (rc == 0) rc = asfs_open(image, ASFS_RDWR, &fs);
+    if (rc == 0) {
+        for (int k = 0; k < FILE_SIZE; k++) content[k] = k;
+        rc = asfs_create(fs, "big", content, FILE_SIZE, NULL);
+        int crc = asfs_close(fs);
+        if (rc == 0) rc = crc;
+    }
+    free(content);
+    if (rc < 0) {
+        unlink(image);
+        return fail("prepare", rc);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) _exit(serve());
+    int failed = pid < 0 ? fail("fork", -errno) : client();
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    unlink(image);
+    unlink(sock_path);
+    printf("%s\n", failed ? "FAIL" : "OK");
+    return failed;
+}
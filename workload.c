@@ -0,0 +1,618 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "asfs_stats.h"
+#include "workload.h"
+
+#define LOG_BUF (64 << 10)
+#define LATE_NS 1000000ull     // открытый цикл: опоздание больше 1 мс считается
+#define MAX_THREADS 256
+
+const char* const workload_op_names[WORKLOAD_MAX] = {
+    [WORKLOAD_CREATE] = "create",
+    [WORKLOAD_EDIT] = "edit",
+    [WORKLOAD_APPEND] = "append",
+    [WORKLOAD_WRITE] = "write",
+    [WORKLOAD_TRUNCATE] = "truncate",
+    [WORKLOAD_DELETE] = "delete",
+    [WORKLOAD_READ] = "read",
+    [WORKLOAD_LOOKUP] = "lookup",
+    [WORKLOAD_LIST] = "list",
+    [WORKLOAD_SNAP_CREATE] = "snapshot",
+    [WORKLOAD_SNAP_RESTORE] = "restore",
+    [WORKLOAD_SNAP_DELETE] = "rmsnap",
+};
+
+// ---- захват ----
+
+struct workload_log {
+    int fd;
+    uint8_t* buf;
+    size_t len;
+    int error;             // первая ошибка записи
+};
+
+uint64_t workload_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Заголовок пишется под flock: несколько процессов могут открыть новый файл разом
+static int log_header(int fd) {
+    if (flock(fd, LOCK_EX) < 0) return -errno;
+    struct stat st;
+    workload_header h;
+    int rc = fstat(fd, &st) < 0 ? -errno : 0;
+    if (rc == 0 && st.st_size == 0) {
+        h = (workload_header){ WORKLOAD_MAGIC, WORKLOAD_VERSION, sizeof(workload_rec) };
+        if (write(fd, &h, sizeof(h)) != sizeof(h)) rc = -EIO;
+    } else if (rc == 0) {
+        if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != WORKLOAD_MAGIC ||
+            h.version != WORKLOAD_VERSION || h.rec_size != sizeof(workload_rec))
+            rc = -EINVAL;  // чужой файл не дописываем
+    }
+    flock(fd, LOCK_UN);
+    return rc;
+}
+
+int workload_open(const char* path, workload_log** out) {
+    workload_log* log = calloc(1, sizeof(*log));
+    if (!log) return -ENOMEM;
+    log->buf = malloc(LOG_BUF);
+    log->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    int rc = !log->buf ? -ENOMEM : log->fd < 0 ? -errno : log_header(log->fd);
+    if (rc < 0) {
+        if (log->fd >= 0) close(log->fd);
+        free(log->buf);
+        free(log);
+        return rc;
+    }
+    *out = log;
+    return 0;
+}
+
+static void log_flush(workload_log* log) {
+    size_t done = 0;
+    while (done < log->len) {
+        ssize_t n = write(log->fd, log->buf + done, log->len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (!log->error) log->error = n < 0 ? -errno : -EIO;
+            break;
+        }
+        done += n;
+    }
+    log->len = 0;
+}
+
+void workload_record(workload_log* log, int op, uint64_t start_ns, const char* name,
+                     const char* name2, uint64_t size, uint64_t offset, int64_t result) {
+    if (!log) return;
+    workload_rec rec = {0};
+    size_t n1 = name ? strnlen(name, UINT8_MAX) : 0;
+    size_t n2 = name2 ? strnlen(name2, UINT8_MAX) : 0;
+    if (log->len + sizeof(rec) + n1 + n2 > LOG_BUF) log_flush(log);
+
+    uint64_t dur = workload_clock() - start_ns;
+    rec.ts_ns = start_ns;
+    rec.offset = offset;
+    rec.size = size > UINT32_MAX ? UINT32_MAX : size;
+    rec.duration_ns = dur > UINT32_MAX ? UINT32_MAX : dur;
+    rec.result = result < INT32_MIN ? INT32_MIN : result > INT32_MAX ? INT32_MAX : result;
+    rec.op = op;
+    rec.name_len = n1;
+    rec.name2_len = n2;
+    memcpy(log->buf + log->len, &rec, sizeof(rec));
+    if (n1) memcpy(log->buf + log->len + sizeof(rec), name, n1);
+    if (n2) memcpy(log->buf + log->len + sizeof(rec) + n1, name2, n2);
+    log->len += sizeof(rec) + n1 + n2;
+}
+
+int workload_close(workload_log* log) {
+    if (!log) return 0;
+    log_flush(log);
+    int rc = log->error;
+    if (close(log->fd) < 0 && rc == 0) rc = -errno;
+    free(log->buf);
+    free(log);
+    return rc;
+}
+
+// ---- чтение записи ----
+
+typedef struct {
+    workload_rec rec;
+    const char* name;      // с нулём, в Trace.names
+    const char* name2;
+    uint32_t seq;          // место в файле - сортировка по времени устойчивая
+    uint32_t thread;
+} Op;
+
+typedef struct {
+    Op* ops;
+    uint32_t count;
+    char* names;
+} Trace;
+
+static void trace_free(Trace* t) {
+    free(t->ops);
+    free(t->names);
+}
+
+static int cmp_op(const void* a, const void* b) {
+    const Op* x = a;
+    const Op* y = b;
+    if (x->rec.ts_ns != y->rec.ts_ns) return x->rec.ts_ns < y->rec.ts_ns ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Процессы сбрасывают буферы целиком, так что в файле записи идут кусками не по
+// времени - после загрузки они сортируются
+static int trace_load(const char* path, Trace* t) {
+    memset(t, 0, sizeof(*t));
+    FILE* f = fopen(path, "rb");
+    if (!f) return -errno;
+    uint8_t* data = NULL;
+    size_t len = 0, cap = 0;
+    for (;;) {
+        if (len == cap) {
+            cap = cap ? cap * 2 : LOG_BUF;
+            uint8_t* p = realloc(data, cap);
+            if (!p) {
+                free(data);
+                fclose(f);
+                return -ENOMEM;
+            }
+            data = p;
+        }
+        size_t n = fread(data + len, 1, cap - len, f);
+        if (n == 0) break;
+        len += n;
+    }
+    int rc = ferror(f) ? -EIO : 0;
+    fclose(f);
+
+    workload_header h;
+    if (rc == 0 && len < sizeof(h)) rc = -EINVAL;
+    if (rc == 0) {
+        memcpy(&h, data, sizeof(h));
+        if (h.magic != WORKLOAD_MAGIC || h.version != WORKLOAD_VERSION ||
+            h.rec_size != sizeof(workload_rec))
+            rc = -EINVAL;
+    }
+    // Первый проход - сколько записей и места под имена; хвост недописанной
+    // записи (процесс упал посреди сброса) отбрасывается
+    size_t pos = sizeof(h), names = 0;
+    while (rc == 0 && pos + sizeof(workload_rec) <= len) {
+        workload_rec r;
+        memcpy(&r, data + pos, sizeof(r));
+        size_t next = pos + sizeof(r) + r.name_len + r.name2_len;
+        if (next > len) break;
+        if (r.op == 0 || r.op >= WORKLOAD_MAX) {
+            rc = -EINVAL;
+            break;
+        }
+        t->count++;
+        names += r.name_len + r.name2_len + 2;
+        pos = next;
+    }
+    if (rc == 0) {
+        t->ops = calloc(t->count ? t->count : 1, sizeof(Op));
+        t->names = malloc(names ? names : 1);
+        if (!t->ops || !t->names) rc = -ENOMEM;
+    }
+    pos = sizeof(h);
+    char* np = t->names;
+    for (uint32_t i = 0; rc == 0 && i < t->count; i++) {
+        Op* op = &t->ops[i];
+        memcpy(&op->rec, data + pos, sizeof(op->rec));
+        pos += sizeof(op->rec);
+        op->seq = i;
+        op->name = np;
+        memcpy(np, data + pos, op->rec.name_len);
+        np[op->rec.name_len] = '\0';
+        np += op->rec.name_len + 1;
+        pos += op->rec.name_len;
+        op->name2 = np;
+        memcpy(np, data + pos, op->rec.name2_len);
+        np[op->rec.name2_len] = '\0';
+        np += op->rec.name2_len + 1;
+        pos += op->rec.name2_len;
+    }
+    free(data);
+    if (rc < 0) {
+        trace_free(t);
+        return rc;
+    }
+    qsort(t->ops, t->count, sizeof(Op), cmp_op);
+    return 0;
+}
+
+int workload_print(const char* path, FILE* out) {
+    Trace t;
+    int rc = trace_load(path, &t);
+    if (rc < 0) return rc;
+    uint64_t ts0 = t.count ? t.ops[0].rec.ts_ns : 0;
+    fprintf(out, "%12s %-9s %10s %10s %8s %10s  %s\n",
+            "time ms", "op", "size", "offset", "result", "dur us", "name");
+    for (uint32_t i = 0; i < t.count; i++) {
+        const workload_rec* r = &t.ops[i].rec;
+        fprintf(out, "%12.3f %-9s %10u %10llu %8d %10.2f  %s%s%s\n",
+                (r->ts_ns - ts0) / 1e6, workload_op_names[r->op], r->size,
+                (unsigned long long)r->offset, r->result, r->duration_ns / 1000.0,
+                t.ops[i].name, r->name2_len ? " " : "", t.ops[i].name2);
+    }
+    fprintf(out, "%u operations\n", t.count);
+    trace_free(&t);
+    return 0;
+}
+
+// ---- воспроизведение ----
+
+// Открытая адресация без удаления: имён не больше, чем операций
+typedef struct {
+    const char** keys;
+    uint32_t* first;       // первая операция с этим именем
+    uint32_t* value;       // у снапшота - слот файла
+    uint32_t mask;
+    uint32_t count;
+} NameTable;
+
+static int names_init(NameTable* nt, uint32_t n) {
+    uint32_t size = 16;
+    while (size < 2ull * n) size *= 2;
+    nt->keys = calloc(size, sizeof(*nt->keys));
+    nt->first = malloc(size * sizeof(uint32_t));
+    nt->value = malloc(size * sizeof(uint32_t));
+    nt->mask = size - 1;
+    nt->count = 0;
+    return nt->keys && nt->first && nt->value ? 0 : -ENOMEM;
+}
+
+static void names_free(NameTable* nt) {
+    free(nt->keys);
+    free(nt->first);
+    free(nt->value);
+}
+
+// Слот имени; новое имя запоминает first = op
+static uint32_t names_get(NameTable* nt, const char* name, uint32_t op, int* created) {
+    uint64_t h = 14695981039346656037ull;  // FNV-1a
+    for (const char* p = name; *p; p++) h = (h ^ (uint8_t)*p) * 1099511628211ull;
+    uint32_t i = h & nt->mask;
+    while (nt->keys[i] && strcmp(nt->keys[i], name) != 0) i = (i + 1) & nt->mask;
+    *created = !nt->keys[i];
+    if (*created) {
+        nt->keys[i] = name;
+        nt->first[i] = op;
+        nt->value[i] = UINT32_MAX;
+        nt->count++;
+    }
+    return i;
+}
+
+typedef struct {
+    const bench_ops* ops;
+    const Op* list;
+    uint32_t* idx;         // номера операций этого потока
+    uint32_t n;
+    uint64_t t0;           // asfs_now_ns старта воспроизведения
+    uint64_t ts0;          // время первой записи
+    double speed;
+    pthread_mutex_t* serial;
+    const uint8_t* data;
+    uint8_t* buf;
+    size_t buf_size;
+    asfs_hist hist[WORKLOAD_MAX];
+    uint64_t errors[WORKLOAD_MAX];
+    uint64_t bytes;
+    uint64_t diverged;     // успех/ошибка не те, что при захвате
+    uint64_t unsupported;
+    uint64_t late;
+    uint64_t end_ns;
+} Worker;
+
+static void sleep_until(uint64_t ns) {
+    struct timespec ts = { ns / 1000000000ull, ns % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+// Возвращает результат движка; -ENOSYS - операции в таблице нет
+static int64_t replay_one(Worker* w, const Op* op) {
+    const bench_ops* o = w->ops;
+    const workload_rec* r = &op->rec;
+    size_t size = r->size;
+    uint64_t entries;
+    switch (r->op) {
+        case WORKLOAD_CREATE:
+            return o->create ? o->create(o->ctx, op->name, w->data, size) : -ENOSYS;
+        case WORKLOAD_EDIT:
+            return o->overwrite ? o->overwrite(o->ctx, op->name, w->data, size) : -ENOSYS;
+        case WORKLOAD_APPEND:
+            return o->append ? o->append(o->ctx, op->name, w->data, size) : -ENOSYS;
+        case WORKLOAD_WRITE:
+            return o->write ? o->write(o->ctx, op->name, w->data, size, r->offset) : -ENOSYS;
+        case WORKLOAD_TRUNCATE:
+            return o->truncate ? o->truncate(o->ctx, op->name, r->offset) : -ENOSYS;
+        case WORKLOAD_DELETE:
+            return o->remove ? o->remove(o->ctx, op->name) : -ENOSYS;
+        case WORKLOAD_READ:
+            if (size > w->buf_size) size = w->buf_size;
+            return o->read ? o->read(o->ctx, op->name, w->buf, size, r->offset) : -ENOSYS;
+        case WORKLOAD_LOOKUP:
+            return o->lookup ? o->lookup(o->ctx, op->name) : -ENOSYS;
+        case WORKLOAD_LIST:
+            return o->list ? o->list(o->ctx, &entries) : -ENOSYS;
+        case WORKLOAD_SNAP_CREATE:
+            return o->snapshot_create ? o->snapshot_create(o->ctx, op->name, op->name2)
+                                      : -ENOSYS;
+        case WORKLOAD_SNAP_RESTORE:
+            return o->snapshot_restore ? o->snapshot_restore(o->ctx, op->name, op->name2)
+                                       : -ENOSYS;
+        case WORKLOAD_SNAP_DELETE:
+            return o->snapshot_delete ? o->snapshot_delete(o->ctx, op->name) : -ENOSYS;
+    }
+    return -ENOSYS;
+}
+
+static void* worker_main(void* arg) {
+    Worker* w = arg;
+    for (uint32_t k = 0; k < w->n; k++) {
+        const Op* op = &w->list[w->idx[k]];
+        const workload_rec* r = &op->rec;
+        uint64_t start = asfs_now_ns();
+        // Открытый цикл: задержка считается от назначенного времени, так что
+        // очередь перед занятым движком в неё входит
+        if (w->speed > 0) {
+            uint64_t due = w->t0 + (uint64_t)((r->ts_ns - w->ts0) / w->speed);
+            if (start < due) sleep_until(due);
+            else if (start - due > LATE_NS) w->late++;
+            start = due;
+        }
+        if (w->serial) pthread_mutex_lock(w->serial);
+        int64_t rc = replay_one(w, op);
+        if (w->serial) pthread_mutex_unlock(w->serial);
+        if (rc == -ENOSYS) {
+            w->unsupported++;
+            continue;
+        }
+        asfs_hist_add(&w->hist[r->op], asfs_now_ns() - start);
+        if (rc < 0) w->errors[r->op]++;
+        if ((rc < 0) != (r->result < 0)) w->diverged++;
+        if (rc >= 0 && r->op <= WORKLOAD_WRITE) w->bytes += r->size;
+        if (rc > 0 && r->op == WORKLOAD_READ) w->bytes += rc;
+    }
+    w->end_ns = asfs_now_ns();
+    return NULL;
+}
+
+// Файл, с которым запись начинается не с create, а операция над ним удалась -
+// он был в образе до захвата. Размер - сколько из него прочитали или сколько
+// показал lookup
+static uint64_t prefill_size(const workload_rec* r) {
+    if (r->op == WORKLOAD_READ && r->result > 0) return r->offset + r->result;
+    if (r->op == WORKLOAD_LOOKUP) return r->size;
+    return 0;
+}
+
+static uint64_t op_data_size(const workload_rec* r) {
+    switch (r->op) {
+        case WORKLOAD_CREATE: case WORKLOAD_EDIT: case WORKLOAD_APPEND: case WORKLOAD_READ:
+            return r->size;
+        case WORKLOAD_WRITE:
+            return r->offset + r->size;
+        case WORKLOAD_TRUNCATE:
+            return r->offset;
+    }
+    return 0;
+}
+
+typedef struct {
+    uint64_t ops, errors;
+    asfs_hist hist;
+} OpTotal;
+
+static void emit_row(const workload_config* cfg, const char* name, const OpTotal* t,
+                     int first) {
+    double p50 = asfs_hist_percentile(&t->hist, 0.50) / 1000.0;
+    double p99 = asfs_hist_percentile(&t->hist, 0.99) / 1000.0;
+    double p999 = asfs_hist_percentile(&t->hist, 0.999) / 1000.0;
+    double max = t->hist.max_ns / 1000.0;
+    switch (cfg->format) {
+        case BENCH_CSV:
+            if (first) fprintf(cfg->out, "op,ops,errors,p50_us,p99_us,p999_us,max_us\n");
+            fprintf(cfg->out, "%s,%llu,%llu,%.2f,%.2f,%.2f,%.2f\n", name,
+                    (unsigned long long)t->ops, (unsigned long long)t->errors,
+                    p50, p99, p999, max);
+            break;
+        case BENCH_JSON:
+            fprintf(cfg->out, "%s\n    {\"op\": \"%s\", \"ops\": %llu, \"errors\": %llu, "
+                    "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f}",
+                    first ? "" : ",", name, (unsigned long long)t->ops,
+                    (unsigned long long)t->errors, p50, p99, p999, max);
+            break;
+        default:
+            if (first)
+                fprintf(cfg->out, "%-10s %10s %8s %10s %10s %10s %10s\n",
+                        "op", "ops", "errors", "p50 us", "p99 us", "p999 us", "max us");
+            fprintf(cfg->out, "%-10s %10llu %8llu %10.2f %10.2f %10.2f %10.2f\n", name,
+                    (unsigned long long)t->ops, (unsigned long long)t->errors,
+                    p50, p99, p999, max);
+            break;
+    }
+}
+
+static void report(const workload_config* cfg, Worker* w, uint32_t threads, uint64_t t0,
+                   uint32_t prefilled) {
+    OpTotal by_op[WORKLOAD_MAX], all;
+    memset(by_op, 0, sizeof(by_op));
+    memset(&all, 0, sizeof(all));
+    uint64_t bytes = 0, diverged = 0, unsupported = 0, late = 0, end = t0;
+    for (uint32_t k = 0; k < threads; k++) {
+        for (int op = 1; op < WORKLOAD_MAX; op++) {
+            asfs_hist_merge(&by_op[op].hist, &w[k].hist[op]);
+            by_op[op].errors += w[k].errors[op];
+        }
+        bytes += w[k].bytes;
+        diverged += w[k].diverged;
+        unsupported += w[k].unsupported;
+        late += w[k].late;
+        if (w[k].end_ns > end) end = w[k].end_ns;
+    }
+    for (int op = 1; op < WORKLOAD_MAX; op++) {
+        by_op[op].ops = by_op[op].hist.count;
+        asfs_hist_merge(&all.hist, &by_op[op].hist);
+        all.errors += by_op[op].errors;
+    }
+    all.ops = all.hist.count;
+    double seconds = (end - t0) / 1e9;
+    double ops_s = seconds > 0 ? all.ops / seconds : 0;
+    double mb_s = seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0;
+
+    if (cfg->format == BENCH_JSON)
+        fprintf(cfg->out, "{\"threads\": %u, \"speed\": %.3f, \"prefilled\": %u, "
+                "\"seconds\": %.6f, \"ops\": %llu, \"errors\": %llu, \"ops_per_sec\": %.2f, "
+                "\"mb_per_sec\": %.2f, \"diverged\": %llu, \"unsupported\": %llu, "
+                "\"late\": %llu,\n  \"by_op\": [",
+                threads, cfg->speed, prefilled, seconds, (unsigned long long)all.ops,
+                (unsigned long long)all.errors, ops_s, mb_s, (unsigned long long)diverged,
+                (unsigned long long)unsupported, (unsigned long long)late);
+    int first = 1;
+    for (int op = 1; op < WORKLOAD_MAX; op++) {
+        if (!by_op[op].ops) continue;
+        emit_row(cfg, workload_op_names[op], &by_op[op], first);
+        first = 0;
+    }
+    emit_row(cfg, "total", &all, first);
+    if (cfg->format == BENCH_JSON) {
+        fprintf(cfg->out, "\n  ]}\n");
+    } else if (cfg->format == BENCH_TEXT) {
+        fprintf(cfg->out, "%.3f s, %.2f ops/s, %.2f MB/s; %u threads, %s",
+                seconds, ops_s, mb_s, threads, cfg->speed > 0 ? "" : "max speed");
+        if (cfg->speed > 0) fprintf(cfg->out, "speed x%g, %llu late", cfg->speed,
+                                    (unsigned long long)late);
+        fprintf(cfg->out, "\n%u files prefilled, %llu ops diverged from the capture, "
+                "%llu unsupported\n", prefilled, (unsigned long long)diverged,
+                (unsigned long long)unsupported);
+    }
+}
+
+int workload_replay(const bench_ops* ops, const char* path, const workload_config* cfg) {
+    Trace t;
+    int rc = trace_load(path, &t);
+    if (rc < 0) return rc;
+    uint32_t threads = cfg->threads ? cfg->threads : 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+    // Раскладка по потокам: файл закреплён за потоком по порядку появления
+    // (files.value - его номер), снапшот - за потоком своего файла (snaps.value -
+    // слот файла)
+    NameTable files = {0}, snaps = {0};
+    rc = names_init(&files, t.count);
+    if (rc == 0) rc = names_init(&snaps, t.count);
+    uint64_t max_data = 1, max_read = 1;
+    for (uint32_t i = 0; rc == 0 && i < t.count; i++) {
+        Op* op = &t.ops[i];
+        int fresh;
+        uint32_t slot = UINT32_MAX;
+        if (op->rec.op == WORKLOAD_SNAP_DELETE) {
+            uint32_t s = names_get(&snaps, op->name, i, &fresh);
+            slot = snaps.value[s];
+        } else if (op->rec.op != WORKLOAD_LIST) {
+            slot = names_get(&files, op->name, i, &fresh);
+            if (fresh) files.value[slot] = files.count - 1;
+            if (op->rec.op == WORKLOAD_SNAP_CREATE || op->rec.op == WORKLOAD_SNAP_RESTORE) {
+                uint32_t s = names_get(&snaps, op->name2, i, &fresh);
+                if (snaps.value[s] == UINT32_MAX) snaps.value[s] = slot;
+            }
+        }
+        op->thread = slot == UINT32_MAX ? i % threads : files.value[slot] % threads;
+        uint64_t size = op_data_size(&op->rec);
+        if (op->rec.op == WORKLOAD_READ) {
+            if (size > max_read) max_read = size;
+        } else if (size > max_data) {
+            max_data = size;
+        }
+        if (prefill_size(&op->rec) > max_data) max_data = prefill_size(&op->rec);
+    }
+
+    uint8_t* data = rc == 0 ? malloc(max_data) : NULL;
+    Worker* w = rc == 0 ? calloc(threads, sizeof(Worker)) : NULL;
+    uint32_t* idx = rc == 0 ? malloc((t.count ? t.count : 1) * sizeof(uint32_t)) : NULL;
+    if (rc == 0 && (!data || !w || !idx)) rc = -ENOMEM;
+    uint32_t rng = 42;
+    for (uint64_t i = 0; rc == 0 && i < max_data; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        data[i] = rng;
+    }
+
+    if (rc == 0 && ops->reset) rc = ops->reset(ops->ctx, files.count + snaps.count, max_data);
+    // Предзаполнение идёт до замера и в порядке появления имён
+    uint32_t prefilled = 0;
+    for (uint32_t i = 0; rc == 0 && i < t.count; i++) {
+        const Op* op = &t.ops[i];
+        const workload_rec* r = &op->rec;
+        int fresh;
+        if (r->op == WORKLOAD_LIST || r->op == WORKLOAD_SNAP_DELETE) continue;
+        uint32_t slot = names_get(&files, op->name, i, &fresh);
+        if (files.first[slot] == i && r->op != WORKLOAD_CREATE && r->result >= 0 &&
+            ops->create && ops->create(ops->ctx, op->name, data, prefill_size(r)) == 0)
+            prefilled++;
+        // Снапшот, который восстанавливают, не создав в записи, тоже был раньше
+        if (r->op == WORKLOAD_SNAP_RESTORE && r->result >= 0 &&
+            snaps.first[names_get(&snaps, op->name2, i, &fresh)] == i &&
+            ops->snapshot_create && ops->snapshot_create(ops->ctx, op->name, op->name2) == 0)
+            prefilled++;
+    }
+
+    pthread_mutex_t serial = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t tids[MAX_THREADS];
+    uint32_t started = 0;
+    uint64_t t0 = 0;
+    if (rc == 0) {
+        uint32_t pos = 0;
+        for (uint32_t k = 0; k < threads; k++) {
+            w[k].idx = idx + pos;
+            for (uint32_t i = 0; i < t.count; i++)
+                if (t.ops[i].thread == k) idx[pos++] = i;
+            w[k].n = idx + pos - w[k].idx;
+        }
+        t0 = asfs_now_ns();
+        for (uint32_t k = 0; k < threads && rc == 0; k++) {
+            w[k].ops = ops;
+            w[k].list = t.ops;
+            w[k].t0 = t0;
+            w[k].ts0 = t.count ? t.ops[0].rec.ts_ns : 0;
+            w[k].speed = cfg->speed;
+            w[k].serial = cfg->serialize ? &serial : NULL;
+            w[k].data = data;
+            w[k].buf_size = max_read;
+            w[k].buf = malloc(max_read);
+            if (!w[k].buf) rc = -ENOMEM;
+            else if ((rc = -pthread_create(&tids[k], NULL, worker_main, &w[k])) == 0) started++;
+        }
+        for (uint32_t k = 0; k < started; k++) pthread_join(tids[k], NULL);
+    }
+    if (rc == 0) report(cfg, w, threads, t0, prefilled);
+
+    for (uint32_t k = 0; w && k < threads; k++) free(w[k].buf);
+    free(w);
+    free(idx);
+    free(data);
+    names_free(&files);
+    names_free(&snaps);
+    trace_free(&t);
+    return rc;
+}
@@ -0,0 +1,80 @@
+#ifndef ASFS_WORKLOAD_H
+#define ASFS_WORKLOAD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "bench.h"
+
+// Захват и воспроизведение нагрузки, общие для asfs и Inode-X.
+// Движок с включённым захватом дописывает каждую операцию (имена, размеры,
+// результат, задержку) в бинарный файл; несколько процессов могут писать в один
+// файл. Воспроизведение гоняет файл на свежем образе через таблицу bench_ops.
+// Содержимое данных не пишется - при воспроизведении оно детерминированное.
+
+enum {
+    WORKLOAD_CREATE = 1,
+    WORKLOAD_EDIT,
+    WORKLOAD_APPEND,
+    WORKLOAD_WRITE,        // данные с offset
+    WORKLOAD_TRUNCATE,     // offset - новый размер
+    WORKLOAD_DELETE,
+    WORKLOAD_READ,         // size - сколько просили, result - сколько прочитано
+    WORKLOAD_LOOKUP,       // size - размер найденного файла
+    WORKLOAD_LIST,
+    WORKLOAD_SNAP_CREATE,  // name - файл, name2 - снапшот
+    WORKLOAD_SNAP_RESTORE,
+    WORKLOAD_SNAP_DELETE,  // name - снапшот
+    WORKLOAD_MAX
+};
+
+#define WORKLOAD_MAGIC 0x4c575341  // "ASWL"
+#define WORKLOAD_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t rec_size;
+} workload_header;
+
+// Запись, 32 байта; за ней name_len и name2_len байт имён без нулей
+typedef struct {
+    uint64_t ts_ns;        // CLOCK_REALTIME на начало операции
+    uint64_t offset;
+    uint32_t size;
+    uint32_t duration_ns;  // насыщается на UINT32_MAX
+    int32_t result;
+    uint8_t op;
+    uint8_t name_len;
+    uint8_t name2_len;
+    uint8_t reserved;
+} workload_rec;
+
+extern const char* const workload_op_names[WORKLOAD_MAX];
+
+typedef struct workload_log workload_log;
+
+// Открывает path на дозапись (пустой или новый файл получает заголовок).
+// Записи копятся в буфере и уходят одной записью O_APPEND - куски разных
+// процессов не перемешиваются внутри себя
+int workload_open(const char* path, workload_log** out);
+uint64_t workload_clock(void);
+// Зовётся движком под его блокировкой; ошибки записи копятся до workload_close
+void workload_record(workload_log* log, int op, uint64_t start_ns, const char* name,
+                     const char* name2, uint64_t size, uint64_t offset, int64_t result);
+int workload_close(workload_log* log);
+
+typedef struct {
+    uint32_t threads;      // 0 - один поток
+    double speed;          // 0 - без пауз; 1 - в темпе записи, 2 - вдвое быстрее
+    int serialize;         // движок не потокобезопасен - операции по одной
+    int format;            // BENCH_TEXT / BENCH_CSV / BENCH_JSON
+    FILE* out;
+} workload_config;
+
+// Пересоздаёт образ через ops->reset, создаёт файлы, которые к началу записи
+// уже были, и воспроизводит операции. Операции с одним файлом (и его
+// снапшотами) идут в одном потоке в исходном порядке
+int workload_replay(const bench_ops* ops, const char* path, const workload_config* cfg);
+int workload_print(const char* path, FILE* out);
+
+#endif